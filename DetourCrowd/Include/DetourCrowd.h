@@ -26,18 +26,29 @@
 #include "DetourProximityGrid.h"
 #include "DetourPathQueue.h"
 
-/// The maximum number of neighbors that a crowd agent can take into account
+/// The default maximum number of neighbors that a crowd agent can take into account
 /// for steering decisions.
 /// @ingroup crowd
+/// @see dtCrowdConfig::maxNeighbours
 static const int DT_CROWDAGENT_MAX_NEIGHBOURS = 6;
 
-/// The maximum number of corners a crowd agent will look ahead in the path.
-/// This value is used for sizing the crowd agent corner buffers.
+/// The default maximum number of corners a crowd agent will look ahead in the path.
 /// Due to the behavior of the crowd manager, the actual number of useful
 /// corners will be one less than this number.
 /// @ingroup crowd
+/// @see dtCrowdConfig::maxCorners
 static const int DT_CROWDAGENT_MAX_CORNERS = 4;
 
+/// The default maximum number of wall segments a crowd agent avoids.
+/// @ingroup crowd
+/// @see dtCrowdConfig::maxLocalSegments
+static const int DT_CROWDAGENT_MAX_LOCAL_SEGMENTS = 8;
+
+/// The default maximum number of polygons searched for the wall segments of a crowd agent.
+/// @ingroup crowd
+/// @see dtCrowdConfig::maxLocalPolys
+static const int DT_CROWDAGENT_MAX_LOCAL_POLYS = 16;
+
 /// The maximum number of crowd avoidance configurations supported by the
 /// crowd manager.
 /// @ingroup crowd
@@ -51,6 +62,29 @@ static const int DT_CROWD_MAX_OBSTAVOIDANCE_PARAMS = 8;
 ///		dtCrowdAgentParams::queryFilterType
 static const int DT_CROWD_MAX_QUERY_FILTER_TYPE = 16;
 
+/// The capacities of a crowd, fixed by #dtCrowd::init.
+/// The per-agent buffers are sized exactly for them, so small crowds can lower
+/// the limits to save memory and dense crowds can raise them to steer around
+/// more neighbours and walls.
+/// @ingroup crowd
+/// @see dtCrowdConfigDefaults
+struct dtCrowdConfig
+{
+	int maxAgents;			///< The maximum number of agents the crowd can manage. [Limit: >= 1]
+	float maxAgentRadius;	///< The maximum radius of any agent that will be added to the crowd. [Limit: > 0]
+	int maxNeighbours;		///< The maximum number of neighbours an agent steers around. [Limit: >= 1]
+	int maxCorners;			///< The maximum number of path corners an agent looks ahead. [Limit: >= 2]
+	int maxLocalSegments;	///< The maximum number of wall segments an agent avoids. [Limit: >= 0]
+	int maxLocalPolys;		///< The maximum number of polygons searched for the wall segments. [Limit: >= 1]
+};
+
+/// Fills a crowd configuration with the default limits.
+///  @param[out]	config			The configuration to fill.
+///  @param[in]		maxAgents		The maximum number of agents the crowd can manage. [Limit: >= 1]
+///  @param[in]		maxAgentRadius	The maximum radius of any agent that will be added to the crowd. [Limit: > 0]
+/// @ingroup crowd
+void dtCrowdConfigDefaults(dtCrowdConfig* config, const int maxAgents, const float maxAgentRadius);
+
 /// Provides neighbor data for agents managed by the crowd.
 /// @ingroup crowd
 /// @see dtCrowdAgent::neis, dtCrowd
@@ -133,8 +167,8 @@ struct dtCrowdAgent
 	/// Time since the agent's path corridor was optimized.
 	float topologyOptTime;
 	
-	/// The known neighbors of the agent.
-	dtCrowdNeighbour neis[DT_CROWDAGENT_MAX_NEIGHBOURS];
+	/// The known neighbors of the agent. [(#dtCrowdNeighbour) * #dtCrowdConfig::maxNeighbours]
+	dtCrowdNeighbour* neis;
 
 	/// The number of neighbors.
 	int nneis;
@@ -152,13 +186,13 @@ struct dtCrowdAgent
 	dtCrowdAgentParams params;
 
 	/// The local path corridor corners for the agent. (Staight path.) [(x, y, z) * #ncorners]
-	float cornerVerts[DT_CROWDAGENT_MAX_CORNERS*3];
+	float* cornerVerts;
 
 	/// The local path corridor corner flags. (See: #dtStraightPathFlags) [(flags) * #ncorners]
-	unsigned char cornerFlags[DT_CROWDAGENT_MAX_CORNERS];
+	unsigned char* cornerFlags;
 
 	/// The reference id of the polygon being entered at the corner. [(polyRef) * #ncorners]
-	dtPolyRef cornerPolys[DT_CROWDAGENT_MAX_CORNERS];
+	dtPolyRef* cornerPolys;
 
 	/// The number of corners.
 	int ncorners;
@@ -198,21 +232,72 @@ struct dtCrowdAgentDebugInfo
 	dtObstacleAvoidanceDebugData* vod;
 };
 
+/// A phase of the crowd update that can be split into ranges of agents.
+/// Implemented by the crowd, executed by a #dtCrowdJobRunner.
+/// @ingroup crowd
+struct dtCrowdJob
+{
+	virtual ~dtCrowdJob() {}
+
+	/// Processes the items [@p begin, @p end) of the phase.
+	///  @param[in]		begin	The first item to process.
+	///  @param[in]		end		One past the last item to process.
+	///  @param[in]		worker	The worker running the range. [Limits: 0 <= value < #dtCrowdJobRunner::getWorkerCount()]
+	virtual void execute(const int begin, const int end, const int worker) = 0;
+};
+
+/// Job system used by dtCrowd::update to spread the per-agent phases over several threads.
+/// Detour does not create threads itself, the application provides them through this interface.
+/// @ingroup crowd
+/// @see dtCrowd::setJobRunner
+struct dtCrowdJobRunner
+{
+	virtual ~dtCrowdJobRunner() {}
+
+	/// The number of workers #run may execute ranges on. [Limit: >= 1]
+	virtual int getWorkerCount() = 0;
+
+	/// Executes @p job over ranges that together cover [0, @p count) and returns
+	/// when all of them are done. Ranges running at the same time must be given
+	/// different worker ids.
+	///  @param[in]		job		The phase to run.
+	///  @param[in]		count	The number of items in the phase.
+	virtual void run(dtCrowdJob* job, const int count) = 0;
+};
+
 /// Provides local steering behaviors for a group of agents. 
 /// @ingroup crowd
 class dtCrowd
 {
+	dtCrowdConfig m_config;
 	int m_maxAgents;
 	dtCrowdAgent* m_agents;
 	dtCrowdAgent** m_activeAgents;
 	dtCrowdAgentAnimation* m_agentAnims;
+
+	// Per-agent buffers sized by m_config, one slice per agent in m_agents order.
+	dtCrowdNeighbour* m_agentNeis;
+	float* m_agentCornerVerts;
+	unsigned char* m_agentCornerFlags;
+	dtPolyRef* m_agentCornerPolys;
+	float* m_agentSegs;
+	float* m_agentSegDists;
+	dtPolyRef* m_agentPolys;
 	
 	dtPathQueue m_pathq;
+	dtCrowdAgent** m_pathqAgents;	///< Agents picked for the path queue in an update.
+	int m_maxPathRequests;
+	int m_maxPathIters;
 
 	dtObstacleAvoidanceParams m_obstacleQueryParams[DT_CROWD_MAX_OBSTAVOIDANCE_PARAMS];
+	dtObstacleAvoidanceBackend* m_obstacleBackends[DT_CROWD_MAX_OBSTAVOIDANCE_PARAMS];	///< Null samples with m_obstacleQuery.
 	dtObstacleAvoidanceQuery* m_obstacleQuery;
+	dtObstacleAvoidanceBatch* m_obstacleBatch;	///< Obstacles of the agents in an update, indexed like the active agents.
 	
 	dtProximityGrid* m_grid;
+	unsigned int* m_gridResults;	///< Neighbour candidates, m_maxGridResults per worker.
+	int m_maxGridResults;
+	int m_gridResultWorkers;
 	
 	dtPolyRef* m_pathResult;
 	int m_maxPathResult;
@@ -227,6 +312,25 @@ class dtCrowd
 
 	dtNavMeshQuery* m_navquery;
 
+	dtCrowdJobRunner* m_jobRunner;
+	int m_workerCount;
+	dtNavMeshQuery** m_workerNavQueries;				///< Per worker, [0] is m_navquery.
+	dtObstacleAvoidanceQuery** m_workerObstacleQueries;	///< Per worker, [0] is m_obstacleQuery.
+	int* m_workerSampleCounts;
+
+	// State of the update in progress, read by the phase jobs.
+	dtCrowdAgent** m_updateAgents;
+	int m_updateAgentCount;
+	float m_updateDt;
+	dtCrowdAgentDebugInfo* m_updateDebug;
+
+	friend struct dtCrowdPhaseJob;
+	void updatePhase(const int phase, const int begin, const int end, const int worker);
+	void runPhase(const int phase, const int count);
+	bool initWorkers();
+	void freeWorkers();
+	bool reserveGridResults(const int workers);
+
 	void updateTopologyOptimization(dtCrowdAgent** agents, const int nagents, const float dt);
 	void updateMoveRequest(const float dt);
 	void checkPathValidity(dtCrowdAgent** agents, const int nagents, const float dt);
@@ -241,12 +345,21 @@ public:
 	dtCrowd();
 	~dtCrowd();
 	
-	/// Initializes the crowd.  
+	/// Initializes the crowd with the default limits of #dtCrowdConfigDefaults.
 	///  @param[in]		maxAgents		The maximum number of agents the crowd can manage. [Limit: >= 1]
 	///  @param[in]		maxAgentRadius	The maximum radius of any agent that will be added to the crowd. [Limit: > 0]
 	///  @param[in]		nav				The navigation mesh to use for planning.
 	/// @return True if the initialization succeeded.
 	bool init(const int maxAgents, const float maxAgentRadius, dtNavMesh* nav);
+
+	/// Initializes the crowd.
+	///  @param[in]		config			The capacities of the crowd.
+	///  @param[in]		nav				The navigation mesh to use for planning.
+	/// @return True if the initialization succeeded.
+	bool init(const dtCrowdConfig* config, dtNavMesh* nav);
+
+	/// Gets the capacities the crowd was initialized with.
+	const dtCrowdConfig* getConfig() const { return &m_config; }
 	
 	/// Sets the shared avoidance configuration for the specified index.
 	///  @param[in]		idx		The index. [Limits: 0 <= value < #DT_CROWD_MAX_OBSTAVOIDANCE_PARAMS]
@@ -258,6 +371,16 @@ public:
 	///							[Limits:  0 <= value < #DT_CROWD_MAX_OBSTAVOIDANCE_PARAMS]
 	/// @return The requested configuration.
 	const dtObstacleAvoidanceParams* getObstacleAvoidanceParams(const int idx) const;
+
+	/// Sets the solver used by the agents of the specified avoidance configuration.
+	///  @param[in]		idx		The index. [Limits: 0 <= value < #DT_CROWD_MAX_OBSTAVOIDANCE_PARAMS]
+	///  @param[in]		backend	The solver, or null to sample with dtObstacleAvoidanceQuery. The crowd
+	///							does not own it and it must stay alive while set.
+	void setObstacleAvoidanceBackend(const int idx, dtObstacleAvoidanceBackend* backend);
+
+	/// Gets the solver of the specified avoidance configuration, null when sampling.
+	///  @param[in]		idx		The index. [Limits: 0 <= value < #DT_CROWD_MAX_OBSTAVOIDANCE_PARAMS]
+	dtObstacleAvoidanceBackend* getObstacleAvoidanceBackend(const int idx) const;
 	
 	/// Gets the specified agent from the pool.
 	///	 @param[in]		idx		The agent index. [Limits: 0 <= value < #getAgentCount()]
@@ -345,9 +468,31 @@ public:
 	/// @return The crowd's path request queue.
 	const dtPathQueue* getPathQueue() const { return &m_pathq; }
 
+	/// Sets how much path finding #update may do.
+	///  @param[in]		maxRequests		The most agents handed to the path queue per update,
+	///									longest waiting first. [Limit: >= 1]
+	///  @param[in]		maxIters		The search iterations the path queue may spend per update. [Limit: >= 1]
+	void setPathQueueBudget(const int maxRequests, const int maxIters);
+
 	/// Gets the query object used by the crowd.
 	const dtNavMeshQuery* getNavMeshQuery() const { return m_navquery; }
 
+	/// Moves the crowd's queries, path queue and per-worker queries to another navmesh.
+	///  @param[in]		nav		The navigation mesh to use for planning.
+	/// @return True if the queries could be bound to the navmesh.
+	bool setNavMesh(dtNavMesh* nav);
+
+	/// Sets the job system #update runs the per-agent phases on, or null to run them serially.
+	/// Every worker gets its own navmesh and obstacle avoidance query; they are created on the
+	/// navmesh the crowd's query is attached to, and #setNavMesh moves them along with it.
+	/// The results do not depend on the number of workers or on how the ranges are scheduled.
+	///  @param[in]		runner	The job system, which must outlive the crowd or be replaced. [Opt]
+	/// @return True if the per-worker queries could be created.
+	bool setJobRunner(dtCrowdJobRunner* runner);
+
+	/// Gets the job system used by #update.
+	dtCrowdJobRunner* getJobRunner() const { return m_jobRunner; }
+
 private:
 	// Explicitly disabled copy constructor and copy assignment operator.
 	dtCrowd(const dtCrowd&);
@@ -431,6 +576,8 @@ feature to find minor members.
 #dtCrowd permits agents to use different avoidance configurations.  This value 
 is the index of the #dtObstacleAvoidanceParams within the crowd.
 
+The configuration also selects the solver, see dtCrowd::setObstacleAvoidanceBackend().
+
 @see dtObstacleAvoidanceParams, dtCrowd::setObstacleAvoidanceParams(), 
 	 dtCrowd::getObstacleAvoidanceParams()
 
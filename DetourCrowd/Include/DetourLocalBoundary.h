@@ -22,23 +22,19 @@
 #include "DetourNavMeshQuery.h"
 
 
+/// The walls around an agent, nearest first.
+/// The boundary does not own its storage, see #init.
 class dtLocalBoundary
 {
-	static const int MAX_LOCAL_SEGS = 8;
-	static const int MAX_LOCAL_POLYS = 16;
-	
-	struct Segment
-	{
-		float s[6];	///< Segment start/end
-		float d;	///< Distance for pruning.
-	};
-	
 	float m_center[3];
-	Segment m_segs[MAX_LOCAL_SEGS];
+	float* m_segs;			///< Segment start/end. [(ax, ay, az, bx, by, bz) * m_maxSegs]
+	float* m_segDists;		///< Distance of each segment, for pruning. [m_maxSegs]
 	int m_nsegs;
+	int m_maxSegs;
 	
-	dtPolyRef m_polys[MAX_LOCAL_POLYS];
+	dtPolyRef* m_polys;
 	int m_npolys;
+	int m_maxPolys;
 
 	void addSegment(const float dist, const float* s);
 	
@@ -46,6 +42,14 @@ public:
 	dtLocalBoundary();
 	~dtLocalBoundary();
 	
+	/// Sets the storage of the boundary and resets it. The arrays must outlive the boundary.
+	///  @param[in]		segs		Segment storage. [(ax, ay, az, bx, by, bz) * maxSegs]
+	///  @param[in]		segDists	Segment distance storage. [Size: maxSegs]
+	///  @param[in]		maxSegs		The most segments kept, the nearest win. [Limit: >= 0]
+	///  @param[in]		polys		Polygon storage. [Size: maxPolys]
+	///  @param[in]		maxPolys	The most polygons searched for segments. [Limit: >= 1]
+	void init(float* segs, float* segDists, const int maxSegs, dtPolyRef* polys, const int maxPolys);
+	
 	void reset();
 	
 	void update(dtPolyRef ref, const float* pos, const float collisionQueryRange,
@@ -55,7 +59,10 @@ public:
 	
 	inline const float* getCenter() const { return m_center; }
 	inline int getSegmentCount() const { return m_nsegs; }
-	inline const float* getSegment(int i) const { return m_segs[i].s; }
+	inline const float* getSegment(int i) const { return &m_segs[i*6]; }
+	/// The number of floats between two segments returned by getSegment().
+	inline int getSegmentStride() const { return 6; }
+	inline int getMaxSegments() const { return m_maxSegs; }
 
 private:
 	// Explicitly disabled copy constructor and copy assignment operator.
@@ -94,6 +94,8 @@ struct dtObstacleAvoidanceParams
 	unsigned char adaptiveDepth;	///< adaptive
 };
 
+class dtObstacleAvoidanceBatch;
+
 class dtObstacleAvoidanceQuery
 {
 public:
@@ -118,7 +120,19 @@ public:
 							   const float* vel, const float* dvel, float* nvel,
 							   const dtObstacleAvoidanceParams* params, 
 							   dtObstacleAvoidanceDebugData* debug = 0);
+
+	/// Samples each active batch agent in [@p begin, @p end) like sampleVelocityGrid() with the
+	/// agent's own obstacles. Agents without debug data are prepared straight from the batch,
+	/// without adding their obstacles to the query.
+	/// @return The number of samples taken.
+	int sampleVelocityGridRange(const dtObstacleAvoidanceBatch* batch, const int begin, const int end);
+
+	/// Samples each active batch agent in [@p begin, @p end) like sampleVelocityAdaptive(), see
+	/// sampleVelocityGridRange().
+	/// @return The number of samples taken.
+	int sampleVelocityAdaptiveRange(const dtObstacleAvoidanceBatch* batch, const int begin, const int end);
 	
+	/// The obstacles added to the query, range calls leave them unset for agents without debug data.
 	inline int getObstacleCircleCount() const { return m_ncircles; }
 	const dtObstacleCircle* getObstacleCircle(const int i) { return &m_circles[i]; }
 
@@ -130,7 +144,25 @@ private:
 	dtObstacleAvoidanceQuery(const dtObstacleAvoidanceQuery&);
 	dtObstacleAvoidanceQuery& operator=(const dtObstacleAvoidanceQuery&);
 
-	void prepare(const float* pos, const float* dvel);
+	void prepare(const float* pos, const float rad, const float* dvel);
+
+	/// Prepares the obstacles of batch agent @p idx for sampling.
+	void prepareBatch(const dtObstacleAvoidanceBatch* batch, const int idx);
+
+	/// Sets circle @p i and segment @p i of the SIMD lanes, only built when the target has SIMD.
+	void setCircleLanes(const int i, const float* pos, const float rad,
+						const dtObstacleCircle* cir, const float* dp, const float* np);
+	void setSegmentLanes(const int i, const float* pos, const float* p, const float* q, const bool touch);
+
+	/// sampleVelocityGrid() and sampleVelocityAdaptive() once the obstacles are prepared.
+	int samplePreparedGrid(const float* pos, const float rad, const float vmax,
+						   const float* vel, const float* dvel, float* nvel,
+						   const dtObstacleAvoidanceParams* params,
+						   dtObstacleAvoidanceDebugData* debug);
+	int samplePreparedAdaptive(const float* pos, const float rad, const float vmax,
+							   const float* vel, const float* dvel, float* nvel,
+							   const dtObstacleAvoidanceParams* params,
+							   dtObstacleAvoidanceDebugData* debug);
 
 	float processSample(const float* vcand, const float cs,
 						const float* pos, const float rad,
@@ -138,6 +170,18 @@ private:
 						const float minPenalty,
 						dtObstacleAvoidanceDebugData* debug);
 
+	/// Scores up to four candidates and keeps the best one in @p best.
+	void processSamples(const float* candx, const float* candz, const int count, const float cs,
+						const float* pos, const float rad,
+						const float* vel, const float* dvel,
+						float& minPenalty, float* best,
+						dtObstacleAvoidanceDebugData* debug);
+
+	/// Vectorized processSample() over four candidates, only built when the target has SIMD.
+	void processSampleBatch(const float* candx, const float* candz, const int count,
+							const float* vel, const float* dvel,
+							const float minPenalty, float* penalties);
+
 	dtObstacleAvoidanceParams m_params;
 	float m_invHorizTime;
 	float m_vmax;
@@ -150,10 +194,130 @@ private:
 	int m_maxSegments;
 	dtObstacleSegment* m_segments;
 	int m_nsegments;
+
+	float* m_circleLanes;	///< Per sample constants of the circles, one array of m_maxCircles per field.
+	float* m_segmentLanes;	///< Per sample constants of the segments, one array of m_maxSegments per field.
 };
 
 dtObstacleAvoidanceQuery* dtAllocObstacleAvoidanceQuery();
 void dtFreeObstacleAvoidanceQuery(dtObstacleAvoidanceQuery* ptr);
 
 
+/// The obstacles and agents of one avoidance update for a whole group of agents.
+///
+/// Circles are stored once in a table shared by all agents of the batch, and
+/// each agent refers to its neighbours by index. Segments are not copied at all,
+/// each agent points at its own array, e.g. the one of its dtLocalBoundary.
+/// Segments the agent is behind of are skipped while sampling.
+///
+/// Setting different circles and agents, and sampling different agent ranges
+/// with different dtObstacleAvoidanceQuery objects, can be done from several
+/// threads at the same time.
+/// @see dtObstacleAvoidanceQuery::sampleVelocityAdaptiveRange()
+class dtObstacleAvoidanceBatch
+{
+public:
+	dtObstacleAvoidanceBatch();
+	~dtObstacleAvoidanceBatch();
+
+	/// @param[in]	maxAgents		The maximum number of agents in a batch.
+	/// @param[in]	maxCircles		The size of the shared circle table.
+	/// @param[in]	maxAgentCircles	The maximum number of circles per agent.
+	bool init(const int maxAgents, const int maxCircles, const int maxAgentCircles);
+
+	/// Starts a new batch of @p nagents agents, which are all skipped until set with setAgent().
+	void reset(const int nagents);
+
+	/// Sets circle @p idx of the shared table.
+	void setCircle(const int idx, const float* pos, const float rad,
+				   const float* vel, const float* dvel);
+
+	/// Sets agent @p idx, without any obstacles. The new velocity is written to @p nvel when sampled.
+	void setAgent(const int idx, const float* pos, const float rad, const float vmax,
+				  const float* vel, const float* dvel, float* nvel,
+				  const dtObstacleAvoidanceParams* params,
+				  dtObstacleAvoidanceDebugData* debug = 0);
+
+	/// Adds shared circle @p circle as an obstacle of agent @p idx.
+	void addAgentCircle(const int idx, const int circle);
+
+	/// Points agent @p idx at @p nsegs segments of 6 floats, @p stride floats apart.
+	/// The segments have to stay unchanged until the agent has been sampled.
+	void setAgentSegments(const int idx, const float* segs, const int nsegs, const int stride);
+
+	/// Sets the time step of the update, used by solvers to resolve overlaps.
+	inline void setTimeStep(const float dt) { m_dt = dt; }
+	inline float getTimeStep() const { return m_dt; }
+
+	inline int getAgentCount() const { return m_nagents; }
+	inline bool isAgentActive(const int i) const { return m_agents[i].active; }
+	inline const float* getAgentPosition(const int i) const { return m_agents[i].pos; }
+	inline float getAgentRadius(const int i) const { return m_agents[i].rad; }
+	inline float getAgentMaxSpeed(const int i) const { return m_agents[i].vmax; }
+	inline const float* getAgentVelocity(const int i) const { return m_agents[i].vel; }
+	inline const float* getAgentDesiredVelocity(const int i) const { return m_agents[i].dvel; }
+	inline const dtObstacleAvoidanceParams* getAgentParams(const int i) const { return m_agents[i].params; }
+	inline dtObstacleAvoidanceDebugData* getAgentDebugData(const int i) const { return m_agents[i].debug; }
+	/// Where the new velocity of agent @p i goes.
+	inline float* getAgentResult(const int i) const { return m_agents[i].nvel; }
+
+	inline int getAgentCircleCount(const int i) const { return m_agents[i].ncircles; }
+	inline const dtObstacleCircle* getAgentCircle(const int i, const int j) const { return &m_circles[m_agentCircles[i*m_maxAgentCircles + j]]; }
+
+	inline int getAgentSegmentCount(const int i) const { return m_agents[i].nsegs; }
+	/// The start and end point of segment @p j of agent @p i, 6 floats.
+	inline const float* getAgentSegment(const int i, const int j) const { return m_agents[i].segs + j*m_agents[i].segStride; }
+
+private:
+	// Explicitly disabled copy constructor and copy assignment operator.
+	dtObstacleAvoidanceBatch(const dtObstacleAvoidanceBatch&);
+	dtObstacleAvoidanceBatch& operator=(const dtObstacleAvoidanceBatch&);
+
+	friend class dtObstacleAvoidanceQuery;
+
+	struct Agent
+	{
+		float pos[3];
+		float rad;
+		float vmax;
+		float vel[3];
+		float dvel[3];
+		float* nvel;
+		const dtObstacleAvoidanceParams* params;
+		dtObstacleAvoidanceDebugData* debug;
+		int ncircles;
+		const float* segs;
+		int nsegs;
+		int segStride;
+		bool active;
+	};
+
+	int m_maxAgents;
+	Agent* m_agents;
+	int* m_agentCircles;		///< m_maxAgentCircles circle indices per agent.
+	int m_maxAgentCircles;
+	int m_nagents;
+
+	int m_maxCircles;
+	dtObstacleCircle* m_circles;
+
+	float m_dt;
+};
+
+dtObstacleAvoidanceBatch* dtAllocObstacleAvoidanceBatch();
+void dtFreeObstacleAvoidanceBatch(dtObstacleAvoidanceBatch* ptr);
+
+/// A velocity solver which dtCrowd can use instead of sampling with dtObstacleAvoidanceQuery.
+/// @see dtCrowd::setObstacleAvoidanceBackend()
+struct dtObstacleAvoidanceBackend
+{
+	virtual ~dtObstacleAvoidanceBackend() {}
+
+	/// Writes the new velocity of batch agent @p idx to dtObstacleAvoidanceBatch::getAgentResult().
+	/// Called for different agents from several threads at once when the crowd has a job runner.
+	/// @return The number of candidate velocities or constraints evaluated.
+	virtual int solve(const dtObstacleAvoidanceBatch* batch, const int idx) = 0;
+};
+
+
 #endif // DETOUROBSTACLEAVOIDANCE_H
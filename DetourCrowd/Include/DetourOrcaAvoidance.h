@@ -0,0 +1,44 @@
+//
+// Copyright (c) 2009-2010 Mikko Mononen memon@inside.org
+//
+// This software is provided 'as-is', without any express or implied
+// warranty.  In no event will the authors be held liable for any damages
+// arising from the use of this software.
+// Permission is granted to anyone to use this software for any purpose,
+// including commercial applications, and to alter it and redistribute it
+// freely, subject to the following restrictions:
+// 1. The origin of this software must not be misrepresented; you must not
+//    claim that you wrote the original software. If you use this software
+//    in a product, an acknowledgment in the product documentation would be
+//    appreciated but is not required.
+// 2. Altered source versions must be plainly marked as such, and must not be
+//    misrepresented as being the original software.
+// 3. This notice may not be removed or altered from any source distribution.
+//
+
+
+#ifndef DETOURORCAAVOIDANCE_H
+#define DETOURORCAAVOIDANCE_H
+
+#include "DetourObstacleAvoidance.h"
+
+/// Optimal reciprocal collision avoidance (ORCA) as a dtObstacleAvoidanceBackend.
+///
+/// Every neighbour circle and boundary segment becomes a half-plane of allowed
+/// velocities, and the new velocity is the one closest to the desired velocity
+/// inside all of them and within the max speed, found with a small 2D linear
+/// program. When the half-planes leave no room, as in dense crowds, the velocity
+/// which violates the circle constraints the least is used, the segments are
+/// always respected. The cost is linear in the number of obstacles.
+///
+/// dtObstacleAvoidanceParams::horizTime is the time horizon for both circles and
+/// segments. The other parameters only apply to sampling and are ignored, as is
+/// the debug data. The solver has no state, one instance can serve every worker.
+class dtOrcaAvoidance : public dtObstacleAvoidanceBackend
+{
+public:
+	/// @return The number of half-planes used.
+	virtual int solve(const dtObstacleAvoidanceBatch* batch, const int idx);
+};
+
+#endif // DETOURORCAAVOIDANCE_H
@@ -24,8 +24,15 @@
 
 static const unsigned int DT_PATHQ_INVALID = 0;
 
+/// The most requests a path queue can hold at once.
+static const int DT_PATHQ_MAX_QUEUE = 0xffff;
+
 typedef unsigned int dtPathQueueRef;
 
+/// Runs sliced path searches for a growing number of requests within an iteration budget.
+/// Waiting requests are started in priority order, oldest first among equal priorities,
+/// and a request that has waited for more than #getMaxWait updates goes ahead of all
+/// priorities so that a stream of urgent requests can not starve it.
 class dtPathQueue
 {
 	struct PathQuery
@@ -41,33 +48,62 @@ class dtPathQueue
 		dtStatus status;
 		int keepAlive;
 		const dtQueryFilter* filter; ///< TODO: This is potentially dangerous!
+		/// Scheduling.
+		float priority;
+		unsigned int order;			///< Request sequence number.
+		unsigned int requestTick;	///< Update count when requested.
 	};
 	
-	static const int MAX_QUEUE = 8;
-	PathQuery m_queue[MAX_QUEUE];
-	dtPathQueueRef m_nextHandle;
+	PathQuery* m_queue;
+	int m_queueSize;		///< Slots allocated.
+	int m_maxQueue;			///< Slot limit, 0 grows up to #DT_PATHQ_MAX_QUEUE.
+	int m_activeCount;		///< Slots holding a request.
+	int m_current;			///< Slot of the search in progress, or -1.
+	unsigned int m_nextHandle;
+	unsigned int m_nextOrder;
+	unsigned int m_tick;
+	int m_maxWait;
 	int m_maxPathSize;
-	int m_queueHead;
 	dtNavMeshQuery* m_navquery;
 	
 	void purge();
+	bool grow();
+	int findSlot(dtPathQueueRef ref) const;
+	int pickNext() const;
 	
 public:
 	dtPathQueue();
 	~dtPathQueue();
 	
-	bool init(const int maxPathSize, const int maxSearchNodeCount, dtNavMesh* nav);
+	/// Initializes the queue.
+	///  @param[in]		maxPathSize			The maximum number of polygons in a path result.
+	///  @param[in]		maxSearchNodeCount	The node pool size of the search query.
+	///  @param[in]		nav					The navigation mesh to search.
+	///  @param[in]		maxQueue			The most requests held at once, 0 to grow as needed. [Limit: <= #DT_PATHQ_MAX_QUEUE]
+	/// @return True if the initialization succeeded.
+	bool init(const int maxPathSize, const int maxSearchNodeCount, dtNavMesh* nav, const int maxQueue = 0);
 	
+	/// Advances the searches, spending at most @p maxIters search iterations.
 	void update(const int maxIters);
 	
+	/// Queues a path search.
+	///  @param[in]		priority	Lower values are searched first, for example the distance to the goal. [Opt]
+	/// @return The request reference, or #DT_PATHQ_INVALID if the queue is full.
 	dtPathQueueRef request(dtPolyRef startRef, dtPolyRef endRef,
 						   const float* startPos, const float* endPos, 
-						   const dtQueryFilter* filter);
+						   const dtQueryFilter* filter, const float priority = 0.0f);
 	
 	dtStatus getRequestStatus(dtPathQueueRef ref) const;
 	
 	dtStatus getPathResult(dtPathQueueRef ref, dtPolyRef* path, int* pathSize, const int maxPath);
 	
+	/// Sets how many updates a request may wait before it goes ahead of higher priorities.
+	inline void setMaxWait(const int updates) { m_maxWait = updates; }
+	inline int getMaxWait() const { return m_maxWait; }
+
+	/// The number of requests waiting, searching or holding an unread result.
+	inline int getRequestCount() const { return m_activeCount; }
+
 	inline const dtNavMeshQuery* getNavQuery() const { return m_navquery; }
 
 private:
@@ -19,6 +19,12 @@
 #ifndef DETOURPROXIMITYGRID_H
 #define DETOURPROXIMITYGRID_H
 
+/// Spatial grid of item bounds, used by the crowd to find neighbours.
+///
+/// Items are added after clear() and sorted by cell with build(), so that the
+/// items of a cell lie next to each other in one flat array and queries scan
+/// contiguous ranges. Cells are hashed into buckets, the world can be of any
+/// size, and the arrays grow with the number of items.
 class dtProximityGrid
 {
 	float m_cellSize;
@@ -26,34 +32,45 @@ class dtProximityGrid
 	
 	struct Item
 	{
-		unsigned short id;
-		short x,y;
-		unsigned short next;
+		unsigned int id;
+		int x,y;			///< Cell of this entry.
+		int minx,miny;		///< First cell of the item, to report it once per query.
 	};
-	Item* m_pool;
-	int m_poolHead;
-	int m_poolSize;
+	Item* m_items;			///< One entry per cell of each item, in the order added.
+	Item* m_sorted;			///< The entries sorted by bucket by build().
+	int m_nitems;
+	int m_maxItems;
 	
-	unsigned short* m_buckets;
-	int m_bucketsSize;
+	int* m_buckets;			///< First sorted entry of each bucket, plus the end.
+	int m_bucketsSize;		///< 0 until build() is called.
+	int m_maxBuckets;
 	
 	int m_bounds[4];
 	
+	bool reserve(const int maxItems);
+	
 public:
 	dtProximityGrid();
 	~dtProximityGrid();
 	
+	/// @param[in]	poolSize	Initial number of item cells, more are allocated when needed.
+	/// @param[in]	cellSize	Size of a grid cell.
 	bool init(const int poolSize, const float cellSize);
 	
 	void clear();
 	
-	void addItem(const unsigned short id,
+	void addItem(const unsigned int id,
 				 const float minx, const float miny,
 				 const float maxx, const float maxy);
 	
+	/// Sorts the items added since clear() by cell. Call before querying.
+	void build();
+	
+	/// Finds the items overlapping the cells of the query bounds, each reported once.
+	/// Can be called from several threads at once.
 	int queryItems(const float minx, const float miny,
 				   const float maxx, const float maxy,
-				   unsigned short* ids, const int maxIds) const;
+				   unsigned int* ids, const int maxIds) const;
 	
 	int getItemCountAt(const int x, const int y) const;
 	
@@ -45,12 +45,28 @@ void dtFreeCrowd(dtCrowd* ptr)
 	dtFree(ptr);
 }
 
+void dtCrowdConfigDefaults(dtCrowdConfig* config, const int maxAgents, const float maxAgentRadius)
+{
+	config->maxAgents = maxAgents;
+	config->maxAgentRadius = maxAgentRadius;
+	config->maxNeighbours = DT_CROWDAGENT_MAX_NEIGHBOURS;
+	config->maxCorners = DT_CROWDAGENT_MAX_CORNERS;
+	config->maxLocalSegments = DT_CROWDAGENT_MAX_LOCAL_SEGMENTS;
+	config->maxLocalPolys = DT_CROWDAGENT_MAX_LOCAL_POLYS;
+}
+
 
 static const int MAX_ITERS_PER_UPDATE = 100;
+static const int MAX_PATH_REQUESTS_PER_UPDATE = 8;
 
 static const int MAX_PATHQUEUE_NODES = 4096;
 static const int MAX_COMMON_NODES = 512;
 
+// The grid returns neighbour candidates in cell order rather than by distance,
+// so more are looked at than an agent keeps.
+static const int MIN_NEIGHBOUR_CANDIDATES = 32;
+static const int NEIGHBOUR_CANDIDATES_PER_NEIGHBOUR = 4;
+
 inline float tween(const float t, const float t0, const float t1)
 {
 	return dtClamp((t-t0) / (t1-t0), 0.0f, 1.0f);
@@ -187,15 +203,14 @@ static int addNeighbour(const int idx, const float dist,
 
 static int getNeighbours(const float* pos, const float height, const float range,
 						 const dtCrowdAgent* skip, dtCrowdNeighbour* result, const int maxResult,
-						 dtCrowdAgent** agents, const int /*nagents*/, dtProximityGrid* grid)
+						 dtCrowdAgent** agents, const int /*nagents*/, dtProximityGrid* grid,
+						 unsigned int* ids, const int maxIds)
 {
 	int n = 0;
 	
-	static const int MAX_NEIS = 32;
-	unsigned short ids[MAX_NEIS];
 	int nids = grid->queryItems(pos[0]-range, pos[2]-range,
 								pos[0]+range, pos[2]+range,
-								ids, MAX_NEIS);
+								ids, maxIds);
 	
 	for (int i = 0; i < nids; ++i)
 	{
@@ -213,7 +228,7 @@ static int getNeighbours(const float* pos, const float height, const float range
 		if (distSqr > dtSqr(range))
 			continue;
 		
-		n = addNeighbour(ids[i], distSqr, result, n, maxResult);
+		n = addNeighbour((int)ids[i], distSqr, result, n, maxResult);
 	}
 	return n;
 }
@@ -334,14 +349,39 @@ dtCrowd::dtCrowd() :
 	m_agents(0),
 	m_activeAgents(0),
 	m_agentAnims(0),
+	m_agentNeis(0),
+	m_agentCornerVerts(0),
+	m_agentCornerFlags(0),
+	m_agentCornerPolys(0),
+	m_agentSegs(0),
+	m_agentSegDists(0),
+	m_agentPolys(0),
+	m_pathqAgents(0),
+	m_maxPathRequests(MAX_PATH_REQUESTS_PER_UPDATE),
+	m_maxPathIters(MAX_ITERS_PER_UPDATE),
 	m_obstacleQuery(0),
+	m_obstacleBatch(0),
 	m_grid(0),
+	m_gridResults(0),
+	m_maxGridResults(0),
+	m_gridResultWorkers(0),
 	m_pathResult(0),
 	m_maxPathResult(0),
 	m_maxAgentRadius(0),
 	m_velocitySampleCount(0),
-	m_navquery(0)
+	m_navquery(0),
+	m_jobRunner(0),
+	m_workerCount(0),
+	m_workerNavQueries(0),
+	m_workerObstacleQueries(0),
+	m_workerSampleCounts(0),
+	m_updateAgents(0),
+	m_updateAgentCount(0),
+	m_updateDt(0),
+	m_updateDebug(0)
 {
+	memset(&m_config, 0, sizeof(m_config));
+	memset(m_obstacleBackends, 0, sizeof(m_obstacleBackends));
 }
 
 dtCrowd::~dtCrowd()
@@ -351,6 +391,8 @@ dtCrowd::~dtCrowd()
 
 void dtCrowd::purge()
 {
+	freeWorkers();
+
 	for (int i = 0; i < m_maxAgents; ++i)
 		m_agents[i].~dtCrowdAgent();
 	dtFree(m_agents);
@@ -362,6 +404,24 @@ void dtCrowd::purge()
 
 	dtFree(m_agentAnims);
 	m_agentAnims = 0;
+
+	dtFree(m_agentNeis);
+	m_agentNeis = 0;
+	dtFree(m_agentCornerVerts);
+	m_agentCornerVerts = 0;
+	dtFree(m_agentCornerFlags);
+	m_agentCornerFlags = 0;
+	dtFree(m_agentCornerPolys);
+	m_agentCornerPolys = 0;
+	dtFree(m_agentSegs);
+	m_agentSegs = 0;
+	dtFree(m_agentSegDists);
+	m_agentSegDists = 0;
+	dtFree(m_agentPolys);
+	m_agentPolys = 0;
+
+	dtFree(m_pathqAgents);
+	m_pathqAgents = 0;
 	
 	dtFree(m_pathResult);
 	m_pathResult = 0;
@@ -369,22 +429,42 @@ void dtCrowd::purge()
 	dtFreeProximityGrid(m_grid);
 	m_grid = 0;
 
+	dtFree(m_gridResults);
+	m_gridResults = 0;
+	m_maxGridResults = 0;
+	m_gridResultWorkers = 0;
+
 	dtFreeObstacleAvoidanceQuery(m_obstacleQuery);
 	m_obstacleQuery = 0;
+
+	dtFreeObstacleAvoidanceBatch(m_obstacleBatch);
+	m_obstacleBatch = 0;
 	
 	dtFreeNavMeshQuery(m_navquery);
 	m_navquery = 0;
 }
 
+bool dtCrowd::init(const int maxAgents, const float maxAgentRadius, dtNavMesh* nav)
+{
+	dtCrowdConfig config;
+	dtCrowdConfigDefaults(&config, maxAgents, maxAgentRadius);
+	return init(&config, nav);
+}
+
 /// @par
 ///
 /// May be called more than once to purge and re-initialize the crowd.
-bool dtCrowd::init(const int maxAgents, const float maxAgentRadius, dtNavMesh* nav)
+bool dtCrowd::init(const dtCrowdConfig* config, dtNavMesh* nav)
 {
 	purge();
+
+	if (config->maxAgents < 1 || config->maxNeighbours < 1 || config->maxCorners < 2 ||
+		config->maxLocalSegments < 0 || config->maxLocalPolys < 1)
+		return false;
 	
-	m_maxAgents = maxAgents;
-	m_maxAgentRadius = maxAgentRadius;
+	memcpy(&m_config, config, sizeof(dtCrowdConfig));
+	m_maxAgents = m_config.maxAgents;
+	m_maxAgentRadius = m_config.maxAgentRadius;
 
 	// Larger than agent radius because it is also used for agent recovery.
 	dtVset(m_agentPlacementHalfExtents, m_maxAgentRadius*2.0f, m_maxAgentRadius*1.5f, m_maxAgentRadius*2.0f);
@@ -392,17 +472,29 @@ bool dtCrowd::init(const int maxAgents, const float maxAgentRadius, dtNavMesh* n
 	m_grid = dtAllocProximityGrid();
 	if (!m_grid)
 		return false;
-	if (!m_grid->init(m_maxAgents*4, maxAgentRadius*3))
+	if (!m_grid->init(m_maxAgents*4, m_maxAgentRadius*3))
+		return false;
+	m_maxGridResults = dtMax(MIN_NEIGHBOUR_CANDIDATES, m_config.maxNeighbours*NEIGHBOUR_CANDIDATES_PER_NEIGHBOUR);
+	if (!reserveGridResults(1))
 		return false;
 	
 	m_obstacleQuery = dtAllocObstacleAvoidanceQuery();
 	if (!m_obstacleQuery)
 		return false;
-	if (!m_obstacleQuery->init(6, 8))
+	// Keep one segment slot when walls are not avoided, allocating none may fail.
+	if (!m_obstacleQuery->init(m_config.maxNeighbours, dtMax(m_config.maxLocalSegments, 1)))
+		return false;
+
+	// Every agent can be an obstacle circle, indexed like m_agents.
+	m_obstacleBatch = dtAllocObstacleAvoidanceBatch();
+	if (!m_obstacleBatch)
+		return false;
+	if (!m_obstacleBatch->init(m_maxAgents, m_maxAgents, m_config.maxNeighbours))
 		return false;
 
 	// Init obstacle query params.
 	memset(m_obstacleQueryParams, 0, sizeof(m_obstacleQueryParams));
+	memset(m_obstacleBackends, 0, sizeof(m_obstacleBackends));
 	for (int i = 0; i < DT_CROWD_MAX_OBSTAVOIDANCE_PARAMS; ++i)
 	{
 		dtObstacleAvoidanceParams* params = &m_obstacleQueryParams[i];
@@ -438,13 +530,40 @@ bool dtCrowd::init(const int maxAgents, const float maxAgentRadius, dtNavMesh* n
 	m_agentAnims = (dtCrowdAgentAnimation*)dtAlloc(sizeof(dtCrowdAgentAnimation)*m_maxAgents, DT_ALLOC_PERM);
 	if (!m_agentAnims)
 		return false;
+
+	m_pathqAgents = (dtCrowdAgent**)dtAlloc(sizeof(dtCrowdAgent*)*m_maxAgents, DT_ALLOC_PERM);
+	if (!m_pathqAgents)
+		return false;
+
+	const int maxNeis = m_config.maxNeighbours;
+	const int maxCorners = m_config.maxCorners;
+	const int maxSegs = m_config.maxLocalSegments;
+	const int maxPolys = m_config.maxLocalPolys;
+	m_agentNeis = (dtCrowdNeighbour*)dtAlloc(sizeof(dtCrowdNeighbour)*m_maxAgents*maxNeis, DT_ALLOC_PERM);
+	m_agentCornerVerts = (float*)dtAlloc(sizeof(float)*m_maxAgents*maxCorners*3, DT_ALLOC_PERM);
+	m_agentCornerFlags = (unsigned char*)dtAlloc(sizeof(unsigned char)*m_maxAgents*maxCorners, DT_ALLOC_PERM);
+	m_agentCornerPolys = (dtPolyRef*)dtAlloc(sizeof(dtPolyRef)*m_maxAgents*maxCorners, DT_ALLOC_PERM);
+	m_agentSegs = (float*)dtAlloc(sizeof(float)*m_maxAgents*dtMax(maxSegs, 1)*6, DT_ALLOC_PERM);
+	m_agentSegDists = (float*)dtAlloc(sizeof(float)*m_maxAgents*dtMax(maxSegs, 1), DT_ALLOC_PERM);
+	m_agentPolys = (dtPolyRef*)dtAlloc(sizeof(dtPolyRef)*m_maxAgents*maxPolys, DT_ALLOC_PERM);
+	if (!m_agentNeis || !m_agentCornerVerts || !m_agentCornerFlags || !m_agentCornerPolys ||
+		!m_agentSegs || !m_agentSegDists || !m_agentPolys)
+		return false;
 	
 	for (int i = 0; i < m_maxAgents; ++i)
 	{
-		new(&m_agents[i]) dtCrowdAgent();
-		m_agents[i].active = false;
-		if (!m_agents[i].corridor.init(m_maxPathResult))
+		dtCrowdAgent* ag = new(&m_agents[i]) dtCrowdAgent();
+		ag->active = false;
+		if (!ag->corridor.init(m_maxPathResult))
 			return false;
+		ag->neis = &m_agentNeis[i*maxNeis];
+		ag->nneis = 0;
+		ag->cornerVerts = &m_agentCornerVerts[i*maxCorners*3];
+		ag->cornerFlags = &m_agentCornerFlags[i*maxCorners];
+		ag->cornerPolys = &m_agentCornerPolys[i*maxCorners];
+		ag->ncorners = 0;
+		ag->boundary.init(&m_agentSegs[i*maxSegs*6], &m_agentSegDists[i*maxSegs], maxSegs,
+						  &m_agentPolys[i*maxPolys], maxPolys);
 	}
 
 	for (int i = 0; i < m_maxAgents; ++i)
@@ -459,9 +578,127 @@ bool dtCrowd::init(const int maxAgents, const float maxAgentRadius, dtNavMesh* n
 	if (dtStatusFailed(m_navquery->init(nav, MAX_COMMON_NODES)))
 		return false;
 	
+	// Keep a job runner set before the re-initialization.
+	return initWorkers();
+}
+
+/// @par
+///
+/// The agents, their corridors and their targets are kept, so the new navmesh should
+/// contain the same tiles as the old one. Pending path requests are dropped and
+/// requested again on the next #update.
+bool dtCrowd::setNavMesh(dtNavMesh* nav)
+{
+	if (!m_navquery)
+		return false;
+	if (dtStatusFailed(m_navquery->init(nav, MAX_COMMON_NODES)))
+		return false;
+	if (!m_pathq.init(m_maxPathResult, MAX_PATHQUEUE_NODES, nav))
+		return false;
+
+	for (int i = 0; i < m_maxAgents; ++i)
+	{
+		dtCrowdAgent* ag = &m_agents[i];
+		if (!ag->active)
+			continue;
+		if (ag->targetState == DT_CROWDAGENT_TARGET_WAITING_FOR_QUEUE ||
+			ag->targetState == DT_CROWDAGENT_TARGET_WAITING_FOR_PATH)
+		{
+			ag->targetPathqRef = DT_PATHQ_INVALID;
+			ag->targetState = DT_CROWDAGENT_TARGET_REQUESTING;
+			ag->targetReplanTime = 0.0;
+		}
+		ag->boundary.reset();
+	}
+
+	return initWorkers();
+}
+
+bool dtCrowd::setJobRunner(dtCrowdJobRunner* runner)
+{
+	m_jobRunner = runner;
+	if (!m_navquery)
+		return true;
+	return initWorkers();
+}
+
+bool dtCrowd::initWorkers()
+{
+	freeWorkers();
+	if (!m_jobRunner)
+		return true;
+
+	const int count = dtMax(1, m_jobRunner->getWorkerCount());
+	if (!reserveGridResults(count))
+		return false;
+	m_workerNavQueries = (dtNavMeshQuery**)dtAlloc(sizeof(dtNavMeshQuery*)*count, DT_ALLOC_PERM);
+	m_workerObstacleQueries = (dtObstacleAvoidanceQuery**)dtAlloc(sizeof(dtObstacleAvoidanceQuery*)*count, DT_ALLOC_PERM);
+	m_workerSampleCounts = (int*)dtAlloc(sizeof(int)*count, DT_ALLOC_PERM);
+	if (!m_workerNavQueries || !m_workerObstacleQueries || !m_workerSampleCounts)
+	{
+		freeWorkers();
+		return false;
+	}
+	memset(m_workerNavQueries, 0, sizeof(dtNavMeshQuery*)*count);
+	memset(m_workerObstacleQueries, 0, sizeof(dtObstacleAvoidanceQuery*)*count);
+	m_workerCount = count;
+
+	// Worker 0 uses the crowd's own queries.
+	m_workerNavQueries[0] = m_navquery;
+	m_workerObstacleQueries[0] = m_obstacleQuery;
+	for (int i = 1; i < count; ++i)
+	{
+		m_workerNavQueries[i] = dtAllocNavMeshQuery();
+		if (!m_workerNavQueries[i] || dtStatusFailed(m_workerNavQueries[i]->init(m_navquery->getAttachedNavMesh(), MAX_COMMON_NODES)))
+		{
+			freeWorkers();
+			return false;
+		}
+		m_workerObstacleQueries[i] = dtAllocObstacleAvoidanceQuery();
+		if (!m_workerObstacleQueries[i] || !m_workerObstacleQueries[i]->init(m_config.maxNeighbours, dtMax(m_config.maxLocalSegments, 1)))
+		{
+			freeWorkers();
+			return false;
+		}
+	}
+	return true;
+}
+
+void dtCrowd::freeWorkers()
+{
+	for (int i = 1; i < m_workerCount; ++i)
+	{
+		dtFreeNavMeshQuery(m_workerNavQueries[i]);
+		dtFreeObstacleAvoidanceQuery(m_workerObstacleQueries[i]);
+	}
+	dtFree(m_workerNavQueries);
+	m_workerNavQueries = 0;
+	dtFree(m_workerObstacleQueries);
+	m_workerObstacleQueries = 0;
+	dtFree(m_workerSampleCounts);
+	m_workerSampleCounts = 0;
+	m_workerCount = 0;
+}
+
+bool dtCrowd::reserveGridResults(const int workers)
+{
+	if (workers <= m_gridResultWorkers)
+		return true;
+	unsigned int* results = (unsigned int*)dtAlloc(sizeof(unsigned int)*m_maxGridResults*workers, DT_ALLOC_PERM);
+	if (!results)
+		return false;
+	dtFree(m_gridResults);
+	m_gridResults = results;
+	m_gridResultWorkers = workers;
 	return true;
 }
 
+void dtCrowd::setPathQueueBudget(const int maxRequests, const int maxIters)
+{
+	m_maxPathRequests = dtMax(1, maxRequests);
+	m_maxPathIters = dtMax(1, maxIters);
+}
+
 void dtCrowd::setObstacleAvoidanceParams(const int idx, const dtObstacleAvoidanceParams* params)
 {
 	if (idx >= 0 && idx < DT_CROWD_MAX_OBSTAVOIDANCE_PARAMS)
@@ -475,6 +712,19 @@ const dtObstacleAvoidanceParams* dtCrowd::getObstacleAvoidanceParams(const int i
 	return 0;
 }
 
+void dtCrowd::setObstacleAvoidanceBackend(const int idx, dtObstacleAvoidanceBackend* backend)
+{
+	if (idx >= 0 && idx < DT_CROWD_MAX_OBSTAVOIDANCE_PARAMS)
+		m_obstacleBackends[idx] = backend;
+}
+
+dtObstacleAvoidanceBackend* dtCrowd::getObstacleAvoidanceBackend(const int idx) const
+{
+	if (idx >= 0 && idx < DT_CROWD_MAX_OBSTAVOIDANCE_PARAMS)
+		return m_obstacleBackends[idx];
+	return 0;
+}
+
 int dtCrowd::getAgentCount() const
 {
 	return m_maxAgents;
@@ -677,8 +927,8 @@ int dtCrowd::getActiveAgents(dtCrowdAgent** agents, const int maxAgents)
 
 void dtCrowd::updateMoveRequest(const float /*dt*/)
 {
-	const int PATH_MAX_AGENTS = 8;
-	dtCrowdAgent* queue[PATH_MAX_AGENTS];
+	const int maxQueue = dtMin(m_maxPathRequests, m_maxAgents);
+	dtCrowdAgent** queue = m_pathqAgents;
 	int nqueue = 0;
 	
 	// Fire off new requests.
@@ -765,22 +1015,24 @@ void dtCrowd::updateMoveRequest(const float /*dt*/)
 		
 		if (ag->targetState == DT_CROWDAGENT_TARGET_WAITING_FOR_QUEUE)
 		{
-			nqueue = addToPathQueue(ag, queue, nqueue, PATH_MAX_AGENTS);
+			nqueue = addToPathQueue(ag, queue, nqueue, maxQueue);
 		}
 	}
 
 	for (int i = 0; i < nqueue; ++i)
 	{
 		dtCrowdAgent* ag = queue[i];
+		// Shorter searches first, the queue's wait limit keeps long ones from starving.
+		const float priority = dtVdist2D(ag->corridor.getTarget(), ag->targetPos);
 		ag->targetPathqRef = m_pathq.request(ag->corridor.getLastPoly(), ag->targetRef,
-											 ag->corridor.getTarget(), ag->targetPos, &m_filters[ag->params.queryFilterType]);
+											 ag->corridor.getTarget(), ag->targetPos, &m_filters[ag->params.queryFilterType], priority);
 		if (ag->targetPathqRef != DT_PATHQ_INVALID)
 			ag->targetState = DT_CROWDAGENT_TARGET_WAITING_FOR_PATH;
 	}
 
 	
 	// Update requests.
-	m_pathq.update(MAX_ITERS_PER_UPDATE);
+	m_pathq.update(m_maxPathIters);
 
 	dtStatus status;
 
@@ -1044,289 +1296,287 @@ void dtCrowd::checkPathValidity(dtCrowdAgent** agents, const int nagents, const
 	}
 }
 	
-void dtCrowd::update(const float dt, dtCrowdAgentDebugInfo* debug)
+/// Per-agent phases of dtCrowd::update that may run on several workers.
+/// A phase only writes the agents in its own range and reads what the earlier phases wrote.
+enum dtCrowdUpdatePhase
 {
-	m_velocitySampleCount = 0;
-	
-	const int debugIdx = debug ? debug->idx : -1;
-	
-	dtCrowdAgent** agents = m_activeAgents;
-	int nagents = getActiveAgents(agents, m_maxAgents);
+	DT_CROWD_PHASE_NEIGHBOURS,			///< Collision boundary and neighbour query.
+	DT_CROWD_PHASE_CORNERS,				///< Next corners and visibility optimization.
+	DT_CROWD_PHASE_STEERING,			///< Desired velocity and separation.
+	DT_CROWD_PHASE_OBSTACLES,			///< Fills the obstacle avoidance batch.
+	DT_CROWD_PHASE_VELOCITY_PLANNING,	///< Obstacle avoidance sampling.
+	DT_CROWD_PHASE_INTEGRATE,
+	DT_CROWD_PHASE_COLLISION,			///< Displacement out of the neighbours.
+	DT_CROWD_PHASE_DISPLACE,			///< Applies the displacement.
+	DT_CROWD_PHASE_MOVE,				///< Moves the corridors to the new positions.
+};
+
+struct dtCrowdPhaseJob : public dtCrowdJob
+{
+	dtCrowd* crowd;
+	int phase;
 
-	// Check that all agents still have valid paths.
-	checkPathValidity(agents, nagents, dt);
-	
-	// Update async move request and path finder.
-	updateMoveRequest(dt);
+	virtual void execute(const int begin, const int end, const int worker)
+	{
+		crowd->updatePhase(phase, begin, end, worker);
+	}
+};
 
-	// Optimize path topology.
-	updateTopologyOptimization(agents, nagents, dt);
-	
-	// Register agents to proximity grid.
-	m_grid->clear();
-	for (int i = 0; i < nagents; ++i)
+void dtCrowd::runPhase(const int phase, const int count)
+{
+	if (count <= 0)
+		return;
+	if (m_jobRunner && m_workerCount > 0)
 	{
-		dtCrowdAgent* ag = agents[i];
-		const float* p = ag->npos;
-		const float r = ag->params.radius;
-		m_grid->addItem((unsigned short)i, p[0]-r, p[2]-r, p[0]+r, p[2]+r);
+		dtCrowdPhaseJob job;
+		job.crowd = this;
+		job.phase = phase;
+		m_jobRunner->run(&job, count);
 	}
-	
-	// Get nearby navmesh segments and agents to collide with.
-	for (int i = 0; i < nagents; ++i)
+	else
 	{
-		dtCrowdAgent* ag = agents[i];
-		if (ag->state != DT_CROWDAGENT_STATE_WALKING)
-			continue;
-
-		// Update the collision boundary after certain distance has been passed or
-		// if it has become invalid.
-		const float updateThr = ag->params.collisionQueryRange*0.25f;
-		if (dtVdist2DSqr(ag->npos, ag->boundary.getCenter()) > dtSqr(updateThr) ||
-			!ag->boundary.isValid(m_navquery, &m_filters[ag->params.queryFilterType]))
-		{
-			ag->boundary.update(ag->corridor.getFirstPoly(), ag->npos, ag->params.collisionQueryRange,
-								m_navquery, &m_filters[ag->params.queryFilterType]);
-		}
-		// Query neighbour agents
-		ag->nneis = getNeighbours(ag->npos, ag->params.height, ag->params.collisionQueryRange,
-								  ag, ag->neis, DT_CROWDAGENT_MAX_NEIGHBOURS,
-								  agents, nagents, m_grid);
-		for (int j = 0; j < ag->nneis; j++)
-			ag->neis[j].idx = getAgentIndex(agents[ag->neis[j].idx]);
+		updatePhase(phase, 0, count, 0);
 	}
-	
-	// Find next corner to steer to.
-	for (int i = 0; i < nagents; ++i)
+}
+
+void dtCrowd::updatePhase(const int phase, const int begin, const int end, const int worker)
+{
+	dtAssert(worker == 0 || worker < m_workerCount);
+
+	dtCrowdAgent** agents = m_updateAgents;
+	const int nagents = m_updateAgentCount;
+	dtCrowdAgentDebugInfo* debug = m_updateDebug;
+	const int debugIdx = debug ? debug->idx : -1;
+	dtNavMeshQuery* navquery = m_workerCount > 0 ? m_workerNavQueries[worker] : m_navquery;
+	dtObstacleAvoidanceQuery* obstacleQuery = m_workerCount > 0 ? m_workerObstacleQueries[worker] : m_obstacleQuery;
+
+	switch (phase)
 	{
-		dtCrowdAgent* ag = agents[i];
-		
-		if (ag->state != DT_CROWDAGENT_STATE_WALKING)
-			continue;
-		if (ag->targetState == DT_CROWDAGENT_TARGET_NONE || ag->targetState == DT_CROWDAGENT_TARGET_VELOCITY)
-			continue;
-		
-		// Find corners for steering
-		ag->ncorners = ag->corridor.findCorners(ag->cornerVerts, ag->cornerFlags, ag->cornerPolys,
-												DT_CROWDAGENT_MAX_CORNERS, m_navquery, &m_filters[ag->params.queryFilterType]);
-		
-		// Check to see if the corner after the next corner is directly visible,
-		// and short cut to there.
-		if ((ag->params.updateFlags & DT_CROWD_OPTIMIZE_VIS) && ag->ncorners > 0)
-		{
-			const float* target = &ag->cornerVerts[dtMin(1,ag->ncorners-1)*3];
-			ag->corridor.optimizePathVisibility(target, ag->params.pathOptimizationRange, m_navquery, &m_filters[ag->params.queryFilterType]);
-			
-			// Copy data for debug purposes.
-			if (debugIdx == i)
-			{
-				dtVcopy(debug->optStart, ag->corridor.getPos());
-				dtVcopy(debug->optEnd, target);
-			}
-		}
-		else
+	case DT_CROWD_PHASE_NEIGHBOURS:
+		// Get nearby navmesh segments and agents to collide with.
+		for (int i = begin; i < end; ++i)
 		{
-			// Copy data for debug purposes.
-			if (debugIdx == i)
+			dtCrowdAgent* ag = agents[i];
+			if (ag->state != DT_CROWDAGENT_STATE_WALKING)
+				continue;
+
+			// Update the collision boundary after certain distance has been passed or
+			// if it has become invalid.
+			const float updateThr = ag->params.collisionQueryRange*0.25f;
+			if (dtVdist2DSqr(ag->npos, ag->boundary.getCenter()) > dtSqr(updateThr) ||
+				!ag->boundary.isValid(navquery, &m_filters[ag->params.queryFilterType]))
 			{
-				dtVset(debug->optStart, 0,0,0);
-				dtVset(debug->optEnd, 0,0,0);
+				ag->boundary.update(ag->corridor.getFirstPoly(), ag->npos, ag->params.collisionQueryRange,
+									navquery, &m_filters[ag->params.queryFilterType]);
 			}
+			// Query neighbour agents
+			ag->nneis = getNeighbours(ag->npos, ag->params.height, ag->params.collisionQueryRange,
+									  ag, ag->neis, m_config.maxNeighbours,
+									  agents, nagents, m_grid,
+									  &m_gridResults[worker*m_maxGridResults], m_maxGridResults);
+			for (int j = 0; j < ag->nneis; j++)
+				ag->neis[j].idx = getAgentIndex(agents[ag->neis[j].idx]);
 		}
-	}
-	
-	// Trigger off-mesh connections (depends on corners).
-	for (int i = 0; i < nagents; ++i)
-	{
-		dtCrowdAgent* ag = agents[i];
-		
-		if (ag->state != DT_CROWDAGENT_STATE_WALKING)
-			continue;
-		if (ag->targetState == DT_CROWDAGENT_TARGET_NONE || ag->targetState == DT_CROWDAGENT_TARGET_VELOCITY)
-			continue;
-		
-		// Check 
-		const float triggerRadius = ag->params.radius*2.25f;
-		if (overOffmeshConnection(ag, triggerRadius))
+		break;
+
+	case DT_CROWD_PHASE_CORNERS:
+		// Find next corner to steer to.
+		for (int i = begin; i < end; ++i)
 		{
-			// Prepare to off-mesh connection.
-			const int idx = (int)(ag - m_agents);
-			dtCrowdAgentAnimation* anim = &m_agentAnims[idx];
+			dtCrowdAgent* ag = agents[i];
 			
-			// Adjust the path over the off-mesh connection.
-			dtPolyRef refs[2];
-			if (ag->corridor.moveOverOffmeshConnection(ag->cornerPolys[ag->ncorners-1], refs,
-													   anim->startPos, anim->endPos, m_navquery))
+			if (ag->state != DT_CROWDAGENT_STATE_WALKING)
+				continue;
+			if (ag->targetState == DT_CROWDAGENT_TARGET_NONE || ag->targetState == DT_CROWDAGENT_TARGET_VELOCITY)
+				continue;
+			
+			// Find corners for steering
+			ag->ncorners = ag->corridor.findCorners(ag->cornerVerts, ag->cornerFlags, ag->cornerPolys,
+													m_config.maxCorners, navquery, &m_filters[ag->params.queryFilterType]);
+			
+			// Check to see if the corner after the next corner is directly visible,
+			// and short cut to there.
+			if ((ag->params.updateFlags & DT_CROWD_OPTIMIZE_VIS) && ag->ncorners > 0)
 			{
-				dtVcopy(anim->initPos, ag->npos);
-				anim->polyRef = refs[1];
-				anim->active = true;
-				anim->t = 0.0f;
-				anim->tmax = (dtVdist2D(anim->startPos, anim->endPos) / ag->params.maxSpeed) * 0.5f;
+				const float* target = &ag->cornerVerts[dtMin(1,ag->ncorners-1)*3];
+				ag->corridor.optimizePathVisibility(target, ag->params.pathOptimizationRange, navquery, &m_filters[ag->params.queryFilterType]);
 				
-				ag->state = DT_CROWDAGENT_STATE_OFFMESH;
-				ag->ncorners = 0;
-				ag->nneis = 0;
-				continue;
+				// Copy data for debug purposes.
+				if (debugIdx == i)
+				{
+					dtVcopy(debug->optStart, ag->corridor.getPos());
+					dtVcopy(debug->optEnd, target);
+				}
 			}
 			else
 			{
-				// Path validity check will ensure that bad/blocked connections will be replanned.
+				// Copy data for debug purposes.
+				if (debugIdx == i)
+				{
+					dtVset(debug->optStart, 0,0,0);
+					dtVset(debug->optEnd, 0,0,0);
+				}
 			}
 		}
-	}
-		
-	// Calculate steering.
-	for (int i = 0; i < nagents; ++i)
-	{
-		dtCrowdAgent* ag = agents[i];
-
-		if (ag->state != DT_CROWDAGENT_STATE_WALKING)
-			continue;
-		if (ag->targetState == DT_CROWDAGENT_TARGET_NONE)
-			continue;
-		
-		float dvel[3] = {0,0,0};
+		break;
 
-		if (ag->targetState == DT_CROWDAGENT_TARGET_VELOCITY)
+	case DT_CROWD_PHASE_STEERING:
+		// Calculate steering.
+		for (int i = begin; i < end; ++i)
 		{
-			dtVcopy(dvel, ag->targetPos);
-			ag->desiredSpeed = dtVlen(ag->targetPos);
-		}
-		else
-		{
-			// Calculate steering direction.
-			if (ag->params.updateFlags & DT_CROWD_ANTICIPATE_TURNS)
-				calcSmoothSteerDirection(ag, dvel);
-			else
-				calcStraightSteerDirection(ag, dvel);
+			dtCrowdAgent* ag = agents[i];
+
+			if (ag->state != DT_CROWDAGENT_STATE_WALKING)
+				continue;
+			if (ag->targetState == DT_CROWDAGENT_TARGET_NONE)
+				continue;
 			
-			// Calculate speed scale, which tells the agent to slowdown at the end of the path.
-			const float slowDownRadius = ag->params.radius*2;	// TODO: make less hacky.
-			const float speedScale = getDistanceToGoal(ag, slowDownRadius) / slowDownRadius;
+			float dvel[3] = {0,0,0};
+
+			if (ag->targetState == DT_CROWDAGENT_TARGET_VELOCITY)
+			{
+				dtVcopy(dvel, ag->targetPos);
+				ag->desiredSpeed = dtVlen(ag->targetPos);
+			}
+			else
+			{
+				// Calculate steering direction.
+				if (ag->params.updateFlags & DT_CROWD_ANTICIPATE_TURNS)
+					calcSmoothSteerDirection(ag, dvel);
+				else
+					calcStraightSteerDirection(ag, dvel);
 				
-			ag->desiredSpeed = ag->params.maxSpeed;
-			dtVscale(dvel, dvel, ag->desiredSpeed * speedScale);
-		}
+				// Calculate speed scale, which tells the agent to slowdown at the end of the path.
+				const float slowDownRadius = ag->params.radius*2;	// TODO: make less hacky.
+				const float speedScale = getDistanceToGoal(ag, slowDownRadius) / slowDownRadius;
+					
+				ag->desiredSpeed = ag->params.maxSpeed;
+				dtVscale(dvel, dvel, ag->desiredSpeed * speedScale);
+			}
 
-		// Separation
-		if (ag->params.updateFlags & DT_CROWD_SEPARATION)
-		{
-			const float separationDist = ag->params.collisionQueryRange; 
-			const float invSeparationDist = 1.0f / separationDist; 
-			const float separationWeight = ag->params.separationWeight;
-			
-			float w = 0;
-			float disp[3] = {0,0,0};
-			
-			for (int j = 0; j < ag->nneis; ++j)
+			// Separation
+			if (ag->params.updateFlags & DT_CROWD_SEPARATION)
 			{
-				const dtCrowdAgent* nei = &m_agents[ag->neis[j].idx];
+				const float separationDist = ag->params.collisionQueryRange; 
+				const float invSeparationDist = 1.0f / separationDist; 
+				const float separationWeight = ag->params.separationWeight;
 				
-				float diff[3];
-				dtVsub(diff, ag->npos, nei->npos);
-				diff[1] = 0;
+				float w = 0;
+				float disp[3] = {0,0,0};
 				
-				const float distSqr = dtVlenSqr(diff);
-				if (distSqr < 0.00001f)
-					continue;
-				if (distSqr > dtSqr(separationDist))
-					continue;
-				const float dist = dtMathSqrtf(distSqr);
-				const float weight = separationWeight * (1.0f - dtSqr(dist*invSeparationDist));
+				for (int j = 0; j < ag->nneis; ++j)
+				{
+					const dtCrowdAgent* nei = &m_agents[ag->neis[j].idx];
+					
+					float diff[3];
+					dtVsub(diff, ag->npos, nei->npos);
+					diff[1] = 0;
+					
+					const float distSqr = dtVlenSqr(diff);
+					if (distSqr < 0.00001f)
+						continue;
+					if (distSqr > dtSqr(separationDist))
+						continue;
+					const float dist = dtMathSqrtf(distSqr);
+					const float weight = separationWeight * (1.0f - dtSqr(dist*invSeparationDist));
+					
+					dtVmad(disp, disp, diff, weight/dist);
+					w += 1.0f;
+				}
 				
-				dtVmad(disp, disp, diff, weight/dist);
-				w += 1.0f;
+				if (w > 0.0001f)
+				{
+					// Adjust desired velocity.
+					dtVmad(dvel, dvel, disp, 1.0f/w);
+					// Clamp desired velocity to desired speed.
+					const float speedSqr = dtVlenSqr(dvel);
+					const float desiredSqr = dtSqr(ag->desiredSpeed);
+					if (speedSqr > desiredSqr)
+						dtVscale(dvel, dvel, desiredSqr/speedSqr);
+				}
 			}
 			
-			if (w > 0.0001f)
-			{
-				// Adjust desired velocity.
-				dtVmad(dvel, dvel, disp, 1.0f/w);
-				// Clamp desired velocity to desired speed.
-				const float speedSqr = dtVlenSqr(dvel);
-				const float desiredSqr = dtSqr(ag->desiredSpeed);
-				if (speedSqr > desiredSqr)
-					dtVscale(dvel, dvel, desiredSqr/speedSqr);
-			}
+			// Set the desired velocity.
+			dtVcopy(ag->dvel, dvel);
 		}
-		
-		// Set the desired velocity.
-		dtVcopy(ag->dvel, dvel);
-	}
-	
-	// Velocity planning.	
-	for (int i = 0; i < nagents; ++i)
-	{
-		dtCrowdAgent* ag = agents[i];
-		
-		if (ag->state != DT_CROWDAGENT_STATE_WALKING)
-			continue;
-		
-		if (ag->params.updateFlags & DT_CROWD_OBSTACLE_AVOIDANCE)
+		break;
+
+	case DT_CROWD_PHASE_OBSTACLES:
+		for (int i = begin; i < end; ++i)
 		{
-			m_obstacleQuery->reset();
+			dtCrowdAgent* ag = agents[i];
 			
-			// Add neighbours as obstacles.
-			for (int j = 0; j < ag->nneis; ++j)
-			{
-				const dtCrowdAgent* nei = &m_agents[ag->neis[j].idx];
-				m_obstacleQuery->addCircle(nei->npos, nei->params.radius, nei->vel, nei->dvel);
-			}
-
-			// Append neighbour segments as obstacles.
-			for (int j = 0; j < ag->boundary.getSegmentCount(); ++j)
-			{
-				const float* s = ag->boundary.getSegment(j);
-				if (dtTriArea2D(ag->npos, s, s+3) < 0.0f)
-					continue;
-				m_obstacleQuery->addSegment(s, s+3);
-			}
-
-			dtObstacleAvoidanceDebugData* vod = 0;
-			if (debugIdx == i) 
-				vod = debug->vod;
+			// Every agent can be a neighbour, share its circle once.
+			m_obstacleBatch->setCircle(getAgentIndex(ag), ag->npos, ag->params.radius, ag->vel, ag->dvel);
 			
-			// Sample new safe velocity.
-			bool adaptive = true;
-			int ns = 0;
-
-			const dtObstacleAvoidanceParams* params = &m_obstacleQueryParams[ag->params.obstacleAvoidanceType];
-				
-			if (adaptive)
+			if (ag->state != DT_CROWDAGENT_STATE_WALKING)
+				continue;
+			
+			if (ag->params.updateFlags & DT_CROWD_OBSTACLE_AVOIDANCE)
 			{
-				ns = m_obstacleQuery->sampleVelocityAdaptive(ag->npos, ag->params.radius, ag->desiredSpeed,
-															 ag->vel, ag->dvel, ag->nvel, params, vod);
+				dtObstacleAvoidanceDebugData* vod = 0;
+				if (debugIdx == i) 
+					vod = debug->vod;
+				
+				const dtObstacleAvoidanceParams* params = &m_obstacleQueryParams[ag->params.obstacleAvoidanceType];
+				m_obstacleBatch->setAgent(i, ag->npos, ag->params.radius, ag->desiredSpeed,
+										  ag->vel, ag->dvel, ag->nvel, params, vod);
+				
+				// Add neighbours as obstacles.
+				for (int j = 0; j < ag->nneis; ++j)
+					m_obstacleBatch->addAgentCircle(i, ag->neis[j].idx);
+				
+				// Use the boundary segments in place.
+				if (ag->boundary.getSegmentCount() > 0)
+				{
+					m_obstacleBatch->setAgentSegments(i, ag->boundary.getSegment(0), ag->boundary.getSegmentCount(),
+													  ag->boundary.getSegmentStride());
+				}
 			}
 			else
 			{
-				ns = m_obstacleQuery->sampleVelocityGrid(ag->npos, ag->params.radius, ag->desiredSpeed,
-														 ag->vel, ag->dvel, ag->nvel, params, vod);
+				// If not using velocity planning, new velocity is directly the desired velocity.
+				dtVcopy(ag->nvel, ag->dvel);
 			}
-			m_velocitySampleCount += ns;
 		}
-		else
+		break;
+
+	case DT_CROWD_PHASE_VELOCITY_PLANNING:
+	{
+		// Sample new safe velocity, or let the solver of the avoidance configuration find it.
+		int sampleCount = 0;
+		for (int i = begin; i < end; ++i)
 		{
-			// If not using velocity planning, new velocity is directly the desired velocity.
-			dtVcopy(ag->nvel, ag->dvel);
+			if (!m_obstacleBatch->isAgentActive(i))
+				continue;
+			dtObstacleAvoidanceBackend* backend = m_obstacleBackends[agents[i]->params.obstacleAvoidanceType];
+			if (backend)
+				sampleCount += backend->solve(m_obstacleBatch, i);
+			else
+				sampleCount += obstacleQuery->sampleVelocityAdaptiveRange(m_obstacleBatch, i, i+1);
 		}
+		if (m_workerCount > 0)
+			m_workerSampleCounts[worker] += sampleCount;
+		else
+			m_velocitySampleCount += sampleCount;
+		break;
 	}
 
-	// Integrate.
-	for (int i = 0; i < nagents; ++i)
-	{
-		dtCrowdAgent* ag = agents[i];
-		if (ag->state != DT_CROWDAGENT_STATE_WALKING)
-			continue;
-		integrate(ag, dt);
-	}
-	
-	// Handle collisions.
-	static const float COLLISION_RESOLVE_FACTOR = 0.7f;
-	
-	for (int iter = 0; iter < 4; ++iter)
+	case DT_CROWD_PHASE_INTEGRATE:
+		for (int i = begin; i < end; ++i)
+		{
+			dtCrowdAgent* ag = agents[i];
+			if (ag->state != DT_CROWDAGENT_STATE_WALKING)
+				continue;
+			integrate(ag, m_updateDt);
+		}
+		break;
+
+	case DT_CROWD_PHASE_COLLISION:
 	{
-		for (int i = 0; i < nagents; ++i)
+		static const float COLLISION_RESOLVE_FACTOR = 0.7f;
+
+		for (int i = begin; i < end; ++i)
 		{
 			dtCrowdAgent* ag = agents[i];
 			const int idx0 = getAgentIndex(ag);
@@ -1377,8 +1627,11 @@ void dtCrowd::update(const float dt, dtCrowdAgentDebugInfo* debug)
 				dtVscale(ag->disp, ag->disp, iw);
 			}
 		}
-		
-		for (int i = 0; i < nagents; ++i)
+		break;
+	}
+
+	case DT_CROWD_PHASE_DISPLACE:
+		for (int i = begin; i < end; ++i)
 		{
 			dtCrowdAgent* ag = agents[i];
 			if (ag->state != DT_CROWDAGENT_STATE_WALKING)
@@ -1386,28 +1639,141 @@ void dtCrowd::update(const float dt, dtCrowdAgentDebugInfo* debug)
 			
 			dtVadd(ag->npos, ag->npos, ag->disp);
 		}
+		break;
+
+	case DT_CROWD_PHASE_MOVE:
+		for (int i = begin; i < end; ++i)
+		{
+			dtCrowdAgent* ag = agents[i];
+			if (ag->state != DT_CROWDAGENT_STATE_WALKING)
+				continue;
+			
+			// Move along navmesh.
+			ag->corridor.movePosition(ag->npos, navquery, &m_filters[ag->params.queryFilterType]);
+			// Get valid constrained position back.
+			dtVcopy(ag->npos, ag->corridor.getPos());
+
+			// If not using path, truncate the corridor to just one poly.
+			if (ag->targetState == DT_CROWDAGENT_TARGET_NONE || ag->targetState == DT_CROWDAGENT_TARGET_VELOCITY)
+			{
+				ag->corridor.reset(ag->corridor.getFirstPoly(), ag->npos);
+				ag->partial = false;
+			}
+		}
+		break;
 	}
+}
+
+/// @par
+///
+/// With a job runner set the per-agent phases are split over its workers.
+/// Each phase only depends on the results of the previous ones, so the
+/// outcome is the same as a serial update.
+void dtCrowd::update(const float dt, dtCrowdAgentDebugInfo* debug)
+{
+	m_velocitySampleCount = 0;
+	for (int i = 0; i < m_workerCount; ++i)
+		m_workerSampleCounts[i] = 0;
+	
+	dtCrowdAgent** agents = m_activeAgents;
+	int nagents = getActiveAgents(agents, m_maxAgents);
+
+	m_updateAgents = agents;
+	m_updateAgentCount = nagents;
+	m_updateDt = dt;
+	m_updateDebug = debug;
+
+	// Check that all agents still have valid paths.
+	checkPathValidity(agents, nagents, dt);
+	
+	// Update async move request and path finder.
+	updateMoveRequest(dt);
+
+	// Optimize path topology.
+	updateTopologyOptimization(agents, nagents, dt);
 	
+	// Register agents to proximity grid.
+	m_grid->clear();
 	for (int i = 0; i < nagents; ++i)
 	{
 		dtCrowdAgent* ag = agents[i];
+		const float* p = ag->npos;
+		const float r = ag->params.radius;
+		m_grid->addItem((unsigned int)i, p[0]-r, p[2]-r, p[0]+r, p[2]+r);
+	}
+	m_grid->build();
+	
+	// Get nearby navmesh segments and agents to collide with.
+	runPhase(DT_CROWD_PHASE_NEIGHBOURS, nagents);
+	
+	// Find next corner to steer to.
+	runPhase(DT_CROWD_PHASE_CORNERS, nagents);
+	
+	// Trigger off-mesh connections (depends on corners).
+	for (int i = 0; i < nagents; ++i)
+	{
+		dtCrowdAgent* ag = agents[i];
+		
 		if (ag->state != DT_CROWDAGENT_STATE_WALKING)
 			continue;
-		
-		// Move along navmesh.
-		ag->corridor.movePosition(ag->npos, m_navquery, &m_filters[ag->params.queryFilterType]);
-		// Get valid constrained position back.
-		dtVcopy(ag->npos, ag->corridor.getPos());
-
-		// If not using path, truncate the corridor to just one poly.
 		if (ag->targetState == DT_CROWDAGENT_TARGET_NONE || ag->targetState == DT_CROWDAGENT_TARGET_VELOCITY)
+			continue;
+		
+		// Check 
+		const float triggerRadius = ag->params.radius*2.25f;
+		if (overOffmeshConnection(ag, triggerRadius))
 		{
-			ag->corridor.reset(ag->corridor.getFirstPoly(), ag->npos);
-			ag->partial = false;
+			// Prepare to off-mesh connection.
+			const int idx = (int)(ag - m_agents);
+			dtCrowdAgentAnimation* anim = &m_agentAnims[idx];
+			
+			// Adjust the path over the off-mesh connection.
+			dtPolyRef refs[2];
+			if (ag->corridor.moveOverOffmeshConnection(ag->cornerPolys[ag->ncorners-1], refs,
+													   anim->startPos, anim->endPos, m_navquery))
+			{
+				dtVcopy(anim->initPos, ag->npos);
+				anim->polyRef = refs[1];
+				anim->active = true;
+				anim->t = 0.0f;
+				anim->tmax = (dtVdist2D(anim->startPos, anim->endPos) / ag->params.maxSpeed) * 0.5f;
+				
+				ag->state = DT_CROWDAGENT_STATE_OFFMESH;
+				ag->ncorners = 0;
+				ag->nneis = 0;
+				continue;
+			}
+			else
+			{
+				// Path validity check will ensure that bad/blocked connections will be replanned.
+			}
 		}
+	}
+		
+	// Calculate steering.
+	runPhase(DT_CROWD_PHASE_STEERING, nagents);
+	
+	// Velocity planning.	
+	m_obstacleBatch->reset(nagents);
+	m_obstacleBatch->setTimeStep(dt);
+	runPhase(DT_CROWD_PHASE_OBSTACLES, nagents);
+	runPhase(DT_CROWD_PHASE_VELOCITY_PLANNING, nagents);
+	for (int i = 0; i < m_workerCount; ++i)
+		m_velocitySampleCount += m_workerSampleCounts[i];
 
+	// Integrate.
+	runPhase(DT_CROWD_PHASE_INTEGRATE, nagents);
+	
+	// Handle collisions.
+	for (int iter = 0; iter < 4; ++iter)
+	{
+		runPhase(DT_CROWD_PHASE_COLLISION, nagents);
+		runPhase(DT_CROWD_PHASE_DISPLACE, nagents);
 	}
 	
+	// Move along navmesh.
+	runPhase(DT_CROWD_PHASE_MOVE, nagents);
+	
 	// Update agents using off-mesh connection.
 	for (int i = 0; i < nagents; ++i)
 	{
@@ -1447,4 +1813,7 @@ void dtCrowd::update(const float dt, dtCrowdAgentDebugInfo* debug)
 		dtVset(ag->dvel, 0,0,0);
 	}
 	
+	m_updateAgents = 0;
+	m_updateAgentCount = 0;
+	m_updateDebug = 0;
 }
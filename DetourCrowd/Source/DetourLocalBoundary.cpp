@@ -25,8 +25,13 @@
 
 
 dtLocalBoundary::dtLocalBoundary() :
+	m_segs(0),
+	m_segDists(0),
 	m_nsegs(0),
-	m_npolys(0)
+	m_maxSegs(0),
+	m_polys(0),
+	m_npolys(0),
+	m_maxPolys(0)
 {
 	dtVset(m_center, FLT_MAX,FLT_MAX,FLT_MAX);
 }
@@ -35,6 +40,16 @@ dtLocalBoundary::~dtLocalBoundary()
 {
 }
 
+void dtLocalBoundary::init(float* segs, float* segDists, const int maxSegs, dtPolyRef* polys, const int maxPolys)
+{
+	m_segs = segs;
+	m_segDists = segDists;
+	m_maxSegs = maxSegs;
+	m_polys = polys;
+	m_maxPolys = maxPolys;
+	reset();
+}
+
 void dtLocalBoundary::reset()
 {
 	dtVset(m_center, FLT_MAX,FLT_MAX,FLT_MAX);
@@ -44,40 +59,46 @@ void dtLocalBoundary::reset()
 
 void dtLocalBoundary::addSegment(const float dist, const float* s)
 {
+	if (!m_maxSegs)
+		return;
+	
 	// Insert neighbour based on the distance.
-	Segment* seg = 0;
+	int slot = 0;
 	if (!m_nsegs)
 	{
 		// First, trivial accept.
-		seg = &m_segs[0];
+		slot = 0;
 	}
-	else if (dist >= m_segs[m_nsegs-1].d)
+	else if (dist >= m_segDists[m_nsegs-1])
 	{
 		// Further than the last segment, skip.
-		if (m_nsegs >= MAX_LOCAL_SEGS)
+		if (m_nsegs >= m_maxSegs)
 			return;
 		// Last, trivial accept.
-		seg = &m_segs[m_nsegs];
+		slot = m_nsegs;
 	}
 	else
 	{
 		// Insert inbetween.
 		int i;
 		for (i = 0; i < m_nsegs; ++i)
-			if (dist <= m_segs[i].d)
+			if (dist <= m_segDists[i])
 				break;
 		const int tgt = i+1;
-		const int n = dtMin(m_nsegs-i, MAX_LOCAL_SEGS-tgt);
-		dtAssert(tgt+n <= MAX_LOCAL_SEGS);
+		const int n = dtMin(m_nsegs-i, m_maxSegs-tgt);
+		dtAssert(tgt+n <= m_maxSegs);
 		if (n > 0)
-			memmove(&m_segs[tgt], &m_segs[i], sizeof(Segment)*n);
-		seg = &m_segs[i];
+		{
+			memmove(&m_segs[tgt*6], &m_segs[i*6], sizeof(float)*6*n);
+			memmove(&m_segDists[tgt], &m_segDists[i], sizeof(float)*n);
+		}
+		slot = i;
 	}
 	
-	seg->d = dist;
-	memcpy(seg->s, s, sizeof(float)*6);
+	m_segDists[slot] = dist;
+	memcpy(&m_segs[slot*6], s, sizeof(float)*6);
 	
-	if (m_nsegs < MAX_LOCAL_SEGS)
+	if (m_nsegs < m_maxSegs)
 		m_nsegs++;
 }
 
@@ -86,7 +107,7 @@ void dtLocalBoundary::update(dtPolyRef ref, const float* pos, const float collis
 {
 	static const int MAX_SEGS_PER_POLY = DT_VERTS_PER_POLYGON*3;
 	
-	if (!ref)
+	if (!ref || !m_maxPolys)
 	{
 		dtVset(m_center, FLT_MAX,FLT_MAX,FLT_MAX);
 		m_nsegs = 0;
@@ -98,7 +119,7 @@ void dtLocalBoundary::update(dtPolyRef ref, const float* pos, const float collis
 	
 	// First query non-overlapping polygons.
 	navquery->findLocalNeighbourhood(ref, pos, collisionQueryRange,
-									 filter, m_polys, 0, &m_npolys, MAX_LOCAL_POLYS);
+									 filter, m_polys, 0, &m_npolys, m_maxPolys);
 	
 	// Secondly, store all polygon edges.
 	m_nsegs = 0;
@@ -25,8 +25,104 @@
 #include <float.h>
 #include <new>
 
+// Candidate velocities are scored four at a time when the target has 4 wide float SIMD,
+// the scalar processSample() is used otherwise and whenever debug data is collected.
+// Define DT_OBSTACLE_AVOIDANCE_NO_SIMD to always use the scalar path.
+#if !defined(DT_OBSTACLE_AVOIDANCE_NO_SIMD)
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define DT_OBSTACLE_AVOIDANCE_SSE
+#define DT_OBSTACLE_AVOIDANCE_SIMD
+#include <emmintrin.h>
+#elif defined(__aarch64__) || defined(_M_ARM64)
+#define DT_OBSTACLE_AVOIDANCE_NEON
+#define DT_OBSTACLE_AVOIDANCE_SIMD
+#include <arm_neon.h>
+#endif
+#endif
+
 static const float DT_PI = 3.14159265f;
 
+static const int DT_SAMPLE_BATCH = 4;
+
+// Fields of dtObstacleAvoidanceQuery::m_circleLanes, relative to the agent being sampled.
+enum dtCircleLane
+{
+	DT_CIRCLE_SX,		// circle position minus agent position
+	DT_CIRCLE_SZ,
+	DT_CIRCLE_C,		// squared distance minus squared combined radius
+	DT_CIRCLE_VELX,
+	DT_CIRCLE_VELZ,
+	DT_CIRCLE_DPX,
+	DT_CIRCLE_DPZ,
+	DT_CIRCLE_NPX,
+	DT_CIRCLE_NPZ,
+	DT_CIRCLE_LANES
+};
+
+// Fields of dtObstacleAvoidanceQuery::m_segmentLanes.
+enum dtSegmentLane
+{
+	DT_SEGMENT_TOUCH,	// 1 when the agent touches the segment
+	DT_SEGMENT_DX,		// q - p
+	DT_SEGMENT_DZ,
+	DT_SEGMENT_WX,		// agent position minus p
+	DT_SEGMENT_WZ,
+	DT_SEGMENT_PERP,	// dtVperp2D(d, w)
+	DT_SEGMENT_LANES
+};
+
+#if defined(DT_OBSTACLE_AVOIDANCE_SSE)
+
+typedef __m128 dtFloat4;
+typedef __m128 dtMask4;
+
+inline dtFloat4 dtSet4(const float v) { return _mm_set1_ps(v); }
+inline dtFloat4 dtLoad4(const float* v) { return _mm_loadu_ps(v); }
+inline void dtStore4(float* dest, const dtFloat4 v) { _mm_storeu_ps(dest, v); }
+inline dtFloat4 dtAdd4(const dtFloat4 a, const dtFloat4 b) { return _mm_add_ps(a, b); }
+inline dtFloat4 dtSub4(const dtFloat4 a, const dtFloat4 b) { return _mm_sub_ps(a, b); }
+inline dtFloat4 dtMul4(const dtFloat4 a, const dtFloat4 b) { return _mm_mul_ps(a, b); }
+inline dtFloat4 dtDiv4(const dtFloat4 a, const dtFloat4 b) { return _mm_div_ps(a, b); }
+inline dtFloat4 dtSqrt4(const dtFloat4 a) { return _mm_sqrt_ps(a); }
+inline dtFloat4 dtMin4(const dtFloat4 a, const dtFloat4 b) { return _mm_min_ps(a, b); }
+inline dtFloat4 dtMax4(const dtFloat4 a, const dtFloat4 b) { return _mm_max_ps(a, b); }
+inline dtFloat4 dtAbs4(const dtFloat4 a) { return _mm_andnot_ps(_mm_set1_ps(-0.0f), a); }
+inline dtMask4 dtLess4(const dtFloat4 a, const dtFloat4 b) { return _mm_cmplt_ps(a, b); }
+inline dtMask4 dtLessEqual4(const dtFloat4 a, const dtFloat4 b) { return _mm_cmple_ps(a, b); }
+inline dtMask4 dtGreater4(const dtFloat4 a, const dtFloat4 b) { return _mm_cmpgt_ps(a, b); }
+inline dtMask4 dtGreaterEqual4(const dtFloat4 a, const dtFloat4 b) { return _mm_cmpge_ps(a, b); }
+inline dtMask4 dtAnd4(const dtMask4 a, const dtMask4 b) { return _mm_and_ps(a, b); }
+inline dtMask4 dtOr4(const dtMask4 a, const dtMask4 b) { return _mm_or_ps(a, b); }
+inline dtFloat4 dtSelect4(const dtMask4 m, const dtFloat4 a, const dtFloat4 b) { return _mm_or_ps(_mm_and_ps(m, a), _mm_andnot_ps(m, b)); }
+inline bool dtAll4(const dtMask4 m) { return _mm_movemask_ps(m) == 0xf; }
+
+#elif defined(DT_OBSTACLE_AVOIDANCE_NEON)
+
+typedef float32x4_t dtFloat4;
+typedef uint32x4_t dtMask4;
+
+inline dtFloat4 dtSet4(const float v) { return vdupq_n_f32(v); }
+inline dtFloat4 dtLoad4(const float* v) { return vld1q_f32(v); }
+inline void dtStore4(float* dest, const dtFloat4 v) { vst1q_f32(dest, v); }
+inline dtFloat4 dtAdd4(const dtFloat4 a, const dtFloat4 b) { return vaddq_f32(a, b); }
+inline dtFloat4 dtSub4(const dtFloat4 a, const dtFloat4 b) { return vsubq_f32(a, b); }
+inline dtFloat4 dtMul4(const dtFloat4 a, const dtFloat4 b) { return vmulq_f32(a, b); }
+inline dtFloat4 dtDiv4(const dtFloat4 a, const dtFloat4 b) { return vdivq_f32(a, b); }
+inline dtFloat4 dtSqrt4(const dtFloat4 a) { return vsqrtq_f32(a); }
+inline dtFloat4 dtMin4(const dtFloat4 a, const dtFloat4 b) { return vminq_f32(a, b); }
+inline dtFloat4 dtMax4(const dtFloat4 a, const dtFloat4 b) { return vmaxq_f32(a, b); }
+inline dtFloat4 dtAbs4(const dtFloat4 a) { return vabsq_f32(a); }
+inline dtMask4 dtLess4(const dtFloat4 a, const dtFloat4 b) { return vcltq_f32(a, b); }
+inline dtMask4 dtLessEqual4(const dtFloat4 a, const dtFloat4 b) { return vcleq_f32(a, b); }
+inline dtMask4 dtGreater4(const dtFloat4 a, const dtFloat4 b) { return vcgtq_f32(a, b); }
+inline dtMask4 dtGreaterEqual4(const dtFloat4 a, const dtFloat4 b) { return vcgeq_f32(a, b); }
+inline dtMask4 dtAnd4(const dtMask4 a, const dtMask4 b) { return vandq_u32(a, b); }
+inline dtMask4 dtOr4(const dtMask4 a, const dtMask4 b) { return vorrq_u32(a, b); }
+inline dtFloat4 dtSelect4(const dtMask4 m, const dtFloat4 a, const dtFloat4 b) { return vbslq_f32(m, a, b); }
+inline bool dtAll4(const dtMask4 m) { return vminvq_u32(m) != 0; }
+
+#endif
+
 static int sweepCircleCircle(const float* c0, const float r0, const float* v,
 							 const float* c1, const float r1,
 							 float& tmin, float& tmax)
@@ -215,7 +311,9 @@ dtObstacleAvoidanceQuery::dtObstacleAvoidanceQuery() :
 	m_ncircles(0),
 	m_maxSegments(0),
 	m_segments(0),
-	m_nsegments(0)
+	m_nsegments(0),
+	m_circleLanes(0),
+	m_segmentLanes(0)
 {
 }
 
@@ -223,6 +321,8 @@ dtObstacleAvoidanceQuery::~dtObstacleAvoidanceQuery()
 {
 	dtFree(m_circles);
 	dtFree(m_segments);
+	dtFree(m_circleLanes);
+	dtFree(m_segmentLanes);
 }
 
 bool dtObstacleAvoidanceQuery::init(const int maxCircles, const int maxSegments)
@@ -240,6 +340,15 @@ bool dtObstacleAvoidanceQuery::init(const int maxCircles, const int maxSegments)
 	if (!m_segments)
 		return false;
 	memset(m_segments, 0, sizeof(dtObstacleSegment)*m_maxSegments);
+
+#ifdef DT_OBSTACLE_AVOIDANCE_SIMD
+	m_circleLanes = (float*)dtAlloc(sizeof(float)*DT_CIRCLE_LANES*dtMax(m_maxCircles, 1), DT_ALLOC_PERM);
+	if (!m_circleLanes)
+		return false;
+	m_segmentLanes = (float*)dtAlloc(sizeof(float)*DT_SEGMENT_LANES*dtMax(m_maxSegments, 1), DT_ALLOC_PERM);
+	if (!m_segmentLanes)
+		return false;
+#endif
 	
 	return true;
 }
@@ -273,47 +382,153 @@ void dtObstacleAvoidanceQuery::addSegment(const float* p, const float* q)
 	dtVcopy(seg->q, q);
 }
 
-void dtObstacleAvoidanceQuery::prepare(const float* pos, const float* dvel)
+// Direction to the circle and the normal on the side to pass it, see processSample().
+static void calcCircleSide(const float* pos, const float* dvel, const dtObstacleCircle* cir, float* dp, float* np)
+{
+	const float orig[3] = {0,0,0};
+	float dv[3];
+	dtVsub(dp, cir->p, pos);
+	dtVnormalize(dp);
+	dtVsub(dv, cir->dvel, dvel);
+	
+	const float a = dtTriArea2D(orig, dp, dv);
+	np[1] = 0;
+	if (a < 0.01f)
+	{
+		np[0] = -dp[2];
+		np[2] = dp[0];
+	}
+	else
+	{
+		np[0] = dp[2];
+		np[2] = -dp[0];
+	}
+}
+
+// Precalc if the agent is really close to the segment.
+inline bool isTouchingSegment(const float* pos, const float* p, const float* q)
+{
+	const float r = 0.01f;
+	float t;
+	return dtDistancePtSegSqr2D(pos, p, q, t) < dtSqr(r);
+}
+
+void dtObstacleAvoidanceQuery::prepare(const float* pos, const float rad, const float* dvel)
 {
 	// Prepare obstacles
 	for (int i = 0; i < m_ncircles; ++i)
 	{
 		dtObstacleCircle* cir = &m_circles[i];
-		
 		// Side
-		const float* pa = pos;
-		const float* pb = cir->p;
-		
-		const float orig[3] = {0,0,0};
-		float dv[3];
-		dtVsub(cir->dp,pb,pa);
-		dtVnormalize(cir->dp);
-		dtVsub(dv, cir->dvel, dvel);
-		
-		const float a = dtTriArea2D(orig, cir->dp,dv);
-		if (a < 0.01f)
-		{
-			cir->np[0] = -cir->dp[2];
-			cir->np[2] = cir->dp[0];
-		}
-		else
-		{
-			cir->np[0] = cir->dp[2];
-			cir->np[2] = -cir->dp[0];
-		}
-	}	
+		calcCircleSide(pos, dvel, cir, cir->dp, cir->np);
+	}
 
 	for (int i = 0; i < m_nsegments; ++i)
 	{
 		dtObstacleSegment* seg = &m_segments[i];
+		seg->touch = isTouchingSegment(pos, seg->p, seg->q);
+	}
+
+#ifdef DT_OBSTACLE_AVOIDANCE_SIMD
+	for (int i = 0; i < m_ncircles; ++i)
+		setCircleLanes(i, pos, rad, &m_circles[i], m_circles[i].dp, m_circles[i].np);
+	for (int i = 0; i < m_nsegments; ++i)
+		setSegmentLanes(i, pos, m_segments[i].p, m_segments[i].q, m_segments[i].touch);
+#else
+	dtIgnoreUnused(rad);
+#endif
+}
+
+void dtObstacleAvoidanceQuery::prepareBatch(const dtObstacleAvoidanceBatch* batch, const int idx)
+{
+	const dtObstacleAvoidanceBatch::Agent* ag = &batch->m_agents[idx];
+	const int* circles = &batch->m_agentCircles[idx*batch->m_maxAgentCircles];
+	
+#ifdef DT_OBSTACLE_AVOIDANCE_SIMD
+	// Only the lanes are read when scoring without debug data, fill them
+	// straight from the shared circles and the agent's segments.
+	if (!ag->debug)
+	{
+		m_ncircles = dtMin(ag->ncircles, m_maxCircles);
+		for (int i = 0; i < m_ncircles; ++i)
+		{
+			const dtObstacleCircle* cir = &batch->m_circles[circles[i]];
+			float dp[3], np[3];
+			calcCircleSide(ag->pos, ag->dvel, cir, dp, np);
+			setCircleLanes(i, ag->pos, ag->rad, cir, dp, np);
+		}
 		
-		// Precalc if the agent is really close to the segment.
-		const float r = 0.01f;
-		float t;
-		seg->touch = dtDistancePtSegSqr2D(pos, seg->p, seg->q, t) < dtSqr(r);
-	}	
+		m_nsegments = 0;
+		for (int i = 0; i < ag->nsegs && m_nsegments < m_maxSegments; ++i)
+		{
+			const float* s = ag->segs + i*ag->segStride;
+			// Skip the segments the agent is behind of.
+			if (dtTriArea2D(ag->pos, s, s+3) < 0.0f)
+				continue;
+			setSegmentLanes(m_nsegments++, ag->pos, s, s+3, isTouchingSegment(ag->pos, s, s+3));
+		}
+		return;
+	}
+#endif
+	
+	reset();
+	
+	for (int i = 0; i < ag->ncircles; ++i)
+	{
+		const dtObstacleCircle* cir = &batch->m_circles[circles[i]];
+		addCircle(cir->p, cir->rad, cir->vel, cir->dvel);
+	}
+	
+	for (int i = 0; i < ag->nsegs; ++i)
+	{
+		const float* s = ag->segs + i*ag->segStride;
+		// Skip the segments the agent is behind of.
+		if (dtTriArea2D(ag->pos, s, s+3) < 0.0f)
+			continue;
+		addSegment(s, s+3);
+	}
+	
+	prepare(ag->pos, ag->rad, ag->dvel);
 }
 
+#ifdef DT_OBSTACLE_AVOIDANCE_SIMD
+
+// Everything processSample() derives from the obstacle alone, one array per field.
+void dtObstacleAvoidanceQuery::setCircleLanes(const int i, const float* pos, const float rad,
+											  const dtObstacleCircle* cir, const float* dp, const float* np)
+{
+	float* lanes = m_circleLanes + i;
+	float s[3];
+	dtVsub(s, cir->p, pos);
+	const float r = rad + cir->rad;
+	lanes[DT_CIRCLE_SX*m_maxCircles] = s[0];
+	lanes[DT_CIRCLE_SZ*m_maxCircles] = s[2];
+	lanes[DT_CIRCLE_C*m_maxCircles] = dtVdot2D(s,s) - r*r;
+	lanes[DT_CIRCLE_VELX*m_maxCircles] = cir->vel[0];
+	lanes[DT_CIRCLE_VELZ*m_maxCircles] = cir->vel[2];
+	lanes[DT_CIRCLE_DPX*m_maxCircles] = dp[0];
+	lanes[DT_CIRCLE_DPZ*m_maxCircles] = dp[2];
+	lanes[DT_CIRCLE_NPX*m_maxCircles] = np[0];
+	lanes[DT_CIRCLE_NPZ*m_maxCircles] = np[2];
+}
+
+void dtObstacleAvoidanceQuery::setSegmentLanes(const int i, const float* pos,
+											   const float* p, const float* q, const bool touch)
+{
+	float* lanes = m_segmentLanes + i;
+	float d[3], w[3];
+	dtVsub(d, q, p);
+	dtVsub(w, pos, p);
+	lanes[DT_SEGMENT_TOUCH*m_maxSegments] = touch ? 1.0f : 0.0f;
+	lanes[DT_SEGMENT_DX*m_maxSegments] = d[0];
+	lanes[DT_SEGMENT_DZ*m_maxSegments] = d[2];
+	lanes[DT_SEGMENT_WX*m_maxSegments] = w[0];
+	lanes[DT_SEGMENT_WZ*m_maxSegments] = w[2];
+	lanes[DT_SEGMENT_PERP*m_maxSegments] = dtVperp2D(d, w);
+}
+
+#endif // DT_OBSTACLE_AVOIDANCE_SIMD
+
 
 /* Calculate the collision penalty for a given velocity vector
  * 
@@ -432,13 +647,205 @@ float dtObstacleAvoidanceQuery::processSample(const float* vcand, const float cs
 	return penalty;
 }
 
+void dtObstacleAvoidanceQuery::processSamples(const float* candx, const float* candz, const int count, const float cs,
+											  const float* pos, const float rad,
+											  const float* vel, const float* dvel,
+											  float& minPenalty, float* best,
+											  dtObstacleAvoidanceDebugData* debug)
+{
+#ifdef DT_OBSTACLE_AVOIDANCE_SIMD
+	float penalties[DT_SAMPLE_BATCH];
+	const bool batch = debug == 0;
+	if (batch)
+		processSampleBatch(candx, candz, count, vel, dvel, minPenalty, penalties);
+#endif
+
+	// Pick in candidate order so that ties go the same way as one at a time.
+	for (int i = 0; i < count; ++i)
+	{
+		const float vcand[3] = { candx[i], 0, candz[i] };
+#ifdef DT_OBSTACLE_AVOIDANCE_SIMD
+		const float penalty = batch ? penalties[i] : processSample(vcand, cs, pos,rad,vel,dvel, minPenalty, debug);
+#else
+		const float penalty = processSample(vcand, cs, pos,rad,vel,dvel, minPenalty, debug);
+#endif
+		if (penalty < minPenalty)
+		{
+			minPenalty = penalty;
+			dtVcopy(best, vcand);
+		}
+	}
+}
+
+#ifdef DT_OBSTACLE_AVOIDANCE_SIMD
+
+static void rejectSamples(float* penalties, const int count)
+{
+	for (int i = 0; i < count; ++i)
+		penalties[i] = FLT_MAX;
+}
+
+/* Same as processSample() for four candidates at once, one per lane.
+ * The obstacle loops are shared by all lanes. A lane which hits the early out is
+ * reported as FLT_MAX, which like the minPenalty returned by processSample() can
+ * never be picked, and the batch stops as soon as every lane has bailed out.
+ */
+void dtObstacleAvoidanceQuery::processSampleBatch(const float* candx, const float* candz, const int count,
+												  const float* vel, const float* dvel,
+												  const float minPenalty, float* penalties)
+{
+	// Unused lanes repeat the last candidate.
+	float bx[DT_SAMPLE_BATCH], bz[DT_SAMPLE_BATCH];
+	for (int i = 0; i < DT_SAMPLE_BATCH; ++i)
+	{
+		const int j = dtMin(i, count-1);
+		bx[i] = candx[j];
+		bz[i] = candz[j];
+	}
+	const dtFloat4 vx = dtLoad4(bx);
+	const dtFloat4 vz = dtLoad4(bz);
+
+	const dtFloat4 zero = dtSet4(0.0f);
+	const dtFloat4 one = dtSet4(1.0f);
+	const dtFloat4 two = dtSet4(2.0f);
+	const dtFloat4 half = dtSet4(0.5f);
+	const dtFloat4 horizTime = dtSet4(m_params.horizTime);
+	const dtFloat4 invVmax = dtSet4(m_invVmax);
+
+	// penalty for straying away from the desired and current velocities
+	const dtFloat4 ddx = dtSub4(dtSet4(dvel[0]), vx);
+	const dtFloat4 ddz = dtSub4(dtSet4(dvel[2]), vz);
+	const dtFloat4 dcx = dtSub4(dtSet4(vel[0]), vx);
+	const dtFloat4 dcz = dtSub4(dtSet4(vel[2]), vz);
+	const dtFloat4 vpen = dtMul4(dtSet4(m_params.weightDesVel), dtMul4(dtSqrt4(dtAdd4(dtMul4(ddx,ddx), dtMul4(ddz,ddz))), invVmax));
+	const dtFloat4 vcpen = dtMul4(dtSet4(m_params.weightCurVel), dtMul4(dtSqrt4(dtAdd4(dtMul4(dcx,dcx), dtMul4(dcz,dcz))), invVmax));
+
+	// find the threshold hit time to bail out based on the early out penalty
+	const dtFloat4 minPen = dtSub4(dtSub4(dtSet4(minPenalty), vpen), vcpen);
+	const dtFloat4 tThreshold = dtMul4(dtSub4(dtDiv4(dtSet4(m_params.weightToi), minPen), dtSet4(0.1f)), horizTime);
+	dtMask4 bail = dtGreater4(dtSub4(tThreshold, horizTime), dtSet4(-FLT_EPSILON));
+	if (dtAll4(bail))
+	{
+		rejectSamples(penalties, count);
+		return;
+	}
+
+	// Find min time of impact and exit amongst all obstacles.
+	dtFloat4 tmin = horizTime;
+	dtFloat4 side = zero;
+
+	for (int i = 0; i < m_ncircles; ++i)
+	{
+		const float* lanes = m_circleLanes + i;
+
+		// RVO
+		const dtFloat4 vabx = dtSub4(dtSub4(dtMul4(vx, two), dtSet4(vel[0])), dtSet4(lanes[DT_CIRCLE_VELX*m_maxCircles]));
+		const dtFloat4 vabz = dtSub4(dtSub4(dtMul4(vz, two), dtSet4(vel[2])), dtSet4(lanes[DT_CIRCLE_VELZ*m_maxCircles]));
+
+		// Side
+		const dtFloat4 dp = dtAdd4(dtMul4(dtSet4(lanes[DT_CIRCLE_DPX*m_maxCircles]), vabx), dtMul4(dtSet4(lanes[DT_CIRCLE_DPZ*m_maxCircles]), vabz));
+		const dtFloat4 np = dtAdd4(dtMul4(dtSet4(lanes[DT_CIRCLE_NPX*m_maxCircles]), vabx), dtMul4(dtSet4(lanes[DT_CIRCLE_NPZ*m_maxCircles]), vabz));
+		side = dtAdd4(side, dtMin4(dtMax4(dtMin4(dtAdd4(dtMul4(dp, half), half), dtMul4(np, two)), zero), one));
+
+		// Sweep, see sweepCircleCircle().
+		const dtFloat4 a = dtAdd4(dtMul4(vabx,vabx), dtMul4(vabz,vabz));
+		const dtFloat4 b = dtAdd4(dtMul4(vabx, dtSet4(lanes[DT_CIRCLE_SX*m_maxCircles])), dtMul4(vabz, dtSet4(lanes[DT_CIRCLE_SZ*m_maxCircles])));
+		const dtFloat4 d = dtSub4(dtMul4(b,b), dtMul4(a, dtSet4(lanes[DT_CIRCLE_C*m_maxCircles])));
+		const dtMask4 hit = dtAnd4(dtGreaterEqual4(a, dtSet4(0.0001f)), dtGreaterEqual4(d, zero));
+		const dtFloat4 inva = dtDiv4(one, a);
+		const dtFloat4 rd = dtSqrt4(dtMax4(d, zero));
+		dtFloat4 htmin = dtMul4(dtSub4(b, rd), inva);
+		const dtFloat4 htmax = dtMul4(dtAdd4(b, rd), inva);
+
+		// Handle overlapping obstacles, avoid more when overlapped.
+		const dtMask4 overlap = dtAnd4(dtLess4(htmin, zero), dtGreater4(htmax, zero));
+		htmin = dtSelect4(overlap, dtMul4(dtSub4(zero, htmin), half), htmin);
+
+		// The closest obstacle is somewhere ahead of us, keep track of nearest obstacle.
+		const dtMask4 closer = dtAnd4(hit, dtAnd4(dtGreaterEqual4(htmin, zero), dtLess4(htmin, tmin)));
+		tmin = dtSelect4(closer, htmin, tmin);
+		bail = dtOr4(bail, dtAnd4(closer, dtLess4(tmin, tThreshold)));
+		if (dtAll4(bail))
+		{
+			rejectSamples(penalties, count);
+			return;
+		}
+	}
+
+	for (int i = 0; i < m_nsegments; ++i)
+	{
+		const float* lanes = m_segmentLanes + i;
+		const float dx = lanes[DT_SEGMENT_DX*m_maxSegments];
+		const float dz = lanes[DT_SEGMENT_DZ*m_maxSegments];
+		dtMask4 hit;
+		dtFloat4 htmin;
+
+		if (lanes[DT_SEGMENT_TOUCH*m_maxSegments] != 0.0f)
+		{
+			// Special case when the agent is very close to the segment.
+			// If the velocity is pointing towards the segment, no collision, else immediate collision.
+			hit = dtGreaterEqual4(dtAdd4(dtMul4(dtSet4(-dz), vx), dtMul4(dtSet4(dx), vz)), zero);
+			htmin = zero;
+		}
+		else
+		{
+			// See isectRaySeg().
+			const dtFloat4 d = dtSub4(dtMul4(vz, dtSet4(dx)), dtMul4(vx, dtSet4(dz)));
+			const dtFloat4 invd = dtDiv4(one, d);
+			const dtFloat4 t = dtMul4(dtSet4(lanes[DT_SEGMENT_PERP*m_maxSegments]), invd);
+			const dtFloat4 s = dtMul4(dtSub4(dtMul4(vz, dtSet4(lanes[DT_SEGMENT_WX*m_maxSegments])),
+											 dtMul4(vx, dtSet4(lanes[DT_SEGMENT_WZ*m_maxSegments]))), invd);
+			hit = dtAnd4(dtGreaterEqual4(dtAbs4(d), dtSet4(1e-6f)),
+						 dtAnd4(dtAnd4(dtGreaterEqual4(t, zero), dtLessEqual4(t, one)),
+								dtAnd4(dtGreaterEqual4(s, zero), dtLessEqual4(s, one))));
+			htmin = t;
+		}
+
+		// Avoid less when facing walls.
+		htmin = dtMul4(htmin, two);
+
+		// The closest obstacle is somewhere ahead of us, keep track of nearest obstacle.
+		const dtMask4 closer = dtAnd4(hit, dtLess4(htmin, tmin));
+		tmin = dtSelect4(closer, htmin, tmin);
+		bail = dtOr4(bail, dtAnd4(closer, dtLess4(tmin, tThreshold)));
+		if (dtAll4(bail))
+		{
+			rejectSamples(penalties, count);
+			return;
+		}
+	}
+
+	// Normalize side bias, to prevent it dominating too much.
+	if (m_ncircles)
+		side = dtDiv4(side, dtSet4((float)m_ncircles));
+
+	const dtFloat4 spen = dtMul4(dtSet4(m_params.weightSide), side);
+	const dtFloat4 tpen = dtMul4(dtSet4(m_params.weightToi), dtDiv4(one, dtAdd4(dtSet4(0.1f), dtMul4(tmin, dtSet4(m_invHorizTime)))));
+
+	const dtFloat4 penalty = dtAdd4(dtAdd4(dtAdd4(vpen, vcpen), spen), tpen);
+
+	float out[DT_SAMPLE_BATCH];
+	dtStore4(out, dtSelect4(bail, dtSet4(FLT_MAX), penalty));
+	for (int i = 0; i < count; ++i)
+		penalties[i] = out[i];
+}
+
+#endif // DT_OBSTACLE_AVOIDANCE_SIMD
+
 int dtObstacleAvoidanceQuery::sampleVelocityGrid(const float* pos, const float rad, const float vmax,
 												 const float* vel, const float* dvel, float* nvel,
 												 const dtObstacleAvoidanceParams* params,
 												 dtObstacleAvoidanceDebugData* debug)
 {
-	prepare(pos, dvel);
-	
+	prepare(pos, rad, dvel);
+	return samplePreparedGrid(pos, rad, vmax, vel, dvel, nvel, params, debug);
+}
+
+int dtObstacleAvoidanceQuery::samplePreparedGrid(const float* pos, const float rad, const float vmax,
+												 const float* vel, const float* dvel, float* nvel,
+												 const dtObstacleAvoidanceParams* params,
+												 dtObstacleAvoidanceDebugData* debug)
+{
 	memcpy(&m_params, params, sizeof(dtObstacleAvoidanceParams));
 	m_invHorizTime = 1.0f / m_params.horizTime;
 	m_vmax = vmax;
@@ -456,6 +863,8 @@ int dtObstacleAvoidanceQuery::sampleVelocityGrid(const float* pos, const float r
 		
 	float minPenalty = FLT_MAX;
 	int ns = 0;
+	float candx[DT_SAMPLE_BATCH], candz[DT_SAMPLE_BATCH];
+	int ncand = 0;
 		
 	for (int y = 0; y < m_params.gridSize; ++y)
 	{
@@ -468,15 +877,19 @@ int dtObstacleAvoidanceQuery::sampleVelocityGrid(const float* pos, const float r
 			
 			if (dtSqr(vcand[0])+dtSqr(vcand[2]) > dtSqr(vmax+cs/2)) continue;
 			
-			const float penalty = processSample(vcand, cs, pos,rad,vel,dvel, minPenalty, debug);
+			candx[ncand] = vcand[0];
+			candz[ncand] = vcand[2];
+			ncand++;
 			ns++;
-			if (penalty < minPenalty)
+			if (ncand == DT_SAMPLE_BATCH)
 			{
-				minPenalty = penalty;
-				dtVcopy(nvel, vcand);
+				processSamples(candx, candz, ncand, cs, pos,rad,vel,dvel, minPenalty, nvel, debug);
+				ncand = 0;
 			}
 		}
 	}
+	if (ncand)
+		processSamples(candx, candz, ncand, cs, pos,rad,vel,dvel, minPenalty, nvel, debug);
 	
 	return ns;
 }
@@ -509,8 +922,15 @@ int dtObstacleAvoidanceQuery::sampleVelocityAdaptive(const float* pos, const flo
 													 const dtObstacleAvoidanceParams* params,
 													 dtObstacleAvoidanceDebugData* debug)
 {
-	prepare(pos, dvel);
-	
+	prepare(pos, rad, dvel);
+	return samplePreparedAdaptive(pos, rad, vmax, vel, dvel, nvel, params, debug);
+}
+
+int dtObstacleAvoidanceQuery::samplePreparedAdaptive(const float* pos, const float rad, const float vmax,
+													 const float* vel, const float* dvel, float* nvel,
+													 const dtObstacleAvoidanceParams* params,
+													 dtObstacleAvoidanceDebugData* debug)
+{
 	memcpy(&m_params, params, sizeof(dtObstacleAvoidanceParams));
 	m_invHorizTime = 1.0f / m_params.horizTime;
 	m_vmax = vmax;
@@ -589,6 +1009,8 @@ int dtObstacleAvoidanceQuery::sampleVelocityAdaptive(const float* pos, const flo
 		float minPenalty = FLT_MAX;
 		float bvel[3];
 		dtVset(bvel, 0,0,0);
+		float candx[DT_SAMPLE_BATCH], candz[DT_SAMPLE_BATCH];
+		int ncand = 0;
 		
 		for (int i = 0; i < npat; ++i)
 		{
@@ -599,14 +1021,18 @@ int dtObstacleAvoidanceQuery::sampleVelocityAdaptive(const float* pos, const flo
 			
 			if (dtSqr(vcand[0])+dtSqr(vcand[2]) > dtSqr(vmax+0.001f)) continue;
 			
-			const float penalty = processSample(vcand,cr/10, pos,rad,vel,dvel, minPenalty, debug);
+			candx[ncand] = vcand[0];
+			candz[ncand] = vcand[2];
+			ncand++;
 			ns++;
-			if (penalty < minPenalty)
+			if (ncand == DT_SAMPLE_BATCH)
 			{
-				minPenalty = penalty;
-				dtVcopy(bvel, vcand);
+				processSamples(candx, candz, ncand, cr/10, pos,rad,vel,dvel, minPenalty, bvel, debug);
+				ncand = 0;
 			}
 		}
+		if (ncand)
+			processSamples(candx, candz, ncand, cr/10, pos,rad,vel,dvel, minPenalty, bvel, debug);
 
 		dtVcopy(res, bvel);
 
@@ -617,3 +1043,155 @@ int dtObstacleAvoidanceQuery::sampleVelocityAdaptive(const float* pos, const flo
 	
 	return ns;
 }
+
+int dtObstacleAvoidanceQuery::sampleVelocityGridRange(const dtObstacleAvoidanceBatch* batch, const int begin, const int end)
+{
+	int ns = 0;
+	for (int i = begin; i < end; ++i)
+	{
+		const dtObstacleAvoidanceBatch::Agent* ag = &batch->m_agents[i];
+		if (!ag->active)
+			continue;
+		prepareBatch(batch, i);
+		ns += samplePreparedGrid(ag->pos, ag->rad, ag->vmax, ag->vel, ag->dvel, ag->nvel, ag->params, ag->debug);
+	}
+	return ns;
+}
+
+int dtObstacleAvoidanceQuery::sampleVelocityAdaptiveRange(const dtObstacleAvoidanceBatch* batch, const int begin, const int end)
+{
+	int ns = 0;
+	for (int i = begin; i < end; ++i)
+	{
+		const dtObstacleAvoidanceBatch::Agent* ag = &batch->m_agents[i];
+		if (!ag->active)
+			continue;
+		prepareBatch(batch, i);
+		ns += samplePreparedAdaptive(ag->pos, ag->rad, ag->vmax, ag->vel, ag->dvel, ag->nvel, ag->params, ag->debug);
+	}
+	return ns;
+}
+
+dtObstacleAvoidanceBatch* dtAllocObstacleAvoidanceBatch()
+{
+	void* mem = dtAlloc(sizeof(dtObstacleAvoidanceBatch), DT_ALLOC_PERM);
+	if (!mem) return 0;
+	return new(mem) dtObstacleAvoidanceBatch;
+}
+
+void dtFreeObstacleAvoidanceBatch(dtObstacleAvoidanceBatch* ptr)
+{
+	if (!ptr) return;
+	ptr->~dtObstacleAvoidanceBatch();
+	dtFree(ptr);
+}
+
+
+dtObstacleAvoidanceBatch::dtObstacleAvoidanceBatch() :
+	m_maxAgents(0),
+	m_agents(0),
+	m_agentCircles(0),
+	m_maxAgentCircles(0),
+	m_nagents(0),
+	m_maxCircles(0),
+	m_circles(0),
+	m_dt(0)
+{
+}
+
+dtObstacleAvoidanceBatch::~dtObstacleAvoidanceBatch()
+{
+	dtFree(m_agents);
+	dtFree(m_agentCircles);
+	dtFree(m_circles);
+}
+
+bool dtObstacleAvoidanceBatch::init(const int maxAgents, const int maxCircles, const int maxAgentCircles)
+{
+	m_maxAgents = maxAgents;
+	m_nagents = 0;
+	m_agents = (Agent*)dtAlloc(sizeof(Agent)*m_maxAgents, DT_ALLOC_PERM);
+	if (!m_agents)
+		return false;
+	memset(m_agents, 0, sizeof(Agent)*m_maxAgents);
+	
+	m_maxAgentCircles = maxAgentCircles;
+	m_agentCircles = (int*)dtAlloc(sizeof(int)*m_maxAgents*m_maxAgentCircles, DT_ALLOC_PERM);
+	if (!m_agentCircles)
+		return false;
+	
+	m_maxCircles = maxCircles;
+	m_circles = (dtObstacleCircle*)dtAlloc(sizeof(dtObstacleCircle)*m_maxCircles, DT_ALLOC_PERM);
+	if (!m_circles)
+		return false;
+	memset(m_circles, 0, sizeof(dtObstacleCircle)*m_maxCircles);
+	
+	return true;
+}
+
+void dtObstacleAvoidanceBatch::reset(const int nagents)
+{
+	dtAssert(nagents <= m_maxAgents);
+	m_nagents = dtMin(nagents, m_maxAgents);
+	for (int i = 0; i < m_nagents; ++i)
+		m_agents[i].active = false;
+}
+
+void dtObstacleAvoidanceBatch::setCircle(const int idx, const float* pos, const float rad,
+										 const float* vel, const float* dvel)
+{
+	if (idx < 0 || idx >= m_maxCircles)
+		return;
+	
+	dtObstacleCircle* cir = &m_circles[idx];
+	dtVcopy(cir->p, pos);
+	cir->rad = rad;
+	dtVcopy(cir->vel, vel);
+	dtVcopy(cir->dvel, dvel);
+}
+
+void dtObstacleAvoidanceBatch::setAgent(const int idx, const float* pos, const float rad, const float vmax,
+										const float* vel, const float* dvel, float* nvel,
+										const dtObstacleAvoidanceParams* params,
+										dtObstacleAvoidanceDebugData* debug)
+{
+	if (idx < 0 || idx >= m_nagents)
+		return;
+	
+	Agent* ag = &m_agents[idx];
+	dtVcopy(ag->pos, pos);
+	ag->rad = rad;
+	ag->vmax = vmax;
+	dtVcopy(ag->vel, vel);
+	dtVcopy(ag->dvel, dvel);
+	ag->nvel = nvel;
+	ag->params = params;
+	ag->debug = debug;
+	ag->ncircles = 0;
+	ag->segs = 0;
+	ag->nsegs = 0;
+	ag->segStride = 0;
+	ag->active = true;
+}
+
+void dtObstacleAvoidanceBatch::addAgentCircle(const int idx, const int circle)
+{
+	if (idx < 0 || idx >= m_nagents || circle < 0 || circle >= m_maxCircles)
+		return;
+	
+	Agent* ag = &m_agents[idx];
+	if (ag->ncircles >= m_maxAgentCircles)
+		return;
+	m_agentCircles[idx*m_maxAgentCircles + ag->ncircles++] = circle;
+}
+
+void dtObstacleAvoidanceBatch::setAgentSegments(const int idx, const float* segs, const int nsegs, const int stride)
+{
+	if (idx < 0 || idx >= m_nagents)
+		return;
+	
+	Agent* ag = &m_agents[idx];
+	ag->segs = segs;
+	ag->nsegs = nsegs;
+	ag->segStride = stride;
+}
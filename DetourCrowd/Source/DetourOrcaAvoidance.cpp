@@ -0,0 +1,478 @@
+//
+// Copyright (c) 2009-2010 Mikko Mononen memon@inside.org
+//
+// This software is provided 'as-is', without any express or implied
+// warranty.  In no event will the authors be held liable for any damages
+// arising from the use of this software.
+// Permission is granted to anyone to use this software for any purpose,
+// including commercial applications, and to alter it and redistribute it
+// freely, subject to the following restrictions:
+// 1. The origin of this software must not be misrepresented; you must not
+//    claim that you wrote the original software. If you use this software
+//    in a product, an acknowledgment in the product documentation would be
+//    appreciated but is not required.
+// 2. Altered source versions must be plainly marked as such, and must not be
+//    misrepresented as being the original software.
+// 3. This notice may not be removed or altered from any source distribution.
+//
+
+
+#include "DetourOrcaAvoidance.h"
+#include "DetourCommon.h"
+#include "DetourMath.h"
+#include <string.h>
+#include <float.h>
+
+// Half-planes are solved in the xz-plane, a 2D vector here is (x, z).
+
+static const int DT_ORCA_MAX_LINES = 64;	///< Obstacles past this are ignored, nearest come first.
+static const float DT_ORCA_EPS = 0.00001f;
+
+/// Allowed velocities are on the left of the directed line.
+struct dtOrcaLine
+{
+	float point[2];
+	float dir[2];
+};
+
+inline float dtOrcaDet(const float* a, const float* b) { return a[0]*b[1] - a[1]*b[0]; }
+inline float dtOrcaDot(const float* a, const float* b) { return a[0]*b[0] + a[1]*b[1]; }
+
+inline bool dtOrcaNormalize(float* v)
+{
+	const float d = dtMathSqrtf(dtOrcaDot(v, v));
+	if (d < DT_ORCA_EPS)
+		return false;
+	v[0] /= d;
+	v[1] /= d;
+	return true;
+}
+
+// Optimizes along line lineNo, subject to the lines before it and the max speed circle.
+static bool linearProgram1(const dtOrcaLine* lines, const int lineNo, const float radius,
+						   const float* optVel, const bool directionOpt, float* result)
+{
+	const dtOrcaLine* line = &lines[lineNo];
+	const float dot = dtOrcaDot(line->point, line->dir);
+	const float discriminant = dtSqr(dot) + dtSqr(radius) - dtOrcaDot(line->point, line->point);
+	
+	// Max speed circle fully invalidates the line.
+	if (discriminant < 0.0f)
+		return false;
+	
+	const float sqrtDiscriminant = dtMathSqrtf(discriminant);
+	float tLeft = -dot - sqrtDiscriminant;
+	float tRight = -dot + sqrtDiscriminant;
+	
+	for (int i = 0; i < lineNo; ++i)
+	{
+		const float diff[2] = { line->point[0] - lines[i].point[0], line->point[1] - lines[i].point[1] };
+		const float denominator = dtOrcaDet(line->dir, lines[i].dir);
+		const float numerator = dtOrcaDet(lines[i].dir, diff);
+		
+		if (dtMathFabsf(denominator) <= DT_ORCA_EPS)
+		{
+			// Parallel lines, either line i excludes all of this one or none of it.
+			if (numerator < 0.0f)
+				return false;
+			continue;
+		}
+		
+		const float t = numerator / denominator;
+		if (denominator >= 0.0f)
+			tRight = dtMin(tRight, t);
+		else
+			tLeft = dtMax(tLeft, t);
+		
+		if (tLeft > tRight)
+			return false;
+	}
+	
+	float t;
+	if (directionOpt)
+	{
+		// Go as far as possible in the optimization direction.
+		t = dtOrcaDot(optVel, line->dir) > 0.0f ? tRight : tLeft;
+	}
+	else
+	{
+		// Closest point to the optimization velocity.
+		const float diff[2] = { optVel[0] - line->point[0], optVel[1] - line->point[1] };
+		t = dtClamp(dtOrcaDot(line->dir, diff), tLeft, tRight);
+	}
+	result[0] = line->point[0] + t*line->dir[0];
+	result[1] = line->point[1] + t*line->dir[1];
+	return true;
+}
+
+// Returns nlines on success, otherwise the line which could not be satisfied.
+static int linearProgram2(const dtOrcaLine* lines, const int nlines, const float radius,
+						  const float* optVel, const bool directionOpt, float* result)
+{
+	if (directionOpt)
+	{
+		// optVel is a unit direction.
+		result[0] = optVel[0]*radius;
+		result[1] = optVel[1]*radius;
+	}
+	else if (dtOrcaDot(optVel, optVel) > dtSqr(radius))
+	{
+		const float d = radius / dtMathSqrtf(dtOrcaDot(optVel, optVel));
+		result[0] = optVel[0]*d;
+		result[1] = optVel[1]*d;
+	}
+	else
+	{
+		result[0] = optVel[0];
+		result[1] = optVel[1];
+	}
+	
+	for (int i = 0; i < nlines; ++i)
+	{
+		const float diff[2] = { lines[i].point[0] - result[0], lines[i].point[1] - result[1] };
+		if (dtOrcaDet(lines[i].dir, diff) > 0.0f)
+		{
+			// The result is on the wrong side of line i, move it onto the line.
+			const float prev[2] = { result[0], result[1] };
+			if (!linearProgram1(lines, i, radius, optVel, directionOpt, result))
+			{
+				result[0] = prev[0];
+				result[1] = prev[1];
+				return i;
+			}
+		}
+	}
+	
+	return nlines;
+}
+
+// Infeasible case: keeps the first nobst lines and minimizes the largest violation of the others.
+static void linearProgram3(const dtOrcaLine* lines, const int nlines, const int nobst,
+						   const int beginLine, const float radius, float* result)
+{
+	dtOrcaLine projLines[DT_ORCA_MAX_LINES];
+	float distance = 0.0f;
+	
+	for (int i = beginLine; i < nlines; ++i)
+	{
+		const float diff[2] = { lines[i].point[0] - result[0], lines[i].point[1] - result[1] };
+		if (dtOrcaDet(lines[i].dir, diff) <= distance)
+			continue;
+		
+		// The result violates line i more than the current distance.
+		memcpy(projLines, lines, sizeof(dtOrcaLine)*nobst);
+		int nproj = nobst;
+		
+		for (int j = nobst; j < i; ++j)
+		{
+			dtOrcaLine* line = &projLines[nproj];
+			const float determinant = dtOrcaDet(lines[i].dir, lines[j].dir);
+			
+			if (dtMathFabsf(determinant) <= DT_ORCA_EPS)
+			{
+				// Parallel lines pointing the same way do not constrain the distance.
+				if (dtOrcaDot(lines[i].dir, lines[j].dir) > 0.0f)
+					continue;
+				line->point[0] = 0.5f*(lines[i].point[0] + lines[j].point[0]);
+				line->point[1] = 0.5f*(lines[i].point[1] + lines[j].point[1]);
+			}
+			else
+			{
+				const float dij[2] = { lines[i].point[0] - lines[j].point[0], lines[i].point[1] - lines[j].point[1] };
+				const float t = dtOrcaDet(lines[j].dir, dij) / determinant;
+				line->point[0] = lines[i].point[0] + t*lines[i].dir[0];
+				line->point[1] = lines[i].point[1] + t*lines[i].dir[1];
+			}
+			
+			line->dir[0] = lines[j].dir[0] - lines[i].dir[0];
+			line->dir[1] = lines[j].dir[1] - lines[i].dir[1];
+			if (!dtOrcaNormalize(line->dir))
+				continue;
+			nproj++;
+		}
+		
+		const float prev[2] = { result[0], result[1] };
+		const float optDir[2] = { -lines[i].dir[1], lines[i].dir[0] };
+		if (linearProgram2(projLines, nproj, radius, optDir, true, result) < nproj)
+		{
+			// Can only fail because of rounding, the result was already optimal then.
+			result[0] = prev[0];
+			result[1] = prev[1];
+		}
+		
+		const float d[2] = { lines[i].point[0] - result[0], lines[i].point[1] - result[1] };
+		distance = dtOrcaDet(lines[i].dir, d);
+	}
+}
+
+// Left and right tangent directions from the agent to a circle of radius rad at rel.
+inline void dtOrcaLegs(const float* rel, const float distSq, const float rad, float* left, float* right)
+{
+	const float leg = dtMathSqrtf(dtMax(0.0f, distSq - dtSqr(rad)));
+	left[0] = (rel[0]*leg - rel[1]*rad) / distSq;
+	left[1] = (rel[0]*rad + rel[1]*leg) / distSq;
+	right[0] = (rel[0]*leg + rel[1]*rad) / distSq;
+	right[1] = (-rel[0]*rad + rel[1]*leg) / distSq;
+}
+
+// Half-plane of the velocities which do not hit segment p1-p2 within the time horizon.
+// The agent is on the right of p1-p2. Returns false when the segment adds no constraint.
+static bool segmentLine(const float* pos, const float rad, const float* vel,
+						const float* p1, const float* p2, const float invTimeHorizon,
+						const dtOrcaLine* lines, const int nlines, dtOrcaLine* line)
+{
+	const float relPos1[2] = { p1[0] - pos[0], p1[1] - pos[1] };
+	const float relPos2[2] = { p2[0] - pos[0], p2[1] - pos[1] };
+	
+	// Skip when an earlier segment already covers this one.
+	for (int i = 0; i < nlines; ++i)
+	{
+		const float a[2] = { invTimeHorizon*relPos1[0] - lines[i].point[0], invTimeHorizon*relPos1[1] - lines[i].point[1] };
+		const float b[2] = { invTimeHorizon*relPos2[0] - lines[i].point[0], invTimeHorizon*relPos2[1] - lines[i].point[1] };
+		if (dtOrcaDet(a, lines[i].dir) - invTimeHorizon*rad >= -DT_ORCA_EPS &&
+			dtOrcaDet(b, lines[i].dir) - invTimeHorizon*rad >= -DT_ORCA_EPS)
+			return false;
+	}
+	
+	const float seg[2] = { p2[0] - p1[0], p2[1] - p1[1] };
+	const float segLenSq = dtOrcaDot(seg, seg);
+	if (segLenSq < DT_ORCA_EPS)
+		return false;
+	const float segLen = dtMathSqrtf(segLenSq);
+	const float unitDir[2] = { seg[0] / segLen, seg[1] / segLen };
+	
+	const float distSq1 = dtOrcaDot(relPos1, relPos1);
+	const float distSq2 = dtOrcaDot(relPos2, relPos2);
+	const float radSq = dtSqr(rad);
+	const float s = -dtOrcaDot(relPos1, seg) / segLenSq;
+	const float closest[2] = { -relPos1[0] - s*seg[0], -relPos1[1] - s*seg[1] };
+	const float distSqLine = dtOrcaDot(closest, closest);
+	
+	// Already touching, only forbid moving further in.
+	if ((s < 0.0f && distSq1 <= radSq) || (s > 1.0f && distSq2 <= radSq))
+	{
+		const float* rel = s < 0.0f ? relPos1 : relPos2;
+		line->point[0] = line->point[1] = 0.0f;
+		line->dir[0] = -rel[1];
+		line->dir[1] = rel[0];
+		return dtOrcaNormalize(line->dir);
+	}
+	if (s >= 0.0f && s < 1.0f && distSqLine <= radSq)
+	{
+		line->point[0] = line->point[1] = 0.0f;
+		line->dir[0] = -unitDir[0];
+		line->dir[1] = -unitDir[1];
+		return true;
+	}
+	
+	// The legs of the velocity obstacle. Seen end on, both come from the nearer end point.
+	const float* leftPoint = p1;
+	const float* rightPoint = p2;
+	float leftLeg[2], rightLeg[2], unused[2];
+	if (s < 0.0f && distSqLine <= radSq)
+	{
+		rightPoint = p1;
+		dtOrcaLegs(relPos1, distSq1, rad, leftLeg, rightLeg);
+	}
+	else if (s > 1.0f && distSqLine <= radSq)
+	{
+		leftPoint = p2;
+		dtOrcaLegs(relPos2, distSq2, rad, leftLeg, rightLeg);
+	}
+	else
+	{
+		dtOrcaLegs(relPos1, distSq1, rad, leftLeg, unused);
+		dtOrcaLegs(relPos2, distSq2, rad, unused, rightLeg);
+	}
+	const bool samePoint = leftPoint == rightPoint;
+	
+	// Cut off at the time horizon.
+	const float leftCutoff[2] = { invTimeHorizon*(leftPoint[0] - pos[0]), invTimeHorizon*(leftPoint[1] - pos[1]) };
+	const float rightCutoff[2] = { invTimeHorizon*(rightPoint[0] - pos[0]), invTimeHorizon*(rightPoint[1] - pos[1]) };
+	const float cutoff[2] = { rightCutoff[0] - leftCutoff[0], rightCutoff[1] - leftCutoff[1] };
+	const float velLeft[2] = { vel[0] - leftCutoff[0], vel[1] - leftCutoff[1] };
+	const float velRight[2] = { vel[0] - rightCutoff[0], vel[1] - rightCutoff[1] };
+	
+	const float t = samePoint ? 0.5f : dtOrcaDot(velLeft, cutoff) / dtOrcaDot(cutoff, cutoff);
+	const float tLeft = dtOrcaDot(velLeft, leftLeg);
+	const float tRight = dtOrcaDot(velRight, rightLeg);
+	
+	// Project on the cutoff circle of an end point.
+	if ((t < 0.0f && tLeft < 0.0f) || (samePoint && tLeft < 0.0f && tRight < 0.0f) || (t > 1.0f && tRight < 0.0f))
+	{
+		const bool left = (t < 0.0f && tLeft < 0.0f) || samePoint;
+		const float* c = left ? leftCutoff : rightCutoff;
+		float w[2] = { vel[0] - c[0], vel[1] - c[1] };
+		if (!dtOrcaNormalize(w))
+			return false;
+		line->dir[0] = w[1];
+		line->dir[1] = -w[0];
+		line->point[0] = c[0] + rad*invTimeHorizon*w[0];
+		line->point[1] = c[1] + rad*invTimeHorizon*w[1];
+		return true;
+	}
+	
+	// Project on the cutoff line or the nearest leg.
+	float distSqCutoff = FLT_MAX;
+	float distSqLeft = FLT_MAX;
+	float distSqRight = FLT_MAX;
+	if (t >= 0.0f && t <= 1.0f && !samePoint)
+	{
+		const float d[2] = { velLeft[0] - t*cutoff[0], velLeft[1] - t*cutoff[1] };
+		distSqCutoff = dtOrcaDot(d, d);
+	}
+	if (tLeft >= 0.0f)
+	{
+		const float d[2] = { velLeft[0] - tLeft*leftLeg[0], velLeft[1] - tLeft*leftLeg[1] };
+		distSqLeft = dtOrcaDot(d, d);
+	}
+	if (tRight >= 0.0f)
+	{
+		const float d[2] = { velRight[0] - tRight*rightLeg[0], velRight[1] - tRight*rightLeg[1] };
+		distSqRight = dtOrcaDot(d, d);
+	}
+	
+	const float* c;
+	if (distSqCutoff <= distSqLeft && distSqCutoff <= distSqRight)
+	{
+		line->dir[0] = -unitDir[0];
+		line->dir[1] = -unitDir[1];
+		c = leftCutoff;
+	}
+	else if (distSqLeft <= distSqRight)
+	{
+		line->dir[0] = leftLeg[0];
+		line->dir[1] = leftLeg[1];
+		c = leftCutoff;
+	}
+	else
+	{
+		line->dir[0] = -rightLeg[0];
+		line->dir[1] = -rightLeg[1];
+		c = rightCutoff;
+	}
+	line->point[0] = c[0] + rad*invTimeHorizon*-line->dir[1];
+	line->point[1] = c[1] + rad*invTimeHorizon*line->dir[0];
+	return true;
+}
+
+// Half-plane of the velocities which do not hit the circle within the time horizon,
+// taking half of the avoidance effort on the assumption that the other agent takes the rest.
+static bool circleLine(const float* pos, const float rad, const float* vel,
+					   const float* cpos, const float crad, const float* cvel,
+					   const float invTimeHorizon, const float invTimeStep, dtOrcaLine* line)
+{
+	const float relPos[2] = { cpos[0] - pos[0], cpos[1] - pos[1] };
+	const float relVel[2] = { vel[0] - cvel[0], vel[1] - cvel[1] };
+	const float distSq = dtOrcaDot(relPos, relPos);
+	const float combinedRadius = rad + crad;
+	const float combinedRadiusSq = dtSqr(combinedRadius);
+	float u[2];
+	
+	if (distSq > combinedRadiusSq)
+	{
+		// Vector from the cutoff center to the relative velocity.
+		const float w[2] = { relVel[0] - invTimeHorizon*relPos[0], relVel[1] - invTimeHorizon*relPos[1] };
+		const float wLengthSq = dtOrcaDot(w, w);
+		const float dot1 = dtOrcaDot(w, relPos);
+		
+		if (dot1 < 0.0f && dtSqr(dot1) > combinedRadiusSq*wLengthSq)
+		{
+			// Project on the cutoff circle.
+			const float wLength = dtMathSqrtf(wLengthSq);
+			const float unitW[2] = { w[0] / wLength, w[1] / wLength };
+			line->dir[0] = unitW[1];
+			line->dir[1] = -unitW[0];
+			u[0] = (combinedRadius*invTimeHorizon - wLength)*unitW[0];
+			u[1] = (combinedRadius*invTimeHorizon - wLength)*unitW[1];
+		}
+		else
+		{
+			// Project on the nearest leg.
+			float left[2], right[2];
+			dtOrcaLegs(relPos, distSq, combinedRadius, left, right);
+			if (dtOrcaDet(relPos, w) > 0.0f)
+			{
+				line->dir[0] = left[0];
+				line->dir[1] = left[1];
+			}
+			else
+			{
+				line->dir[0] = -right[0];
+				line->dir[1] = -right[1];
+			}
+			const float dot2 = dtOrcaDot(relVel, line->dir);
+			u[0] = dot2*line->dir[0] - relVel[0];
+			u[1] = dot2*line->dir[1] - relVel[1];
+		}
+	}
+	else
+	{
+		// Overlapping, get apart within the time step.
+		float w[2] = { relVel[0] - invTimeStep*relPos[0], relVel[1] - invTimeStep*relPos[1] };
+		const float wLength = dtMathSqrtf(dtOrcaDot(w, w));
+		if (!dtOrcaNormalize(w))
+			return false;
+		line->dir[0] = w[1];
+		line->dir[1] = -w[0];
+		u[0] = (combinedRadius*invTimeStep - wLength)*w[0];
+		u[1] = (combinedRadius*invTimeStep - wLength)*w[1];
+	}
+	
+	line->point[0] = vel[0] + 0.5f*u[0];
+	line->point[1] = vel[1] + 0.5f*u[1];
+	return true;
+}
+
+int dtOrcaAvoidance::solve(const dtObstacleAvoidanceBatch* batch, const int idx)
+{
+	const float* pos3 = batch->getAgentPosition(idx);
+	const float* vel3 = batch->getAgentVelocity(idx);
+	const float* dvel3 = batch->getAgentDesiredVelocity(idx);
+	const float rad = batch->getAgentRadius(idx);
+	const float vmax = batch->getAgentMaxSpeed(idx);
+	const dtObstacleAvoidanceParams* params = batch->getAgentParams(idx);
+	
+	const float invTimeHorizon = 1.0f / params->horizTime;
+	const float dt = batch->getTimeStep();
+	const float invTimeStep = dt > 0.0f ? 1.0f / dt : invTimeHorizon;
+	
+	const float pos[2] = { pos3[0], pos3[2] };
+	const float vel[2] = { vel3[0], vel3[2] };
+	const float dvel[2] = { dvel3[0], dvel3[2] };
+	
+	dtOrcaLine lines[DT_ORCA_MAX_LINES];
+	int nlines = 0;
+	
+	// Segments first, they stay hard constraints when the circles can not all be met.
+	for (int i = 0; i < batch->getAgentSegmentCount(idx) && nlines < DT_ORCA_MAX_LINES; ++i)
+	{
+		const float* s = batch->getAgentSegment(idx, i);
+		// Skip the segments the agent is behind of.
+		if (dtTriArea2D(pos3, s, s+3) < 0.0f)
+			continue;
+		const float p1[2] = { s[0], s[2] };
+		const float p2[2] = { s[3], s[5] };
+		if (segmentLine(pos, rad, vel, p1, p2, invTimeHorizon, lines, nlines, &lines[nlines]))
+			nlines++;
+	}
+	const int nobst = nlines;
+	
+	for (int i = 0; i < batch->getAgentCircleCount(idx) && nlines < DT_ORCA_MAX_LINES; ++i)
+	{
+		const dtObstacleCircle* cir = batch->getAgentCircle(idx, i);
+		const float cpos[2] = { cir->p[0], cir->p[2] };
+		const float cvel[2] = { cir->vel[0], cir->vel[2] };
+		if (circleLine(pos, rad, vel, cpos, cir->rad, cvel, invTimeHorizon, invTimeStep, &lines[nlines]))
+			nlines++;
+	}
+	
+	float result[2];
+	const int fail = linearProgram2(lines, nlines, vmax, dvel, false, result);
+	if (fail < nlines)
+		linearProgram3(lines, nlines, nobst, fail, vmax, result);
+	
+	dtVset(batch->getAgentResult(idx), result[0], 0.0f, result[1]);
+	
+	return nlines;
+}
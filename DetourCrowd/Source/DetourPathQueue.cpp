@@ -24,14 +24,23 @@
 #include "DetourCommon.h"
 
 
+static const int PATHQ_SLOT_BITS = 16;
+static const int PATHQ_INITIAL_QUEUE = 8;
+static const int PATHQ_DEFAULT_MAX_WAIT = 16; // in update ticks.
+
 dtPathQueue::dtPathQueue() :
+	m_queue(0),
+	m_queueSize(0),
+	m_maxQueue(0),
+	m_activeCount(0),
+	m_current(-1),
 	m_nextHandle(1),
+	m_nextOrder(0),
+	m_tick(0),
+	m_maxWait(PATHQ_DEFAULT_MAX_WAIT),
 	m_maxPathSize(0),
-	m_queueHead(0),
 	m_navquery(0)
 {
-	for (int i = 0; i < MAX_QUEUE; ++i)
-		m_queue[i].path = 0;
 }
 
 dtPathQueue::~dtPathQueue()
@@ -43,14 +52,16 @@ void dtPathQueue::purge()
 {
 	dtFreeNavMeshQuery(m_navquery);
 	m_navquery = 0;
-	for (int i = 0; i < MAX_QUEUE; ++i)
-	{
+	for (int i = 0; i < m_queueSize; ++i)
 		dtFree(m_queue[i].path);
-		m_queue[i].path = 0;
-	}
+	dtFree(m_queue);
+	m_queue = 0;
+	m_queueSize = 0;
+	m_activeCount = 0;
+	m_current = -1;
 }
 
-bool dtPathQueue::init(const int maxPathSize, const int maxSearchNodeCount, dtNavMesh* nav)
+bool dtPathQueue::init(const int maxPathSize, const int maxSearchNodeCount, dtNavMesh* nav, const int maxQueue)
 {
 	purge();
 
@@ -61,58 +72,127 @@ bool dtPathQueue::init(const int maxPathSize, const int maxSearchNodeCount, dtNa
 		return false;
 	
 	m_maxPathSize = maxPathSize;
-	for (int i = 0; i < MAX_QUEUE; ++i)
+	m_maxQueue = dtClamp(maxQueue, 0, DT_PATHQ_MAX_QUEUE);
+	m_tick = 0;
+	
+	return grow();
+}
+
+/// @par
+///
+/// Doubles the slot array. The path buffers of new slots are allocated on first use.
+bool dtPathQueue::grow()
+{
+	const int limit = m_maxQueue > 0 ? m_maxQueue : DT_PATHQ_MAX_QUEUE;
+	const int size = dtMin(m_queueSize > 0 ? m_queueSize*2 : PATHQ_INITIAL_QUEUE, limit);
+	if (size <= m_queueSize)
+		return false;
+
+	PathQuery* queue = (PathQuery*)dtAlloc(sizeof(PathQuery)*size, DT_ALLOC_PERM);
+	if (!queue)
+		return false;
+	if (m_queueSize)
+		memcpy(queue, m_queue, sizeof(PathQuery)*m_queueSize);
+	for (int i = m_queueSize; i < size; ++i)
 	{
-		m_queue[i].ref = DT_PATHQ_INVALID;
-		m_queue[i].path = (dtPolyRef*)dtAlloc(sizeof(dtPolyRef)*m_maxPathSize, DT_ALLOC_PERM);
-		if (!m_queue[i].path)
-			return false;
+		queue[i].ref = DT_PATHQ_INVALID;
+		queue[i].path = 0;
+		queue[i].status = 0;
 	}
-	
-	m_queueHead = 0;
-	
+	dtFree(m_queue);
+	m_queue = queue;
+	m_queueSize = size;
 	return true;
 }
 
+int dtPathQueue::findSlot(dtPathQueueRef ref) const
+{
+	if (ref == DT_PATHQ_INVALID)
+		return -1;
+	const int slot = (int)(ref & ((1 << PATHQ_SLOT_BITS) - 1));
+	if (slot >= m_queueSize || m_queue[slot].ref != ref)
+		return -1;
+	return slot;
+}
+
+/// @par
+///
+/// Requests that waited longer than the maximum wait come first, oldest first.
+/// The others follow by priority, then by age.
+int dtPathQueue::pickNext() const
+{
+	int best = -1;
+	bool bestStarved = false;
+	for (int i = 0; i < m_queueSize; ++i)
+	{
+		const PathQuery& q = m_queue[i];
+		if (q.ref == DT_PATHQ_INVALID || q.status != 0)
+			continue;
+		const bool starved = (int)(m_tick - q.requestTick) > m_maxWait;
+		if (best == -1)
+		{
+			best = i;
+			bestStarved = starved;
+			continue;
+		}
+		const PathQuery& b = m_queue[best];
+		const bool older = (int)(q.order - b.order) < 0;
+		bool better;
+		if (starved != bestStarved)
+			better = starved;
+		else if (starved || q.priority == b.priority)
+			better = older;
+		else
+			better = q.priority < b.priority;
+		if (better)
+		{
+			best = i;
+			bestStarved = starved;
+		}
+	}
+	return best;
+}
+
 void dtPathQueue::update(const int maxIters)
 {
 	static const int MAX_KEEP_ALIVE = 2; // in update ticks.
 
-	// Update path request until there is nothing to update
-	// or upto maxIters pathfinder iterations has been consumed.
-	int iterCount = maxIters;
-	
-	for (int i = 0; i < MAX_QUEUE; ++i)
+	m_tick++;
+
+	// If a path result has not been read in few frames, free the slot.
+	for (int i = 0; i < m_queueSize; ++i)
 	{
-		PathQuery& q = m_queue[m_queueHead % MAX_QUEUE];
-		
-		// Skip inactive requests.
+		PathQuery& q = m_queue[i];
 		if (q.ref == DT_PATHQ_INVALID)
-		{
-			m_queueHead++;
 			continue;
-		}
-		
-		// Handle completed request.
 		if (dtStatusSucceed(q.status) || dtStatusFailed(q.status))
 		{
-			// If the path result has not been read in few frames, free the slot.
 			q.keepAlive++;
 			if (q.keepAlive > MAX_KEEP_ALIVE)
 			{
 				q.ref = DT_PATHQ_INVALID;
 				q.status = 0;
+				m_activeCount--;
 			}
-			
-			m_queueHead++;
-			continue;
 		}
-		
-		// Handle query start.
-		if (q.status == 0)
+	}
+
+	// Update path requests until there is nothing to update
+	// or upto maxIters pathfinder iterations have been consumed.
+	// Only one sliced search can be in progress on the query at a time.
+	int iterCount = maxIters;
+	while (iterCount > 0)
+	{
+		if (m_current < 0)
 		{
+			m_current = pickNext();
+			if (m_current < 0)
+				break;
+			PathQuery& q = m_queue[m_current];
 			q.status = m_navquery->initSlicedFindPath(q.startRef, q.endRef, q.startPos, q.endPos, q.filter);
-		}		
+		}
+
+		PathQuery& q = m_queue[m_current];
 		// Handle query in progress.
 		if (dtStatusInProgress(q.status))
 		{
@@ -124,21 +204,24 @@ void dtPathQueue::update(const int maxIters)
 		{
 			q.status = m_navquery->finalizeSlicedFindPath(q.path, &q.npath, m_maxPathSize);
 		}
-
-		if (iterCount <= 0)
-			break;
-
-		m_queueHead++;
+		if (!dtStatusInProgress(q.status))
+			m_current = -1;
 	}
 }
 
 dtPathQueueRef dtPathQueue::request(dtPolyRef startRef, dtPolyRef endRef,
 									const float* startPos, const float* endPos,
-									const dtQueryFilter* filter)
+									const dtQueryFilter* filter, const float priority)
 {
+	if (!m_navquery)
+		return DT_PATHQ_INVALID;
+	// Make room if every slot is taken.
+	if (m_activeCount >= m_queueSize && !grow())
+		return DT_PATHQ_INVALID;
+
 	// Find empty slot
 	int slot = -1;
-	for (int i = 0; i < MAX_QUEUE; ++i)
+	for (int i = 0; i < m_queueSize; ++i)
 	{
 		if (m_queue[i].ref == DT_PATHQ_INVALID)
 		{
@@ -146,14 +229,23 @@ dtPathQueueRef dtPathQueue::request(dtPolyRef startRef, dtPolyRef endRef,
 			break;
 		}
 	}
-	// Could not find slot.
 	if (slot == -1)
 		return DT_PATHQ_INVALID;
+
+	PathQuery& q = m_queue[slot];
+	if (!q.path)
+	{
+		q.path = (dtPolyRef*)dtAlloc(sizeof(dtPolyRef)*m_maxPathSize, DT_ALLOC_PERM);
+		if (!q.path)
+			return DT_PATHQ_INVALID;
+	}
 	
-	dtPathQueueRef ref = m_nextHandle++;
-	if (m_nextHandle == DT_PATHQ_INVALID) m_nextHandle++;
+	// The slot is part of the ref, which makes the lookups direct.
+	const dtPathQueueRef ref = (m_nextHandle << PATHQ_SLOT_BITS) | (dtPathQueueRef)slot;
+	m_nextHandle++;
+	if (m_nextHandle >= (1u << (32 - PATHQ_SLOT_BITS)))
+		m_nextHandle = 1;
 	
-	PathQuery& q = m_queue[slot];
 	q.ref = ref;
 	dtVcopy(q.startPos, startPos);
 	q.startRef = startRef;
@@ -164,37 +256,39 @@ dtPathQueueRef dtPathQueue::request(dtPolyRef startRef, dtPolyRef endRef,
 	q.npath = 0;
 	q.filter = filter;
 	q.keepAlive = 0;
+	q.priority = priority;
+	q.order = m_nextOrder++;
+	q.requestTick = m_tick;
+	m_activeCount++;
 	
 	return ref;
 }
 
 dtStatus dtPathQueue::getRequestStatus(dtPathQueueRef ref) const
 {
-	for (int i = 0; i < MAX_QUEUE; ++i)
-	{
-		if (m_queue[i].ref == ref)
-			return m_queue[i].status;
-	}
-	return DT_FAILURE;
+	const int slot = findSlot(ref);
+	if (slot < 0)
+		return DT_FAILURE;
+	return m_queue[slot].status;
 }
 
 dtStatus dtPathQueue::getPathResult(dtPathQueueRef ref, dtPolyRef* path, int* pathSize, const int maxPath)
 {
-	for (int i = 0; i < MAX_QUEUE; ++i)
-	{
-		if (m_queue[i].ref == ref)
-		{
-			PathQuery& q = m_queue[i];
-			dtStatus details = q.status & DT_STATUS_DETAIL_MASK;
-			// Free request for reuse.
-			q.ref = DT_PATHQ_INVALID;
-			q.status = 0;
-			// Copy path
-			int n = dtMin(q.npath, maxPath);
-			memcpy(path, q.path, sizeof(dtPolyRef)*n);
-			*pathSize = n;
-			return details | DT_SUCCESS;
-		}
-	}
-	return DT_FAILURE;
+	const int slot = findSlot(ref);
+	if (slot < 0)
+		return DT_FAILURE;
+
+	PathQuery& q = m_queue[slot];
+	dtStatus details = q.status & DT_STATUS_DETAIL_MASK;
+	// Free request for reuse.
+	q.ref = DT_PATHQ_INVALID;
+	q.status = 0;
+	m_activeCount--;
+	if (m_current == slot)
+		m_current = -1;
+	// Copy path
+	int n = dtMin(q.npath, maxPath);
+	memcpy(path, q.path, sizeof(dtPolyRef)*n);
+	*pathSize = n;
+	return details | DT_SUCCESS;
 }
@@ -17,6 +17,7 @@
 //
 
 #include <string.h>
+#include <limits.h>
 #include <new>
 #include "DetourProximityGrid.h"
 #include "DetourCommon.h"
@@ -42,25 +43,28 @@ void dtFreeProximityGrid(dtProximityGrid* ptr)
 
 inline int hashPos2(int x, int y, int n)
 {
-	return ((x*73856093) ^ (y*19349663)) & (n-1);
+	return (int)(((unsigned int)x*73856093u ^ (unsigned int)y*19349663u) & (unsigned int)(n-1));
 }
 
 
 dtProximityGrid::dtProximityGrid() :
 	m_cellSize(0),
 	m_invCellSize(0),
-	m_pool(0),
-	m_poolHead(0),
-	m_poolSize(0),
+	m_items(0),
+	m_sorted(0),
+	m_nitems(0),
+	m_maxItems(0),
 	m_buckets(0),
-	m_bucketsSize(0)
+	m_bucketsSize(0),
+	m_maxBuckets(0)
 {
 }
 
 dtProximityGrid::~dtProximityGrid()
 {
 	dtFree(m_buckets);
-	dtFree(m_pool);
+	dtFree(m_sorted);
+	dtFree(m_items);
 }
 
 bool dtProximityGrid::init(const int poolSize, const float cellSize)
@@ -71,35 +75,51 @@ bool dtProximityGrid::init(const int poolSize, const float cellSize)
 	m_cellSize = cellSize;
 	m_invCellSize = 1.0f / m_cellSize;
 	
-	// Allocate hashs buckets
-	m_bucketsSize = dtNextPow2(poolSize);
-	m_buckets = (unsigned short*)dtAlloc(sizeof(unsigned short)*m_bucketsSize, DT_ALLOC_PERM);
-	if (!m_buckets)
+	if (!reserve(poolSize))
 		return false;
 	
-	// Allocate pool of items.
-	m_poolSize = poolSize;
-	m_poolHead = 0;
-	m_pool = (Item*)dtAlloc(sizeof(Item)*m_poolSize, DT_ALLOC_PERM);
-	if (!m_pool)
+	clear();
+	
+	return true;
+}
+
+bool dtProximityGrid::reserve(const int maxItems)
+{
+	if (maxItems <= m_maxItems)
+		return true;
+	
+	Item* items = (Item*)dtAlloc(sizeof(Item)*maxItems, DT_ALLOC_PERM);
+	Item* sorted = (Item*)dtAlloc(sizeof(Item)*maxItems, DT_ALLOC_PERM);
+	if (!items || !sorted)
+	{
+		dtFree(items);
+		dtFree(sorted);
 		return false;
+	}
 	
-	clear();
+	if (m_nitems)
+		memcpy(items, m_items, sizeof(Item)*m_nitems);
+	dtFree(m_items);
+	dtFree(m_sorted);
+	m_items = items;
+	m_sorted = sorted;
+	m_maxItems = maxItems;
 	
 	return true;
 }
 
 void dtProximityGrid::clear()
 {
-	memset(m_buckets, 0xff, sizeof(unsigned short)*m_bucketsSize);
-	m_poolHead = 0;
-	m_bounds[0] = 0xffff;
-	m_bounds[1] = 0xffff;
-	m_bounds[2] = -0xffff;
-	m_bounds[3] = -0xffff;
+	m_nitems = 0;
+	m_bucketsSize = 0;
+	// Empty until the first item, cells can lie past +-0xffff.
+	m_bounds[0] = INT_MAX;
+	m_bounds[1] = INT_MAX;
+	m_bounds[2] = INT_MIN;
+	m_bounds[3] = INT_MIN;
 }
 
-void dtProximityGrid::addItem(const unsigned short id,
+void dtProximityGrid::addItem(const unsigned int id,
 							  const float minx, const float miny,
 							  const float maxx, const float maxy)
 {
@@ -108,6 +128,13 @@ void dtProximityGrid::addItem(const unsigned short id,
 	const int imaxx = (int)dtMathFloorf(maxx * m_invCellSize);
 	const int imaxy = (int)dtMathFloorf(maxy * m_invCellSize);
 	
+	const int ncells = (imaxx-iminx+1)*(imaxy-iminy+1);
+	if (m_nitems + ncells > m_maxItems)
+	{
+		if (!reserve(dtMax(m_maxItems*2, m_nitems + ncells)))
+			return;
+	}
+	
 	m_bounds[0] = dtMin(m_bounds[0], iminx);
 	m_bounds[1] = dtMin(m_bounds[1], iminy);
 	m_bounds[2] = dtMax(m_bounds[2], imaxx);
@@ -117,26 +144,61 @@ void dtProximityGrid::addItem(const unsigned short id,
 	{
 		for (int x = iminx; x <= imaxx; ++x)
 		{
-			if (m_poolHead < m_poolSize)
-			{
-				const int h = hashPos2(x, y, m_bucketsSize);
-				const unsigned short idx = (unsigned short)m_poolHead;
-				m_poolHead++;
-				Item& item = m_pool[idx];
-				item.x = (short)x;
-				item.y = (short)y;
-				item.id = id;
-				item.next = m_buckets[h];
-				m_buckets[h] = idx;
-			}
+			Item& item = m_items[m_nitems++];
+			item.id = id;
+			item.x = x;
+			item.y = y;
+			item.minx = iminx;
+			item.miny = iminy;
 		}
 	}
 }
 
+void dtProximityGrid::build()
+{
+	const int size = (int)dtNextPow2((unsigned int)dtMax(m_nitems, 1));
+	if (size + 1 > m_maxBuckets)
+	{
+		int* buckets = (int*)dtAlloc(sizeof(int)*(size+1), DT_ALLOC_PERM);
+		if (!buckets)
+		{
+			m_bucketsSize = 0;
+			return;
+		}
+		dtFree(m_buckets);
+		m_buckets = buckets;
+		m_maxBuckets = size + 1;
+	}
+	m_bucketsSize = size;
+	
+	// Counting sort by bucket. The entries are placed from the end of their
+	// bucket, so the last one added comes first as with a linked bucket.
+	memset(m_buckets, 0, sizeof(int)*(size+1));
+	for (int i = 0; i < m_nitems; ++i)
+		m_buckets[hashPos2(m_items[i].x, m_items[i].y, size)]++;
+	
+	int end = 0;
+	for (int i = 0; i < size; ++i)
+	{
+		end += m_buckets[i];
+		m_buckets[i] = end;
+	}
+	m_buckets[size] = end;
+	
+	for (int i = 0; i < m_nitems; ++i)
+	{
+		const int h = hashPos2(m_items[i].x, m_items[i].y, size);
+		m_sorted[--m_buckets[h]] = m_items[i];
+	}
+}
+
 int dtProximityGrid::queryItems(const float minx, const float miny,
 								const float maxx, const float maxy,
-								unsigned short* ids, const int maxIds) const
+								unsigned int* ids, const int maxIds) const
 {
+	if (!m_bucketsSize)
+		return 0;
+	
 	const int iminx = (int)dtMathFloorf(minx * m_invCellSize);
 	const int iminy = (int)dtMathFloorf(miny * m_invCellSize);
 	const int imaxx = (int)dtMathFloorf(maxx * m_invCellSize);
@@ -149,26 +211,18 @@ int dtProximityGrid::queryItems(const float minx, const float miny,
 		for (int x = iminx; x <= imaxx; ++x)
 		{
 			const int h = hashPos2(x, y, m_bucketsSize);
-			unsigned short idx = m_buckets[h];
-			while (idx != 0xffff)
+			const Item* item = &m_sorted[m_buckets[h]];
+			const Item* end = &m_sorted[m_buckets[h+1]];
+			for (; item != end; ++item)
 			{
-				Item& item = m_pool[idx];
-				if ((int)item.x == x && (int)item.y == y)
-				{
-					// Check if the id exists already.
-					const unsigned short* end = ids + n;
-					unsigned short* i = ids;
-					while (i != end && *i != item.id)
-						++i;
-					// Item not found, add it.
-					if (i == end)
-					{
-						if (n >= maxIds)
-							return n;
-						ids[n++] = item.id;
-					}
-				}
-				idx = item.next;
+				if (item->x != x || item->y != y)
+					continue;
+				// An item covering several cells is reported at the first one inside the query.
+				if (x != dtMax(item->minx, iminx) || y != dtMax(item->miny, iminy))
+					continue;
+				if (n >= maxIds)
+					return n;
+				ids[n++] = item->id;
 			}
 		}
 	}
@@ -178,16 +232,17 @@ int dtProximityGrid::queryItems(const float minx, const float miny,
 
 int dtProximityGrid::getItemCountAt(const int x, const int y) const
 {
+	if (!m_bucketsSize)
+		return 0;
+	
 	int n = 0;
 	
 	const int h = hashPos2(x, y, m_bucketsSize);
-	unsigned short idx = m_buckets[h];
-	while (idx != 0xffff)
+	for (int i = m_buckets[h]; i < m_buckets[h+1]; ++i)
 	{
-		Item& item = m_pool[idx];
-		if ((int)item.x == x && (int)item.y == y)
+		const Item& item = m_sorted[i];
+		if (item.x == x && item.y == y)
 			n++;
-		idx = item.next;
 	}
 	
 	return n;
@@ -165,6 +165,17 @@ public:
 	
 	dtStatus buildNavMeshTile(const dtCompressedTileRef ref, class dtNavMesh* navmesh);
 	
+	/// Builds the navmesh tile data of a compressed tile without adding it to a navmesh.
+	/// All scratch memory comes from @p talloc, so several tiles can be built from
+	/// different threads at once, each with its own allocator, as long as the cache
+	/// itself is not modified meanwhile.
+	///  @param[in]		ref			The compressed tile to build.
+	///  @param[in]		talloc		The allocator for the intermediate results.
+	///  @param[out]	navData		The tile data, allocated with dtAlloc. Null if the tile has no polygons.
+	///  @param[out]	navDataSize	The size of @p navData.
+	dtStatus buildNavMeshTileData(const dtCompressedTileRef ref, struct dtTileCacheAlloc* talloc,
+								  unsigned char** navData, int* navDataSize) const;
+	
 	void calcTightTileBounds(const struct dtTileCacheLayerHeader* header, float* bmin, float* bmax) const;
 	
 	void getObstacleBounds(const struct dtTileCacheObstacle* ob, float* bmin, float* bmax) const;
@@ -0,0 +1,744 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <vector>
+#include <thread>
+
+#include "catch.hpp"
+
+#include "AStarHeap.h"
+#include "AStarImpl.h"
+#include "AStarTile.h"
+#include "AStarHierarchy.h"
+#include "AStarWrapper.h"
+
+// Deterministic wall pattern, roughly one cell in five is blocked.
+static bool NextWall(unsigned int &seed)
+{
+	seed = seed * 1103515245 + 12345;
+	return ((seed >> 16) % 5) == 0;
+}
+
+static void AddTileWalls(CAStarTile &tile, unsigned int seed)
+{
+	const int count = tile.GetWidth() * tile.GetHeight();
+	for (int i = 0; i < count; i++)
+	{
+		tile.SetCost(i, NextWall(seed) ? -1 : 0);
+	}
+	tile.SetCost(0, 0);
+	tile.SetCost(count - 1, 0);
+}
+
+// Checks that consecutive path cells are neighbours and that only the end may be blocked.
+static bool IsValidTilePath(const CAStarTile &tile, const std::vector<int> &path, bool bEnable45)
+{
+	for (size_t i = 1; i < path.size(); i++)
+	{
+		int dx = abs(path[i] % tile.GetWidth() - path[i - 1] % tile.GetWidth());
+		int dy = abs(path[i] / tile.GetWidth() - path[i - 1] / tile.GetWidth());
+		if (dx > 1 || dy > 1 || dx + dy == 0 || (!bEnable45 && dx + dy > 1))
+			return false;
+		if (i + 1 < path.size() && tile.GetCost(path[i]) == -1)
+			return false;
+	}
+	return true;
+}
+
+static bool IsValidTilePath(CAStarTile &tile, bool bEnable45)
+{
+	return IsValidTilePath(tile, tile.GetPath(), bEnable45);
+}
+
+// 4-connected node grid searched through the generic CAStarImpl.
+class NodeGrid : public CAStarImpl
+{
+public:
+	NodeGrid(int width, int height) : m_nWidth(width), m_nHeight(height), m_vecNodes(width * height)
+	{
+		for (int y = 0; y < height; y++)
+		{
+			for (int x = 0; x < width; x++)
+			{
+				CAStarNode &node = m_vecNodes[y * width + x];
+				node.loss = 0;
+				Link(node, x - 1, y);
+				Link(node, x + 1, y);
+				Link(node, x, y - 1);
+				Link(node, x, y + 1);
+			}
+		}
+	}
+
+	// Same wall pattern as AddTileWalls, leaving the corners open.
+	void AddWalls(unsigned int seed)
+	{
+		for (size_t i = 0; i < m_vecNodes.size(); i++)
+		{
+			m_vecNodes[i].loss = NextWall(seed) ? -1 : 0;
+		}
+		m_vecNodes.front().loss = 0;
+		m_vecNodes.back().loss = 0;
+	}
+
+	bool Search(int sx, int sy, int ex, int ey)
+	{
+		for (size_t i = 0; i < m_vecNodes.size(); i++)
+		{
+			m_vecNodes[i].parent = 0;
+			m_vecNodes[i].state = ASS_NONE;
+		}
+		return CAStarImpl::Search(&m_vecNodes[sy * m_nWidth + sx], &m_vecNodes[ey * m_nWidth + ex]);
+	}
+
+	int PathCost()
+	{
+		return GetPath().empty() ? -1 : GetPath().back()->g;
+	}
+
+protected:
+	virtual int Hn(CAStarNode *pCurrentNode, CAStarNode * /*pPrevNode*/, CAStarNode *pEndNode)
+	{
+		if (pCurrentNode->loss == -1)
+			return -1;
+		int i1 = (int)(pCurrentNode - &m_vecNodes[0]);
+		int i2 = (int)(pEndNode - &m_vecNodes[0]);
+		return (abs(i1 % m_nWidth - i2 % m_nWidth) + abs(i1 / m_nWidth - i2 / m_nWidth)) * 10;
+	}
+
+private:
+	void Link(CAStarNode &node, int x, int y)
+	{
+		if (x < 0 || y < 0 || x >= m_nWidth || y >= m_nHeight)
+			return;
+		Neighbor neighbor;
+		neighbor.loss = 10;
+		neighbor.node = &m_vecNodes[y * m_nWidth + x];
+		node.neighbor.push_back(neighbor);
+	}
+
+	int m_nWidth;
+	int m_nHeight;
+	std::vector<CAStarNode> m_vecNodes;
+};
+
+struct IntItem
+{
+	int key;
+	int pos;
+};
+
+struct IntItemTraits
+{
+	inline int Key(IntItem *item) const { return item->key; }
+	inline int &Pos(IntItem *item) const { return item->pos; }
+};
+
+TEST_CASE("CAStarHeap")
+{
+	SECTION("Pops items in key order")
+	{
+		IntItem items[8];
+		const int keys[8] = { 5, 3, 9, 1, 7, 3, 8, 0 };
+		CAStarHeap<IntItem*, IntItemTraits> heap;
+		for (int i = 0; i < 8; i++)
+		{
+			items[i].key = keys[i];
+			heap.Push(&items[i]);
+		}
+		int last = -1;
+		while (!heap.Empty())
+		{
+			IntItem *item = heap.Pop();
+			REQUIRE(item->key >= last);
+			REQUIRE(item->pos == -1);
+			last = item->key;
+		}
+	}
+
+	SECTION("Modify moves a lowered key to the top")
+	{
+		IntItem items[4] = { { 10, -1 }, { 20, -1 }, { 30, -1 }, { 40, -1 } };
+		CAStarHeap<IntItem*, IntItemTraits> heap;
+		for (int i = 0; i < 4; i++)
+			heap.Push(&items[i]);
+		items[3].key = 5;
+		heap.Modify(&items[3]);
+		REQUIRE(heap.Top() == &items[3]);
+		REQUIRE(heap.Pop() == &items[3]);
+		REQUIRE(heap.Pop() == &items[0]);
+	}
+}
+
+TEST_CASE("CAStarImpl open lists")
+{
+	NodeGrid heapGrid(64, 64);
+	NodeGrid setGrid(64, 64);
+	heapGrid.AddWalls(7);
+	setGrid.AddWalls(7);
+	heapGrid.SetOpenList(AOL_HEAP);
+	setGrid.SetOpenList(AOL_MULTISET);
+
+	SECTION("Heap and multiset find paths of the same cost")
+	{
+		const int queries[4][4] = { { 0, 0, 63, 63 }, { 63, 0, 0, 63 }, { 10, 5, 50, 60 }, { 0, 0, 1, 0 } };
+		for (int i = 0; i < 4; i++)
+		{
+			bool heapFound = heapGrid.Search(queries[i][0], queries[i][1], queries[i][2], queries[i][3]);
+			bool setFound = setGrid.Search(queries[i][0], queries[i][1], queries[i][2], queries[i][3]);
+			REQUIRE(heapFound == setFound);
+			REQUIRE(heapGrid.PathCost() == setGrid.PathCost());
+		}
+	}
+}
+
+TEST_CASE("CAStarTile")
+{
+	SECTION("Grid search matches the node graph search")
+	{
+		NodeGrid nodes(64, 64);
+		nodes.AddWalls(7);
+		CAStarTile tile;
+		tile.Init(64, 64, false);
+		AddTileWalls(tile, 7);
+
+		const int queries[4][4] = { { 0, 0, 63, 63 }, { 63, 0, 0, 63 }, { 10, 5, 50, 60 }, { 0, 0, 1, 0 } };
+		for (int i = 0; i < 4; i++)
+		{
+			bool nodeFound = nodes.Search(queries[i][0], queries[i][1], queries[i][2], queries[i][3]);
+			bool tileFound = tile.Search(queries[i][0], queries[i][1], queries[i][2], queries[i][3]);
+			REQUIRE(nodeFound == tileFound);
+			if (tileFound)
+			{
+				REQUIRE(IsValidTilePath(tile, false));
+				REQUIRE(((int)tile.GetPath().size() - 1) * 10 == nodes.PathCost());
+			}
+		}
+	}
+
+	SECTION("Diagonal moves")
+	{
+		CAStarTile tile;
+		tile.Init(16, 16, true);
+		REQUIRE(tile.Search(0, 0, 15, 15));
+		REQUIRE(tile.GetPath().size() == 16);
+		REQUIRE(IsValidTilePath(tile, true));
+	}
+
+	SECTION("Walled off end is not reached")
+	{
+		CAStarTile tile;
+		tile.Init(8, 8, true);
+		for (int y = 0; y < 8; y++)
+			tile.SetCost(y * 8 + 4, -1);
+		REQUIRE(!tile.Search(0, 0, 7, 7));
+		REQUIRE(tile.GetPath().empty());
+	}
+
+	SECTION("Costs are stored in a byte")
+	{
+		CAStarTile tile;
+		tile.Init(4, 4);
+		tile.SetCost(1, -1);
+		tile.SetCost(2, 1000);
+		tile.SetCost(3, 7);
+		REQUIRE(tile.GetCost(0) == 0);
+		REQUIRE(tile.GetCost(1) == -1);
+		REQUIRE(tile.GetCost(2) == ASTAR_COST_MAX);
+		REQUIRE(tile.GetCost(3) == 7);
+	}
+}
+
+TEST_CASE("CAStarTile jump point search")
+{
+	const int queries[6][4] = { { 0, 0, 63, 63 }, { 63, 0, 0, 63 }, { 10, 5, 50, 60 }, { 0, 0, 1, 0 }, { 32, 0, 32, 63 }, { 5, 40, 60, 40 } };
+
+	SECTION("Finds the same routes as A*")
+	{
+		for (int diagonal = 0; diagonal < 2; diagonal++)
+		{
+			CAStarTile astar;
+			CAStarTile jps;
+			astar.Init(64, 64, diagonal != 0, ASM_ASTAR);
+			jps.Init(64, 64, diagonal != 0, ASM_JPS);
+			AddTileWalls(astar, 11);
+			AddTileWalls(jps, 11);
+			REQUIRE(jps.IsUniformCost());
+
+			for (int i = 0; i < 6; i++)
+			{
+				bool astarFound = astar.Search(queries[i][0], queries[i][1], queries[i][2], queries[i][3]);
+				bool jpsFound = jps.Search(queries[i][0], queries[i][1], queries[i][2], queries[i][3]);
+				REQUIRE(astarFound == jpsFound);
+				if (jpsFound)
+				{
+					REQUIRE(jps.GetPath().front() == queries[i][1] * 64 + queries[i][0]);
+					REQUIRE(jps.GetPath().back() == queries[i][3] * 64 + queries[i][2]);
+					REQUIRE(IsValidTilePath(jps, diagonal != 0));
+					// Manhattan distance is exact for 4 way moves, so both searches are optimal.
+					if (!diagonal)
+						REQUIRE(jps.GetPath().size() == astar.GetPath().size());
+				}
+			}
+		}
+	}
+
+	SECTION("Falls back to A* when costs differ")
+	{
+		CAStarTile astar;
+		CAStarTile jps;
+		astar.Init(32, 32, true, ASM_ASTAR);
+		jps.Init(32, 32, true, ASM_JPS);
+		astar.SetCost(100, 5);
+		jps.SetCost(100, 5);
+		REQUIRE(!jps.IsUniformCost());
+		REQUIRE(jps.Search(0, 0, 31, 20));
+		REQUIRE(astar.Search(0, 0, 31, 20));
+		REQUIRE(jps.GetPath() == astar.GetPath());
+
+		jps.SetCost(100, 0);
+		REQUIRE(jps.IsUniformCost());
+		jps.SetCost(100, -1);
+		REQUIRE(jps.IsUniformCost());
+	}
+}
+
+TEST_CASE("CAStarTile repeated searches")
+{
+	SECTION("Back to back searches match fresh instances")
+	{
+		for (int mode = ASM_ASTAR; mode <= ASM_JPS; mode++)
+		{
+			for (int diagonal = 0; diagonal < 2; diagonal++)
+			{
+				CAStarTile reused;
+				reused.Init(48, 48, diagonal != 0, (AStarSearchMode)mode);
+				AddTileWalls(reused, 3);
+
+				unsigned int seed = 99;
+				for (int i = 0; i < 200; i++)
+				{
+					seed = seed * 1103515245 + 12345;
+					int sx = (seed >> 8) % 48;
+					int sy = (seed >> 14) % 48;
+					int ex = (seed >> 20) % 48;
+					int ey = (seed >> 26) % 48;
+
+					CAStarTile fresh;
+					fresh.Init(48, 48, diagonal != 0, (AStarSearchMode)mode);
+					AddTileWalls(fresh, 3);
+
+					REQUIRE(reused.Search(sx, sy, ex, ey) == fresh.Search(sx, sy, ex, ey));
+					REQUIRE(reused.GetPath() == fresh.GetPath());
+				}
+			}
+		}
+	}
+}
+
+TEST_CASE("CAStarTileContext")
+{
+	CAStarTile tile;
+	tile.Init(64, 64, true, ASM_ASTAR);
+	AddTileWalls(tile, 5);
+
+	SECTION("Interleaved contexts keep their own paths")
+	{
+		CAStarTileContext a;
+		CAStarTileContext b;
+		REQUIRE(tile.Search(a, 0, 0, 63, 63));
+		REQUIRE(tile.Search(b, 10, 5, 50, 60));
+		std::vector<int> pathA = a.GetPath();
+		std::vector<int> pathB = b.GetPath();
+
+		REQUIRE(tile.Search(0, 0, 63, 63));
+		REQUIRE(tile.GetPath() == pathA);
+		REQUIRE(tile.Search(10, 5, 50, 60));
+		REQUIRE(tile.GetPath() == pathB);
+	}
+
+	SECTION("Copies search on their own arrays")
+	{
+		std::vector<CAStarTileContext> contexts(1);
+		REQUIRE(tile.Search(contexts[0], 0, 0, 63, 63));
+		const std::vector<int> path = contexts[0].GetPath();
+
+		// Growing the vector copies the first context and frees the original.
+		contexts.resize(8);
+		REQUIRE(tile.Search(contexts[0], 0, 0, 63, 63));
+		REQUIRE(contexts[0].GetPath() == path);
+		REQUIRE(tile.Search(contexts[7], 0, 0, 63, 63));
+		REQUIRE(contexts[7].GetPath() == path);
+	}
+
+	SECTION("Threads share one tile")
+	{
+		std::vector<int> expected[4];
+		const int queries[4][4] = { { 0, 0, 63, 63 }, { 63, 0, 0, 63 }, { 10, 5, 50, 60 }, { 1, 62, 60, 2 } };
+		for (int i = 0; i < 4; i++)
+		{
+			tile.Search(queries[i][0], queries[i][1], queries[i][2], queries[i][3]);
+			expected[i] = tile.GetPath();
+		}
+
+		bool match[4] = { false, false, false, false };
+		std::vector<std::thread> threads;
+		for (int i = 0; i < 4; i++)
+		{
+			threads.push_back(std::thread([&tile, &queries, &expected, &match, i]() {
+				CAStarTileContext ctx;
+				bool same = true;
+				for (int n = 0; n < 20; n++)
+				{
+					tile.Search(ctx, queries[i][0], queries[i][1], queries[i][2], queries[i][3]);
+					same = same && ctx.GetPath() == expected[i];
+				}
+				match[i] = same;
+			}));
+		}
+		for (size_t i = 0; i < threads.size(); i++)
+			threads[i].join();
+		for (int i = 0; i < 4; i++)
+			REQUIRE(match[i]);
+	}
+}
+
+TEST_CASE("AStarWrapper handles")
+{
+	SECTION("Maps and contexts are independent")
+	{
+		AStarMap *map1 = AStarMapCreate(16, 16, false, 100, 200, ASM_ASTAR);
+		AStarMap *map2 = AStarMapCreate(16, 16, true, 0, 0, ASM_JPS);
+		AStarContext *ctx = AStarContextCreate();
+		for (int y = 0; y < 15; y++)
+			REQUIRE(AStarMapSetCost(map1, 108, 200 + y, -1));
+		REQUIRE(!AStarMapSetCost(map1, 0, 0, -1));
+
+		REQUIRE(AStarMapSearch(map1, ctx, 100, 200, 115, 200) == 46);
+		int x = 0, y = 0;
+		REQUIRE(AStarContextGetPath(ctx, 0, x, y));
+		REQUIRE(x == 100);
+		REQUIRE(y == 200);
+		REQUIRE(AStarContextGetPath(ctx, 45, x, y));
+		REQUIRE(x == 115);
+		REQUIRE(y == 200);
+
+		REQUIRE(AStarMapSearch(map2, ctx, 0, 0, 15, 15) == 16);
+		REQUIRE(AStarContextGetPath(ctx, 15, x, y));
+		REQUIRE(x == 15);
+		REQUIRE(y == 15);
+		REQUIRE(!AStarContextGetPath(ctx, 16, x, y));
+
+		REQUIRE(AStarMapSearch(map1, ctx, 100, 200, 115, 200) == 46);
+		AStarMapRelease(map1);
+		REQUIRE(AStarContextGetPath(ctx, 45, x, y));
+		REQUIRE(x == 115);
+		REQUIRE(y == 200);
+
+		AStarContextRelease(ctx);
+		AStarMapRelease(map2);
+	}
+
+	SECTION("Hierarchy follows cost changes")
+	{
+		AStarMap *map = AStarMapCreate(64, 64, false, 0, 0, ASM_ASTAR);
+		AStarContext *ctx = AStarContextCreate();
+		REQUIRE(AStarMapEnableHierarchy(map, 8));
+		REQUIRE(AStarMapSearch(map, ctx, 0, 0, 63, 0) == 64);
+
+		for (int y = 1; y < 64; y++)
+			REQUIRE(AStarMapSetCost(map, 30, y, -1));
+		REQUIRE(AStarMapSearch(map, ctx, 0, 63, 63, 63) > 64);
+		REQUIRE(AStarMapSetCost(map, 30, 0, -1));
+		REQUIRE(AStarMapSearch(map, ctx, 0, 63, 63, 63) == 0);
+
+		REQUIRE(AStarMapEnableHierarchy(map, 0));
+		REQUIRE(AStarMapSearch(map, ctx, 0, 63, 63, 63) == 0);
+
+		AStarContextRelease(ctx);
+		AStarMapRelease(map);
+	}
+
+	SECTION("Searches starting at once rebuild the marked clusters once")
+	{
+		AStarMap *map = AStarMapCreate(64, 64, false, 0, 0, ASM_ASTAR);
+		REQUIRE(AStarMapEnableHierarchy(map, 8));
+		for (int y = 1; y < 64; y++)
+			REQUIRE(AStarMapSetCost(map, 30, y, -1));
+
+		AStarMap *flat = AStarMapCreate(64, 64, false, 0, 0, ASM_ASTAR);
+		for (int y = 1; y < 64; y++)
+			REQUIRE(AStarMapSetCost(flat, 30, y, -1));
+		AStarContext *ctx = AStarContextCreate();
+		const int expected = AStarMapSearch(flat, ctx, 0, 63, 63, 63);
+		REQUIRE(expected > 64);
+
+		int found[4] = { 0, 0, 0, 0 };
+		std::vector<std::thread> threads;
+		for (int i = 0; i < 4; i++)
+		{
+			threads.push_back(std::thread([map, &found, i]() {
+				AStarContext *threadCtx = AStarContextCreate();
+				found[i] = AStarMapSearch(map, threadCtx, 0, 63, 63, 63);
+				AStarContextRelease(threadCtx);
+			}));
+		}
+		for (size_t i = 0; i < threads.size(); i++)
+			threads[i].join();
+		for (int i = 0; i < 4; i++)
+			REQUIRE(found[i] == expected);
+
+		AStarContextRelease(ctx);
+		AStarMapRelease(flat);
+		AStarMapRelease(map);
+	}
+}
+
+TEST_CASE("CAStarHierarchy")
+{
+	const int queries[6][4] = { { 0, 0, 127, 127 }, { 127, 0, 0, 127 }, { 10, 5, 100, 120 }, { 3, 60, 124, 64 }, { 40, 40, 41, 90 }, { 5, 5, 9, 9 } };
+
+	SECTION("Agrees with the flat search")
+	{
+		for (int diagonal = 0; diagonal < 2; diagonal++)
+		{
+			CAStarTile tile;
+			tile.Init(128, 128, diagonal != 0);
+			AddTileWalls(tile, 11);
+			CAStarHierarchy hierarchy;
+			hierarchy.Init(&tile, 16);
+			REQUIRE(hierarchy.GetEntranceCount() > 0);
+			REQUIRE(!hierarchy.IsDirty());
+
+			CAStarTileContext flat;
+			for (int i = 0; i < 6; i++)
+			{
+				bool flatFound = tile.Search(flat, queries[i][0], queries[i][1], queries[i][2], queries[i][3]);
+				bool found = hierarchy.Search(queries[i][0], queries[i][1], queries[i][2], queries[i][3]);
+				REQUIRE(found == flatFound);
+				if (found)
+				{
+					const std::vector<int> &path = hierarchy.GetPath();
+					REQUIRE(path.front() == queries[i][1] * 128 + queries[i][0]);
+					REQUIRE(path.back() == queries[i][3] * 128 + queries[i][2]);
+					REQUIRE(IsValidTilePath(tile, path, diagonal != 0));
+					REQUIRE(path.size() >= flat.GetPath().size());
+				}
+			}
+		}
+	}
+
+	SECTION("Cost changes only rebuild the touching clusters")
+	{
+		CAStarTile tile;
+		tile.Init(64, 64, false);
+		CAStarHierarchy hierarchy;
+		hierarchy.Init(&tile, 16);
+
+		hierarchy.SetCost(20 * 64 + 20, 5);
+		REQUIRE(hierarchy.GetDirtyCount() == 1);
+		hierarchy.SetCost(20 * 64 + 21, 5);
+		REQUIRE(hierarchy.GetDirtyCount() == 1);
+		hierarchy.Update();
+		REQUIRE(!hierarchy.IsDirty());
+
+		// On the border between two clusters
+		hierarchy.SetCost(20 * 64 + 31, 5);
+		REQUIRE(hierarchy.GetDirtyCount() == 2);
+		// On a corner, which adds the cluster below; diagonal neighbours share no entrances
+		hierarchy.SetCost(31 * 64 + 31, 5);
+		REQUIRE(hierarchy.GetDirtyCount() == 3);
+		hierarchy.Update();
+
+		// Wall off the left quarter except one gap, then close the gap
+		for (int y = 0; y < 64; y++)
+			hierarchy.SetCost(y * 64 + 16, y == 40 ? 0 : -1);
+		REQUIRE(hierarchy.Search(0, 0, 63, 0));
+		REQUIRE(IsValidTilePath(tile, hierarchy.GetPath(), false));
+		hierarchy.SetCost(40 * 64 + 16, -1);
+		REQUIRE(!hierarchy.Search(0, 0, 63, 0));
+		REQUIRE(hierarchy.GetPath().empty());
+	}
+}
+
+// TODO: Implement benchmarking for platforms other than posix.
+#ifdef __unix__
+#include <unistd.h>
+#ifdef _POSIX_TIMERS
+#include <time.h>
+#include <stdint.h>
+
+static int64_t AStarNowNanos() {
+	struct timespec tp;
+	clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &tp);
+	return tp.tv_nsec + 1000000000LL * tp.tv_sec;
+}
+
+#define BM(name, iterations) \
+	struct BM_ ## name { \
+		static void Run() { \
+			int64_t begin_time = AStarNowNanos(); \
+			for (int i = 0 ; i < iterations; i++) { \
+				Body(); \
+			} \
+			int64_t nanos = AStarNowNanos() - begin_time; \
+			printf("BM_%-35s %ld iterations in %10ld nanos: %10.2f nanos/it\n", #name ":", (int64_t)iterations, nanos, double(nanos) / iterations); \
+		} \
+		static void Body(); \
+	}; \
+	TEST_CASE(#name) { \
+		BM_ ## name::Run(); \
+	} \
+	void BM_ ## name::Body()
+
+const int kAStarLoops = 4;
+const int kAStarGridSize = 512;
+
+static NodeGrid &BenchGrid()
+{
+	static NodeGrid *grid = 0;
+	if (!grid)
+	{
+		grid = new NodeGrid(kAStarGridSize, kAStarGridSize);
+		grid->AddWalls(42);
+	}
+	return *grid;
+}
+
+BM(AStarOpenList_Heap, kAStarLoops)
+{
+	NodeGrid &grid = BenchGrid();
+	grid.SetOpenList(AOL_HEAP);
+	grid.Search(0, 0, kAStarGridSize - 1, kAStarGridSize - 1);
+}
+BM(AStarOpenList_Multiset, kAStarLoops)
+{
+	NodeGrid &grid = BenchGrid();
+	grid.SetOpenList(AOL_MULTISET);
+	grid.Search(0, 0, kAStarGridSize - 1, kAStarGridSize - 1);
+}
+
+static CAStarTile &BenchTile()
+{
+	static CAStarTile *tile = 0;
+	if (!tile)
+	{
+		tile = new CAStarTile();
+		tile->Init(kAStarGridSize, kAStarGridSize, false);
+		AddTileWalls(*tile, 42);
+	}
+	return *tile;
+}
+
+BM(AStarTile_Grid, kAStarLoops)
+{
+	CAStarTile &tile = BenchTile();
+	tile.Search(0, 0, kAStarGridSize - 1, kAStarGridSize - 1);
+}
+// Serpentine of long walls with uniform cost, the case JPS is made for.
+static void AddLongWalls(CAStarTile &tile)
+{
+	for (int x = 16; x < kAStarGridSize; x += 32)
+	{
+		for (int y = 0; y < kAStarGridSize; y++)
+		{
+			bool gapAtBottom = (x / 32) % 2 == 0;
+			if ((gapAtBottom && y < kAStarGridSize - 4) || (!gapAtBottom && y > 4))
+				tile.SetCost(y * kAStarGridSize + x, -1);
+		}
+	}
+}
+
+BM(AStarTile_Serpentine_AStar, kAStarLoops)
+{
+	static CAStarTile *tile = 0;
+	if (!tile)
+	{
+		tile = new CAStarTile();
+		tile->Init(kAStarGridSize, kAStarGridSize, true, ASM_ASTAR);
+		AddLongWalls(*tile);
+	}
+	tile->Search(0, 0, kAStarGridSize - 1, kAStarGridSize - 1);
+}
+BM(AStarTile_Serpentine_JPS, kAStarLoops)
+{
+	static CAStarTile *tile = 0;
+	if (!tile)
+	{
+		tile = new CAStarTile();
+		tile->Init(kAStarGridSize, kAStarGridSize, true, ASM_JPS);
+		AddLongWalls(*tile);
+	}
+	tile->Search(0, 0, kAStarGridSize - 1, kAStarGridSize - 1);
+}
+// 1024 grid of 32 cell rooms joined by one door per wall, the layout HPA* is made for.
+static CAStarTile &BenchLargeTile()
+{
+	static CAStarTile *tile = 0;
+	if (!tile)
+	{
+		tile = new CAStarTile();
+		tile->Init(1024, 1024, false);
+		for (int y = 0; y < 1024; y++)
+		{
+			for (int x = 0; x < 1024; x++)
+			{
+				const int rx = x / 32, ry = y / 32;
+				const bool wallX = x % 32 == 31 && y % 32 != (rx * 7 + ry * 13) % 30;
+				const bool wallY = y % 32 == 31 && x % 32 != (rx * 11 + ry * 5) % 30;
+				if (wallX || wallY)
+					tile->SetCost(y * 1024 + x, -1);
+			}
+		}
+	}
+	return *tile;
+}
+
+static CAStarHierarchy &BenchHierarchy()
+{
+	static CAStarHierarchy *hierarchy = 0;
+	if (!hierarchy)
+	{
+		hierarchy = new CAStarHierarchy();
+		hierarchy->Init(&BenchLargeTile(), 16);
+	}
+	return *hierarchy;
+}
+
+BM(AStarHierarchy_Init1024, 1)
+{
+	BenchHierarchy();
+}
+BM(AStarTile_Large_Flat, kAStarLoops)
+{
+	BenchLargeTile().Search(0, 0, 1022, 1022);
+}
+BM(AStarTile_Large_Hierarchy, kAStarLoops)
+{
+	BenchHierarchy().Search(0, 0, 1022, 1022);
+}
+BM(AStarHierarchy_SetCost1024, 1000)
+{
+	static int cell = 0;
+	cell = (cell + 7919) % (1024 * 1024);
+	BenchHierarchy().SetCost(cell, BenchLargeTile().GetCost(cell));
+	BenchHierarchy().Update();
+}
+BM(AStarTile_ShortSearch1024, 1000)
+{
+	static CAStarTile *tile = 0;
+	if (!tile)
+	{
+		tile = new CAStarTile();
+		tile->Init(1024, 1024, true);
+	}
+	tile->Search(500, 500, 503, 500);
+}
+BM(AStarTile_Init1024, kAStarLoops)
+{
+	CAStarTile tile;
+	tile.Init(1024, 1024, true);
+}
+
+#undef BM
+#endif  // _POSIX_TIMERS
+#endif  // __unix__
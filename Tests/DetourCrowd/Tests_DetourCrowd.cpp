@@ -0,0 +1,1147 @@
+#include <stdio.h>
+#include <math.h>
+#include <string.h>
+#include <float.h>
+#include <vector>
+#include <thread>
+#include <algorithm>
+
+#include "catch.hpp"
+
+#include "DetourCommon.h"
+#include "DetourMath.h"
+#include "DetourNavMeshBuilder.h"
+#include "DetourCrowd.h"
+#include "DetourObstacleAvoidance.h"
+#include "DetourOrcaAvoidance.h"
+#include "DetourProximityGrid.h"
+
+static float NextRandom(unsigned int &seed)
+{
+	seed = seed * 1103515245 + 12345;
+	return (float)((seed >> 8) & 0xffff) / 65536.0f;
+}
+
+struct GridItem
+{
+	unsigned int id;
+	float bmin[2];
+	float bmax[2];
+};
+
+// Items overlapping the cells of the query, the way dtProximityGrid::queryItems finds them.
+static std::vector<unsigned int> BruteForceQuery(const std::vector<GridItem> &items, const float cellSize,
+												 const float minx, const float miny, const float maxx, const float maxy)
+{
+	const int qminx = (int)floorf(minx / cellSize);
+	const int qminy = (int)floorf(miny / cellSize);
+	const int qmaxx = (int)floorf(maxx / cellSize);
+	const int qmaxy = (int)floorf(maxy / cellSize);
+	std::vector<unsigned int> ids;
+	for (size_t i = 0; i < items.size(); i++)
+	{
+		const GridItem &item = items[i];
+		if ((int)floorf(item.bmin[0] / cellSize) > qmaxx || (int)floorf(item.bmax[0] / cellSize) < qminx ||
+			(int)floorf(item.bmin[1] / cellSize) > qmaxy || (int)floorf(item.bmax[1] / cellSize) < qminy)
+			continue;
+		ids.push_back(item.id);
+	}
+	std::sort(ids.begin(), ids.end());
+	return ids;
+}
+
+static std::vector<GridItem> RandomItems(int count, float worldSize, float radius, unsigned int seed)
+{
+	std::vector<GridItem> items(count);
+	for (int i = 0; i < count; i++)
+	{
+		const float x = (NextRandom(seed) - 0.5f) * worldSize;
+		const float y = (NextRandom(seed) - 0.5f) * worldSize;
+		items[i].id = (unsigned int)i;
+		items[i].bmin[0] = x - radius;
+		items[i].bmin[1] = y - radius;
+		items[i].bmax[0] = x + radius;
+		items[i].bmax[1] = y + radius;
+	}
+	return items;
+}
+
+static void AddItems(dtProximityGrid &grid, const std::vector<GridItem> &items)
+{
+	grid.clear();
+	for (size_t i = 0; i < items.size(); i++)
+		grid.addItem(items[i].id, items[i].bmin[0], items[i].bmin[1], items[i].bmax[0], items[i].bmax[1]);
+	grid.build();
+}
+
+TEST_CASE("dtProximityGrid")
+{
+	const float cellSize = 1.8f;
+
+	SECTION("Queries match a brute force search")
+	{
+		const std::vector<GridItem> items = RandomItems(500, 60.0f, 0.6f, 17);
+		dtProximityGrid grid;
+		REQUIRE(grid.init((int)items.size() * 4, cellSize));
+		AddItems(grid, items);
+
+		unsigned int seed = 99;
+		std::vector<unsigned int> ids(items.size());
+		for (int i = 0; i < 200; i++)
+		{
+			const float x = (NextRandom(seed) - 0.5f) * 70.0f;
+			const float y = (NextRandom(seed) - 0.5f) * 70.0f;
+			const float range = NextRandom(seed) * 10.0f;
+			const int n = grid.queryItems(x - range, y - range, x + range, y + range, &ids[0], (int)ids.size());
+			std::vector<unsigned int> found(ids.begin(), ids.begin() + n);
+			std::sort(found.begin(), found.end());
+			REQUIRE(found == BruteForceQuery(items, cellSize, x - range, y - range, x + range, y + range));
+		}
+	}
+
+	SECTION("Items covering several cells are reported once")
+	{
+		dtProximityGrid grid;
+		REQUIRE(grid.init(4, cellSize));
+		grid.clear();
+		grid.addItem(7, -5.0f, -5.0f, 5.0f, 5.0f);
+		grid.addItem(8, 0.5f, 0.5f, 0.6f, 0.6f);
+		grid.build();
+
+		unsigned int ids[8];
+		const int n = grid.queryItems(-10.0f, -10.0f, 10.0f, 10.0f, ids, 8);
+		REQUIRE(n == 2);
+		REQUIRE(std::count(ids, ids + n, 7u) == 1);
+		REQUIRE(std::count(ids, ids + n, 8u) == 1);
+		REQUIRE(grid.getItemCountAt(0, 0) == 2);
+		REQUIRE(grid.getItemCountAt(-3, -3) == 1);
+		REQUIRE(grid.getItemCountAt(4, 4) == 0);
+	}
+
+	SECTION("Grows past the initial pool size")
+	{
+		const std::vector<GridItem> items = RandomItems(3000, 100.0f, 0.6f, 5);
+		dtProximityGrid grid;
+		REQUIRE(grid.init(16, cellSize));
+		AddItems(grid, items);
+
+		std::vector<unsigned int> ids(items.size());
+		const int n = grid.queryItems(-100.0f, -100.0f, 100.0f, 100.0f, &ids[0], (int)ids.size());
+		REQUIRE(n == (int)items.size());
+
+		// A smaller second frame reuses the arrays.
+		AddItems(grid, RandomItems(10, 100.0f, 0.6f, 6));
+		REQUIRE(grid.queryItems(-100.0f, -100.0f, 100.0f, 100.0f, &ids[0], (int)ids.size()) == 10);
+	}
+
+	SECTION("Keeps 32-bit ids and far away cells")
+	{
+		dtProximityGrid grid;
+		REQUIRE(grid.init(4, cellSize));
+		grid.clear();
+		grid.addItem(0x12345678u, 1000000.0f, -1000000.0f, 1000000.5f, -999999.5f);
+		grid.addItem(70000u, 0.0f, 0.0f, 0.5f, 0.5f);
+		grid.build();
+
+		unsigned int ids[4];
+		REQUIRE(grid.queryItems(999999.0f, -1000001.0f, 1000001.0f, -999999.0f, ids, 4) == 1);
+		REQUIRE(ids[0] == 0x12345678u);
+		REQUIRE(grid.queryItems(-1.0f, -1.0f, 1.0f, 1.0f, ids, 4) == 1);
+		REQUIRE(ids[0] == 70000u);
+
+		// Bounds follow the items alone, both sides past the old 0xffff seed.
+		grid.clear();
+		grid.addItem(1u, 200000.0f, 200000.0f, 200000.5f, 200000.5f);
+		grid.addItem(2u, 300000.0f, 300000.0f, 300000.5f, 300000.5f);
+		grid.build();
+		const int* bounds = grid.getBounds();
+		const float invCellSize = 1.0f / cellSize;
+		REQUIRE(bounds[0] == (int)floorf(200000.0f * invCellSize));
+		REQUIRE(bounds[1] == (int)floorf(200000.0f * invCellSize));
+		REQUIRE(bounds[2] == (int)floorf(300000.5f * invCellSize));
+		REQUIRE(bounds[3] == (int)floorf(300000.5f * invCellSize));
+	}
+
+	SECTION("Empty grid")
+	{
+		dtProximityGrid grid;
+		REQUIRE(grid.init(4, cellSize));
+		grid.clear();
+		REQUIRE(grid.getBounds()[0] > grid.getBounds()[2]);
+		REQUIRE(grid.getBounds()[1] > grid.getBounds()[3]);
+		unsigned int ids[4];
+		REQUIRE(grid.queryItems(-1.0f, -1.0f, 1.0f, 1.0f, ids, 4) == 0);
+		grid.build();
+		REQUIRE(grid.queryItems(-1.0f, -1.0f, 1.0f, 1.0f, ids, 4) == 0);
+		REQUIRE(grid.getItemCountAt(0, 0) == 0);
+	}
+}
+
+// A single tile navmesh of size x size unit quads on y = 0, the cells set in
+// holes are left out. Quads sharing an edge are linked.
+static dtNavMesh* CreateGridNavMesh(const int size, const std::vector<bool> &holes = std::vector<bool>())
+{
+	const int nvp = DT_VERTS_PER_POLYGON;
+	std::vector<unsigned short> verts;
+	for (int z = 0; z <= size; z++)
+	{
+		for (int x = 0; x <= size; x++)
+		{
+			verts.push_back((unsigned short)x);
+			verts.push_back(0);
+			verts.push_back((unsigned short)z);
+		}
+	}
+	std::vector<int> cellPoly(size * size, -1);
+	int polyCount = 0;
+	for (int i = 0; i < size * size; i++)
+	{
+		if (holes.empty() || !holes[i])
+			cellPoly[i] = polyCount++;
+	}
+	std::vector<unsigned short> polys(polyCount * 2 * nvp, 0xffff);
+	for (int z = 0; z < size; z++)
+	{
+		for (int x = 0; x < size; x++)
+		{
+			const int p = cellPoly[z * size + x];
+			if (p < 0)
+				continue;
+			unsigned short* poly = &polys[p * 2 * nvp];
+			poly[0] = (unsigned short)(z * (size + 1) + x);
+			poly[1] = (unsigned short)((z + 1) * (size + 1) + x);
+			poly[2] = (unsigned short)((z + 1) * (size + 1) + x + 1);
+			poly[3] = (unsigned short)(z * (size + 1) + x + 1);
+			// Edges -x, +z, +x, -z in the vertex order above.
+			const int nx[4] = { x - 1, x, x + 1, x };
+			const int nz[4] = { z, z + 1, z, z - 1 };
+			for (int e = 0; e < 4; e++)
+			{
+				if (nx[e] >= 0 && nx[e] < size && nz[e] >= 0 && nz[e] < size && cellPoly[nz[e] * size + nx[e]] >= 0)
+					poly[nvp + e] = (unsigned short)cellPoly[nz[e] * size + nx[e]];
+			}
+		}
+	}
+	std::vector<unsigned short> flags(polyCount, 1);
+	std::vector<unsigned char> areas(polyCount, 0);
+
+	dtNavMeshCreateParams params;
+	memset(&params, 0, sizeof(params));
+	params.verts = &verts[0];
+	params.vertCount = (int)verts.size() / 3;
+	params.polys = &polys[0];
+	params.polyFlags = &flags[0];
+	params.polyAreas = &areas[0];
+	params.polyCount = polyCount;
+	params.nvp = nvp;
+	params.walkableHeight = 2.0f;
+	params.walkableRadius = 0.5f;
+	params.walkableClimb = 0.5f;
+	dtVset(params.bmin, 0, -1.0f, 0);
+	dtVset(params.bmax, (float)size, 1.0f, (float)size);
+	params.cs = 1.0f;
+	params.ch = 1.0f;
+	params.buildBvTree = true;
+	unsigned char* data = 0;
+	int dataSize = 0;
+	if (!dtCreateNavMeshData(&params, &data, &dataSize))
+		return 0;
+	dtNavMesh* navMesh = dtAllocNavMesh();
+	if (!navMesh || dtStatusFailed(navMesh->init(data, dataSize, DT_TILE_FREE_DATA)))
+	{
+		dtFree(data);
+		dtFreeNavMesh(navMesh);
+		return 0;
+	}
+	return navMesh;
+}
+
+static dtCrowdAgentParams DefaultAgentParams()
+{
+	dtCrowdAgentParams ap;
+	memset(&ap, 0, sizeof(ap));
+	ap.radius = 0.5f;
+	ap.height = 2.0f;
+	ap.maxAcceleration = 8.0f;
+	ap.maxSpeed = 3.5f;
+	ap.collisionQueryRange = ap.radius * 12.0f;
+	ap.pathOptimizationRange = ap.radius * 30.0f;
+	ap.updateFlags = DT_CROWD_ANTICIPATE_TURNS | DT_CROWD_OBSTACLE_AVOIDANCE | DT_CROWD_SEPARATION |
+		DT_CROWD_OPTIMIZE_VIS | DT_CROWD_OPTIMIZE_TOPO;
+	ap.obstacleAvoidanceType = 3;
+	ap.separationWeight = 2.0f;
+	return ap;
+}
+
+// Adds count agents in rows along the -z side of the mesh, each heading for
+// the mirrored spot on the +z side, and the other way round for every other one.
+static void AddCrossingAgents(dtCrowd &crowd, const int count, const float size)
+{
+	const dtCrowdAgentParams ap = DefaultAgentParams();
+	const float ext[3] = { 2.0f, 2.0f, 2.0f };
+	for (int i = 0; i < count; i++)
+	{
+		const float x = 2.5f + (float)(i % 12) * (size - 5.0f) / 11.0f;
+		const float z = 2.5f + (float)(i / 12) * 1.5f;
+		const bool flip = (i % 2) != 0;
+		const float pos[3] = { x, 0, flip ? size - z : z };
+		const float target[3] = { size - x, 0, flip ? z : size - z };
+		const int idx = crowd.addAgent(pos, &ap);
+		REQUIRE(idx >= 0);
+		dtPolyRef ref = 0;
+		float nearest[3];
+		crowd.getNavMeshQuery()->findNearestPoly(target, ext, crowd.getFilter(0), &ref, nearest);
+		REQUIRE(ref != 0);
+		REQUIRE(crowd.requestMoveTarget(idx, ref, nearest));
+	}
+}
+
+// Runs the ranges of a phase on their own threads, one range per worker.
+class ThreadJobRunner : public dtCrowdJobRunner
+{
+public:
+	explicit ThreadJobRunner(int workers) : m_workers(workers) {}
+
+	virtual int getWorkerCount() { return m_workers; }
+
+	virtual void run(dtCrowdJob* job, const int count)
+	{
+		std::vector<std::thread> threads;
+		for (int w = 0; w < m_workers; w++)
+		{
+			const int begin = count * w / m_workers;
+			const int end = count * (w + 1) / m_workers;
+			threads.push_back(std::thread([=]() { job->execute(begin, end, w); }));
+		}
+		for (size_t i = 0; i < threads.size(); i++)
+			threads[i].join();
+	}
+
+private:
+	int m_workers;
+};
+
+TEST_CASE("dtCrowd job runner")
+{
+	const int size = 32;
+	dtNavMesh* navMesh = CreateGridNavMesh(size);
+	REQUIRE(navMesh);
+
+	SECTION("Any worker count gives the same steps")
+	{
+		ThreadJobRunner one(1), several(4);
+		dtCrowd serial, single, parallel;
+		dtCrowd* crowds[3] = { &serial, &single, &parallel };
+		dtCrowdJobRunner* runners[3] = { 0, &one, &several };
+		for (int c = 0; c < 3; c++)
+		{
+			REQUIRE(crowds[c]->init(64, 0.6f, navMesh));
+			REQUIRE(crowds[c]->setJobRunner(runners[c]));
+			AddCrossingAgents(*crowds[c], 48, (float)size);
+		}
+
+		std::vector<float> start;
+		for (int i = 0; i < serial.getAgentCount(); i++)
+			start.insert(start.end(), serial.getAgent(i)->npos, serial.getAgent(i)->npos + 3);
+
+		for (int step = 0; step < 120; step++)
+		{
+			for (int c = 0; c < 3; c++)
+				crowds[c]->update(0.1f, 0);
+			int differences = 0;
+			for (int i = 0; i < serial.getAgentCount(); i++)
+			{
+				const dtCrowdAgent* ag = serial.getAgent(i);
+				for (int c = 1; c < 3; c++)
+				{
+					const dtCrowdAgent* other = crowds[c]->getAgent(i);
+					if (ag->active != other->active ||
+						memcmp(ag->npos, other->npos, sizeof(ag->npos)) != 0 ||
+						memcmp(ag->vel, other->vel, sizeof(ag->vel)) != 0 ||
+						memcmp(ag->nvel, other->nvel, sizeof(ag->nvel)) != 0)
+						differences++;
+				}
+			}
+			REQUIRE(differences == 0);
+		}
+
+		// The agents crossed the mesh, so the steps compared moving agents.
+		float moved = 0;
+		for (int i = 0; i < serial.getAgentCount(); i++)
+		{
+			if (serial.getAgent(i)->active)
+				moved += dtVdist2D(serial.getAgent(i)->npos, &start[i * 3]);
+		}
+		REQUIRE(moved > 48 * (float)size / 2);
+	}
+
+	dtFreeNavMesh(navMesh);
+}
+
+struct PathQueueScene
+{
+	dtNavMesh* navMesh;
+	dtNavMeshQuery* query;
+	dtQueryFilter filter;
+	dtPolyRef startRef, endRef;
+	float startPos[3], endPos[3];
+
+	// A search of a few iterations along a row of the grid.
+	explicit PathQueueScene(const int length)
+	{
+		navMesh = CreateGridNavMesh(length + 2);
+		query = dtAllocNavMeshQuery();
+		query->init(navMesh, 512);
+		const float ext[3] = { 0.5f, 1.0f, 0.5f };
+		const float start[3] = { 0.5f, 0, 0.5f };
+		const float end[3] = { length + 0.5f, 0, 0.5f };
+		query->findNearestPoly(start, ext, &filter, &startRef, startPos);
+		query->findNearestPoly(end, ext, &filter, &endRef, endPos);
+	}
+
+	~PathQueueScene()
+	{
+		dtFreeNavMeshQuery(query);
+		dtFreeNavMesh(navMesh);
+	}
+
+	dtPathQueueRef Request(dtPathQueue &queue, const float priority)
+	{
+		return queue.request(startRef, endRef, startPos, endPos, &filter, priority);
+	}
+};
+
+// Updates the queue one search iteration at a time and reads the results as
+// they finish, in the order of refs. Returns the finished requests in order.
+static std::vector<int> FinishRequests(dtPathQueue &queue, const std::vector<dtPathQueueRef> &refs, const int maxUpdates)
+{
+	std::vector<int> finished;
+	std::vector<bool> done(refs.size(), false);
+	for (int u = 0; u < maxUpdates && finished.size() < refs.size(); u++)
+	{
+		queue.update(1);
+		for (size_t i = 0; i < refs.size(); i++)
+		{
+			if (done[i] || !dtStatusSucceed(queue.getRequestStatus(refs[i])))
+				continue;
+			dtPolyRef path[64];
+			int npath = 0;
+			REQUIRE(dtStatusSucceed(queue.getPathResult(refs[i], path, &npath, 64)));
+			REQUIRE(npath > 1);
+			done[i] = true;
+			finished.push_back((int)i);
+		}
+	}
+	return finished;
+}
+
+TEST_CASE("dtPathQueue")
+{
+	PathQueueScene scene(6);
+	REQUIRE(scene.startRef != 0);
+	REQUIRE(scene.endRef != 0);
+
+	SECTION("Searches lower priorities first, oldest first among equals")
+	{
+		dtPathQueue queue;
+		REQUIRE(queue.init(64, 512, scene.navMesh));
+		queue.setMaxWait(1000);
+		const float priorities[6] = { 3.0f, 1.0f, 2.0f, 1.0f, 0.5f, 3.0f };
+		std::vector<dtPathQueueRef> refs;
+		for (int i = 0; i < 6; i++)
+		{
+			refs.push_back(scene.Request(queue, priorities[i]));
+			REQUIRE(refs.back() != DT_PATHQ_INVALID);
+		}
+		const int expected[6] = { 4, 1, 3, 2, 0, 5 };
+		REQUIRE(FinishRequests(queue, refs, 1000) == std::vector<int>(expected, expected + 6));
+		REQUIRE(queue.getRequestCount() == 0);
+	}
+
+	SECTION("Grows past the initial size up to the limit")
+	{
+		dtPathQueue queue;
+		REQUIRE(queue.init(64, 512, scene.navMesh));
+		std::vector<dtPathQueueRef> refs;
+		for (int i = 0; i < 100; i++)
+		{
+			refs.push_back(scene.Request(queue, 0.0f));
+			REQUIRE(refs.back() != DT_PATHQ_INVALID);
+		}
+		REQUIRE(queue.getRequestCount() == 100);
+		std::vector<dtPathQueueRef> unique(refs);
+		std::sort(unique.begin(), unique.end());
+		REQUIRE(std::unique(unique.begin(), unique.end()) == unique.end());
+		REQUIRE(FinishRequests(queue, refs, 10000).size() == refs.size());
+
+		dtPathQueue limited;
+		REQUIRE(limited.init(64, 512, scene.navMesh, 8));
+		for (int i = 0; i < 8; i++)
+			REQUIRE(scene.Request(limited, 0.0f) != DT_PATHQ_INVALID);
+		REQUIRE(scene.Request(limited, 0.0f) == DT_PATHQ_INVALID);
+	}
+
+	SECTION("Low priorities are not starved by a stream of urgent requests")
+	{
+		// One urgent request per update is more than the budget can search, so
+		// the urgent ones alone would keep the queue busy forever.
+		const int maxWait = 4;
+		const int updates = 200;
+		for (int aging = 0; aging < 2; aging++)
+		{
+			dtPathQueue queue;
+			REQUIRE(queue.init(64, 512, scene.navMesh));
+			queue.setMaxWait(aging ? maxWait : 1 << 30);
+			const dtPathQueueRef low = scene.Request(queue, 100.0f);
+			int finishedAt = -1;
+			std::vector<dtPathQueueRef> urgent;
+			for (int u = 0; u < updates && finishedAt < 0; u++)
+			{
+				urgent.push_back(scene.Request(queue, 0.0f));
+				queue.update(1);
+				if (dtStatusSucceed(queue.getRequestStatus(low)))
+					finishedAt = u;
+				// Read the urgent results so their slots are reused.
+				for (size_t i = 0; i < urgent.size(); i++)
+				{
+					if (dtStatusSucceed(queue.getRequestStatus(urgent[i])))
+					{
+						dtPolyRef path[64];
+						int npath = 0;
+						queue.getPathResult(urgent[i], path, &npath, 64);
+					}
+				}
+			}
+			if (aging)
+			{
+				// Waits for the search in progress, then its own search of about
+				// as many iterations as the path is long.
+				REQUIRE(finishedAt >= maxWait);
+				REQUIRE(finishedAt <= maxWait + 20);
+			}
+			else
+			{
+				REQUIRE(finishedAt == -1);
+			}
+		}
+	}
+}
+
+static dtObstacleAvoidanceParams DefaultAvoidanceParams()
+{
+	// The crowd's defaults.
+	dtObstacleAvoidanceParams params;
+	params.velBias = 0.4f;
+	params.weightDesVel = 2.0f;
+	params.weightCurVel = 0.75f;
+	params.weightSide = 0.75f;
+	params.weightToi = 2.5f;
+	params.horizTime = 2.5f;
+	params.gridSize = 33;
+	params.adaptiveDivs = 7;
+	params.adaptiveRings = 2;
+	params.adaptiveDepth = 5;
+	return params;
+}
+
+static void RandomVelocity(float* vel, const float vmax, unsigned int &seed)
+{
+	const float a = NextRandom(seed) * 6.2831853f;
+	const float v = NextRandom(seed) * vmax;
+	dtVset(vel, cosf(a) * v, 0, sinf(a) * v);
+}
+
+// An agent at the origin among random neighbours and walls.
+struct AvoidanceScene
+{
+	float pos[3], vel[3], dvel[3];
+	float rad, vmax;
+	std::vector<float> circles;		// pos, rad, vel, dvel
+	std::vector<float> segments;	// p, q
+
+	AvoidanceScene(unsigned int seed)
+	{
+		rad = 0.5f;
+		vmax = 3.5f;
+		dtVset(pos, 0, 0, 0);
+		RandomVelocity(vel, vmax, seed);
+		RandomVelocity(dvel, vmax, seed);
+		const int ncircles = (int)(NextRandom(seed) * 7);
+		for (int i = 0; i < ncircles; i++)
+		{
+			float c[10];
+			dtVset(c, (NextRandom(seed) - 0.5f) * 8.0f, 0, (NextRandom(seed) - 0.5f) * 8.0f);
+			c[3] = 0.3f + NextRandom(seed) * 0.5f;
+			RandomVelocity(c + 4, vmax, seed);
+			RandomVelocity(c + 7, vmax, seed);
+			circles.insert(circles.end(), c, c + 10);
+		}
+		const int nsegments = (int)(NextRandom(seed) * 9);
+		for (int i = 0; i < nsegments; i++)
+		{
+			float p[6];
+			dtVset(p, (NextRandom(seed) - 0.5f) * 10.0f, 0, (NextRandom(seed) - 0.5f) * 10.0f);
+			dtVset(p + 3, p[0] + (NextRandom(seed) - 0.5f) * 6.0f, 0, p[2] + (NextRandom(seed) - 0.5f) * 6.0f);
+			segments.insert(segments.end(), p, p + 6);
+		}
+		// Now and then right against a wall.
+		if (nsegments && NextRandom(seed) < 0.2f)
+		{
+			dtVset(&segments[0], -2.0f, 0, 0.005f);
+			dtVset(&segments[3], 2.0f, 0, 0.005f);
+		}
+	}
+
+	// With behindSkipped, leaves out the segments the agent is behind of like a batch does.
+	void AddTo(dtObstacleAvoidanceQuery &query, const bool behindSkipped = false) const
+	{
+		query.reset();
+		for (size_t i = 0; i < circles.size(); i += 10)
+			query.addCircle(&circles[i], circles[i + 3], &circles[i + 4], &circles[i + 7]);
+		for (size_t i = 0; i < segments.size(); i += 6)
+		{
+			if (!behindSkipped || dtTriArea2D(pos, &segments[i], &segments[i + 3]) >= 0.0f)
+				query.addSegment(&segments[i], &segments[i + 3]);
+		}
+	}
+};
+
+// The penalty debug data recorded for velocity vel, FLT_MAX if it was not scored.
+static float SamplePenalty(const dtObstacleAvoidanceDebugData &debug, const float* vel)
+{
+	for (int i = 0; i < debug.getSampleCount(); i++)
+	{
+		if (dtVdist2DSqr(debug.getSampleVelocity(i), vel) < 1e-12f)
+			return debug.getSamplePenalty(i);
+	}
+	return FLT_MAX;
+}
+
+static float MinSamplePenalty(const dtObstacleAvoidanceDebugData &debug)
+{
+	float pen = FLT_MAX;
+	for (int i = 0; i < debug.getSampleCount(); i++)
+		pen = dtMin(pen, debug.getSamplePenalty(i));
+	return pen;
+}
+
+TEST_CASE("dtObstacleAvoidanceQuery")
+{
+	dtObstacleAvoidanceQuery query;
+	REQUIRE(query.init(8, 16));
+	dtObstacleAvoidanceDebugData debug;
+	REQUIRE(debug.init(2048));
+	const dtObstacleAvoidanceParams params = DefaultAvoidanceParams();
+
+	// Without debug data the candidates are scored four at a time with SIMD
+	// where the target has it, with debug data always one at a time.
+	SECTION("Scores the same with and without SIMD")
+	{
+		for (unsigned int s = 1; s <= 500; s++)
+		{
+			const AvoidanceScene scene(s * 7919);
+			for (int adaptive = 0; adaptive < 2; adaptive++)
+			{
+				float fast[3], scalar[3];
+				scene.AddTo(query);
+				const int nfast = adaptive ?
+					query.sampleVelocityAdaptive(scene.pos, scene.rad, scene.vmax, scene.vel, scene.dvel, fast, &params) :
+					query.sampleVelocityGrid(scene.pos, scene.rad, scene.vmax, scene.vel, scene.dvel, fast, &params);
+				scene.AddTo(query);
+				const int nscalar = adaptive ?
+					query.sampleVelocityAdaptive(scene.pos, scene.rad, scene.vmax, scene.vel, scene.dvel, scalar, &params, &debug) :
+					query.sampleVelocityGrid(scene.pos, scene.rad, scene.vmax, scene.vel, scene.dvel, scalar, &params, &debug);
+				REQUIRE(nfast == nscalar);
+				REQUIRE(memcmp(fast, scalar, sizeof(fast)) == 0);
+				if (!adaptive)
+				{
+					// The pick is the lowest penalty the one at a time path scored,
+					// the adaptive debug data holds every depth.
+					REQUIRE(SamplePenalty(debug, fast) == MinSamplePenalty(debug));
+				}
+			}
+		}
+	}
+
+	SECTION("The range calls sample every batch agent like the single agent calls")
+	{
+		const int nagents = 200;
+		std::vector<AvoidanceScene> scenes;
+		for (int i = 0; i < nagents; i++)
+			scenes.push_back(AvoidanceScene(1000 + i * 31));
+
+		dtObstacleAvoidanceBatch batch;
+		REQUIRE(batch.init(nagents, nagents * 6, 6));
+		std::vector<float> results(nagents * 3, -1.0f);
+		for (int adaptive = 0; adaptive < 2; adaptive++)
+		{
+			batch.reset(nagents);
+			int ncircles = 0;
+			for (int i = 0; i < nagents; i++)
+			{
+				// Every fifth agent is left inactive, and another fifth is
+				// sampled with debug data, through the obstacles of the query.
+				if (i % 5 == 4)
+					continue;
+				const AvoidanceScene &scene = scenes[i];
+				batch.setAgent(i, scene.pos, scene.rad, scene.vmax, scene.vel, scene.dvel, &results[i * 3], &params,
+							   i % 5 == 2 ? &debug : 0);
+				for (size_t c = 0; c < scene.circles.size(); c += 10)
+				{
+					batch.setCircle(ncircles, &scene.circles[c], scene.circles[c + 3], &scene.circles[c + 4], &scene.circles[c + 7]);
+					batch.addAgentCircle(i, ncircles++);
+				}
+				if (!scene.segments.empty())
+					batch.setAgentSegments(i, &scene.segments[0], (int)scene.segments.size() / 6, 6);
+			}
+
+			// Two ranges, the way the crowd splits the agents between workers.
+			const int nbatch = adaptive ?
+				query.sampleVelocityAdaptiveRange(&batch, 0, 17) + query.sampleVelocityAdaptiveRange(&batch, 17, nagents) :
+				query.sampleVelocityGridRange(&batch, 0, 17) + query.sampleVelocityGridRange(&batch, 17, nagents);
+
+			int nsingle = 0;
+			for (int i = 0; i < nagents; i++)
+			{
+				float nvel[3] = { -1.0f, -1.0f, -1.0f };
+				if (i % 5 != 4)
+				{
+					const AvoidanceScene &scene = scenes[i];
+					dtObstacleAvoidanceDebugData* agentDebug = i % 5 == 2 ? &debug : 0;
+					scene.AddTo(query, true);
+					nsingle += adaptive ?
+						query.sampleVelocityAdaptive(scene.pos, scene.rad, scene.vmax, scene.vel, scene.dvel, nvel, &params, agentDebug) :
+						query.sampleVelocityGrid(scene.pos, scene.rad, scene.vmax, scene.vel, scene.dvel, nvel, &params, agentDebug);
+				}
+				REQUIRE(memcmp(nvel, &results[i * 3], sizeof(nvel)) == 0);
+			}
+			REQUIRE(nbatch == nsingle);
+		}
+	}
+}
+
+// Agents on an open plane steered by ORCA alone, each one heading straight for its goal.
+struct OrcaScene
+{
+	std::vector<float> pos, vel, goals;
+	float rad, vmax;
+
+	OrcaScene() : rad(0.5f), vmax(3.5f) {}
+
+	void AddAgent(float x, float z, float gx, float gz)
+	{
+		const float p[3] = { x, 0, z };
+		const float g[3] = { gx, 0, gz };
+		pos.insert(pos.end(), p, p + 3);
+		goals.insert(goals.end(), g, g + 3);
+		vel.insert(vel.end(), 3, 0.0f);
+	}
+
+	int Count() const { return (int)pos.size() / 3; }
+
+	// Moves every agent one step, returns the smallest distance between two agents after it.
+	float Step(dtOrcaAvoidance &orca, dtObstacleAvoidanceBatch &batch, const dtObstacleAvoidanceParams &params, const float dt)
+	{
+		const int n = Count();
+		std::vector<float> dvel(n * 3), nvel(n * 3);
+		batch.reset(n);
+		batch.setTimeStep(dt);
+		for (int i = 0; i < n; i++)
+		{
+			dtVsub(&dvel[i * 3], &goals[i * 3], &pos[i * 3]);
+			const float dist = dtVlen(&dvel[i * 3]);
+			if (dist > vmax * dt)
+				dtVscale(&dvel[i * 3], &dvel[i * 3], vmax / dist);
+			else
+				dtVscale(&dvel[i * 3], &dvel[i * 3], 1.0f / dt);
+		}
+		for (int i = 0; i < n; i++)
+			batch.setCircle(i, &pos[i * 3], rad, &vel[i * 3], &dvel[i * 3]);
+		for (int i = 0; i < n; i++)
+		{
+			batch.setAgent(i, &pos[i * 3], rad, vmax, &vel[i * 3], &dvel[i * 3], &nvel[i * 3], &params);
+			for (int j = 0; j < n; j++)
+			{
+				if (j != i)
+					batch.addAgentCircle(i, j);
+			}
+		}
+		for (int i = 0; i < n; i++)
+			orca.solve(&batch, i);
+
+		float minDist = FLT_MAX;
+		for (int i = 0; i < n; i++)
+		{
+			dtVcopy(&vel[i * 3], &nvel[i * 3]);
+			dtVmad(&pos[i * 3], &pos[i * 3], &vel[i * 3], dt);
+		}
+		for (int i = 0; i < n; i++)
+		{
+			for (int j = i + 1; j < n; j++)
+				minDist = dtMin(minDist, dtVdist2D(&pos[i * 3], &pos[j * 3]));
+		}
+		return minDist;
+	}
+
+	float MaxGoalDistance() const
+	{
+		float d = 0;
+		for (int i = 0; i < Count(); i++)
+			d = dtMax(d, dtVdist2D(&pos[i * 3], &goals[i * 3]));
+		return d;
+	}
+};
+
+static bool IsFiniteVelocity(const float* vel)
+{
+	return dtMathIsfinite(vel[0]) && dtMathIsfinite(vel[1]) && dtMathIsfinite(vel[2]);
+}
+
+TEST_CASE("dtOrcaAvoidance")
+{
+	dtOrcaAvoidance orca;
+	dtObstacleAvoidanceBatch batch;
+	REQUIRE(batch.init(16, 16, 16));
+	const dtObstacleAvoidanceParams params = DefaultAvoidanceParams();
+	const float dt = 0.1f;
+
+	SECTION("Head-on agents pass each other without touching")
+	{
+		// Slightly off one line, agents exactly opposite each other only slow
+		// down, as with any reciprocal avoidance. The same goes for symmetric
+		// scenes below.
+		OrcaScene scene;
+		scene.AddAgent(-5.0f, -0.1f, 5.0f, -0.1f);
+		scene.AddAgent(5.0f, 0.1f, -5.0f, 0.1f);
+		float minDist = FLT_MAX;
+		for (int step = 0; step < 100; step++)
+			minDist = dtMin(minDist, scene.Step(orca, batch, params, dt));
+		REQUIRE(minDist >= 2 * scene.rad - 0.01f);
+		REQUIRE(scene.MaxGoalDistance() < 0.1f);
+	}
+
+	SECTION("Crossing agents pass each other without touching")
+	{
+		// Two pairs in opposite lanes crossing two others, starting at different
+		// distances from the crossing so that not everyone meets at once.
+		OrcaScene scene;
+		scene.AddAgent(-6.0f, -1.0f, 6.0f, -1.0f);
+		scene.AddAgent(7.3f, 1.0f, -6.0f, 1.0f);
+		scene.AddAgent(1.0f, -8.6f, 1.0f, 6.0f);
+		scene.AddAgent(-1.0f, 9.9f, -1.0f, -6.0f);
+		float minDist = FLT_MAX;
+		for (int step = 0; step < 200; step++)
+		{
+			minDist = dtMin(minDist, scene.Step(orca, batch, params, dt));
+			for (int i = 0; i < scene.Count(); i++)
+				REQUIRE(dtVlen(&scene.vel[i * 3]) <= scene.vmax * 1.001f);
+		}
+		REQUIRE(minDist >= 2 * scene.rad - 0.01f);
+		REQUIRE(scene.MaxGoalDistance() < 0.1f);
+	}
+
+	SECTION("Falls back to the least violation when boxed in, still respecting walls")
+	{
+		// Overlapping neighbours all around pushing in, a wall ahead and the
+		// desired velocity into it. No velocity within the max speed meets all
+		// the neighbour constraints.
+		const float pos[3] = { 0, 0, 0 };
+		const float vel[3] = { 0, 0, 0 };
+		const float dvel[3] = { 0, 0, 3.5f };
+		const float wall[6] = { -2.0f, 0, 1.0f, 2.0f, 0, 1.0f };
+		float nvel[3] = { 0, 0, 0 };
+		batch.reset(1);
+		batch.setTimeStep(dt);
+		batch.setAgent(0, pos, 0.5f, 3.5f, vel, dvel, nvel, &params);
+		for (int i = 0; i < 6; i++)
+		{
+			const float a = (float)i * 6.2831853f / 6.0f;
+			const float cpos[3] = { cosf(a) * 0.6f, 0, sinf(a) * 0.6f };
+			const float cvel[3] = { -cosf(a), 0, -sinf(a) };
+			batch.setCircle(i, cpos, 0.5f, cvel, cvel);
+			batch.addAgentCircle(0, i);
+		}
+		batch.setAgentSegments(0, wall, 1, 6);
+
+		REQUIRE(orca.solve(&batch, 0) == 7);
+		REQUIRE(IsFiniteVelocity(nvel));
+		REQUIRE(dtVlen(nvel) <= 3.5f * 1.001f);
+		// The wall half a radius away is not reached within the time horizon.
+		REQUIRE(nvel[2] <= 0.5f / params.horizTime + 0.001f);
+
+		// Overlapping a lone neighbour is resolvable, the agent moves away from it.
+		batch.reset(1);
+		batch.setAgent(0, pos, 0.5f, 3.5f, vel, vel, nvel, &params);
+		const float cpos[3] = { 0.6f, 0, 0 };
+		batch.setCircle(0, cpos, 0.5f, vel, vel);
+		batch.addAgentCircle(0, 0);
+		REQUIRE(orca.solve(&batch, 0) == 1);
+		REQUIRE(IsFiniteVelocity(nvel));
+		REQUIRE(nvel[0] < 0);
+	}
+}
+
+TEST_CASE("dtCrowd obstacle avoidance backend")
+{
+	const int size = 32;
+	dtNavMesh* navMesh = CreateGridNavMesh(size);
+	REQUIRE(navMesh);
+
+	SECTION("Can be switched on a live crowd")
+	{
+		// The same crowd twice, the second one switches to ORCA and back while walking.
+		dtOrcaAvoidance orca;
+		ThreadJobRunner runner(4);
+		dtCrowd sampled, switched;
+		REQUIRE(sampled.init(64, 0.6f, navMesh));
+		REQUIRE(switched.init(64, 0.6f, navMesh));
+		REQUIRE(switched.setJobRunner(&runner));
+		AddCrossingAgents(sampled, 48, (float)size);
+		AddCrossingAgents(switched, 48, (float)size);
+		REQUIRE(switched.getObstacleAvoidanceBackend(3) == 0);
+
+		std::vector<float> start;
+		for (int i = 0; i < switched.getAgentCount(); i++)
+			start.insert(start.end(), switched.getAgent(i)->npos, switched.getAgent(i)->npos + 3);
+
+		int orcaDifferences = 0;
+		for (int step = 0; step < 200; step++)
+		{
+			if (step == 20)
+			{
+				switched.setObstacleAvoidanceBackend(3, &orca);
+				REQUIRE(switched.getObstacleAvoidanceBackend(3) == &orca);
+			}
+			else if (step == 60)
+			{
+				switched.setObstacleAvoidanceBackend(3, 0);
+				REQUIRE(switched.getObstacleAvoidanceBackend(3) == 0);
+			}
+			sampled.update(0.1f, 0);
+			switched.update(0.1f, 0);
+
+			int differences = 0;
+			for (int i = 0; i < switched.getAgentCount(); i++)
+			{
+				const dtCrowdAgent* ag = switched.getAgent(i);
+				REQUIRE(IsFiniteVelocity(ag->nvel));
+				REQUIRE(IsFiniteVelocity(ag->npos));
+				REQUIRE(dtVlen(ag->nvel) <= ag->params.maxSpeed * 1.001f);
+				if (memcmp(ag->nvel, sampled.getAgent(i)->nvel, sizeof(ag->nvel)) != 0)
+					differences++;
+			}
+			// Same steps until the switch, then ORCA picks other velocities.
+			if (step < 20)
+				REQUIRE(differences == 0);
+			else if (step < 60)
+				orcaDifferences += differences;
+		}
+		REQUIRE(orcaDifferences > 0);
+
+		// The agents kept crossing the mesh after switching back.
+		float moved = 0;
+		for (int i = 0; i < switched.getAgentCount(); i++)
+			moved += dtVdist2D(switched.getAgent(i)->npos, &start[i * 3]);
+		REQUIRE(moved > 48 * (float)size / 2);
+	}
+
+	dtFreeNavMesh(navMesh);
+}
+
+// The largest neighbour, corner and wall segment counts seen on any agent.
+struct CrowdLimitsSeen
+{
+	int neighbours, corners, segments;
+
+	CrowdLimitsSeen() : neighbours(0), corners(0), segments(0) {}
+
+	void Add(dtCrowd &crowd)
+	{
+		for (int i = 0; i < crowd.getAgentCount(); i++)
+		{
+			const dtCrowdAgent* ag = crowd.getAgent(i);
+			if (!ag->active)
+				continue;
+			neighbours = dtMax(neighbours, ag->nneis);
+			corners = dtMax(corners, ag->ncorners);
+			segments = dtMax(segments, ag->boundary.getSegmentCount());
+		}
+	}
+};
+
+TEST_CASE("dtCrowd config")
+{
+	// Pillars every four cells give the agents walls to avoid and paths with corners.
+	const int size = 32;
+	std::vector<bool> holes(size * size, false);
+	for (int z = 2; z < size - 2; z += 4)
+		for (int x = 4; x < size - 4; x += 4)
+			holes[z * size + x] = true;
+	dtNavMesh* navMesh = CreateGridNavMesh(size, holes);
+	REQUIRE(navMesh);
+
+	SECTION("Agents stay within lowered and raised limits")
+	{
+		dtCrowdConfig configs[3];
+		dtCrowdConfigDefaults(&configs[0], 64, 0.6f);
+		configs[0].maxNeighbours = 2;
+		configs[0].maxCorners = 2;
+		configs[0].maxLocalSegments = 3;
+		dtCrowdConfigDefaults(&configs[1], 64, 0.6f);
+		dtCrowdConfigDefaults(&configs[2], 64, 0.6f);
+		configs[2].maxNeighbours = 16;
+		configs[2].maxCorners = 8;
+		configs[2].maxLocalSegments = 24;
+		configs[2].maxLocalPolys = 48;
+
+		CrowdLimitsSeen seen[3];
+		for (int c = 0; c < 3; c++)
+		{
+			dtCrowd crowd;
+			REQUIRE(crowd.init(&configs[c], navMesh));
+			REQUIRE(crowd.getConfig()->maxNeighbours == configs[c].maxNeighbours);
+			AddCrossingAgents(crowd, 48, (float)size);
+			for (int step = 0; step < 100; step++)
+			{
+				crowd.update(0.1f, 0);
+				seen[c].Add(crowd);
+			}
+			REQUIRE(seen[c].neighbours <= configs[c].maxNeighbours);
+			REQUIRE(seen[c].corners <= configs[c].maxCorners);
+			REQUIRE(seen[c].segments <= configs[c].maxLocalSegments);
+		}
+
+		// The lowered limits are reached, the raised ones are used past the
+		// defaults. The corridor returns one corner less than its limit.
+		REQUIRE(seen[0].neighbours == configs[0].maxNeighbours);
+		REQUIRE(seen[0].corners == configs[0].maxCorners - 1);
+		REQUIRE(seen[0].segments == configs[0].maxLocalSegments);
+		REQUIRE(seen[2].neighbours > seen[1].neighbours);
+		REQUIRE(seen[2].corners > seen[1].corners);
+		REQUIRE(seen[2].segments > seen[1].segments);
+	}
+
+	SECTION("Agents walk without wall segments")
+	{
+		ThreadJobRunner runner(2);
+		dtCrowdConfig config;
+		dtCrowdConfigDefaults(&config, 64, 0.6f);
+		config.maxLocalSegments = 0;
+		dtCrowd crowd;
+		REQUIRE(crowd.init(&config, navMesh));
+		REQUIRE(crowd.setJobRunner(&runner));
+		AddCrossingAgents(crowd, 48, (float)size);
+
+		std::vector<float> start;
+		for (int i = 0; i < crowd.getAgentCount(); i++)
+			start.insert(start.end(), crowd.getAgent(i)->npos, crowd.getAgent(i)->npos + 3);
+		CrowdLimitsSeen seen;
+		for (int step = 0; step < 100; step++)
+		{
+			crowd.update(0.1f, 0);
+			seen.Add(crowd);
+		}
+		REQUIRE(seen.segments == 0);
+		float moved = 0;
+		for (int i = 0; i < crowd.getAgentCount(); i++)
+			moved += dtVdist2D(crowd.getAgent(i)->npos, &start[i * 3]);
+		REQUIRE(moved > 48 * (float)size / 4);
+	}
+
+	SECTION("Limits below the minimum are rejected")
+	{
+		dtCrowdConfig config;
+		dtCrowdConfigDefaults(&config, 64, 0.6f);
+		dtCrowd crowd;
+		config.maxNeighbours = 0;
+		REQUIRE(!crowd.init(&config, navMesh));
+		dtCrowdConfigDefaults(&config, 64, 0.6f);
+		config.maxCorners = 1;
+		REQUIRE(!crowd.init(&config, navMesh));
+		dtCrowdConfigDefaults(&config, 64, 0.6f);
+		config.maxLocalSegments = -1;
+		REQUIRE(!crowd.init(&config, navMesh));
+		dtCrowdConfigDefaults(&config, 64, 0.6f);
+		REQUIRE(crowd.init(&config, navMesh));
+	}
+
+	dtFreeNavMesh(navMesh);
+}
+
+// TODO: Implement benchmarking for platforms other than posix.
+#ifdef __unix__
+#include <unistd.h>
+#ifdef _POSIX_TIMERS
+#include <time.h>
+#include <stdint.h>
+
+static int64_t CrowdNowNanos() {
+	struct timespec tp;
+	clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &tp);
+	return tp.tv_nsec + 1000000000LL * tp.tv_sec;
+}
+
+#define BM(name, iterations) \
+	struct BM_ ## name { \
+		static void Run() { \
+			int64_t begin_time = CrowdNowNanos(); \
+			for (int i = 0 ; i < iterations; i++) { \
+				Body(); \
+			} \
+			int64_t nanos = CrowdNowNanos() - begin_time; \
+			printf("BM_%-35s %ld iterations in %10ld nanos: %10.2f nanos/it\n", #name ":", (int64_t)iterations, nanos, double(nanos) / iterations); \
+		} \
+		static void Body(); \
+	}; \
+	TEST_CASE(#name) { \
+		BM_ ## name::Run(); \
+	} \
+	void BM_ ## name::Body()
+
+// One crowd tick with the default crowd settings: 0.6 radius agents, about
+// four square metres per agent, cells of three radii and a query range of
+// twelve radii around every agent.
+static void BenchProximityTick(dtProximityGrid &grid, const std::vector<GridItem> &items)
+{
+	AddItems(grid, items);
+	unsigned int ids[32];
+	int found = 0;
+	for (size_t i = 0; i < items.size(); i++)
+	{
+		const float x = (items[i].bmin[0] + items[i].bmax[0]) * 0.5f;
+		const float y = (items[i].bmin[1] + items[i].bmax[1]) * 0.5f;
+		found += grid.queryItems(x - 7.2f, y - 7.2f, x + 7.2f, y + 7.2f, ids, 32);
+	}
+	REQUIRE(found > 0);
+}
+
+static void BenchProximityGrid(int count)
+{
+	static std::vector<GridItem> items;
+	static dtProximityGrid *grid = 0;
+	if ((int)items.size() != count)
+	{
+		items = RandomItems(count, sqrtf(count * 4.0f), 0.6f, 1);
+		delete grid;
+		grid = new dtProximityGrid();
+		grid->init(count * 4, 1.8f);
+	}
+	BenchProximityTick(*grid, items);
+}
+
+BM(ProximityGrid_1k, 100)
+{
+	BenchProximityGrid(1000);
+}
+BM(ProximityGrid_10k, 10)
+{
+	BenchProximityGrid(10000);
+}
+BM(ProximityGrid_50k, 2)
+{
+	BenchProximityGrid(50000);
+}
+
+#undef BM
+#endif  // _POSIX_TIMERS
+#endif  // __unix__
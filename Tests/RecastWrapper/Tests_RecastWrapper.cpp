@@ -0,0 +1,280 @@
+#include <stdio.h>
+#include <math.h>
+#include <string.h>
+#include <map>
+#include <vector>
+
+#include "catch.hpp"
+
+#include "DetourCommon.h"
+#include "DetourNavMesh.h"
+#include "DetourNavMeshBuilder.h"
+#include "DetourNavMeshQuery.h"
+#include "RecastWrapper.h"
+
+// The poly flags of RecastWrapper's sample areas.
+static const unsigned short POLYFLAGS_WALK = 0x01;
+static const unsigned short POLYFLAGS_DISABLED = 0x10;
+
+// Axis aligned quads on a single tile, edges shared by two quads are linked.
+struct QuadMesh
+{
+	float bmin[3];
+	float bmax[3];
+	float cs;
+	float ch;
+	std::vector<unsigned short> verts;
+	std::vector<unsigned short> polys;
+	std::vector<unsigned short> flags;
+	std::vector<unsigned char> areas;
+	std::map<std::vector<unsigned short>, unsigned short> vertIndex;
+
+	QuadMesh(float minx, float miny, float minz, float maxx, float maxy, float maxz, float cellSize)
+		: cs(cellSize), ch(0.5f)
+	{
+		bmin[0] = minx; bmin[1] = miny; bmin[2] = minz;
+		bmax[0] = maxx; bmax[1] = maxy; bmax[2] = maxz;
+	}
+
+	unsigned short AddVert(float x, float y, float z)
+	{
+		std::vector<unsigned short> v(3);
+		v[0] = (unsigned short)floorf((x - bmin[0]) / cs + 0.5f);
+		v[1] = (unsigned short)floorf((y - bmin[1]) / ch + 0.5f);
+		v[2] = (unsigned short)floorf((z - bmin[2]) / cs + 0.5f);
+		std::map<std::vector<unsigned short>, unsigned short>::iterator it = vertIndex.find(v);
+		if (it != vertIndex.end())
+			return it->second;
+		const unsigned short index = (unsigned short)(verts.size() / 3);
+		verts.insert(verts.end(), v.begin(), v.end());
+		vertIndex[v] = index;
+		return index;
+	}
+
+	void AddQuad(float x0, float z0, float x1, float z1, float y, unsigned short flag = POLYFLAGS_WALK)
+	{
+		const unsigned short quad[4] = { AddVert(x0, y, z0), AddVert(x0, y, z1), AddVert(x1, y, z1), AddVert(x1, y, z0) };
+		for (int i = 0; i < 4; i++)
+			polys.push_back(quad[i]);
+		for (int i = 4; i < 2 * DT_VERTS_PER_POLYGON; i++)
+			polys.push_back(0xffff);
+		flags.push_back(flag);
+		areas.push_back(0);
+	}
+
+	void AddQuads(float x0, float z0, float x1, float z1, float y, float size)
+	{
+		for (float x = x0; x < x1; x += size)
+			for (float z = z0; z < z1; z += size)
+				AddQuad(x, z, x + size, z + size, y);
+	}
+
+	void LinkEdges()
+	{
+		const int nvp = DT_VERTS_PER_POLYGON;
+		std::map<std::pair<unsigned short, unsigned short>, unsigned short> edges;
+		const int polyCount = (int)flags.size();
+		for (int p = 0; p < polyCount; p++)
+			for (int e = 0; e < 4; e++)
+				edges[std::make_pair(polys[p * 2 * nvp + e], polys[p * 2 * nvp + (e + 1) % 4])] = (unsigned short)p;
+		for (int p = 0; p < polyCount; p++)
+		{
+			for (int e = 0; e < 4; e++)
+			{
+				std::map<std::pair<unsigned short, unsigned short>, unsigned short>::iterator it =
+					edges.find(std::make_pair(polys[p * 2 * nvp + (e + 1) % 4], polys[p * 2 * nvp + e]));
+				if (it != edges.end())
+					polys[p * 2 * nvp + nvp + e] = it->second;
+			}
+		}
+	}
+
+	// Writes the single tile nav data BuildBlockData reads.
+	bool Write(const char* path)
+	{
+		LinkEdges();
+		dtNavMeshCreateParams params;
+		memset(&params, 0, sizeof(params));
+		params.verts = &verts[0];
+		params.vertCount = (int)verts.size() / 3;
+		params.polys = &polys[0];
+		params.polyFlags = &flags[0];
+		params.polyAreas = &areas[0];
+		params.polyCount = (int)flags.size();
+		params.nvp = DT_VERTS_PER_POLYGON;
+		params.walkableHeight = 2.0f;
+		params.walkableRadius = 0.6f;
+		params.walkableClimb = 0.9f;
+		dtVcopy(params.bmin, bmin);
+		dtVcopy(params.bmax, bmax);
+		params.cs = cs;
+		params.ch = ch;
+		params.buildBvTree = true;
+		unsigned char* data = 0;
+		int dataSize = 0;
+		if (!dtCreateNavMeshData(&params, &data, &dataSize))
+			return false;
+		FILE* fp = fopen(path, "wb");
+		if (fp)
+		{
+			fwrite(data, dataSize, 1, fp);
+			fclose(fp);
+		}
+		dtFree(data);
+		return fp != 0;
+	}
+};
+
+static std::vector<char> ReadBlockData(const char* path, int width, int height)
+{
+	std::vector<char> block;
+	FILE* fp = fopen(path, "rb");
+	if (!fp)
+		return block;
+	int w = 0, h = 0;
+	if (fread(&w, sizeof(w), 1, fp) == 1 && fread(&h, sizeof(h), 1, fp) == 1 && w == width && h == height)
+	{
+		block.resize(width * height);
+		if (fread(&block[0], block.size(), 1, fp) != 1)
+			block.clear();
+	}
+	fclose(fp);
+	return block;
+}
+
+// The nearest poly and wall distance queries of every cell, what BuildBlockData
+// did before it rasterized the polygons.
+static std::vector<char> ExactBlockData(const char* binPath, int width, int height)
+{
+	std::vector<char> block;
+	FILE* fp = fopen(binPath, "rb");
+	if (!fp)
+		return block;
+	fseek(fp, 0, SEEK_END);
+	const int dataSize = (int)ftell(fp);
+	fseek(fp, 0, SEEK_SET);
+	unsigned char* data = (unsigned char*)dtAlloc(dataSize, DT_ALLOC_PERM);
+	const bool read = fread(data, dataSize, 1, fp) == 1;
+	fclose(fp);
+	dtNavMesh* navMesh = dtAllocNavMesh();
+	dtNavMeshQuery* navQuery = dtAllocNavMeshQuery();
+	if (!read || dtStatusFailed(navMesh->init(data, dataSize, DT_TILE_FREE_DATA)))
+		dtFree(data);
+	else if (dtStatusSucceed(navQuery->init(navMesh, 2048)))
+	{
+		dtQueryFilter filter;
+		filter.setIncludeFlags(0xffff ^ POLYFLAGS_DISABLED);
+		filter.setExcludeFlags(0);
+		const float extents[3] = { 50.6f, 50.0f, 50.6f };
+		block.resize(width * height);
+		for (int j = 0; j < height; j++)
+		{
+			for (int i = 0; i < width; i++)
+			{
+				const float pos[3] = { -(float)i, 0, (float)j };
+				dtPolyRef ref = 0;
+				float nearest[3];
+				bool overPoly = false;
+				dtStatus status = navQuery->findNearestPoly(pos, extents, &filter, &ref, nearest, &overPoly);
+				if (overPoly && status == DT_SUCCESS)
+				{
+					float hitDist, hitPos[3], hitNormal[3];
+					status = navQuery->findDistanceToWall(ref, pos, 20.0f, &filter, &hitDist, hitPos, hitNormal);
+					overPoly = status == DT_SUCCESS && hitDist >= 0.6f;
+				}
+				block[j * width + i] = overPoly;
+			}
+		}
+	}
+	dtFreeNavMeshQuery(navQuery);
+	dtFreeNavMesh(navMesh);
+	return block;
+}
+
+// A flat square obj from (minx, minz) to (maxx, maxz).
+static bool WritePlaneObj(const char* path, float minx, float minz, float maxx, float maxz)
+{
+	FILE* fp = fopen(path, "w");
+	if (!fp)
+		return false;
+	fprintf(fp, "v %f 0 %f\nv %f 0 %f\nv %f 0 %f\nv %f 0 %f\n", minx, minz, maxx, minz, maxx, maxz, minx, maxz);
+	fprintf(fp, "f 1 3 2\nf 1 4 3\n");
+	fclose(fp);
+	return true;
+}
+
+static int CountWalkable(const std::vector<char> &block)
+{
+	int count = 0;
+	for (size_t i = 0; i < block.size(); i++)
+		count += block[i] ? 1 : 0;
+	return count;
+}
+
+TEST_CASE("BuildBlockData")
+{
+	const char* binPath = "Tests_RecastWrapper_navmesh.bin";
+	const char* blockPath = "Tests_RecastWrapper_block.bin";
+
+	SECTION("Matches the exact queries on stacked floors")
+	{
+		// A low ground floor, a floor just above the sampled height over its
+		// middle, a higher walkway and a disabled platform. The cells near the
+		// upper floors are nearer to them than to the ground under them.
+		QuadMesh mesh(-42.0f, -4.0f, -2.0f, 2.0f, 4.0f, 42.0f, 0.5f);
+		mesh.AddQuads(-40.5f, -0.5f, 0.5f, 40.5f, -3.0f, 20.5f);
+		mesh.AddQuad(-25.5f, 14.5f, -14.5f, 25.5f, 0.5f);
+		mesh.AddQuad(-8.5f, 4.5f, -4.5f, 30.5f, 2.5f);
+		mesh.AddQuad(-35.5f, 30.5f, -30.5f, 35.5f, -1.0f, POLYFLAGS_DISABLED);
+		REQUIRE(mesh.Write(binPath));
+
+		const int width = 40, height = 40;
+		const std::vector<char> exact = ExactBlockData(binPath, width, height);
+		REQUIRE(CountWalkable(exact) > 0);
+		REQUIRE(CountWalkable(exact) < width * height);
+		for (int threads = 1; threads <= 4; threads += 3)
+		{
+			REQUIRE(BuildBlockDataEx(binPath, blockPath, width, height, false, threads) == 0);
+			REQUIRE(ReadBlockData(blockPath, width, height) == exact);
+		}
+	}
+
+	SECTION("Matches the exact queries where the wall search runs out of nodes")
+	{
+		// More polygons within the wall search radius than a query has nodes.
+		QuadMesh mesh(-22.0f, -1.0f, -2.0f, 2.0f, 1.0f, 22.0f, 0.125f);
+		mesh.AddQuads(-20.125f, -0.125f, 0.125f, 20.125f, 0.0f, 0.25f);
+		REQUIRE(mesh.Write(binPath));
+
+		const int width = 21, height = 21;
+		const std::vector<char> exact = ExactBlockData(binPath, width, height);
+		REQUIRE(CountWalkable(exact) > 0);
+		REQUIRE(BuildBlockDataEx(binPath, blockPath, width, height, false, 4) == 0);
+		REQUIRE(ReadBlockData(blockPath, width, height) == exact);
+	}
+
+	SECTION("Obstacles are sampled on the tile cache navmesh just loaded")
+	{
+		// A small mesh built after the sampled one, which used to be sampled instead.
+		const char* objPath = "Tests_RecastWrapper_plane.obj";
+		const char* otherBinPath = "Tests_RecastWrapper_other.bin";
+		REQUIRE(WritePlaneObj(objPath, -44.0f, -4.0f, 4.0f, 44.0f));
+		REQUIRE(BuildTempObstacles(objPath, binPath, 0) != 0);
+		REQUIRE(WritePlaneObj(objPath, -44.0f, 34.0f, -34.0f, 44.0f));
+		REQUIRE(BuildTempObstacles(objPath, otherBinPath, 0) != 0);
+
+		const int width = 40, height = 40;
+		REQUIRE(BuildBlockDataObstaclesEx(binPath, blockPath, width, height, false, 2) == 0);
+		const std::vector<char> block = ReadBlockData(blockPath, width, height);
+		REQUIRE(block.size() == (size_t)(width * height));
+		// Walkable away from the obstacle at (-32, 32), not under it.
+		REQUIRE(block[5 * width + 5]);
+		REQUIRE(!block[32 * width + 32]);
+		REQUIRE(CountWalkable(block) > width * height / 2);
+		remove(objPath);
+		remove(otherBinPath);
+	}
+
+	remove(binPath);
+	remove(blockPath);
+}
@@ -0,0 +1,89 @@
+#pragma once
+#include <vector>
+
+// Intrusive binary min-heap used as the A* open list.
+// Items are ordered by Traits::Key() and remember their own slot through
+// Traits::Pos(), so an item already in the heap can be re-sorted in O(log n)
+// without searching for it. Storage is a single vector which keeps its
+// capacity between searches, so pushes do not allocate once it has grown.
+template<class T, class Traits>
+class CAStarHeap
+{
+public:
+	CAStarHeap() {}
+	explicit CAStarHeap(const Traits &traits) : m_traits(traits) {}
+
+	inline void SetTraits(const Traits &traits) { m_traits = traits; }
+	inline void Reserve(int n) { m_vecHeap.reserve(n); }
+	inline void Clear() { m_vecHeap.clear(); }
+	inline bool Empty() const { return m_vecHeap.empty(); }
+	inline int Size() const { return (int)m_vecHeap.size(); }
+	inline T Top() const { return m_vecHeap[0]; }
+
+	void Push(T item)
+	{
+		m_vecHeap.push_back(item);
+		BubbleUp((int)m_vecHeap.size() - 1, item);
+	}
+
+	T Pop()
+	{
+		T top = m_vecHeap[0];
+		T last = m_vecHeap.back();
+		m_vecHeap.pop_back();
+		if (!m_vecHeap.empty())
+		{
+			TrickleDown(0, last);
+		}
+		m_traits.Pos(top) = -1;
+		return top;
+	}
+
+	// The key of item has decreased, move it up to its new place.
+	void Modify(T item)
+	{
+		BubbleUp(m_traits.Pos(item), item);
+	}
+
+private:
+	void BubbleUp(int i, T item)
+	{
+		const int key = m_traits.Key(item);
+		while (i > 0)
+		{
+			int parent = (i - 1) / 2;
+			T p = m_vecHeap[parent];
+			if (m_traits.Key(p) <= key)
+				break;
+			m_vecHeap[i] = p;
+			m_traits.Pos(p) = i;
+			i = parent;
+		}
+		m_vecHeap[i] = item;
+		m_traits.Pos(item) = i;
+	}
+
+	void TrickleDown(int i, T item)
+	{
+		const int key = m_traits.Key(item);
+		const int size = (int)m_vecHeap.size();
+		int child = i * 2 + 1;
+		while (child < size)
+		{
+			if (child + 1 < size && m_traits.Key(m_vecHeap[child + 1]) < m_traits.Key(m_vecHeap[child]))
+				child++;
+			T c = m_vecHeap[child];
+			if (key <= m_traits.Key(c))
+				break;
+			m_vecHeap[i] = c;
+			m_traits.Pos(c) = i;
+			i = child;
+			child = i * 2 + 1;
+		}
+		m_vecHeap[i] = item;
+		m_traits.Pos(item) = i;
+	}
+
+	std::vector<T> m_vecHeap;
+	Traits m_traits;
+};
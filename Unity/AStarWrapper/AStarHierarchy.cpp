@@ -0,0 +1,430 @@
+#include "AStarHierarchy.h"
+#include <stdlib.h>
+#include <algorithm>
+#include <functional>
+
+// Same neighbour order and step costs as CAStarTile.
+static const int s_nDirX[8] = { -1, 1, 0, -1, 1, 0, -1, 1 };
+static const int s_nDirY[8] = { 0, 0, -1, -1, -1, 1, 1, 1 };
+static const int s_nDirLoss[8] = { 10, 10, 10, 14, 14, 10, 14, 14 };
+static const bool s_bDirDiagonal[8] = { false, false, false, true, true, false, true, true };
+
+// Border runs at least this long get an entrance at each end instead of one in the middle.
+static const int MAX_ENTRANCE_WIDTH = 6;
+
+CAStarHierarchy::CAStarHierarchy()
+{
+	m_pTile = nullptr;
+	m_nWidth = 0;
+	m_nHeight = 0;
+	m_nClusterSize = 0;
+	m_nClusterCountX = 0;
+	m_nClusterCountY = 0;
+}
+
+CAStarHierarchy::~CAStarHierarchy()
+{
+}
+
+void CAStarHierarchy::Init(CAStarTile *pTile, int nClusterSize /*= 16*/)
+{
+	m_pTile = pTile;
+	m_nWidth = pTile->GetWidth();
+	m_nHeight = pTile->GetHeight();
+	m_nClusterSize = std::max(nClusterSize, 2);
+	m_nClusterCountX = (m_nWidth + m_nClusterSize - 1) / m_nClusterSize;
+	m_nClusterCountY = (m_nHeight + m_nClusterSize - 1) / m_nClusterSize;
+
+	const int nClusterCount = m_nClusterCountX * m_nClusterCountY;
+	m_vecCluster.clear();
+	m_vecCluster.resize(nClusterCount);
+	m_vecNodeSlot.assign(m_nWidth * m_nHeight, -1);
+	m_vecDirty.assign(nClusterCount, 0);
+	m_vecDirtyList.clear();
+
+	for (int i = 0; i < nClusterCount; i++)
+	{
+		MarkDirty(i);
+	}
+	Update();
+}
+
+void CAStarHierarchy::SetCost(int index, int loss)
+{
+	m_pTile->SetCost(index, loss);
+
+	// Cells on a cluster border also decide the entrances of the neighbour.
+	const int x = index % m_nWidth;
+	const int y = index / m_nWidth;
+	const int cluster = GetClusterOf(index);
+	MarkDirty(cluster);
+	if (x % m_nClusterSize == 0 && x > 0)
+		MarkDirty(cluster - 1);
+	if (x % m_nClusterSize == m_nClusterSize - 1 && x < m_nWidth - 1)
+		MarkDirty(cluster + 1);
+	if (y % m_nClusterSize == 0 && y > 0)
+		MarkDirty(cluster - m_nClusterCountX);
+	if (y % m_nClusterSize == m_nClusterSize - 1 && y < m_nHeight - 1)
+		MarkDirty(cluster + m_nClusterCountX);
+}
+
+void CAStarHierarchy::MarkDirty(int cluster)
+{
+	if (!m_vecDirty[cluster])
+	{
+		m_vecDirty[cluster] = 1;
+		m_vecDirtyList.push_back(cluster);
+	}
+}
+
+void CAStarHierarchy::Update()
+{
+	for (size_t i = 0; i < m_vecDirtyList.size(); i++)
+	{
+		RebuildCluster(m_vecDirtyList[i]);
+		m_vecDirty[m_vecDirtyList[i]] = 0;
+	}
+	m_vecDirtyList.clear();
+}
+
+int CAStarHierarchy::GetEntranceCount() const
+{
+	int count = 0;
+	for (size_t i = 0; i < m_vecCluster.size(); i++)
+	{
+		count += (int)m_vecCluster[i].vecNode.size();
+	}
+	return count;
+}
+
+void CAStarHierarchy::RebuildCluster(int cluster)
+{
+	Cluster &c = m_vecCluster[cluster];
+	for (size_t i = 0; i < c.vecNode.size(); i++)
+	{
+		m_vecNodeSlot[c.vecNode[i]] = -1;
+	}
+	c.vecNode.clear();
+	c.vecPartner.clear();
+
+	std::vector<int> inner;
+	std::vector<int> outer;
+	for (int side = 0; side < 4; side++)
+	{
+		FindTransitions(cluster, side, inner, outer);
+	}
+	for (size_t i = 0; i < inner.size(); i++)
+	{
+		int slot = m_vecNodeSlot[inner[i]];
+		if (slot == -1)
+		{
+			slot = (int)c.vecNode.size();
+			m_vecNodeSlot[inner[i]] = slot;
+			c.vecNode.push_back(inner[i]);
+			c.vecPartner.push_back(-1);
+			c.vecPartner.push_back(-1);
+		}
+		// A corner cell can lead into two neighbours.
+		c.vecPartner[slot * 2 + (c.vecPartner[slot * 2] == -1 ? 0 : 1)] = outer[i];
+	}
+
+	const int n = (int)c.vecNode.size();
+	c.vecDist.assign(n * n, -1);
+	const int x0 = (cluster % m_nClusterCountX) * m_nClusterSize;
+	const int y0 = (cluster / m_nClusterCountX) * m_nClusterSize;
+	for (int i = 0; i < n; i++)
+	{
+		LocalDijkstra(cluster, c.vecNode[i], false, m_vecBuildDist, m_vecBuildHeap);
+		for (int j = 0; j < n; j++)
+		{
+			const int node = c.vecNode[j];
+			c.vecDist[i * n + j] = m_vecBuildDist[(node / m_nWidth - y0) * m_nClusterSize + node % m_nWidth - x0];
+		}
+	}
+}
+
+void CAStarHierarchy::FindTransitions(int cluster, int side, std::vector<int> &inner, std::vector<int> &outer) const
+{
+	const int x0 = (cluster % m_nClusterCountX) * m_nClusterSize;
+	const int y0 = (cluster / m_nClusterCountX) * m_nClusterSize;
+	const int x1 = std::min(x0 + m_nClusterSize, m_nWidth) - 1;
+	const int y1 = std::min(y0 + m_nClusterSize, m_nHeight) - 1;
+
+	// Border line inside the cluster as start cell, step and length, plus the offset to the outside cell.
+	int start, step, length, across;
+	switch (side)
+	{
+	case 0:
+		if (x0 == 0) return;
+		start = y0 * m_nWidth + x0; step = m_nWidth; length = y1 - y0 + 1; across = -1;
+		break;
+	case 1:
+		if (x1 == m_nWidth - 1) return;
+		start = y0 * m_nWidth + x1; step = m_nWidth; length = y1 - y0 + 1; across = 1;
+		break;
+	case 2:
+		if (y0 == 0) return;
+		start = y0 * m_nWidth + x0; step = 1; length = x1 - x0 + 1; across = -m_nWidth;
+		break;
+	default:
+		if (y1 == m_nHeight - 1) return;
+		start = y1 * m_nWidth + x0; step = 1; length = x1 - x0 + 1; across = m_nWidth;
+		break;
+	}
+
+	int runStart = -1;
+	for (int i = 0; i <= length; i++)
+	{
+		const int cell = start + i * step;
+		const bool open = i < length &&
+			m_pTile->GetCost(cell) != -1 && m_pTile->GetCost(cell + across) != -1;
+		if (open && runStart == -1)
+		{
+			runStart = i;
+		}
+		else if (!open && runStart != -1)
+		{
+			const int runLength = i - runStart;
+			if (runLength < MAX_ENTRANCE_WIDTH)
+			{
+				const int mid = start + (runStart + runLength / 2) * step;
+				inner.push_back(mid);
+				outer.push_back(mid + across);
+			}
+			else
+			{
+				const int first = start + runStart * step;
+				const int last = start + (i - 1) * step;
+				inner.push_back(first);
+				outer.push_back(first + across);
+				inner.push_back(last);
+				outer.push_back(last + across);
+			}
+			runStart = -1;
+		}
+	}
+}
+
+void CAStarHierarchy::LocalDijkstra(int cluster, int source, bool bReverse, std::vector<int> &dist, std::vector<std::pair<int, int> > &heap) const
+{
+	const int x0 = (cluster % m_nClusterCountX) * m_nClusterSize;
+	const int y0 = (cluster / m_nClusterCountX) * m_nClusterSize;
+	const int x1 = std::min(x0 + m_nClusterSize, m_nWidth);
+	const int y1 = std::min(y0 + m_nClusterSize, m_nHeight);
+	const bool bEnable45 = m_pTile->IsEnable45();
+	const std::greater<std::pair<int, int> > cmp;
+
+	dist.assign(m_nClusterSize * m_nClusterSize, -1);
+	heap.clear();
+	dist[(source / m_nWidth - y0) * m_nClusterSize + source % m_nWidth - x0] = 0;
+	heap.push_back(std::make_pair(0, source));
+
+	while (!heap.empty())
+	{
+		std::pop_heap(heap.begin(), heap.end(), cmp);
+		const int g = heap.back().first;
+		const int cell = heap.back().second;
+		heap.pop_back();
+
+		const int x = cell % m_nWidth;
+		const int y = cell / m_nWidth;
+		if (g > dist[(y - y0) * m_nClusterSize + x - x0])
+			continue;
+
+		for (int dir = 0; dir < 8; dir++)
+		{
+			if (!bEnable45 && s_bDirDiagonal[dir])
+				continue;
+			const int nx = x + s_nDirX[dir];
+			const int ny = y + s_nDirY[dir];
+			if (nx < x0 || nx >= x1 || ny < y0 || ny >= y1)
+				continue;
+			const int next = ny * m_nWidth + nx;
+			if (m_pTile->GetCost(next) == -1)
+				continue;
+
+			// Entering a cell costs the step plus the cell's own cost; walking
+			// backwards that is the cost of the cell we came from.
+			const int nCost = g + s_nDirLoss[dir] + std::max(m_pTile->GetCost(bReverse ? cell : next), 0);
+			int &d = dist[(ny - y0) * m_nClusterSize + nx - x0];
+			if (d == -1 || nCost < d)
+			{
+				d = nCost;
+				heap.push_back(std::make_pair(nCost, next));
+				std::push_heap(heap.begin(), heap.end(), cmp);
+			}
+		}
+	}
+}
+
+void CAStarHierarchy::Relax(CAStarTileContext &ctx, int nCurrent, int nNext, int g, int nEndIndex) const
+{
+	if (ctx.GetState(nNext) == ASS_CLOSE)
+		return;
+	const int f = g + Hn(nNext, nEndIndex);
+	if (ctx.GetState(nNext) == ASS_OPEN)
+	{
+		if (f < ctx.m_vecF[nNext])
+		{
+			ctx.m_vecParent[nNext] = nCurrent;
+			ctx.m_vecG[nNext] = g;
+			ctx.m_vecF[nNext] = f;
+			ctx.m_heapOpen.Modify(nNext);
+		}
+	}
+	else
+	{
+		ctx.m_vecParent[nNext] = nCurrent;
+		ctx.m_vecG[nNext] = g;
+		ctx.m_vecF[nNext] = f;
+		ctx.SetState(nNext, ASS_OPEN);
+		ctx.m_heapOpen.Push(nNext);
+	}
+}
+
+int CAStarHierarchy::Hn(int index, int endIndex) const
+{
+	return (abs(endIndex / m_nWidth - index / m_nWidth) + abs(endIndex % m_nWidth - index % m_nWidth)) * 10;
+}
+
+bool CAStarHierarchy::Search(int sx, int sy, int ex, int ey)
+{
+	Update();
+	return Search(m_context, sx, sy, ex, ey);
+}
+
+bool CAStarHierarchy::Search(CAStarHierarchyContext &ctx, int sx, int sy, int ex, int ey) const
+{
+	const int nStartIndex = sy * m_nWidth + sx;
+	const int nEndIndex = ey * m_nWidth + ex;
+	const int nStartCluster = GetClusterOf(nStartIndex);
+	const int nEndCluster = GetClusterOf(nEndIndex);
+	CAStarTileContext &tc = ctx.m_tileContext;
+
+	// Short queries are cheaper on the tile directly.
+	if (nStartCluster == nEndCluster)
+	{
+		return m_pTile->Search(tc, sx, sy, ex, ey);
+	}
+
+	// Connect start and end to the entrances of their own clusters.
+	const Cluster &startCluster = m_vecCluster[nStartCluster];
+	const Cluster &endCluster = m_vecCluster[nEndCluster];
+	const int sx0 = (nStartCluster % m_nClusterCountX) * m_nClusterSize;
+	const int sy0 = (nStartCluster / m_nClusterCountX) * m_nClusterSize;
+	const int ex0 = (nEndCluster % m_nClusterCountX) * m_nClusterSize;
+	const int ey0 = (nEndCluster / m_nClusterCountX) * m_nClusterSize;
+
+	LocalDijkstra(nStartCluster, nStartIndex, false, ctx.m_vecLocal, ctx.m_vecLocalHeap);
+	ctx.m_vecStartCost.resize(startCluster.vecNode.size());
+	for (size_t i = 0; i < startCluster.vecNode.size(); i++)
+	{
+		const int node = startCluster.vecNode[i];
+		ctx.m_vecStartCost[i] = ctx.m_vecLocal[(node / m_nWidth - sy0) * m_nClusterSize + node % m_nWidth - sx0];
+	}
+	LocalDijkstra(nEndCluster, nEndIndex, true, ctx.m_vecLocal, ctx.m_vecLocalHeap);
+	ctx.m_vecEndCost.resize(endCluster.vecNode.size());
+	for (size_t i = 0; i < endCluster.vecNode.size(); i++)
+	{
+		const int node = endCluster.vecNode[i];
+		ctx.m_vecEndCost[i] = ctx.m_vecLocal[(node / m_nWidth - ey0) * m_nClusterSize + node % m_nWidth - ex0];
+	}
+
+	// A* over the entrance cells, reusing the tile context's per-cell arrays.
+	tc.m_vecPath.clear();
+	tc.m_heapOpen.Clear();
+	tc.Prepare(m_nWidth * m_nHeight);
+	tc.m_vecG[nStartIndex] = 0;
+	tc.m_vecF[nStartIndex] = Hn(nStartIndex, nEndIndex);
+	tc.m_vecParent[nStartIndex] = -1;
+	tc.SetState(nStartIndex, ASS_OPEN);
+	tc.m_heapOpen.Push(nStartIndex);
+
+	bool bFound = false;
+	while (!tc.m_heapOpen.Empty())
+	{
+		const int nCurrent = tc.m_heapOpen.Pop();
+		tc.SetState(nCurrent, ASS_CLOSE);
+		if (nCurrent == nEndIndex)
+		{
+			bFound = true;
+			break;
+		}
+
+		const int g = tc.m_vecG[nCurrent];
+		if (nCurrent == nStartIndex)
+		{
+			for (size_t i = 0; i < startCluster.vecNode.size(); i++)
+			{
+				if (ctx.m_vecStartCost[i] >= 0)
+					Relax(tc, nCurrent, startCluster.vecNode[i], g + ctx.m_vecStartCost[i], nEndIndex);
+			}
+		}
+
+		const int slot = m_vecNodeSlot[nCurrent];
+		if (slot == -1)
+			continue;
+
+		const int cluster = GetClusterOf(nCurrent);
+		const Cluster &c = m_vecCluster[cluster];
+		const int n = (int)c.vecNode.size();
+		for (int i = 0; i < n; i++)
+		{
+			const int d = c.vecDist[slot * n + i];
+			if (i != slot && d >= 0)
+				Relax(tc, nCurrent, c.vecNode[i], g + d, nEndIndex);
+		}
+		for (int k = 0; k < 2; k++)
+		{
+			const int partner = c.vecPartner[slot * 2 + k];
+			if (partner != -1)
+				Relax(tc, nCurrent, partner, g + 10 + m_pTile->GetCost(partner), nEndIndex);
+		}
+		if (cluster == nEndCluster && ctx.m_vecEndCost[slot] >= 0)
+		{
+			Relax(tc, nCurrent, nEndIndex, g + ctx.m_vecEndCost[slot], nEndIndex);
+		}
+	}
+
+	if (!bFound)
+	{
+		// Diagonal moves can slip between clusters where no straight
+		// entrance exists, so only a 4 way grid can trust the miss.
+		if (m_pTile->IsEnable45())
+			return m_pTile->Search(tc, sx, sy, ex, ey);
+		tc.m_vecPath.clear();
+		return false;
+	}
+
+	ctx.m_vecAbstract.clear();
+	for (int i = nEndIndex; i != -1; i = tc.m_vecParent[i])
+	{
+		ctx.m_vecAbstract.push_back(i);
+	}
+	std::reverse(ctx.m_vecAbstract.begin(), ctx.m_vecAbstract.end());
+
+	// Refine each abstract edge into cells.
+	ctx.m_vecRefined.clear();
+	ctx.m_vecRefined.push_back(nStartIndex);
+	for (size_t i = 1; i < ctx.m_vecAbstract.size(); i++)
+	{
+		const int from = ctx.m_vecAbstract[i - 1];
+		const int to = ctx.m_vecAbstract[i];
+		const int dx = abs(to % m_nWidth - from % m_nWidth);
+		const int dy = abs(to / m_nWidth - from / m_nWidth);
+		if (dx + dy == 1)
+		{
+			ctx.m_vecRefined.push_back(to);
+			continue;
+		}
+		if (!m_pTile->Search(tc, from % m_nWidth, from / m_nWidth, to % m_nWidth, to / m_nWidth))
+		{
+			return m_pTile->Search(tc, sx, sy, ex, ey);
+		}
+		const std::vector<int> &segment = tc.GetPath();
+		ctx.m_vecRefined.insert(ctx.m_vecRefined.end(), segment.begin() + 1, segment.end());
+	}
+
+	tc.m_vecPath.swap(ctx.m_vecRefined);
+	return true;
+}
@@ -0,0 +1,94 @@
+#pragma once
+#include "AStarTile.h"
+#include <vector>
+#include <utility>
+
+// Scratch state for CAStarHierarchy searches, one per thread.
+class CAStarHierarchyContext
+{
+public:
+	// Cell indices from start to end of the last search
+	inline const std::vector<int> &GetPath() const { return m_tileContext.GetPath(); }
+	inline CAStarTileContext &GetTileContext() { return m_tileContext; }
+
+private:
+	friend class CAStarHierarchy;
+
+	CAStarTileContext m_tileContext;			// abstract search, then segment refinement
+	std::vector<int> m_vecLocal;				// cluster sized distance scratch
+	std::vector<std::pair<int, int> > m_vecLocalHeap;	// cluster sized open list scratch
+	std::vector<int> m_vecStartCost;			// start to each entrance of its cluster
+	std::vector<int> m_vecEndCost;				// each entrance of its cluster to end
+	std::vector<int> m_vecAbstract;				// entrance cells picked by the abstract search
+	std::vector<int> m_vecRefined;				// path being assembled from the refined segments
+};
+
+// Hierarchical pathfinding (HPA*) over a CAStarTile.
+// The grid is cut into square clusters. Walkable runs along the border of
+// two clusters become entrance cells, and the cost between the entrances of
+// a cluster is precomputed. Long queries search this small abstract graph
+// first and then run the tile search only between consecutive entrances.
+// Queries inside one cluster go straight to the tile.
+class CAStarHierarchy
+{
+public:
+	CAStarHierarchy();
+	~CAStarHierarchy();
+
+	// Builds the abstract graph for the whole tile, which must outlive the hierarchy
+	void Init(CAStarTile *pTile, int nClusterSize = 16);
+	// Changes a cell cost and marks the clusters it affects for rebuilding
+	void SetCost(int index, int loss);
+	// Rebuilds the clusters touched by SetCost since the last update
+	void Update();
+
+	// Updates and searches with the hierarchy's own context
+	bool Search(int sx, int sy, int ex, int ey);
+	// Read only, the hierarchy has to be up to date
+	bool Search(CAStarHierarchyContext &ctx, int sx, int sy, int ex, int ey) const;
+	inline const std::vector<int> &GetPath() const { return m_context.GetPath(); }
+
+	inline int GetClusterSize() const { return m_nClusterSize; }
+	inline bool IsDirty() const { return !m_vecDirtyList.empty(); }
+	inline int GetDirtyCount() const { return (int)m_vecDirtyList.size(); }
+	int GetEntranceCount() const;
+
+private:
+	struct Cluster
+	{
+		std::vector<int> vecNode;		// entrance cells
+		std::vector<int> vecPartner;	// two cells per entrance across the border, -1 for none
+		std::vector<int> vecDist;		// entrance to entrance cost, -1 if not connected inside the cluster
+	};
+
+	inline int GetClusterOf(int index) const
+	{
+		return (index / m_nWidth / m_nClusterSize) * m_nClusterCountX + (index % m_nWidth) / m_nClusterSize;
+	}
+	int Hn(int index, int endIndex) const;
+	// Adds or lowers an abstract open list entry
+	void Relax(CAStarTileContext &ctx, int nCurrent, int nNext, int g, int nEndIndex) const;
+
+	void MarkDirty(int cluster);
+	void RebuildCluster(int cluster);
+	// Adds the transitions on one side of a cluster, side is 0 left, 1 right, 2 up, 3 down
+	void FindTransitions(int cluster, int side, std::vector<int> &inner, std::vector<int> &outer) const;
+	// Dijkstra restricted to a cluster. With bReverse the costs are to the source instead of from it.
+	void LocalDijkstra(int cluster, int source, bool bReverse, std::vector<int> &dist, std::vector<std::pair<int, int> > &heap) const;
+
+	CAStarTile *m_pTile;
+	int m_nWidth;
+	int m_nHeight;
+	int m_nClusterSize;
+	int m_nClusterCountX;
+	int m_nClusterCountY;
+
+	std::vector<Cluster> m_vecCluster;
+	std::vector<int> m_vecNodeSlot;		// per cell, index in its cluster's vecNode or -1
+	std::vector<char> m_vecDirty;
+	std::vector<int> m_vecDirtyList;
+
+	std::vector<int> m_vecBuildDist;
+	std::vector<std::pair<int, int> > m_vecBuildHeap;
+	CAStarHierarchyContext m_context;
+};
@@ -10,10 +10,12 @@ CAStarNode::CAStarNode()
 	h = 0;
 	loss = 1;
 	state = ASS_NONE;
+	heapIndex = -1;
 }
 
 CAStarImpl::CAStarImpl()
 {
+	m_eOpenList = AOL_HEAP;
 }
 
 
@@ -30,6 +32,7 @@ bool CAStarImpl::Search(CAStarNode *pStart, CAStarNode *pEnd)
 {
 	m_listPath.clear();
 	m_setOpen.clear();
+	m_heapOpen.Clear();
 	m_vecPath.clear();
 
 	//if(pEnd->loss == -1)
@@ -52,12 +55,11 @@ bool CAStarImpl::Search(CAStarNode *pStart, CAStarNode *pEnd)
 	// д򿪵ĽڵһֱѰֱߵյ㣬ûе
 	while (!bFind)
 	{
-		if (m_setOpen.size() == 0)
+		if (IsOpenEmpty())
 			break;
 
 		// ÿζȡһ һԶõ
-		CAStarNode *pCurrentNode = *m_setOpen.begin();
-		m_setOpen.erase(m_setOpen.begin());
+		CAStarNode *pCurrentNode = PopOpen();
 		AddToClose(pCurrentNode);
 
 		// ڽڵֵ
@@ -103,24 +105,7 @@ bool CAStarImpl::Search(CAStarNode *pStart, CAStarNode *pEnd)
 				// ıȽʹ
 				if (f < pNextNode->f)
 				{
-					pNextNode->parent = pCurrentNode;
-					pNextNode->g = g;
-					pNextNode->h = h;
-					pNextNode->f = f;
-
-					auto itr2 = m_setOpen.find(pNextNode);
-					// Ϊص value ͬĵһ Ҫ
-					while (itr2 != m_setOpen.end() && (*itr2)->f == pNextNode->f)
-					{
-						if (*itr2 == pNextNode)
-						{
-							m_setOpen.erase(itr2);
-							AddToOpen(pNextNode);
-							break;
-						}
-
-						++itr2;
-					}
+					UpdateOpen(pNextNode, pCurrentNode, g, h, f);
 				}
 			}
 			// ڴб Ӹýڵ
@@ -164,9 +149,67 @@ int CAStarImpl::Hn(CAStarNode *pCurrentNode, CAStarNode *pPrevNode, CAStarNode *
 void CAStarImpl::AddToOpen(CAStarNode *pNode)
 {
 	pNode->state = ASS_OPEN;
+	if (m_eOpenList == AOL_HEAP)
+	{
+		m_heapOpen.Push(pNode);
+	}
+	else
+	{
+		m_setOpen.insert(pNode);
+	}
+}
+
+void CAStarImpl::UpdateOpen(CAStarNode *pNode, CAStarNode *pParent, int g, int h, int f)
+{
+	if (m_eOpenList == AOL_HEAP)
+	{
+		pNode->parent = pParent;
+		pNode->g = g;
+		pNode->h = h;
+		pNode->f = f;
+		m_heapOpen.Modify(pNode);
+		return;
+	}
+
+	// The set is ordered by f, so the node has to be found and removed
+	// while it still carries its old key.
+	auto range = m_setOpen.equal_range(pNode);
+	for (auto itr = range.first; itr != range.second; ++itr)
+	{
+		if (*itr == pNode)
+		{
+			m_setOpen.erase(itr);
+			break;
+		}
+	}
+	pNode->parent = pParent;
+	pNode->g = g;
+	pNode->h = h;
+	pNode->f = f;
 	m_setOpen.insert(pNode);
 }
 
+CAStarNode *CAStarImpl::PopOpen()
+{
+	if (m_eOpenList == AOL_HEAP)
+	{
+		return m_heapOpen.Pop();
+	}
+	CAStarNode *pNode = *m_setOpen.begin();
+	m_setOpen.erase(m_setOpen.begin());
+	return pNode;
+}
+
+bool CAStarImpl::IsOpenEmpty()
+{
+	if (m_eOpenList == AOL_HEAP)
+	{
+		return m_heapOpen.Empty();
+	}
+	return m_setOpen.empty();
+}
+
+
 void CAStarImpl::AddToClose(CAStarNode *pNode)
 {
 	pNode->state = ASS_CLOSE;
@@ -3,6 +3,7 @@
 #include <list>
 #include <set>
 #include <vector>
+#include "AStarHeap.h"
 
 enum AStarNodeState
 {
@@ -31,6 +32,7 @@ public:
 	int h; // Ԥreturn false;
 	int loss; // ֵ Ϊ-1 ʾ
 	char state;
+	int heapIndex; // slot in the open heap, -1 when not in it
 }; 
 
 typedef CAStarNode* CAStarNodePtr;
@@ -41,6 +43,18 @@ struct CAStarNodeComp {
 	}
 };
 
+struct CAStarNodeHeapTraits {
+	inline int Key(const CAStarNodePtr &node) const { return node->f; }
+	inline int &Pos(const CAStarNodePtr &node) const { return node->heapIndex; }
+};
+
+// Open list engine used by CAStarImpl::Search
+enum AStarOpenList
+{
+	AOL_HEAP,		// indexed binary heap, O(log n) decrease-key, no allocation per push
+	AOL_MULTISET,	// legacy std::multiset, kept for comparison
+};
+
 class CAStarImpl
 {
 public:
@@ -50,6 +64,9 @@ public:
 	virtual bool Search(CAStarNode *pStart, CAStarNode *pEnd);
 	const std::vector<CAStarNode*> &GetPath();
 
+	inline void SetOpenList(AStarOpenList type) { m_eOpenList = type; }
+	inline AStarOpenList GetOpenList() { return m_eOpenList; }
+
 protected:
 	// 
 	virtual int Gn(CAStarNode *pPrevNode, CAStarNode *pNode);
@@ -58,6 +75,10 @@ protected:
 
 private:
 	void AddToOpen(CAStarNode *pNode);
+	// Re-sort a node already in the open list after its f has been lowered to f
+	void UpdateOpen(CAStarNode *pNode, CAStarNode *pParent, int g, int h, int f);
+	CAStarNode *PopOpen();
+	bool IsOpenEmpty();
 	void AddToClose(CAStarNode *pNode);
 	// Ƿڹرսڵб
 	bool IsInClose(CAStarNode *pNode);
@@ -65,6 +86,8 @@ private:
 	bool IsInOpen(CAStarNode *pNode);
 
 protected:
+	AStarOpenList m_eOpenList;
+	CAStarHeap<CAStarNodePtr, CAStarNodeHeapTraits> m_heapOpen;
 	std::multiset<CAStarNodePtr, CAStarNodeComp> m_setOpen;  // б
 	std::list<CAStarNode*> m_listPath; // ·
 	std::vector<CAStarNode*> m_vecPath; // ·
@@ -1,8 +1,59 @@
 #include "AStarTile.h"
+#include <stdlib.h>
 #include <time.h>
+#include <algorithm>
+
+// Neighbour offsets in search order: left, right, up, up-left, up-right,
+// down, down-left, down-right. The diagonals are skipped unless 45 degree
+// moves are enabled.
+static const int s_nDirX[8] = { -1, 1, 0, -1, 1, 0, -1, 1 };
+static const int s_nDirY[8] = { 0, 0, -1, -1, -1, 1, 1, 1 };
+static const int s_nDirLoss[8] = { 10, 10, 10, 14, 14, 10, 14, 14 };
+static const bool s_bDirDiagonal[8] = { false, false, false, true, true, false, true, true };
+
+CAStarTileContext::CAStarTileContext()
+{
+	m_nSearchId = 0;
+}
+
+CAStarTileContext::~CAStarTileContext()
+{
+}
+
+void CAStarTileContext::Prepare(int count)
+{
+	if ((int)m_vecSearchId.size() != count)
+	{
+		m_vecG.assign(count, 0);
+		m_vecF.assign(count, 0);
+		m_vecParent.assign(count, -1);
+		m_vecHeapIndex.assign(count, -1);
+		m_vecState.assign(count, ASS_NONE);
+		m_vecSearchId.assign(count, 0);
+		m_nSearchId = 0;
+	}
+
+	// Bound on every search so a copied context points at its own arrays.
+	CAStarTileHeapTraits traits;
+	traits.f = m_vecF.empty() ? 0 : &m_vecF[0];
+	traits.heapIndex = m_vecHeapIndex.empty() ? 0 : &m_vecHeapIndex[0];
+	m_heapOpen.SetTraits(traits);
+
+	// Cells stamped by an older search read as ASS_NONE, so nothing has to be cleared.
+	if (++m_nSearchId == 0)
+	{
+		std::fill(m_vecSearchId.begin(), m_vecSearchId.end(), 0u);
+		m_nSearchId = 1;
+	}
+}
 
 CAStarTile::CAStarTile()
 {
+	m_nWidth = 0;
+	m_nHeight = 0;
+	m_bEnable45 = false;
+	m_eMode = ASM_ASTAR;
+	m_nNonUniformCount = 0;
 }
 
 
@@ -10,141 +61,339 @@ CAStarTile::~CAStarTile()
 {
 }
 
-void CAStarTile::Init(int width, int height, bool bEnable45 /*= false*/)
+void CAStarTile::Init(int width, int height, bool bEnable45 /*= false*/, AStarSearchMode eMode /*= ASM_ASTAR*/)
 {
 	m_nWidth = width;
 	m_nHeight = height;
-	m_vecTileNode.resize(width*height);
-	for (int i = 0; i < width*height; i++)
+	m_bEnable45 = bEnable45;
+	m_eMode = eMode;
+	m_nNonUniformCount = 0;
+
+	m_vecCost.assign(width*height, 0);
+	m_context.m_vecPath.clear();
+}
+
+void CAStarTile::SetCost(int index, int loss)
+{
+	if (m_vecCost[index] != 0 && m_vecCost[index] != ASTAR_COST_BLOCKED)
+	{
+		m_nNonUniformCount--;
+	}
+	if (loss < 0)
+	{
+		m_vecCost[index] = ASTAR_COST_BLOCKED;
+	}
+	else
+	{
+		m_vecCost[index] = (unsigned char)std::min<int>(loss, ASTAR_COST_MAX);
+	}
+	if (m_vecCost[index] != 0 && m_vecCost[index] != ASTAR_COST_BLOCKED)
+	{
+		m_nNonUniformCount++;
+	}
+}
+
+int CAStarTile::GetCost(int index) const
+{
+	return m_vecCost[index] == ASTAR_COST_BLOCKED ? -1 : m_vecCost[index];
+}
+
+bool CAStarTile::Search(int sx, int sy, int ex, int ey)
+{
+	return Search(m_context, sx, sy, ex, ey);
+}
+
+bool CAStarTile::Search(CAStarTileContext &ctx, int sx, int sy, int ex, int ey) const
+{
+	int nStartIndex = sy*m_nWidth + sx;
+	int nEndIndex = ey*m_nWidth + ex;
+
+	ctx.m_vecPath.clear();
+	ctx.m_heapOpen.Clear();
+
+	if (nStartIndex == nEndIndex)
+	{
+		ctx.m_vecPath.push_back(nStartIndex);
+		ctx.m_vecPath.push_back(nEndIndex);
+		return true;
+	}
+
+	ctx.Prepare(m_nWidth*m_nHeight);
+
+	ctx.m_vecG[nStartIndex] = 0;
+	ctx.m_vecF[nStartIndex] = Hn(nStartIndex, nEndIndex);
+	ctx.m_vecParent[nStartIndex] = -1;
+	ctx.SetState(nStartIndex, ASS_OPEN);
+	ctx.m_heapOpen.Push(nStartIndex);
+
+	// Jumping over cells is only valid when they all cost the same,
+	// otherwise fall back to visiting every cell.
+	if (m_eMode == ASM_JPS && IsUniformCost())
 	{
-		m_vecTileNode[i].index = i;
-		m_vecTileNode[i].loss = 0;
-		m_vecTileNode[i].neighbor.clear();
+		return SearchJPS(ctx, nEndIndex);
 	}
-	// ʼнڵڽڵ
-	for (int row = 0; row < height; row++)
+	return SearchAStar(ctx, nEndIndex);
+}
+
+bool CAStarTile::SearchAStar(CAStarTileContext &ctx, int nEndIndex) const
+{
+	while (!ctx.m_heapOpen.Empty())
 	{
-		for (int col = 0; col < width; col++)
+		int nCurrent = ctx.m_heapOpen.Pop();
+		ctx.SetState(nCurrent, ASS_CLOSE);
+
+		const int x = nCurrent % m_nWidth;
+		const int y = nCurrent / m_nWidth;
+		for (int dir = 0; dir < 8; dir++)
 		{
-			int nIndex = row*width + col;
+			if (!m_bEnable45 && s_bDirDiagonal[dir])
+				continue;
+			const int nx = x + s_nDirX[dir];
+			const int ny = y + s_nDirY[dir];
+			if (nx < 0 || nx >= m_nWidth || ny < 0 || ny >= m_nHeight)
+				continue;
 
-			CAStarTileNode *pNode = &m_vecTileNode[nIndex];
+			const int nNext = ny*m_nWidth + nx;
+			const int g = ctx.m_vecG[nCurrent] + m_vecCost[nNext] + s_nDirLoss[dir];
+			// The end cell is accepted as soon as it is reached, even if it is blocked.
+			if (nNext == nEndIndex)
+			{
+				ctx.m_vecG[nNext] = g;
+				ctx.m_vecParent[nNext] = nCurrent;
+				BuildPath(ctx, nEndIndex);
+				return true;
+			}
 
-			Neighbor neighbor;
-			// 
-			if (col > 0)
+			if (ctx.GetState(nNext) == ASS_CLOSE || m_vecCost[nNext] == ASTAR_COST_BLOCKED)
+				continue;
+
+			Relax(ctx, nCurrent, nNext, g, nEndIndex);
+		}
+	}
+
+	return false;
+}
+
+bool CAStarTile::SearchJPS(CAStarTileContext &ctx, int nEndIndex) const
+{
+	int dirX[8];
+	int dirY[8];
+	while (!ctx.m_heapOpen.Empty())
+	{
+		int nCurrent = ctx.m_heapOpen.Pop();
+		ctx.SetState(nCurrent, ASS_CLOSE);
+
+		const int x = nCurrent % m_nWidth;
+		const int y = nCurrent / m_nWidth;
+
+		// Prune the directions that can be reached more cheaply through the parent.
+		int nDirCount = 0;
+		const int nParent = ctx.m_vecParent[nCurrent];
+		if (nParent == -1)
+		{
+			for (int dir = 0; dir < 8; dir++)
 			{
-				neighbor.loss = 10;
-				neighbor.node = &m_vecTileNode[nIndex -1];
-				pNode->neighbor.push_back(neighbor);
+				if (!m_bEnable45 && s_bDirDiagonal[dir])
+					continue;
+				dirX[nDirCount] = s_nDirX[dir];
+				dirY[nDirCount] = s_nDirY[dir];
+				nDirCount++;
 			}
-			// 
-			if (col < width - 1)
+		}
+		else
+		{
+			const int px = nParent % m_nWidth;
+			const int py = nParent / m_nWidth;
+			const int dx = (x > px) - (x < px);
+			const int dy = (y > py) - (y < py);
+			if (!m_bEnable45)
 			{
-				neighbor.loss = 10;
-				neighbor.node = &m_vecTileNode[nIndex +1];
-				pNode->neighbor.push_back(neighbor);
+				// Keep going straight and branch sideways.
+				dirX[nDirCount] = dx; dirY[nDirCount] = dy; nDirCount++;
+				dirX[nDirCount] = dy; dirY[nDirCount] = dx; nDirCount++;
+				dirX[nDirCount] = -dy; dirY[nDirCount] = -dx; nDirCount++;
 			}
-			// 
-			if (row > 0)
+			else if (dx != 0 && dy != 0)
 			{
-				neighbor.loss = 10;
-				neighbor.node = &m_vecTileNode[nIndex-width];
-				pNode->neighbor.push_back(neighbor);
-
-				if(bEnable45)
+				dirX[nDirCount] = 0; dirY[nDirCount] = dy; nDirCount++;
+				dirX[nDirCount] = dx; dirY[nDirCount] = 0; nDirCount++;
+				dirX[nDirCount] = dx; dirY[nDirCount] = dy; nDirCount++;
+				if (!IsWalkable(x - dx, y, nEndIndex))
 				{
-					// 
-					if (col > 0)
-					{
-						neighbor.loss = 14;
-						neighbor.node = &m_vecTileNode[nIndex - 1- width];
-						pNode->neighbor.push_back(neighbor);
-					}
-					// 
-					if (col < width - 1)
-					{
-						neighbor.loss = 14;
-						neighbor.node = &m_vecTileNode[nIndex + 1- width];
-						pNode->neighbor.push_back(neighbor);
-					}
+					dirX[nDirCount] = -dx; dirY[nDirCount] = dy; nDirCount++;
+				}
+				if (!IsWalkable(x, y - dy, nEndIndex))
+				{
+					dirX[nDirCount] = dx; dirY[nDirCount] = -dy; nDirCount++;
 				}
 			}
-			// 
-			if (row < height-1)
+			else if (dx != 0)
 			{
-				neighbor.loss = 10;
-				neighbor.node = &m_vecTileNode[nIndex + width];
-				pNode->neighbor.push_back(neighbor);
-
-				if(bEnable45)
+				dirX[nDirCount] = dx; dirY[nDirCount] = 0; nDirCount++;
+				if (!IsWalkable(x, y + 1, nEndIndex))
+				{
+					dirX[nDirCount] = dx; dirY[nDirCount] = 1; nDirCount++;
+				}
+				if (!IsWalkable(x, y - 1, nEndIndex))
 				{
-					// 
-					if (col > 0)
-					{
-						neighbor.loss = 14;
-						neighbor.node = &m_vecTileNode[nIndex - 1+ width];
-						pNode->neighbor.push_back(neighbor);
-					}
-					// 
-					if (col < width - 1)
-					{
-						neighbor.loss = 14;
-						neighbor.node = &m_vecTileNode[nIndex + 1+ width];
-						pNode->neighbor.push_back(neighbor);
-					}
+					dirX[nDirCount] = dx; dirY[nDirCount] = -1; nDirCount++;
 				}
 			}
-
-			// 
-			if (col > 0)
+			else
 			{
-				neighbor.loss = 10;
-				neighbor.node = &m_vecTileNode[nIndex -1];
-				pNode->neighbor.push_back(neighbor);
+				dirX[nDirCount] = 0; dirY[nDirCount] = dy; nDirCount++;
+				if (!IsWalkable(x + 1, y, nEndIndex))
+				{
+					dirX[nDirCount] = 1; dirY[nDirCount] = dy; nDirCount++;
+				}
+				if (!IsWalkable(x - 1, y, nEndIndex))
+				{
+					dirX[nDirCount] = -1; dirY[nDirCount] = dy; nDirCount++;
+				}
 			}
-			// 
-			if (col < width - 1)
+		}
+
+		for (int i = 0; i < nDirCount; i++)
+		{
+			const int nNext = Jump(x, y, dirX[i], dirY[i], nEndIndex);
+			if (nNext == -1)
+				continue;
+
+			// Jumps run along straight or diagonal lines.
+			const int nStepX = abs(nNext % m_nWidth - x);
+			const int nStepY = abs(nNext / m_nWidth - y);
+			const int nDiagonal = std::min(nStepX, nStepY);
+			const int g = ctx.m_vecG[nCurrent] + nDiagonal * 14 + (std::max(nStepX, nStepY) - nDiagonal) * 10;
+			if (nNext == nEndIndex)
 			{
-				neighbor.loss = 10;
-				neighbor.node = &m_vecTileNode[nIndex +1];
-				pNode->neighbor.push_back(neighbor);
+				ctx.m_vecG[nNext] = g;
+				ctx.m_vecParent[nNext] = nCurrent;
+				BuildPath(ctx, nEndIndex);
+				return true;
 			}
+
+			if (ctx.GetState(nNext) == ASS_CLOSE)
+				continue;
+
+			Relax(ctx, nCurrent, nNext, g, nEndIndex);
 		}
 	}
+
+	return false;
 }
 
-bool CAStarTile::Search(int sx, int sy, int ex, int ey)
+int CAStarTile::Jump(int x, int y, int dx, int dy, int nEndIndex) const
 {
-	int nStartIndex = sy*m_nWidth + sx;
-	int nEndIndex = ey*m_nWidth + ex;
-
-	for (int i = 0; i < m_nWidth*m_nHeight; i++)
+	for (;;)
 	{
-		m_vecTileNode[i].parent = 0;
-		m_vecTileNode[i].f = 0;
-		m_vecTileNode[i].g = 0;
-		m_vecTileNode[i].h = 0;
-		m_vecTileNode[i].state = 0;
+		x += dx;
+		y += dy;
+		if (!IsWalkable(x, y, nEndIndex))
+			return -1;
+
+		const int index = y*m_nWidth + x;
+		if (index == nEndIndex)
+			return index;
+
+		if (m_bEnable45)
+		{
+			if (dx != 0 && dy != 0)
+			{
+				if ((IsWalkable(x - dx, y + dy, nEndIndex) && !IsWalkable(x - dx, y, nEndIndex)) ||
+					(IsWalkable(x + dx, y - dy, nEndIndex) && !IsWalkable(x, y - dy, nEndIndex)))
+					return index;
+				// A diagonal step is a jump point if a straight scan from it finds one.
+				if (Jump(x, y, dx, 0, nEndIndex) != -1 || Jump(x, y, 0, dy, nEndIndex) != -1)
+					return index;
+			}
+			else if (dx != 0)
+			{
+				if ((IsWalkable(x + dx, y + 1, nEndIndex) && !IsWalkable(x, y + 1, nEndIndex)) ||
+					(IsWalkable(x + dx, y - 1, nEndIndex) && !IsWalkable(x, y - 1, nEndIndex)))
+					return index;
+			}
+			else
+			{
+				if ((IsWalkable(x + 1, y + dy, nEndIndex) && !IsWalkable(x + 1, y, nEndIndex)) ||
+					(IsWalkable(x - 1, y + dy, nEndIndex) && !IsWalkable(x - 1, y, nEndIndex)))
+					return index;
+			}
+		}
+		else
+		{
+			if (dx != 0)
+			{
+				if ((IsWalkable(x, y - 1, nEndIndex) && !IsWalkable(x - dx, y - 1, nEndIndex)) ||
+					(IsWalkable(x, y + 1, nEndIndex) && !IsWalkable(x - dx, y + 1, nEndIndex)))
+					return index;
+			}
+			else
+			{
+				if ((IsWalkable(x - 1, y, nEndIndex) && !IsWalkable(x - 1, y - dy, nEndIndex)) ||
+					(IsWalkable(x + 1, y, nEndIndex) && !IsWalkable(x + 1, y - dy, nEndIndex)))
+					return index;
+				// Vertical scans stop wherever a horizontal scan would find something.
+				if (Jump(x, y, 1, 0, nEndIndex) != -1 || Jump(x, y, -1, 0, nEndIndex) != -1)
+					return index;
+			}
+		}
 	}
+}
 
-	return CAStarImpl::Search(&m_vecTileNode[nStartIndex], &m_vecTileNode[nEndIndex]);
+void CAStarTile::Relax(CAStarTileContext &ctx, int nCurrent, int nNext, int g, int nEndIndex) const
+{
+	const int f = g + Hn(nNext, nEndIndex);
+	if (ctx.GetState(nNext) == ASS_OPEN)
+	{
+		if (f < ctx.m_vecF[nNext])
+		{
+			ctx.m_vecParent[nNext] = nCurrent;
+			ctx.m_vecG[nNext] = g;
+			ctx.m_vecF[nNext] = f;
+			ctx.m_heapOpen.Modify(nNext);
+		}
+	}
+	else
+	{
+		ctx.m_vecParent[nNext] = nCurrent;
+		ctx.m_vecG[nNext] = g;
+		ctx.m_vecF[nNext] = f;
+		ctx.SetState(nNext, ASS_OPEN);
+		ctx.m_heapOpen.Push(nNext);
+	}
 }
 
-int CAStarTile::Hn(CAStarNode *pCurrentNode, CAStarNode *pPrevNode, CAStarNode *pEndNode)
+void CAStarTile::BuildPath(CAStarTileContext &ctx, int nEndIndex) const
 {
-	if (pCurrentNode->loss == -1)
+	ctx.m_vecPath.clear();
+	for (int i = nEndIndex; i != -1; i = ctx.m_vecParent[i])
 	{
-		return -1;
+		if (!ctx.m_vecPath.empty())
+		{
+			// Fill in the cells skipped by a jump.
+			int x = ctx.m_vecPath.back() % m_nWidth;
+			int y = ctx.m_vecPath.back() / m_nWidth;
+			const int tx = i % m_nWidth;
+			const int ty = i / m_nWidth;
+			const int dx = (tx > x) - (tx < x);
+			const int dy = (ty > y) - (ty < y);
+			for (x += dx, y += dy; x != tx || y != ty; x += dx, y += dy)
+			{
+				ctx.m_vecPath.push_back(y*m_nWidth + x);
+			}
+		}
+		ctx.m_vecPath.push_back(i);
 	}
-	int nIndex1 = ((CAStarTileNode*)pCurrentNode)->index;
-	int nIndex2 = ((CAStarTileNode*)pEndNode)->index;
+	std::reverse(ctx.m_vecPath.begin(), ctx.m_vecPath.end());
+}
 
-	int nRow1 = nIndex1 / m_nWidth;
-	int nCol1 = nIndex1 % m_nWidth;
+int CAStarTile::Hn(int index, int endIndex) const
+{
+	int nRow1 = index / m_nWidth;
+	int nCol1 = index % m_nWidth;
 
-	int nRow2 = nIndex2 / m_nWidth;
-	int nCol2 = nIndex2 % m_nWidth;
+	int nRow2 = endIndex / m_nWidth;
+	int nCol2 = endIndex % m_nWidth;
 
 	return (abs(nRow2 - nRow1) + abs(nCol2 - nCol1))*10;
-}
\ No newline at end of file
+}
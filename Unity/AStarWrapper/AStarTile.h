@@ -2,31 +2,125 @@
 #include "AStarImpl.h"
 #include <vector>
 
-class CAStarTileNode : public CAStarNode
+// Cost value stored for a cell that can not be entered
+static const unsigned char ASTAR_COST_BLOCKED = 0xFF;
+// Highest extra cost a walkable cell can carry
+static const unsigned char ASTAR_COST_MAX = 0xFE;
+
+// Search algorithm used by CAStarTile::Search
+enum AStarSearchMode
+{
+	ASM_ASTAR,	// plain A* over every cell
+	ASM_JPS,	// jump point search, used while all walkable cells share the same cost
+};
+
+struct CAStarTileHeapTraits
+{
+	int *f;
+	int *heapIndex;
+	inline int Key(int index) const { return f[index]; }
+	inline int &Pos(int index) const { return heapIndex[index]; }
+};
+
+class CAStarTile;
+
+// Per-search scratch state. A context can be used with any CAStarTile,
+// but only by one search at a time, so give each thread its own.
+class CAStarTileContext
 {
 public:
-	int index;
+	CAStarTileContext();
+	~CAStarTileContext();
+
+	// Cell indices from start to end of the last search
+	inline const std::vector<int> &GetPath() const { return m_vecPath; }
+
+private:
+	friend class CAStarTile;
+	friend class CAStarHierarchy;
+
+	// Sizes the arrays for a grid of count cells and starts a new search id
+	void Prepare(int count);
+
+	inline int GetState(int index) const
+	{
+		return m_vecSearchId[index] == m_nSearchId ? (int)m_vecState[index] : (int)ASS_NONE;
+	}
+	inline void SetState(int index, AStarNodeState state)
+	{
+		m_vecSearchId[index] = m_nSearchId;
+		m_vecState[index] = (unsigned char)state;
+	}
+
+	std::vector<int> m_vecG;				// cost from start
+	std::vector<int> m_vecF;				// g + estimate to end
+	std::vector<int> m_vecParent;			// previous cell on the best path, -1 for none
+	std::vector<int> m_vecHeapIndex;		// slot in m_heapOpen
+	std::vector<unsigned char> m_vecState;	// AStarNodeState, only valid when m_vecSearchId matches
+	std::vector<unsigned int> m_vecSearchId;	// search that last touched the cell
+	unsigned int m_nSearchId;				// current search, bumped by every Prepare call
+
+	CAStarHeap<int, CAStarTileHeapTraits> m_heapOpen;
+	std::vector<int> m_vecPath;
 };
 
-class CAStarTile :
-	public CAStarImpl
+// Grid pathfinder. Neighbours are derived from the cell index and the
+// direction, and every per-cell field lives in its own flat array.
+// The tile itself only holds the costs; searches write into a
+// CAStarTileContext, so one tile can be searched from several threads
+// as long as SetCost is not called at the same time.
+class CAStarTile
 {
 public:
 	CAStarTile();
 	~CAStarTile();
-	void Init(int width, int height, bool bEnable45 = false);
+	void Init(int width, int height, bool bEnable45 = false, AStarSearchMode eMode = ASM_ASTAR);
+	// Searches with the tile's own context
 	bool Search(int sx, int sy, int ex, int ey);
+	bool Search(CAStarTileContext &ctx, int sx, int sy, int ex, int ey) const;
+
+	inline int GetWidth() const { return m_nWidth; }
+	inline int GetHeight() const { return m_nHeight; }
+	inline AStarSearchMode GetSearchMode() const { return m_eMode; }
+	inline void SetSearchMode(AStarSearchMode eMode) { m_eMode = eMode; }
+	// True when every walkable cell has zero extra cost, which JPS requires
+	inline bool IsUniformCost() const { return m_nNonUniformCount == 0; }
 
-	inline int GetWidth() { return m_nWidth; }
-	inline int GetHeight() { return m_nHeight; }
+	// loss is the extra cost of entering the cell, -1 blocks it
+	void SetCost(int index, int loss);
+	int GetCost(int index) const;
+	inline bool IsEnable45() const { return m_bEnable45; }
+
+	// Cell indices from start to end of the last Search without a context
+	inline const std::vector<int> &GetPath() const { return m_context.GetPath(); }
 
-	inline std::vector<CAStarTileNode> &GetTileNode() { return m_vecTileNode;  }
-	
 protected:
-	virtual int Hn(CAStarNode *pCurrentNode, CAStarNode *pPrevNode, CAStarNode *pEndNode);
+	int Hn(int index, int endIndex) const;
+
+	// Both run from the open list Search seeded with the start cell
+	bool SearchAStar(CAStarTileContext &ctx, int nEndIndex) const;
+	bool SearchJPS(CAStarTileContext &ctx, int nEndIndex) const;
+	// Steps from (x, y) in direction (dx, dy) until a jump point is found, returns -1 if there is none
+	int Jump(int x, int y, int dx, int dy, int nEndIndex) const;
+	// Adds the open list entry or lowers its cost, shared by both search modes
+	void Relax(CAStarTileContext &ctx, int nCurrent, int nNext, int g, int nEndIndex) const;
+	// Walks the parents from the end and expands jumps into single cell steps
+	void BuildPath(CAStarTileContext &ctx, int nEndIndex) const;
+	inline bool IsWalkable(int x, int y, int nEndIndex) const
+	{
+		if (x < 0 || x >= m_nWidth || y < 0 || y >= m_nHeight)
+			return false;
+		const int index = y*m_nWidth + x;
+		return m_vecCost[index] != ASTAR_COST_BLOCKED || index == nEndIndex;
+	}
 
-	std::vector<CAStarTileNode> m_vecTileNode;
 	int m_nWidth;
 	int m_nHeight;
-};
+	bool m_bEnable45;
+	AStarSearchMode m_eMode;
+	int m_nNonUniformCount;	// walkable cells with a non zero cost
 
+	std::vector<unsigned char> m_vecCost;	// extra cost per cell, ASTAR_COST_BLOCKED if not walkable
+
+	CAStarTileContext m_context;
+};
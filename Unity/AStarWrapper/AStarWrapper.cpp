@@ -2,126 +2,243 @@
 #include <stdio.h>
 #include <stdint.h>
 #include <memory>
+#include <mutex>
+#include <atomic>
 #include <fstream>
+#include <algorithm>
 #include "AStarTile.h"
+#include "AStarHierarchy.h"
 
-CAStarTile* g_pAStarTitle = nullptr;
-int g_Astar_Offset_X = 0;
-int g_Astar_Offset_Y = 0;
-
-void AstarCreate(int width, int height, bool enable45, int offset_x, int offset_y)
-{
-	if (g_pAStarTitle == nullptr)
-	{
-		g_pAStarTitle = new CAStarTile();
-	}
-	g_pAStarTitle->Init(width, height, enable45);
-	g_Astar_Offset_X = offset_x;
-	g_Astar_Offset_Y = offset_y;
-}
-
-bool AStarSetCost(int sx, int sy, int lost)
+class AStarMap
 {
-	if (g_pAStarTitle == nullptr)
+public:
+	AStarMap()
 	{
-		return false;
+		m_nOffsetX = 0;
+		m_nOffsetY = 0;
+		m_pHierarchy = nullptr;
+		m_bHierarchyDirty = false;
 	}
-	sx = sx - g_Astar_Offset_X;
-	sy = sy - g_Astar_Offset_X;
-	if (sx < 0 || sx >= g_pAStarTitle->GetWidth() || sy < 0 || sy >= g_pAStarTitle->GetHeight())
+	~AStarMap()
 	{
-		return false;
+		delete m_pHierarchy;
 	}
 
-	int idx = sx + sy * g_pAStarTitle->GetWidth();
-	auto &nodes = g_pAStarTitle->GetTileNode();
-	if (idx < 0 || idx >= nodes.size())
-	{
-		return false;
-	}
-	nodes[idx].loss = lost;
-	return true;
-}
+public:
+	CAStarTile m_tile;
+	CAStarHierarchy* m_pHierarchy; // optional, searches across clusters go through it when set
+	std::atomic<bool> m_bHierarchyDirty; // set by cost changes, the next search rebuilds the clusters
+	std::mutex m_hierarchyLock; // lets one of the searches starting at once do the rebuild
+	int m_nOffsetX;
+	int m_nOffsetY;
+};
 
-int AStarSearch(int sx, int sy, int ex, int ey)
+class AStarContext
 {
-	if (g_pAStarTitle == nullptr)
+public:
+	AStarContext()
 	{
-		return 0;
+		m_nWidth = 0;
+		m_nOffsetX = 0;
+		m_nOffsetY = 0;
 	}
 
+public:
+	CAStarHierarchyContext m_context; // its tile context serves the flat searches
+	// Layout of the last searched map, converts the path back to map
+	// coordinates even after that map is released
+	int m_nWidth;
+	int m_nOffsetX;
+	int m_nOffsetY;
+};
 
+// Default map and context behind the handle-less API.
+AStarMap* g_pAStarMap = nullptr;
+AStarContext* g_pAStarContext = nullptr;
 
-	sx = sx - g_Astar_Offset_X;
-	sy = sy - g_Astar_Offset_X;
-	ex = ex - g_Astar_Offset_X;
-	ey = ey - g_Astar_Offset_X;
-
-	if (sx < 0)
+static int ClampCoord(int v, int size)
+{
+	if (v < 0)
 	{
-		sx = 0;
+		return 0;
 	}
-	else
+	return std::min<int>(v, size - 1);
+}
+
+AStarMap* AStarMapCreate(int width, int height, bool enable45, int offset_x, int offset_y, int mode)
+{
+	AStarMap* map = new AStarMap();
+	map->m_tile.Init(width, height, enable45, (AStarSearchMode)mode);
+	map->m_nOffsetX = offset_x;
+	map->m_nOffsetY = offset_y;
+	return map;
+}
+
+bool AStarMapEnableHierarchy(AStarMap* map, int cluster_size)
+{
+	if (map == nullptr)
 	{
-		sx = std::min<int>(sx, g_pAStarTitle->GetWidth()-1);
+		return false;
 	}
-	if (sy < 0)
+	if (cluster_size <= 0)
 	{
-		sy = 0;
+		delete map->m_pHierarchy;
+		map->m_pHierarchy = nullptr;
+		return true;
 	}
-	else
+	if (map->m_pHierarchy == nullptr)
 	{
-		sy = std::min<int>(sy, g_pAStarTitle->GetHeight() - 1);
+		map->m_pHierarchy = new CAStarHierarchy();
 	}
+	map->m_pHierarchy->Init(&map->m_tile, cluster_size);
+	return true;
+}
 
-	if (ex < 0)
+bool AStarMapSetCost(AStarMap* map, int sx, int sy, int lost)
+{
+	if (map == nullptr)
 	{
-		ex = 0;
+		return false;
 	}
-	else
+	sx = sx - map->m_nOffsetX;
+	sy = sy - map->m_nOffsetY;
+	if (sx < 0 || sx >= map->m_tile.GetWidth() || sy < 0 || sy >= map->m_tile.GetHeight())
 	{
-		ex = std::min<int>(ex, g_pAStarTitle->GetWidth() - 1);
+		return false;
 	}
-	if (ey < 0)
+
+	int idx = sx + sy * map->m_tile.GetWidth();
+	if (map->m_pHierarchy != nullptr)
 	{
-		ey = 0;
+		// Only marks the clusters around the cell, the next search rebuilds them.
+		map->m_pHierarchy->SetCost(idx, lost);
+		map->m_bHierarchyDirty.store(true, std::memory_order_release);
+		return true;
 	}
-	else
+	map->m_tile.SetCost(idx, lost);
+	return true;
+}
+
+void AStarMapRelease(AStarMap* map)
+{
+	delete map;
+}
+
+AStarContext* AStarContextCreate()
+{
+	return new AStarContext();
+}
+
+void AStarContextRelease(AStarContext* ctx)
+{
+	delete ctx;
+}
+
+int AStarMapSearch(AStarMap* map, AStarContext* ctx, int sx, int sy, int ex, int ey)
+{
+	if (map == nullptr || ctx == nullptr)
 	{
-		ey = std::min<int>(ey, g_pAStarTitle->GetHeight() - 1);
+		return 0;
 	}
 
+	const CAStarTile &tile = map->m_tile;
+	sx = ClampCoord(sx - map->m_nOffsetX, tile.GetWidth());
+	sy = ClampCoord(sy - map->m_nOffsetY, tile.GetHeight());
+	ex = ClampCoord(ex - map->m_nOffsetX, tile.GetWidth());
+	ey = ClampCoord(ey - map->m_nOffsetY, tile.GetHeight());
+
+	if (map->m_pHierarchy != nullptr && map->m_bHierarchyDirty.load(std::memory_order_acquire))
+	{
+		std::lock_guard<std::mutex> lock(map->m_hierarchyLock);
+		if (map->m_bHierarchyDirty.load(std::memory_order_relaxed))
+		{
+			map->m_pHierarchy->Update();
+			map->m_bHierarchyDirty.store(false, std::memory_order_release);
+		}
+	}
 
-	if (!g_pAStarTitle->Search(sx, sy, ex, ey))
+	ctx->m_nWidth = tile.GetWidth();
+	ctx->m_nOffsetX = map->m_nOffsetX;
+	ctx->m_nOffsetY = map->m_nOffsetY;
+	bool found = map->m_pHierarchy != nullptr
+		? map->m_pHierarchy->Search(ctx->m_context, sx, sy, ex, ey)
+		: tile.Search(ctx->m_context.GetTileContext(), sx, sy, ex, ey);
+	if (!found)
 	{
 		return 0;
 	}
-	return g_pAStarTitle->GetPath().size();
+	return ctx->m_context.GetPath().size();
 }
 
-bool AStarGetPath(int index, int &x, int &y)
+bool AStarContextGetPath(AStarContext* ctx, int index, int& x, int& y)
 {
-	if (g_pAStarTitle == nullptr)
+	if (ctx == nullptr || ctx->m_nWidth <= 0)
 	{
 		return false;
 	}
 
-	auto &paths = g_pAStarTitle->GetPath();
+	auto &paths = ctx->m_context.GetPath();
 	if (index < 0 || index >= paths.size())
 		return false;
 
-	int idx = ((CAStarTileNode*)paths[index])->index;
-	x = idx % g_pAStarTitle->GetWidth() + g_Astar_Offset_X;
-	y = idx / g_pAStarTitle->GetWidth() + g_Astar_Offset_Y;
+	int idx = paths[index];
+	x = idx % ctx->m_nWidth + ctx->m_nOffsetX;
+	y = idx / ctx->m_nWidth + ctx->m_nOffsetY;
 
 	return true;
 }
 
+void AstarCreate(int width, int height, bool enable45, int offset_x, int offset_y)
+{
+	AstarCreateEx(width, height, enable45, offset_x, offset_y, ASM_ASTAR);
+}
+
+void AstarCreateEx(int width, int height, bool enable45, int offset_x, int offset_y, int mode)
+{
+	if (g_pAStarMap == nullptr)
+	{
+		g_pAStarMap = new AStarMap();
+	}
+	if (g_pAStarContext == nullptr)
+	{
+		g_pAStarContext = new AStarContext();
+	}
+	g_pAStarMap->m_tile.Init(width, height, enable45, (AStarSearchMode)mode);
+	AStarMapEnableHierarchy(g_pAStarMap, 0);
+	g_pAStarMap->m_nOffsetX = offset_x;
+	g_pAStarMap->m_nOffsetY = offset_y;
+}
+
+bool AStarEnableHierarchy(int cluster_size)
+{
+	return AStarMapEnableHierarchy(g_pAStarMap, cluster_size);
+}
+
+bool AStarSetCost(int sx, int sy, int lost)
+{
+	return AStarMapSetCost(g_pAStarMap, sx, sy, lost);
+}
+
+int AStarSearch(int sx, int sy, int ex, int ey)
+{
+	return AStarMapSearch(g_pAStarMap, g_pAStarContext, sx, sy, ex, ey);
+}
+
+bool AStarGetPath(int index, int &x, int &y)
+{
+	return AStarContextGetPath(g_pAStarContext, index, x, y);
+}
+
 void AstarRelease()
 {
-	if (g_pAStarTitle == nullptr)
+	if (g_pAStarMap != nullptr)
 	{
-		delete g_pAStarTitle;
-		g_pAStarTitle = nullptr;
+		delete g_pAStarMap;
+		g_pAStarMap = nullptr;
 	}
-}
\ No newline at end of file
+	if (g_pAStarContext != nullptr)
+	{
+		delete g_pAStarContext;
+		g_pAStarContext = nullptr;
+	}
+}
@@ -21,8 +21,31 @@ extern "C"
 	//EXPORT_API bool UpdateObstaclesMesh();
 
 	EXPORT_API void AstarCreate(int width, int height, bool enable45, int offset_x, int offset_y);
+	// mode: 0 = A*, 1 = jump point search (falls back to A* once any cell has a non zero cost)
+	EXPORT_API void AstarCreateEx(int width, int height, bool enable45, int offset_x, int offset_y, int mode);
+	// See AStarMapEnableHierarchy, call it after the costs are set up
+	EXPORT_API bool AStarEnableHierarchy(int cluster_size);
 	EXPORT_API bool AStarSetCost(int sx, int sy, int lost);
 	EXPORT_API int AStarSearch(int sx, int sy, int ex, int ey);
 	EXPORT_API bool AStarGetPath(int index, int& x, int& y);
 	EXPORT_API void AstarRelease();
+
+	// Handle based API. A map holds the costs and can be searched from several
+	// threads at once, each with its own context. AStarMapSetCost must not run
+	// while a search on the same map is in progress.
+	class AStarMap;
+	class AStarContext;
+
+	EXPORT_API AStarMap* AStarMapCreate(int width, int height, bool enable45, int offset_x, int offset_y, int mode);
+	// Builds an HPA* cluster graph over the map so long searches only visit
+	// the cells near the abstract path. Costs set afterwards only mark the
+	// clusters around the cell, the next AStarMapSearch rebuilds the marked
+	// ones. cluster_size <= 0 turns it off again.
+	EXPORT_API bool AStarMapEnableHierarchy(AStarMap* map, int cluster_size);
+	EXPORT_API bool AStarMapSetCost(AStarMap* map, int sx, int sy, int lost);
+	EXPORT_API void AStarMapRelease(AStarMap* map);
+	EXPORT_API AStarContext* AStarContextCreate();
+	EXPORT_API void AStarContextRelease(AStarContext* ctx);
+	EXPORT_API int AStarMapSearch(AStarMap* map, AStarContext* ctx, int sx, int sy, int ex, int ey);
+	EXPORT_API bool AStarContextGetPath(AStarContext* ctx, int index, int& x, int& y);
 }
\ No newline at end of file
@@ -1,17 +1,36 @@
 #include "NavMeshWrapper.h"
 #include <stdio.h>
 #include <stdint.h>
+#include <string.h>
 #include <memory>
 #include <fstream>
+#include <mutex>
+#include <vector>
+#include <algorithm>
+#include <atomic>
+#include <map>
+#include <thread>
+#include <condition_variable>
 #include "DetourCrowd.h"
+#include "DetourOrcaAvoidance.h"
 #include "DetourNavMesh.h"
 #include "DetourNavMeshBuilder.h"
 #include "DetourNavMeshQuery.h"
+#include "DetourNode.h"
 #include "DetourTileCache.h"
 #include "DetourTileCacheBuilder.h"
 #include "DetourCommon.h"
 #include "fastlz.h"
 
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
 #ifdef WIN32
 #ifndef NDEBUG
 	#define ENABLE_LOG
@@ -20,6 +39,7 @@
 
 FILE* fp;
 static const int MAX_POLYS = 256;
+static const int MAX_QUERY_NODES = 2048;
 
 struct NavMeshSetHeader
 {
@@ -191,12 +211,336 @@ struct MeshProcess : public dtTileCacheMeshProcess
 	}
 };
 
-LinearAllocator* m_talloc = new LinearAllocator(32000);
-FastLZCompressor* m_tcomp = new FastLZCompressor;
-MeshProcess* m_tmproc = new MeshProcess;
+// What a dtTileCache builds its navmesh tiles with. The tile cache keeps pointers
+// to them and the allocator is scratch space, so every tile cache gets its own.
+struct TileCacheProcs
+{
+	TileCacheProcs() : talloc(32000) {}
+
+	LinearAllocator talloc;
+	FastLZCompressor tcomp;
+	MeshProcess tmproc;
+};
 //------------------------- TempObstacles End-------------------------------
 
 
+// Copy-on-write mapping of a navmesh file. Pages Detour never writes to stay
+// shared with every other mapping of the same file, across processes too.
+class MappedFile
+{
+public:
+	MappedFile()
+	{
+		m_data = nullptr;
+		m_size = 0;
+#ifdef _WIN32
+		m_file = INVALID_HANDLE_VALUE;
+		m_mapping = nullptr;
+#endif
+	}
+
+	~MappedFile()
+	{
+		Close();
+	}
+
+	bool Open(const char* path)
+	{
+		Close();
+#ifdef _WIN32
+		m_file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+		if (m_file == INVALID_HANDLE_VALUE)
+			return false;
+		LARGE_INTEGER size;
+		if (!GetFileSizeEx(m_file, &size) || size.QuadPart == 0)
+		{
+			Close();
+			return false;
+		}
+		m_mapping = CreateFileMappingA(m_file, nullptr, PAGE_WRITECOPY, 0, 0, nullptr);
+		if (m_mapping == nullptr)
+		{
+			Close();
+			return false;
+		}
+		m_data = (unsigned char*)MapViewOfFile(m_mapping, FILE_MAP_COPY, 0, 0, 0);
+		m_size = (size_t)size.QuadPart;
+#else
+		int fd = open(path, O_RDONLY);
+		if (fd < 0)
+			return false;
+		struct stat st;
+		if (fstat(fd, &st) != 0 || st.st_size == 0)
+		{
+			::close(fd);
+			return false;
+		}
+		void* data = mmap(nullptr, (size_t)st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+		::close(fd);
+		if (data == MAP_FAILED)
+			return false;
+		m_data = (unsigned char*)data;
+		m_size = (size_t)st.st_size;
+#endif
+		if (m_data == nullptr)
+		{
+			Close();
+			return false;
+		}
+		return true;
+	}
+
+	// Takes over the mapping of other, which is left closed
+	void Adopt(MappedFile& other)
+	{
+		Close();
+		std::swap(m_data, other.m_data);
+		std::swap(m_size, other.m_size);
+#ifdef _WIN32
+		std::swap(m_file, other.m_file);
+		std::swap(m_mapping, other.m_mapping);
+#endif
+	}
+
+	void Close()
+	{
+#ifdef _WIN32
+		if (m_data)
+			UnmapViewOfFile(m_data);
+		if (m_mapping)
+			CloseHandle(m_mapping);
+		if (m_file != INVALID_HANDLE_VALUE)
+			CloseHandle(m_file);
+		m_mapping = nullptr;
+		m_file = INVALID_HANDLE_VALUE;
+#else
+		if (m_data)
+			munmap(m_data, m_size);
+#endif
+		m_data = nullptr;
+		m_size = 0;
+	}
+
+public:
+	unsigned char* m_data;
+	size_t m_size;
+#ifdef _WIN32
+	HANDLE m_file;
+	HANDLE m_mapping;
+#endif
+};
+
+// A map loaded once and shared by every instance attached to it. The base
+// navmesh is never modified; an instance that adds temp obstacles builds its
+// own tiles on top of the shared compressed tiles, see NavMeshInstance::Detach.
+class NavMeshShared
+{
+public:
+	NavMeshShared()
+	{
+		m_refCount = 1;
+		m_navMesh = nullptr;
+		m_hasTileCache = false;
+		memset(&m_meshParams, 0, sizeof(m_meshParams));
+		memset(&m_cacheParams, 0, sizeof(m_cacheParams));
+	}
+
+	~NavMeshShared()
+	{
+		if (m_navMesh)
+		{
+			dtFreeNavMesh(m_navMesh);
+			m_navMesh = nullptr;
+		}
+		for (size_t i = 0; i < m_tiles.size(); ++i)
+		{
+			dtFree(m_tiles[i].data);
+		}
+		m_tiles.clear();
+	}
+
+	void AddRef()
+	{
+		++m_refCount;
+	}
+
+	void Release()
+	{
+		if (--m_refCount == 0)
+			delete this;
+	}
+
+public:
+	std::atomic<int> m_refCount;
+	dtNavMesh* m_navMesh;					// base mesh without obstacles, read only
+	bool m_hasTileCache;
+	dtNavMeshParams m_meshParams;
+	dtTileCacheParams m_cacheParams;
+	std::vector<TileCacheData> m_tiles;		// compressed tiles, read only, used in place by every tile cache
+};
+
+class NavMeshInstance;
+
+// Filter and pick extents a query runs with, set up once per instance and picked by id.
+struct QueryProfile
+{
+	dtQueryFilter filter;
+	float extents[3];
+};
+
+// Thread pool running the parallel phases of dtCrowd::update. The calling
+// thread works as worker 0, the pool threads take the other worker ids.
+class CrowdJobRunner : public dtCrowdJobRunner
+{
+public:
+	explicit CrowdJobRunner(int threadCount)
+	{
+		m_job = nullptr;
+		m_count = 0;
+		m_grain = 1;
+		m_generation = 0;
+		m_busy = 0;
+		m_stop = false;
+		for (int i = 1; i < threadCount; ++i)
+		{
+			m_threads.push_back(std::thread(&CrowdJobRunner::WorkerMain, this, i));
+		}
+	}
+
+	~CrowdJobRunner()
+	{
+		{
+			std::lock_guard<std::mutex> lock(m_lock);
+			m_stop = true;
+		}
+		m_wake.notify_all();
+		for (size_t i = 0; i < m_threads.size(); ++i)
+		{
+			m_threads[i].join();
+		}
+	}
+
+	virtual int getWorkerCount()
+	{
+		return (int)m_threads.size() + 1;
+	}
+
+	virtual void run(dtCrowdJob* job, const int count)
+	{
+		// Small phases are not worth waking the pool for.
+		static const int MIN_PARALLEL_COUNT = 64;
+		if (m_threads.empty() || count < MIN_PARALLEL_COUNT)
+		{
+			job->execute(0, count, 0);
+			return;
+		}
+
+		{
+			std::lock_guard<std::mutex> lock(m_lock);
+			m_job = job;
+			m_count = count;
+			m_grain = dtMax(16, count / (getWorkerCount() * 4));
+			m_next = 0;
+			m_busy = (int)m_threads.size();
+			m_generation++;
+		}
+		m_wake.notify_all();
+		RunRanges(job, count, 0);
+
+		std::unique_lock<std::mutex> lock(m_lock);
+		m_done.wait(lock, [this] { return m_busy == 0; });
+		m_job = nullptr;
+	}
+
+private:
+	void RunRanges(dtCrowdJob* job, int count, int worker)
+	{
+		for (;;)
+		{
+			const int begin = m_next.fetch_add(m_grain);
+			if (begin >= count)
+				break;
+			job->execute(begin, dtMin(begin + m_grain, count), worker);
+		}
+	}
+
+	void WorkerMain(int worker)
+	{
+		unsigned int seen = 0;
+		for (;;)
+		{
+			dtCrowdJob* job;
+			int count;
+			{
+				std::unique_lock<std::mutex> lock(m_lock);
+				m_wake.wait(lock, [&] { return m_stop || m_generation != seen; });
+				if (m_stop)
+					return;
+				seen = m_generation;
+				job = m_job;
+				count = m_count;
+			}
+			RunRanges(job, count, worker);
+			{
+				std::lock_guard<std::mutex> lock(m_lock);
+				m_busy--;
+			}
+			m_done.notify_one();
+		}
+	}
+
+	std::vector<std::thread> m_threads;
+	std::mutex m_lock;
+	std::condition_variable m_wake;
+	std::condition_variable m_done;
+	dtCrowdJob* m_job;
+	int m_count;
+	int m_grain;
+	std::atomic<int> m_next;
+	unsigned int m_generation;	// bumped by every parallel run
+	int m_busy;					// pool threads not done with the current run
+	bool m_stop;
+};
+
+// A time sliced path search, see RequestPath.
+struct PathRequest
+{
+	dtPathQueueRef ref;			// search in the path queue, DT_PATHQ_INVALID while waiting for a slot or done
+	int profile;
+	int status;					// NavMeshPathStatus
+	float startPos[3];
+	float endPos[3];
+	dtPolyRef startRef;
+	dtPolyRef endRef;
+	std::vector<float> points;	// x, y pairs once done
+};
+
+// A query with its own scratch, leased from a NavMeshInstance by one thread at a time.
+class NavMeshQuery
+{
+public:
+	NavMeshQuery(NavMeshInstance* inst)
+	{
+		m_inst = inst;
+		m_navQuery = nullptr;
+	}
+
+	~NavMeshQuery()
+	{
+		if (m_navQuery)
+		{
+			dtFreeNavMeshQuery(m_navQuery);
+			m_navQuery = nullptr;
+		}
+	}
+
+public:
+	NavMeshInstance* m_inst;
+	dtNavMeshQuery* m_navQuery;
+	float m_straightPath[MAX_POLYS * 3];
+	int32_t m_nStraightPath = 0;
+};
+
 class NavMeshInstance
 {
 public:
@@ -206,13 +550,29 @@ public:
 		m_navQuery = nullptr;
 		m_crowd = nullptr;
 		m_tileCache = nullptr;
+		m_shared = nullptr;
+		m_tileCacheProcs = nullptr;
+		m_pathQueue = nullptr;
+		m_nextPathTicket = 1;
+		m_crowdJobs = nullptr;
+
+		// Path searches pick with wider extents than raycasts and crowd targets.
+		for (int i = 0; i < NAVQUERY_MAX_PROFILES; ++i)
+		{
+			QueryProfile& profile = m_profiles[i];
+			profile.filter.setIncludeFlags(SAMPLE_POLYFLAGS_ALL ^ SAMPLE_POLYFLAGS_DISABLED);
+			profile.filter.setExcludeFlags(0);
+			dtVset(profile.extents, 2.0f, 4.0f, 2.0f);
+		}
+		dtVset(m_profiles[NAVQUERY_PROFILE_PATH].extents, 3.0f, 4.0f, 3.0f);
 	}
 
 	~NavMeshInstance()
 	{
 		if (m_navMesh)
 		{
-			dtFreeNavMesh(m_navMesh);
+			if (m_shared == nullptr || m_navMesh != m_shared->m_navMesh)
+				dtFreeNavMesh(m_navMesh);
 			m_navMesh = nullptr;
 		}
 		if (m_crowd)
@@ -220,6 +580,10 @@ public:
 			dtFreeCrowd(m_crowd);
 			m_crowd = nullptr;
 		}
+		delete m_crowdJobs;
+		m_crowdJobs = nullptr;
+		delete m_pathQueue;
+		m_pathQueue = nullptr;
 		if (m_navQuery)
 		{
 			dtFreeNavMeshQuery(m_navQuery);
@@ -230,6 +594,140 @@ public:
 			dtFreeTileCache(m_tileCache);
 			m_tileCache = nullptr;
 		}
+		delete m_tileCacheProcs;
+		m_tileCacheProcs = nullptr;
+		for (size_t i = 0; i < m_queries.size(); ++i)
+		{
+			delete m_queries[i];
+		}
+		m_queries.clear();
+		m_freeQueries.clear();
+		// Tiles may point into the mapping or the shared map, so they go last.
+		m_mappedFile.Close();
+		if (m_shared)
+		{
+			m_shared->Release();
+			m_shared = nullptr;
+		}
+	}
+
+	// Gives an instance attached to a shared tile cache map its own navmesh and
+	// tile cache, so temp obstacles only change this instance. The navmesh tiles
+	// are copied from the base with their original refs, which keeps poly refs
+	// held by agents valid; the compressed tiles stay shared.
+	bool Detach()
+	{
+		if (m_shared == nullptr || !m_shared->m_hasTileCache || m_tileCache != nullptr)
+			return m_tileCache != nullptr;
+
+		const dtNavMesh* base = m_shared->m_navMesh;
+		dtNavMesh* navMesh = dtAllocNavMesh();
+		if (!navMesh || dtStatusFailed(navMesh->init(&m_shared->m_meshParams)))
+		{
+			dtFreeNavMesh(navMesh);
+			return false;
+		}
+		for (int i = 0; i < base->getMaxTiles(); ++i)
+		{
+			const dtMeshTile* tile = base->getTile(i);
+			if (!tile || !tile->header || !tile->dataSize)
+				continue;
+			unsigned char* data = (unsigned char*)dtAlloc(tile->dataSize, DT_ALLOC_PERM);
+			if (!data)
+			{
+				dtFreeNavMesh(navMesh);
+				return false;
+			}
+			memcpy(data, tile->data, tile->dataSize);
+			if (dtStatusFailed(navMesh->addTile(data, tile->dataSize, DT_TILE_FREE_DATA, base->getTileRef(tile), 0)))
+			{
+				dtFree(data);
+				dtFreeNavMesh(navMesh);
+				return false;
+			}
+		}
+
+		TileCacheProcs* procs = new TileCacheProcs();
+		dtTileCache* tileCache = dtAllocTileCache();
+		if (!tileCache || dtStatusFailed(tileCache->init(&m_shared->m_cacheParams, &procs->talloc, &procs->tcomp, &procs->tmproc)))
+		{
+			dtFreeTileCache(tileCache);
+			delete procs;
+			dtFreeNavMesh(navMesh);
+			return false;
+		}
+		for (size_t i = 0; i < m_shared->m_tiles.size(); ++i)
+		{
+			tileCache->addTile(m_shared->m_tiles[i].data, m_shared->m_tiles[i].dataSize, 0, 0);
+		}
+
+		// Everything that searched the base now searches the own mesh.
+		m_tileCache = tileCache;
+		m_tileCacheProcs = procs;
+		m_navQuery->init(navMesh, MAX_QUERY_NODES);
+		{
+			// Leased queries may be searching the base right now, they are
+			// rebound in ReleaseQuery once returned.
+			std::lock_guard<std::mutex> lock(m_queryLock);
+			m_navMesh = navMesh;
+			for (size_t i = 0; i < m_freeQueries.size(); ++i)
+			{
+				m_freeQueries[i]->m_navQuery->init(m_navMesh, MAX_QUERY_NODES);
+			}
+		}
+		if (m_crowd && m_crowd->getNavMeshQuery())
+		{
+			// Keeps the agents, their pending path requests are made again.
+			m_crowd->setNavMesh(m_navMesh);
+		}
+		if (m_pathQueue)
+		{
+			// Searches in flight ran on the old mesh, start them over.
+			m_pathQueue->init(MAX_POLYS, MAX_QUERY_NODES, m_navMesh);
+			for (std::map<unsigned int, PathRequest>::iterator it = m_pathRequests.begin(); it != m_pathRequests.end(); ++it)
+			{
+				it->second.ref = DT_PATHQ_INVALID;
+			}
+		}
+		return true;
+	}
+
+	// Hands out an idle query, creating one when all are leased.
+	NavMeshQuery* AcquireQuery()
+	{
+		std::lock_guard<std::mutex> lock(m_queryLock);
+		if (!m_freeQueries.empty())
+		{
+			NavMeshQuery* query = m_freeQueries.back();
+			m_freeQueries.pop_back();
+			return query;
+		}
+
+		NavMeshQuery* query = new NavMeshQuery(this);
+		query->m_navQuery = dtAllocNavMeshQuery();
+		if (!query->m_navQuery || dtStatusFailed(query->m_navQuery->init(m_navMesh, MAX_QUERY_NODES)))
+		{
+			delete query;
+			return nullptr;
+		}
+		m_queries.push_back(query);
+		return query;
+	}
+
+	// Takes a query back, rebinding it when the instance detached while it was leased.
+	void ReleaseQuery(NavMeshQuery* query)
+	{
+		std::lock_guard<std::mutex> lock(m_queryLock);
+		if (query->m_navQuery->getAttachedNavMesh() != m_navMesh)
+		{
+			query->m_navQuery->init(m_navMesh, MAX_QUERY_NODES);
+		}
+		m_freeQueries.push_back(query);
+	}
+
+	inline const QueryProfile* GetProfile(int id) const
+	{
+		return (id >= 0 && id < NAVQUERY_MAX_PROFILES) ? &m_profiles[id] : nullptr;
 	}
 
 public:
@@ -237,8 +735,42 @@ public:
 	dtNavMeshQuery* m_navQuery;
 	dtCrowd* m_crowd;
 	dtTileCache* m_tileCache;
+	TileCacheProcs* m_tileCacheProcs;	// used by m_tileCache, freed after it
 	float m_straightPath[MAX_POLYS * 3];
 	int32_t m_nStraightPath = 0;
+
+	std::mutex m_queryLock;
+	std::vector<NavMeshQuery*> m_queries;		// every query created, owned by the instance
+	std::vector<NavMeshQuery*> m_freeQueries;	// the ones not leased right now
+
+	MappedFile m_mappedFile;	// backing store of the tiles when loaded from a file
+	NavMeshShared* m_shared;	// map this instance is attached to, if any
+
+	// Read by every query without locking, so change them before querying from other threads.
+	QueryProfile m_profiles[NAVQUERY_MAX_PROFILES];
+
+	CrowdJobRunner* m_crowdJobs;						// set by SetCrowdThreadCount
+	dtOrcaAvoidance m_orca;								// crowd solver for NAVCROWD_AVOIDANCE_ORCA
+	dtPathQueue* m_pathQueue;							// created by the first RequestPath
+	std::map<unsigned int, PathRequest> m_pathRequests;	// by ticket, so iterating goes oldest first
+	unsigned int m_nextPathTicket;
+};
+
+// Returns a leased query to its instance when it goes out of scope.
+class NavMeshQueryLease
+{
+public:
+	NavMeshQueryLease(NavMeshInstance* inst) : m_inst(inst), m_query(inst->AcquireQuery()) {}
+	~NavMeshQueryLease()
+	{
+		if (m_query)
+			m_inst->ReleaseQuery(m_query);
+	}
+	NavMeshQuery* get() const { return m_query; }
+
+private:
+	NavMeshInstance* m_inst;
+	NavMeshQuery* m_query;
 };
 
 
@@ -251,35 +783,95 @@ public:
 #include <list>
 std::list<NavMeshInstance*> g_navmesh_insts;
 
-NavMeshInstance* LoadNavMesh(unsigned char* pucValue, unsigned int uiLength)
+// Inits navMesh from a solo tile or from a NavMeshSetHeader tile set.
+// With DT_TILE_FREE_DATA the navmesh owns data on success; a tile set is then
+// copied tile by tile and data is freed here. Without it the tiles are used in place.
+static dtStatus InitNavMeshData(dtNavMesh* navMesh, unsigned char* data, unsigned int uiLength, int flags)
+{
+	NavMeshSetHeader header;
+	if (uiLength < sizeof(NavMeshSetHeader))
+		return navMesh->init(data, uiLength, flags);
+	memcpy(&header, data, sizeof(NavMeshSetHeader));
+	if (header.magic != NAVMESHSET_MAGIC)
+		return navMesh->init(data, uiLength, flags);
+	if (header.version != NAVMESHSET_VERSION)
+		return DT_FAILURE | DT_WRONG_VERSION;
+
+	dtStatus status = navMesh->init(&header.params);
+	if (dtStatusFailed(status))
+		return status;
+
+	unsigned int pos = sizeof(NavMeshSetHeader);
+	for (int i = 0; i < header.numTiles; ++i)
+	{
+		NavMeshTileHeader tileHeader;
+		if (pos + sizeof(tileHeader) > uiLength)
+			return DT_FAILURE | DT_INVALID_PARAM;
+		memcpy(&tileHeader, data + pos, sizeof(tileHeader));
+		pos += sizeof(tileHeader);
+		if (!tileHeader.tileRef || tileHeader.dataSize <= 0 || (unsigned int)tileHeader.dataSize > uiLength - pos)
+			return DT_FAILURE | DT_INVALID_PARAM;
+
+		unsigned char* tileData = data + pos;
+		if (flags & DT_TILE_FREE_DATA)
+		{
+			tileData = (unsigned char*)dtAlloc(tileHeader.dataSize, DT_ALLOC_PERM);
+			if (!tileData)
+				return DT_FAILURE | DT_OUT_OF_MEMORY;
+			memcpy(tileData, data + pos, tileHeader.dataSize);
+		}
+		else if (((uintptr_t)tileData & 3) != 0)
+		{
+			return DT_FAILURE | DT_INVALID_PARAM;
+		}
+		pos += tileHeader.dataSize;
+
+		status = navMesh->addTile(tileData, tileHeader.dataSize, flags, tileHeader.tileRef, 0);
+		if (dtStatusFailed(status))
+		{
+			if (flags & DT_TILE_FREE_DATA)
+				dtFree(tileData);
+			return status;
+		}
+	}
+
+	if (flags & DT_TILE_FREE_DATA)
+		dtFree(data);
+	return DT_SUCCESS;
+}
+
+// Creates an instance over a solo navmesh or a tile set. With DT_TILE_FREE_DATA
+// in flags the instance takes data over, also when it fails. Without it the data
+// is used in place and has to outlive the instance.
+static NavMeshInstance* CreateNavMeshInstance(unsigned char* data, unsigned int uiLength, int flags)
 {
-#ifdef ENABLE_LOG
-	fp = fopen("navmesh.log", "w+");
-#endif
-	LOG("--------------------------------------------LoadNavMesh--------------------------------------------");
 	dtNavMesh *g_navMesh = dtAllocNavMesh();
 	if (!g_navMesh)
 	{
 		LOG("Could not create Detour navmesh");
+		if (flags & DT_TILE_FREE_DATA)
+			dtFree(data);
 		return nullptr;
 	}
 
 	dtStatus status;
 
-	unsigned char* data = (unsigned char*)dtAlloc(uiLength, DT_ALLOC_PERM);
-	memcpy(data, pucValue, uiLength);
-	status = g_navMesh->init(data, uiLength, DT_TILE_FREE_DATA);
+	status = InitNavMeshData(g_navMesh, data, uiLength, flags);
 	if (dtStatusFailed(status))
 	{
 		LOG("Could not init Detour navmesh");
+		dtFreeNavMesh(g_navMesh);
+		if (flags & DT_TILE_FREE_DATA)
+			dtFree(data);
 		return nullptr;
 	}
 
 	dtNavMeshQuery *g_navQuery = dtAllocNavMeshQuery();
-	status = g_navQuery->init(g_navMesh, 2048);
-	if (dtStatusFailed(status))
+	if (!g_navQuery || dtStatusFailed(g_navQuery->init(g_navMesh, MAX_QUERY_NODES)))
 	{
 		LOG("Could not init Detour navmesh query");
+		dtFreeNavMeshQuery(g_navQuery);
+		dtFreeNavMesh(g_navMesh);
 		return nullptr;
 	}
 	LOG("LoadNavMesh:%d", uiLength);
@@ -294,103 +886,384 @@ NavMeshInstance* LoadNavMesh(unsigned char* pucValue, unsigned int uiLength)
 	return navMeshInstance;
 }
 
-NavMeshInstance *LoadObstaclesMesh(unsigned char* pucValue, unsigned int uiLength)
+NavMeshInstance* LoadNavMesh(unsigned char* pucValue, unsigned int uiLength)
 {
 #ifdef ENABLE_LOG
 	fp = fopen("navmesh.log", "w+");
 #endif
-	LOG("--------------------------------------------LoadObstaclesMesh--------------------------------------------");
+	LOG("--------------------------------------------LoadNavMesh--------------------------------------------");
+	unsigned char* data = (unsigned char*)dtAlloc(uiLength, DT_ALLOC_PERM);
+	if (!data)
+	{
+		return nullptr;
+	}
+	memcpy(data, pucValue, uiLength);
+	return CreateNavMeshInstance(data, uiLength, DT_TILE_FREE_DATA);
+}
 
-	// Read header.
-	TileCacheSetHeader header;
-	int pos = 0;
-	memcpy(&header, pucValue + pos, sizeof(TileCacheSetHeader));
-	pos += sizeof(TileCacheSetHeader);
-	if (header.magic != TILECACHESET_MAGIC)
+NavMeshInstance* LoadNavMeshInPlace(unsigned char* pucValue, unsigned int uiLength)
+{
+#ifdef ENABLE_LOG
+	fp = fopen("navmesh.log", "w+");
+#endif
+	LOG("--------------------------------------------LoadNavMeshInPlace--------------------------------------------");
+	// Detour reads the tile through casts, so it must start on a 4 byte boundary.
+	if (pucValue == nullptr || ((uintptr_t)pucValue & 3) != 0)
 	{
+		LOG("Navmesh buffer is not 4 byte aligned");
 		return nullptr;
 	}
-	if (header.version != TILECACHESET_VERSION)
+	return CreateNavMeshInstance(pucValue, uiLength, 0);
+}
+
+NavMeshInstance* LoadNavMeshFile(const char* path)
+{
+#ifdef ENABLE_LOG
+	fp = fopen("navmesh.log", "w+");
+#endif
+	LOG("--------------------------------------------LoadNavMeshFile--------------------------------------------");
+	MappedFile file;
+	if (path == nullptr || !file.Open(path))
 	{
+		LOG("Could not map %s", path ? path : "");
 		return nullptr;
 	}
+	NavMeshInstance* navMeshInstance = CreateNavMeshInstance(file.m_data, (unsigned int)file.m_size, 0);
+	if (navMeshInstance)
+	{
+		navMeshInstance->m_mappedFile.Adopt(file);
+	}
+	return navMeshInstance;
+}
 
-	dtNavMesh *g_navMesh = dtAllocNavMesh();
-	if (!g_navMesh)
+// Creates an instance over a tile cache set. With inPlace the compressed tiles
+// are used where they are in pucValue, which then has to outlive the instance.
+static NavMeshInstance* CreateObstaclesInstance(unsigned char* pucValue, unsigned int uiLength, bool inPlace)
+{
+	// Read header.
+	TileCacheSetHeader header;
+	unsigned int pos = 0;
+	if (uiLength < sizeof(TileCacheSetHeader))
 	{
 		return nullptr;
 	}
-	dtStatus status = g_navMesh->init(&header.meshParams);
-	if (dtStatusFailed(status))
+	memcpy(&header, pucValue + pos, sizeof(TileCacheSetHeader));
+	pos += sizeof(TileCacheSetHeader);
+	if (header.magic != TILECACHESET_MAGIC)
+	{
+		return nullptr;
+	}
+	if (header.version != TILECACHESET_VERSION)
 	{
 		return nullptr;
 	}
 
-	m_talloc = new LinearAllocator(32000);
-	m_tcomp = new FastLZCompressor;
-	m_tmproc = new MeshProcess;
-	dtTileCache *g_tileCache = dtAllocTileCache();
-	if (!g_tileCache)
+	// The instance owns everything from here on, so deleting it cleans up a failed load.
+	NavMeshInstance* navMeshInstance = new NavMeshInstance();
+	navMeshInstance->m_navMesh = dtAllocNavMesh();
+	if (!navMeshInstance->m_navMesh || dtStatusFailed(navMeshInstance->m_navMesh->init(&header.meshParams)))
 	{
-		fclose(fp);
+		LOG("Could not init Detour navmesh");
+		delete navMeshInstance;
 		return nullptr;
 	}
-	status = g_tileCache->init(&header.cacheParams, m_talloc, m_tcomp, m_tmproc);
-	if (dtStatusFailed(status))
+
+	TileCacheProcs* procs = new TileCacheProcs();
+	navMeshInstance->m_tileCacheProcs = procs;
+	navMeshInstance->m_tileCache = dtAllocTileCache();
+	if (!navMeshInstance->m_tileCache ||
+		dtStatusFailed(navMeshInstance->m_tileCache->init(&header.cacheParams, &procs->talloc, &procs->tcomp, &procs->tmproc)))
 	{
+		LOG("Could not init tile cache");
+		delete navMeshInstance;
 		return nullptr;
 	}
+	dtTileCache* tileCache = navMeshInstance->m_tileCache;
 
 	// Read tiles.
 	for (int i = 0; i < header.numTiles; ++i)
 	{
 		TileCacheTileHeader tileHeader;
+		if (pos + sizeof(tileHeader) > uiLength)
+			break;
 		memcpy(&tileHeader, pucValue + pos, sizeof(tileHeader));
 		pos += sizeof(tileHeader);
-		if (!tileHeader.tileRef || !tileHeader.dataSize)
+		if (!tileHeader.tileRef || tileHeader.dataSize <= 0 || pos + tileHeader.dataSize > uiLength)
 			break;
 
-		unsigned char* data = (unsigned char*)dtAlloc(tileHeader.dataSize, DT_ALLOC_PERM);
-		if (!data) break;
-		memset(data, 0, tileHeader.dataSize);
-		memcpy(data, pucValue + pos, tileHeader.dataSize);
+		// The tile cache reads the layer header through a cast, so tiles that
+		// do not start on a 4 byte boundary are still copied.
+		unsigned char* data = pucValue + pos;
+		unsigned char flags = 0;
+		if (!inPlace || ((uintptr_t)data & 3) != 0)
+		{
+			data = (unsigned char*)dtAlloc(tileHeader.dataSize, DT_ALLOC_PERM);
+			if (!data) break;
+			memcpy(data, pucValue + pos, tileHeader.dataSize);
+			flags = DT_COMPRESSEDTILE_FREE_DATA;
+		}
 		pos += tileHeader.dataSize;
 
 		dtCompressedTileRef tile = 0;
-		dtStatus addTileStatus = g_tileCache->addTile(data, tileHeader.dataSize, DT_COMPRESSEDTILE_FREE_DATA, &tile);
-		if (dtStatusFailed(addTileStatus))
+		dtStatus addTileStatus = tileCache->addTile(data, tileHeader.dataSize, flags, &tile);
+		if (dtStatusFailed(addTileStatus) && flags)
 		{
 			dtFree(data);
 		}
 
 		if (tile)
-			g_tileCache->buildNavMeshTile(tile, g_navMesh);
+			tileCache->buildNavMeshTile(tile, navMeshInstance->m_navMesh);
 	}
 
-	dtNavMeshQuery *g_navQuery = dtAllocNavMeshQuery();
-	status = g_navQuery->init(g_navMesh, 2048);
-	if (dtStatusFailed(status))
+	navMeshInstance->m_navQuery = dtAllocNavMeshQuery();
+	if (!navMeshInstance->m_navQuery || dtStatusFailed(navMeshInstance->m_navQuery->init(navMeshInstance->m_navMesh, MAX_QUERY_NODES)))
 	{
 		LOG("Could not init Detour navmesh query");
+		delete navMeshInstance;
 		return nullptr;
 	}
 	LOG("LoadObstaclesMesh:%d", uiLength);
 
-	dtCrowd *g_crowd = dtAllocCrowd();
+	navMeshInstance->m_crowd = dtAllocCrowd();
+	g_navmesh_insts.push_back(navMeshInstance);
+
+	return navMeshInstance;
+}
+
+NavMeshInstance *LoadObstaclesMesh(unsigned char* pucValue, unsigned int uiLength)
+{
+#ifdef ENABLE_LOG
+	fp = fopen("navmesh.log", "w+");
+#endif
+	LOG("--------------------------------------------LoadObstaclesMesh--------------------------------------------");
+	return CreateObstaclesInstance(pucValue, uiLength, false);
+}
+
+NavMeshInstance *LoadObstaclesMeshInPlace(unsigned char* pucValue, unsigned int uiLength)
+{
+#ifdef ENABLE_LOG
+	fp = fopen("navmesh.log", "w+");
+#endif
+	LOG("--------------------------------------------LoadObstaclesMeshInPlace--------------------------------------------");
+	if (pucValue == nullptr)
+	{
+		return nullptr;
+	}
+	return CreateObstaclesInstance(pucValue, uiLength, true);
+}
+
+NavMeshInstance *LoadObstaclesMeshFile(const char* path)
+{
+#ifdef ENABLE_LOG
+	fp = fopen("navmesh.log", "w+");
+#endif
+	LOG("--------------------------------------------LoadObstaclesMeshFile--------------------------------------------");
+	MappedFile file;
+	if (path == nullptr || !file.Open(path))
+	{
+		LOG("Could not map %s", path ? path : "");
+		return nullptr;
+	}
+	NavMeshInstance* navMeshInstance = CreateObstaclesInstance(file.m_data, (unsigned int)file.m_size, true);
+	if (navMeshInstance)
+	{
+		navMeshInstance->m_mappedFile.Adopt(file);
+	}
+	return navMeshInstance;
+}
+
+NavMeshShared* LoadSharedNavMesh(unsigned char* pucValue, unsigned int uiLength)
+{
+	if (pucValue == nullptr || uiLength == 0)
+	{
+		return nullptr;
+	}
+	unsigned char* data = (unsigned char*)dtAlloc(uiLength, DT_ALLOC_PERM);
+	if (!data)
+	{
+		return nullptr;
+	}
+	memcpy(data, pucValue, uiLength);
+
+	NavMeshShared* shared = new NavMeshShared();
+	shared->m_navMesh = dtAllocNavMesh();
+	if (!shared->m_navMesh || dtStatusFailed(InitNavMeshData(shared->m_navMesh, data, uiLength, DT_TILE_FREE_DATA)))
+	{
+		LOG("Could not init shared Detour navmesh");
+		dtFree(data);
+		shared->Release();
+		return nullptr;
+	}
+	return shared;
+}
+
+NavMeshShared* LoadSharedObstaclesMesh(unsigned char* pucValue, unsigned int uiLength)
+{
+	TileCacheSetHeader header;
+	unsigned int pos = 0;
+	if (pucValue == nullptr || uiLength < sizeof(TileCacheSetHeader))
+	{
+		return nullptr;
+	}
+	memcpy(&header, pucValue + pos, sizeof(TileCacheSetHeader));
+	pos += sizeof(TileCacheSetHeader);
+	if (header.magic != TILECACHESET_MAGIC || header.version != TILECACHESET_VERSION)
+	{
+		return nullptr;
+	}
+
+	NavMeshShared* shared = new NavMeshShared();
+	shared->m_hasTileCache = true;
+	shared->m_meshParams = header.meshParams;
+	shared->m_cacheParams = header.cacheParams;
+	shared->m_navMesh = dtAllocNavMesh();
+	if (!shared->m_navMesh || dtStatusFailed(shared->m_navMesh->init(&header.meshParams)))
+	{
+		shared->Release();
+		return nullptr;
+	}
+
+	// The compressed tiles are copied once here and used in place from then on.
+	TileCacheProcs procs;
+	dtTileCache* tileCache = dtAllocTileCache();
+	if (!tileCache || dtStatusFailed(tileCache->init(&header.cacheParams, &procs.talloc, &procs.tcomp, &procs.tmproc)))
+	{
+		dtFreeTileCache(tileCache);
+		shared->Release();
+		return nullptr;
+	}
+	for (int i = 0; i < header.numTiles; ++i)
+	{
+		TileCacheTileHeader tileHeader;
+		if (pos + sizeof(tileHeader) > uiLength)
+			break;
+		memcpy(&tileHeader, pucValue + pos, sizeof(tileHeader));
+		pos += sizeof(tileHeader);
+		if (!tileHeader.tileRef || tileHeader.dataSize <= 0 || pos + tileHeader.dataSize > uiLength)
+			break;
+
+		TileCacheData tile;
+		tile.data = (unsigned char*)dtAlloc(tileHeader.dataSize, DT_ALLOC_PERM);
+		if (!tile.data) break;
+		tile.dataSize = tileHeader.dataSize;
+		memcpy(tile.data, pucValue + pos, tileHeader.dataSize);
+		pos += tileHeader.dataSize;
+		shared->m_tiles.push_back(tile);
+
+		dtCompressedTileRef ref = 0;
+		if (dtStatusSucceed(tileCache->addTile(tile.data, tile.dataSize, 0, &ref)) && ref)
+			tileCache->buildNavMeshTile(ref, shared->m_navMesh);
+	}
+	dtFreeTileCache(tileCache);
+	return shared;
+}
+
+void ReleaseSharedNavMesh(NavMeshShared* shared)
+{
+	if (shared)
+	{
+		shared->Release();
+	}
+}
+
+NavMeshInstance* AttachNavMeshInstance(NavMeshShared* shared)
+{
+	if (shared == nullptr || shared->m_navMesh == nullptr)
+	{
+		return nullptr;
+	}
 
+	dtNavMeshQuery *g_navQuery = dtAllocNavMeshQuery();
+	if (!g_navQuery || dtStatusFailed(g_navQuery->init(shared->m_navMesh, MAX_QUERY_NODES)))
+	{
+		LOG("Could not init Detour navmesh query");
+		dtFreeNavMeshQuery(g_navQuery);
+		return nullptr;
+	}
 
 	NavMeshInstance* navMeshInstance = new NavMeshInstance();
-	navMeshInstance->m_crowd = g_crowd;
-	navMeshInstance->m_navMesh = g_navMesh;
+	shared->AddRef();
+	navMeshInstance->m_shared = shared;
+	navMeshInstance->m_crowd = dtAllocCrowd();
+	navMeshInstance->m_navMesh = shared->m_navMesh;
 	navMeshInstance->m_navQuery = g_navQuery;
-	navMeshInstance->m_tileCache = g_tileCache;
-
 	g_navmesh_insts.push_back(navMeshInstance);
-
 	return navMeshInstance;
 }
 
+static int StraightPathFromPolys(dtNavMeshQuery* navQuery, const float* sPos, const float* ePos, dtPolyRef m_endRef, dtStatus status,
+	const dtPolyRef* m_polys, int m_nPolys, float* straightPath, int32_t& nStraightPath);
+
+// Finds the straight path between two Detour positions into straightPath, which must hold MAX_POLYS points.
+// Only the first nStraightPath points are written, the rest of the buffer keeps old data.
+static int FindStraightPathInto(dtNavMeshQuery* navQuery, const QueryProfile& profile, const float* sPos, const float* ePos, float* straightPath, int32_t& nStraightPath)
+{
+	const dtQueryFilter& m_filter = profile.filter;
+	const float* m_polyPickExt = profile.extents;
+
+	dtPolyRef m_polys[MAX_POLYS];
+
+	int32_t m_nPolys = 0;
+	dtPolyRef m_startRef = 0;
+	dtPolyRef m_endRef = 0;
+
+	nStraightPath = 0;
+
+	navQuery->findNearestPoly(sPos, m_polyPickExt, &m_filter, &m_startRef, 0);
+	navQuery->findNearestPoly(ePos, m_polyPickExt, &m_filter, &m_endRef, 0);
+	if (!m_startRef || !m_endRef)
+	{
+		return NAVPATH_NO_POLY;
+	}
+	dtStatus status = navQuery->findPath(m_startRef, m_endRef, sPos, ePos, &m_filter, m_polys, &m_nPolys, MAX_POLYS);
+	return StraightPathFromPolys(navQuery, sPos, ePos, m_endRef, status, m_polys, m_nPolys, straightPath, nStraightPath);
+}
+
+// Turns the poly corridor of a path search into straight path points, returns a NavMeshPathStatus.
+static int StraightPathFromPolys(dtNavMeshQuery* navQuery, const float* sPos, const float* ePos, dtPolyRef m_endRef, dtStatus status,
+	const dtPolyRef* m_polys, int m_nPolys, float* straightPath, int32_t& nStraightPath)
+{
+	float m_fixedEPos[3];
+	int32_t m_nStraightPathOptions = 0;
+
+	nStraightPath = 0;
+	if (m_nPolys > 0)
+	{
+		// In case of partial path, make sure the end point is clamped to the last polygon.
+		m_fixedEPos[0] = ePos[0];
+		m_fixedEPos[1] = ePos[1];
+		m_fixedEPos[2] = ePos[2];
+
+		if (m_polys[m_nPolys - 1] != m_endRef)
+			navQuery->closestPointOnPoly(m_polys[m_nPolys - 1], ePos, m_fixedEPos, 0);
+
+		navQuery->findStraightPath(sPos, m_fixedEPos, m_polys, m_nPolys, straightPath, 0,
+			0, &nStraightPath, MAX_POLYS, m_nStraightPathOptions);
+
+		if (nStraightPath >= MAX_POLYS)
+		{
+			nStraightPath = MAX_POLYS;
+			LOG("straightPath out of bound of max polys.");
+		}
+	}
+
+	if (nStraightPath == 0)
+	{
+		return NAVPATH_NO_PATH;
+	}
+	if (dtStatusDetail(status, DT_PARTIAL_RESULT) || m_polys[m_nPolys - 1] != m_endRef)
+	{
+		return NAVPATH_PARTIAL;
+	}
+	return NAVPATH_SUCCESS;
+}
+
 int FindStraightPath(NavMeshInstance* inst, float startX, float startY, float endX, float endY)
+{
+	return FindStraightPathEx(inst, NAVQUERY_PROFILE_PATH, startX, startY, endX, endY);
+}
+
+int FindStraightPathEx(NavMeshInstance* inst, int profile, float startX, float startY, float endX, float endY)
 {
 	LOG("FindStraightPath Enter:start(%f, %f) end(%f, %f)", startX, startY, endX, endY);
 	if (!inst->m_navQuery)
@@ -398,6 +1271,12 @@ int FindStraightPath(NavMeshInstance* inst, float startX, float startY, float en
 		LOG("navQuery is nullptr");
 		return 0;
 	}
+	const QueryProfile* queryProfile = inst->GetProfile(profile);
+	if (queryProfile == nullptr)
+	{
+		inst->m_nStraightPath = 0;
+		return 0;
+	}
 	
 	float sPos[3] = { 0 };
 	sPos[0] = -startX;
@@ -409,55 +1288,64 @@ int FindStraightPath(NavMeshInstance* inst, float startX, float startY, float en
 	ePos[1] = 0.f;
 	ePos[2] = endY;
 
-	dtQueryFilter m_filter;
-	m_filter.setIncludeFlags(SAMPLE_POLYFLAGS_ALL ^ SAMPLE_POLYFLAGS_DISABLED);
-	m_filter.setExcludeFlags(0);
-
-	float m_polyPickExt[3] = { 3.0f, 4.0f, 3.0f };
-
-	float m_fixedEPos[3];
-	dtPolyRef m_polys[MAX_POLYS];
-	unsigned char m_straightPathFlags[MAX_POLYS];
-	dtPolyRef m_straightPathPolys[MAX_POLYS];
-
-	memset(m_fixedEPos, 0, sizeof(m_fixedEPos));
-	memset(m_polys, 0, sizeof(m_polys));
-	memset(inst->m_straightPath, 0, sizeof(inst->m_straightPath));
-	memset(m_straightPathFlags, 0, sizeof(m_straightPathFlags));
-	memset(m_straightPathPolys, 0, sizeof(m_straightPathPolys));
-
-	int32_t m_nPolys = 0;
-	int32_t m_nStraightPathOptions = 0;
-	dtPolyRef m_startRef = 0;
-	dtPolyRef m_endRef = 0;
-
-	inst->m_navQuery->findNearestPoly(sPos, m_polyPickExt, &m_filter, &m_startRef, 0);
-	inst->m_navQuery->findNearestPoly(ePos, m_polyPickExt, &m_filter, &m_endRef, 0);
-	inst->m_navQuery->findPath(m_startRef, m_endRef, sPos, ePos, &m_filter, m_polys, &m_nPolys, MAX_POLYS);
+	FindStraightPathInto(inst->m_navQuery, *queryProfile, sPos, ePos, inst->m_straightPath, inst->m_nStraightPath);
+	LOG("FindStraightPath End:%d", inst->m_nStraightPath);
+	return inst->m_nStraightPath;
+}
 
-	inst->m_nStraightPath = 0;
+int FindStraightPathBatch(NavMeshInstance* inst, const float* queries, int queryCount, float* points, int maxPoints, int* offsets, int* counts, int* status)
+{
+	return FindStraightPathBatchEx(inst, NAVQUERY_PROFILE_PATH, queries, queryCount, points, maxPoints, offsets, counts, status);
+}
 
-	if (m_nPolys > 0)
+int FindStraightPathBatchEx(NavMeshInstance* inst, int profile, const float* queries, int queryCount, float* points, int maxPoints, int* offsets, int* counts, int* status)
+{
+	LOG("FindStraightPathBatch Enter:%d", queryCount);
+	if (inst == nullptr || !inst->m_navQuery || inst->GetProfile(profile) == nullptr || queries == nullptr || queryCount < 0 ||
+		(queryCount > 0 && (points == nullptr || offsets == nullptr || counts == nullptr || status == nullptr)))
 	{
-		// In case of partial path, make sure the end point is clamped to the last polygon.
-		m_fixedEPos[0] = ePos[0];
-		m_fixedEPos[1] = ePos[1];
-		m_fixedEPos[2] = ePos[2];
+		return -1;
+	}
 
-		if (m_polys[m_nPolys - 1] != m_endRef)
-			inst->m_navQuery->closestPointOnPoly(m_polys[m_nPolys - 1], ePos, m_fixedEPos, 0);
+	NavMeshQueryLease lease(inst);
+	NavMeshQuery* query = lease.get();
+	if (query == nullptr)
+	{
+		return -1;
+	}
 
-		inst->m_navQuery->findStraightPath(sPos, m_fixedEPos, m_polys, m_nPolys, inst->m_straightPath, m_straightPathFlags,
-			m_straightPathPolys, &inst->m_nStraightPath, MAX_POLYS, m_nStraightPathOptions);
+	int written = 0;
+	for (int i = 0; i < queryCount; ++i)
+	{
+		const float* q = &queries[i * 4];
+		float sPos[3] = { -q[0], 0.f, q[1] };
+		float ePos[3] = { -q[2], 0.f, q[3] };
+
+		int32_t n = 0;
+		status[i] = FindStraightPathInto(query->m_navQuery, *inst->GetProfile(profile), sPos, ePos, query->m_straightPath, n);
+		offsets[i] = written;
+		counts[i] = 0;
+		if (n == 0)
+			continue;
+		if (written + n > maxPoints)
+		{
+			// Later, shorter paths may still fit.
+			status[i] = NAVPATH_BUFFER_FULL;
+			continue;
+		}
 
-		if (inst->m_nStraightPath >= MAX_POLYS)
+		float* out = &points[written * 2];
+		for (int j = 0; j < n; ++j)
 		{
-			inst->m_nStraightPath = MAX_POLYS;
-			LOG("straightPath out of bound of max polys.");
+			out[j * 2 + 0] = -query->m_straightPath[j * 3 + 0];
+			out[j * 2 + 1] = query->m_straightPath[j * 3 + 2];
 		}
+		counts[i] = n;
+		written += n;
 	}
-	LOG("FindStraightPath End:%d", inst->m_nStraightPath);
-	return inst->m_nStraightPath;
+
+	LOG("FindStraightPathBatch End:%d", written);
+	return written;
 }
 
 bool GetPathPoint(NavMeshInstance* inst, int index, float& x, float& y)
@@ -475,7 +1363,7 @@ bool GetPathPoint(NavMeshInstance* inst, int index, float& x, float& y)
 	return true;
 }
 
-bool PathRaycast(NavMeshInstance* inst, float startX, float startY, float endX, float endY, float& hitX, float& hitY)
+static bool PathRaycastWith(dtNavMeshQuery* navQuery, const QueryProfile& profile, float startX, float startY, float endX, float endY, float& hitX, float& hitY)
 {
 	hitX = 0;
 	hitY = 0;
@@ -489,22 +1377,18 @@ bool PathRaycast(NavMeshInstance* inst, float startX, float startY, float endX,
 	ePos[1] = 0.f;
 	ePos[2] = endY;
 
-	dtQueryFilter m_filter;
-	m_filter.setIncludeFlags(SAMPLE_POLYFLAGS_ALL ^ SAMPLE_POLYFLAGS_DISABLED);
-	m_filter.setExcludeFlags(0);
-
-	float m_polyPickExt[3] = { 2.0f, 4.0f, 2.0f };
+	const dtQueryFilter& m_filter = profile.filter;
+	const float* m_polyPickExt = profile.extents;
 
 	float m_hitNormal[3];
-	memset(m_hitNormal, 0, sizeof(m_hitNormal));
 	dtPolyRef m_polys[MAX_POLYS];
 
 	dtPolyRef m_startRef = 0;
-	inst->m_navQuery->findNearestPoly(sPos, m_polyPickExt, &m_filter, &m_startRef, 0);
+	navQuery->findNearestPoly(sPos, m_polyPickExt, &m_filter, &m_startRef, 0);
 
 	float t = 0;
 	int m_npolys = 0;
-	dtStatus status = inst->m_navQuery->raycast(m_startRef, sPos, ePos, &m_filter, &t, m_hitNormal, m_polys, &m_npolys, MAX_POLYS);
+	dtStatus status = navQuery->raycast(m_startRef, sPos, ePos, &m_filter, &t, m_hitNormal, m_polys, &m_npolys, MAX_POLYS);
 	bool success = dtStatusSucceed(status);
 	if (sPos[0]==ePos[0]&&sPos[2]==ePos[2])
 	{
@@ -536,6 +1420,231 @@ bool PathRaycast(NavMeshInstance* inst, float startX, float startY, float endX,
 	}
 }
 
+bool PathRaycast(NavMeshInstance* inst, float startX, float startY, float endX, float endY, float& hitX, float& hitY)
+{
+	return PathRaycastEx(inst, NAVQUERY_PROFILE_POINT, startX, startY, endX, endY, hitX, hitY);
+}
+
+bool PathRaycastEx(NavMeshInstance* inst, int profile, float startX, float startY, float endX, float endY, float& hitX, float& hitY)
+{
+	NavMeshQueryLease lease(inst);
+	if (lease.get() == nullptr || inst->GetProfile(profile) == nullptr)
+	{
+		hitX = 0;
+		hitY = 0;
+		return false;
+	}
+	return PathRaycastWith(lease.get()->m_navQuery, *inst->GetProfile(profile), startX, startY, endX, endY, hitX, hitY);
+}
+
+NavMeshQuery* AcquireNavMeshQuery(NavMeshInstance* inst)
+{
+	if (inst == nullptr || inst->m_navMesh == nullptr)
+		return nullptr;
+	return inst->AcquireQuery();
+}
+
+void ReleaseNavMeshQuery(NavMeshQuery* query)
+{
+	if (query)
+	{
+		query->m_nStraightPath = 0;
+		query->m_inst->ReleaseQuery(query);
+	}
+}
+
+int QueryFindStraightPath(NavMeshQuery* query, float startX, float startY, float endX, float endY)
+{
+	return QueryFindStraightPathEx(query, NAVQUERY_PROFILE_PATH, startX, startY, endX, endY);
+}
+
+int QueryFindStraightPathEx(NavMeshQuery* query, int profile, float startX, float startY, float endX, float endY)
+{
+	if (query == nullptr)
+		return 0;
+	const QueryProfile* queryProfile = query->m_inst->GetProfile(profile);
+	if (queryProfile == nullptr)
+	{
+		query->m_nStraightPath = 0;
+		return 0;
+	}
+
+	float sPos[3] = { -startX, 0.f, startY };
+	float ePos[3] = { -endX, 0.f, endY };
+	FindStraightPathInto(query->m_navQuery, *queryProfile, sPos, ePos, query->m_straightPath, query->m_nStraightPath);
+	return query->m_nStraightPath;
+}
+
+bool QueryGetPathPoint(NavMeshQuery* query, int index, float& x, float& y)
+{
+	if (query == nullptr || index < 0 || index >= query->m_nStraightPath)
+		return false;
+
+	auto startPtr = &query->m_straightPath[index * 3];
+	x = -startPtr[0];
+	y = startPtr[2];
+	return true;
+}
+
+bool QueryPathRaycast(NavMeshQuery* query, float startX, float startY, float endX, float endY, float& hitX, float& hitY)
+{
+	return QueryPathRaycastEx(query, NAVQUERY_PROFILE_POINT, startX, startY, endX, endY, hitX, hitY);
+}
+
+bool QueryPathRaycastEx(NavMeshQuery* query, int profile, float startX, float startY, float endX, float endY, float& hitX, float& hitY)
+{
+	if (query == nullptr || query->m_inst->GetProfile(profile) == nullptr)
+	{
+		hitX = 0;
+		hitY = 0;
+		return false;
+	}
+	return PathRaycastWith(query->m_navQuery, *query->m_inst->GetProfile(profile), startX, startY, endX, endY, hitX, hitY);
+}
+
+bool SetQueryProfile(NavMeshInstance* inst, int profile, unsigned short includeFlags, unsigned short excludeFlags, float extentX, float extentY, float extentZ)
+{
+	if (inst == nullptr || inst->GetProfile(profile) == nullptr)
+		return false;
+	QueryProfile& queryProfile = inst->m_profiles[profile];
+	queryProfile.filter.setIncludeFlags(includeFlags);
+	queryProfile.filter.setExcludeFlags(excludeFlags);
+	dtVset(queryProfile.extents, extentX, extentY, extentZ);
+	return true;
+}
+
+bool SetQueryProfileAreaCost(NavMeshInstance* inst, int profile, int area, float cost)
+{
+	if (inst == nullptr || inst->GetProfile(profile) == nullptr || area < 0 || area >= DT_MAX_AREAS)
+		return false;
+	inst->m_profiles[profile].filter.setAreaCost(area, cost);
+	return true;
+}
+
+unsigned int RequestPath(NavMeshInstance* inst, int profile, float startX, float startY, float endX, float endY)
+{
+	if (inst == nullptr || inst->m_navQuery == nullptr || inst->GetProfile(profile) == nullptr)
+		return 0;
+	if (inst->m_pathQueue == nullptr)
+	{
+		dtPathQueue* pathQueue = new dtPathQueue();
+		if (!pathQueue->init(MAX_POLYS, MAX_QUERY_NODES, inst->m_navMesh))
+		{
+			delete pathQueue;
+			return 0;
+		}
+		inst->m_pathQueue = pathQueue;
+	}
+
+	const unsigned int ticket = inst->m_nextPathTicket++;
+	if (inst->m_nextPathTicket == 0)
+		inst->m_nextPathTicket = 1;
+	PathRequest& request = inst->m_pathRequests[ticket];
+	request.ref = DT_PATHQ_INVALID;
+	request.profile = profile;
+	request.status = NAVPATH_PENDING;
+	dtVset(request.startPos, -startX, 0.f, startY);
+	dtVset(request.endPos, -endX, 0.f, endY);
+	request.startRef = 0;
+	request.endRef = 0;
+
+	// Picking the end polys is cheap, only the search is time sliced.
+	const QueryProfile* queryProfile = inst->GetProfile(profile);
+	inst->m_navQuery->findNearestPoly(request.startPos, queryProfile->extents, &queryProfile->filter, &request.startRef, 0);
+	inst->m_navQuery->findNearestPoly(request.endPos, queryProfile->extents, &queryProfile->filter, &request.endRef, 0);
+	if (!request.startRef || !request.endRef)
+		request.status = NAVPATH_NO_POLY;
+	return ticket;
+}
+
+int UpdatePathRequests(NavMeshInstance* inst, int maxIters)
+{
+	if (inst == nullptr || inst->m_navQuery == nullptr)
+		return -1;
+	dtPathQueue* pathQueue = inst->m_pathQueue;
+	if (pathQueue == nullptr)
+		return 0;
+
+	typedef std::map<unsigned int, PathRequest>::iterator Iter;
+	bool queueFull = false;
+	for (Iter it = inst->m_pathRequests.begin(); it != inst->m_pathRequests.end() && !queueFull; ++it)
+	{
+		PathRequest& request = it->second;
+		if (request.status != NAVPATH_PENDING || request.ref != DT_PATHQ_INVALID)
+			continue;
+		request.ref = pathQueue->request(request.startRef, request.endRef, request.startPos, request.endPos,
+			&inst->m_profiles[request.profile].filter);
+		queueFull = request.ref == DT_PATHQ_INVALID;
+	}
+
+	pathQueue->update(maxIters);
+
+	int pending = 0;
+	dtPolyRef polys[MAX_POLYS];
+	float straightPath[MAX_POLYS * 3];
+	for (Iter it = inst->m_pathRequests.begin(); it != inst->m_pathRequests.end(); ++it)
+	{
+		PathRequest& request = it->second;
+		if (request.status != NAVPATH_PENDING)
+			continue;
+		const dtStatus status = request.ref != DT_PATHQ_INVALID ? pathQueue->getRequestStatus(request.ref) : 0;
+		if (status == 0 || dtStatusInProgress(status))
+		{
+			pending++;
+			continue;
+		}
+
+		int nPolys = 0;
+		const dtStatus result = pathQueue->getPathResult(request.ref, polys, &nPolys, MAX_POLYS);
+		request.ref = DT_PATHQ_INVALID;
+		if (dtStatusFailed(status))
+		{
+			request.status = NAVPATH_NO_PATH;
+			continue;
+		}
+
+		int32_t nStraightPath = 0;
+		request.status = StraightPathFromPolys(inst->m_navQuery, request.startPos, request.endPos, request.endRef, result,
+			polys, nPolys, straightPath, nStraightPath);
+		request.points.resize(nStraightPath * 2);
+		for (int i = 0; i < nStraightPath; ++i)
+		{
+			request.points[i * 2 + 0] = -straightPath[i * 3 + 0];
+			request.points[i * 2 + 1] = straightPath[i * 3 + 2];
+		}
+	}
+	return pending;
+}
+
+int GetPathRequestStatus(NavMeshInstance* inst, unsigned int ticket)
+{
+	if (inst == nullptr)
+		return -1;
+	std::map<unsigned int, PathRequest>::const_iterator it = inst->m_pathRequests.find(ticket);
+	return it != inst->m_pathRequests.end() ? it->second.status : -1;
+}
+
+int GetPathRequestPoints(NavMeshInstance* inst, unsigned int ticket, float* points, int maxPoints)
+{
+	if (inst == nullptr || (points == nullptr && maxPoints > 0))
+		return -1;
+	std::map<unsigned int, PathRequest>::const_iterator it = inst->m_pathRequests.find(ticket);
+	if (it == inst->m_pathRequests.end())
+		return -1;
+	const std::vector<float>& src = it->second.points;
+	const int n = dtMin((int)src.size() / 2, maxPoints);
+	if (n > 0)
+		memcpy(points, &src[0], sizeof(float) * n * 2);
+	return n;
+}
+
+void ReleasePathRequest(NavMeshInstance* inst, unsigned int ticket)
+{
+	// A search still in the queue runs on, its result is dropped by the queue.
+	if (inst)
+		inst->m_pathRequests.erase(ticket);
+}
+
 void UnLoadNavMesh(NavMeshInstance* inst)
 {
 	if (inst)
@@ -561,7 +1670,7 @@ void UnLoadNavMesh(NavMeshInstance* inst)
 
 bool AddObstacles(NavMeshInstance* inst, float x, float y, float z, float radius, float height, unsigned int& id, bool update)
 {
-	if (inst->m_tileCache == nullptr)
+	if (!inst->Detach())
 		return false;
 	float pos[3] = {-x,y,z};
 	dtStatus status = ((dtTileCache*)inst->m_tileCache)->addObstacle(pos, radius, height, (dtObstacleRef*)&id);
@@ -589,7 +1698,7 @@ bool AddObstacles(NavMeshInstance* inst, float x, float y, float z, float radius
 }
 bool AddBoxObstacles(NavMeshInstance* inst, float minx, float miny, float minz, float maxx, float maxy, float maxz, unsigned int& id, bool update)
 {
-	if (inst->m_tileCache == nullptr)
+	if (!inst->Detach())
 		return false;
 	float bmin[3] = { -maxx,miny,minz };
 	float bmax[3] = { -minx,maxy,maxz };
@@ -658,10 +1767,19 @@ bool UpdateObstaclesMesh(NavMeshInstance* inst)
 
 bool InitCrowd(NavMeshInstance* inst, int max_agent/* = 128*/, float agent_radius/*=0.7*/)
 {
-	if (inst->m_tileCache == nullptr || inst->m_navQuery == nullptr || inst->m_crowd == nullptr)
+	return InitCrowdWithLimits(inst, max_agent, agent_radius, DT_CROWDAGENT_MAX_NEIGHBOURS, DT_CROWDAGENT_MAX_LOCAL_SEGMENTS);
+}
+bool InitCrowdWithLimits(NavMeshInstance* inst, int max_agent, float agent_radius, int max_neighbours, int max_local_segments)
+{
+	if (inst->m_navQuery == nullptr || inst->m_crowd == nullptr)
 		return false;
 
-	inst->m_crowd->init(max_agent, agent_radius, inst->m_navMesh);
+	dtCrowdConfig config;
+	dtCrowdConfigDefaults(&config, max_agent, agent_radius);
+	config.maxNeighbours = max_neighbours;
+	config.maxLocalSegments = max_local_segments;
+	if (!inst->m_crowd->init(&config, inst->m_navMesh))
+		return false;
 
 	auto crowd = inst->m_crowd;
 	// Make polygons with 'disabled' flag invalid.
@@ -703,9 +1821,51 @@ bool InitCrowd(NavMeshInstance* inst, int max_agent/* = 128*/, float agent_radiu
 
 	return true;
 }
+bool SetCrowdThreadCount(NavMeshInstance* inst, int threadCount)
+{
+	if (inst == nullptr || inst->m_crowd == nullptr)
+		return false;
+	if (threadCount <= 0)
+		threadCount = (int)std::thread::hardware_concurrency();
+
+	// Drop the old pool before starting a new one.
+	inst->m_crowd->setJobRunner(nullptr);
+	delete inst->m_crowdJobs;
+	inst->m_crowdJobs = nullptr;
+	if (threadCount <= 1)
+		return true;
+
+	inst->m_crowdJobs = new CrowdJobRunner(threadCount);
+	return inst->m_crowd->setJobRunner(inst->m_crowdJobs);
+}
+
+bool SetCrowdPathBudget(NavMeshInstance* inst, int maxRequests, int maxIters)
+{
+	if (inst == nullptr || inst->m_crowd == nullptr)
+		return false;
+	inst->m_crowd->setPathQueueBudget(maxRequests, maxIters);
+	return true;
+}
+
+bool SetCrowdAvoidanceSolver(NavMeshInstance* inst, int solver)
+{
+	if (inst == nullptr || inst->m_crowd == nullptr)
+		return false;
+
+	dtObstacleAvoidanceBackend* backend = nullptr;
+	if (solver == NAVCROWD_AVOIDANCE_ORCA)
+		backend = &inst->m_orca;
+	else if (solver != NAVCROWD_AVOIDANCE_SAMPLING)
+		return false;
+
+	for (int i = 0; i < DT_CROWD_MAX_OBSTAVOIDANCE_PARAMS; ++i)
+		inst->m_crowd->setObstacleAvoidanceBackend(i, backend);
+	return true;
+}
+
 bool AddCrowdAgent(NavMeshInstance* inst, float x, float y, float z, float radius, float height, float maxAcceleration, float maxSpeed, unsigned int& id, int update_flag /*= 0*/)
 {
-	if (inst->m_tileCache == nullptr || inst->m_navQuery == nullptr || inst->m_crowd == nullptr)
+	if (inst->m_navQuery == nullptr || inst->m_crowd == nullptr)
 		return false;
 	auto crowd = inst->m_crowd;
 	dtCrowdAgentParams ap;
@@ -728,7 +1888,7 @@ bool AddCrowdAgent(NavMeshInstance* inst, float x, float y, float z, float radiu
 
 bool RemoveCrowdAgent(NavMeshInstance* inst, unsigned int id)
 {
-	if (inst->m_tileCache == nullptr || inst->m_navQuery == nullptr || inst->m_crowd == nullptr)
+	if (inst->m_navQuery == nullptr || inst->m_crowd == nullptr)
 		return false;
 	dtCrowd* crowd = inst->m_crowd;
 	crowd->removeAgent(id);
@@ -738,7 +1898,7 @@ bool RemoveCrowdAgent(NavMeshInstance* inst, unsigned int id)
 
 bool UpdateCrowdAgent(NavMeshInstance* inst, float dt)
 {
-	if (inst->m_tileCache == nullptr || inst->m_navQuery == nullptr || inst->m_crowd == nullptr)
+	if (inst->m_navQuery == nullptr || inst->m_crowd == nullptr)
 		return false;
 	inst->m_crowd->update(dt, nullptr);
 	return true;
@@ -746,7 +1906,7 @@ bool UpdateCrowdAgent(NavMeshInstance* inst, float dt)
 
 bool GetCrowdAgentPos(NavMeshInstance* inst, int index, float& x, float& y)
 {
-	if (inst->m_tileCache == nullptr || inst->m_navQuery == nullptr || inst->m_crowd == nullptr)
+	if (inst->m_navQuery == nullptr || inst->m_crowd == nullptr)
 		return false;
 
 	const dtCrowdAgent* ag = inst->m_crowd->getAgent(index);
@@ -762,38 +1922,326 @@ bool GetCrowdAgentPos(NavMeshInstance* inst, int index, float& x, float& y)
 
 bool ResetCrowdAgentTarget(NavMeshInstance* inst, int index)
 {
-	if (inst->m_tileCache == nullptr || inst->m_navQuery == nullptr || inst->m_crowd == nullptr)
+	if (inst->m_navQuery == nullptr || inst->m_crowd == nullptr)
 		return false;
 	inst->m_crowd->resetMoveTarget(index);
 
 	return true;
 }
+// Finds the poly under (x, y) and requests it as the agent's move target
+static bool requestCrowdTarget(dtCrowd* crowd, dtNavMeshQuery* navQuery, const QueryProfile& profile, int index, float x, float y)
+{
+	const dtCrowdAgent* ag = crowd->getAgent(index);
+	if (ag == nullptr || !ag->active)
+		return false;
+
+	float ePos[3] = { 0 };
+	ePos[0] = -x;
+	ePos[1] = 0.f;
+	ePos[2] = y;
+
+	dtPolyRef ref = 0;
+	navQuery->findNearestPoly(ePos, profile.extents, &profile.filter, &ref, 0);
+	return crowd->requestMoveTarget(index, ref, ePos);
+}
+
 bool SetCrowdAgentTarget(NavMeshInstance* inst, int index, float x, float y)
 {
-	if (inst->m_tileCache == nullptr || inst->m_navQuery == nullptr || inst->m_crowd == nullptr)
+	if (inst->m_navQuery == nullptr || inst->m_crowd == nullptr)
 		return false;
 
 	const dtCrowdAgent* ag = inst->m_crowd->getAgent(index);
 	if (ag == nullptr)
 		return false;
 
-	float ePos[3] = { 0 };
-	ePos[0] = -x;
-	ePos[1] = 0.f;
-	ePos[2] = y;
+	NavMeshQueryLease lease(inst);
+	if (lease.get() == nullptr)
+		return false;
+	requestCrowdTarget(inst->m_crowd, lease.get()->m_navQuery, inst->m_profiles[NAVQUERY_PROFILE_POINT], index, x, y);
+	return true;
+}
 
-	dtQueryFilter m_filter;
-	m_filter.setIncludeFlags(SAMPLE_POLYFLAGS_ALL ^ SAMPLE_POLYFLAGS_DISABLED);
-	m_filter.setExcludeFlags(0);
+int GetCrowdAgentStates(NavMeshInstance* inst, int maxAgents, int* indices, float* posX, float* posY, float* velX, float* velY, int* states, int* targetStates)
+{
+	if (inst == nullptr || inst->m_crowd == nullptr || maxAgents < 0)
+		return -1;
 
-	float m_polyPickExt[3] = { 2.0f, 4.0f, 2.0f };
+	dtCrowd* crowd = inst->m_crowd;
+	const int agentCount = crowd->getAgentCount();
+	int n = 0;
+	for (int i = 0; i < agentCount && n < maxAgents; ++i)
+	{
+		const dtCrowdAgent* ag = crowd->getAgent(i);
+		if (!ag->active)
+			continue;
+		if (indices)
+			indices[n] = i;
+		if (posX)
+			posX[n] = -ag->npos[0];
+		if (posY)
+			posY[n] = ag->npos[2];
+		if (velX)
+			velX[n] = -ag->vel[0];
+		if (velY)
+			velY[n] = ag->vel[2];
+		if (states)
+			states[n] = ag->state;
+		if (targetStates)
+			targetStates[n] = ag->targetState;
+		n++;
+	}
+	return n;
+}
 
-	dtPolyRef m_startRef = 0;
-	inst->m_navQuery->findNearestPoly(ePos, m_polyPickExt, &m_filter, &m_startRef, 0);
-	inst->m_crowd->requestMoveTarget(index, m_startRef, ePos);
+int SetCrowdAgentTargets(NavMeshInstance* inst, const int* indices, const float* targetX, const float* targetY, int count)
+{
+	if (inst == nullptr || inst->m_navQuery == nullptr || inst->m_crowd == nullptr ||
+		indices == nullptr || targetX == nullptr || targetY == nullptr || count < 0)
+		return -1;
+
+	const QueryProfile& profile = inst->m_profiles[NAVQUERY_PROFILE_POINT];
+
+	NavMeshQueryLease lease(inst);
+	if (lease.get() == nullptr)
+		return -1;
+	dtNavMeshQuery* navQuery = lease.get()->m_navQuery;
+
+	int accepted = 0;
+	for (int i = 0; i < count; ++i)
+	{
+		if (requestCrowdTarget(inst->m_crowd, navQuery, profile, indices[i], targetX[i], targetY[i]))
+			accepted++;
+	}
+	return accepted;
+}
+
+int SetCrowdAgentParams(NavMeshInstance* inst, const int* indices, int count, const float* radius, const float* maxAcceleration, const float* maxSpeed, const int* updateFlags)
+{
+	if (inst == nullptr || inst->m_crowd == nullptr || indices == nullptr || count < 0)
+		return -1;
+
+	dtCrowd* crowd = inst->m_crowd;
+	int updated = 0;
+	for (int i = 0; i < count; ++i)
+	{
+		const dtCrowdAgent* ag = crowd->getAgent(indices[i]);
+		if (ag == nullptr || !ag->active)
+			continue;
+		dtCrowdAgentParams ap = ag->params;
+		if (radius)
+		{
+			// Keep the ranges AddCrowdAgent derives from the radius
+			ap.radius = radius[i];
+			ap.collisionQueryRange = ap.radius * 12.0f;
+			ap.pathOptimizationRange = ap.radius * 30.0f;
+		}
+		if (maxAcceleration)
+			ap.maxAcceleration = maxAcceleration[i];
+		if (maxSpeed)
+			ap.maxSpeed = maxSpeed[i];
+		if (updateFlags)
+			ap.updateFlags = (unsigned char)updateFlags[i];
+		crowd->updateAgentParameters(indices[i], &ap);
+		updated++;
+	}
+	return updated;
+}
+
+
+// Block files written by RecastWrapper's BuildBlockData, see SetBlockDataFormat there.
+static const int BLOCKDATA_MAGIC = 'B' << 24 | 'L' << 16 | 'K' << 8 | 'D'; //'BLKD';
+static const int BLOCKDATA_VERSION = 1;
+static const unsigned int BLOCKDATA_TILE_BLOCKED = 0;
+static const unsigned int BLOCKDATA_TILE_WALKABLE = 1;
+
+enum BlockDataFormat
+{
+	BLOCK_FORMAT_BYTES,	// width, height, then one char per cell
+	BLOCK_FORMAT_BITS,	// header, then rows of 32 bit words with one bit per cell
+	BLOCK_FORMAT_TILES,	// header, tile table, then the bits of the tiles that are not uniform
+};
+
+struct BlockDataHeader
+{
+	int magic;
+	int version;
+	int format;
+	int width;
+	int height;
+	int tileSize;
+	unsigned int dataSize;
+	unsigned int reserved;
+};
+
+// Walkable flags of a block grid, read in place from a copy or a mapped file.
+class BlockData
+{
+public:
+	BlockData()
+	{
+		m_format = BLOCK_FORMAT_BYTES;
+		m_width = 0;
+		m_height = 0;
+		m_tileSize = 0;
+		m_rowWords = 0;
+		m_tilesX = 0;
+		m_data = nullptr;
+		m_size = 0;
+	}
+
+	// Checks the file and sets up the lookups, data must stay valid and 4 byte aligned
+	bool Init(const unsigned char* data, size_t size)
+	{
+		m_data = data;
+		m_size = size;
+		if (size < 2 * sizeof(int))
+			return false;
+		BlockDataHeader header;
+		memset(&header, 0, sizeof(header));
+		memcpy(&header, data, dtMin(size, sizeof(header)));
+		if (header.magic != BLOCKDATA_MAGIC)
+		{
+			// Legacy file without a header
+			m_format = BLOCK_FORMAT_BYTES;
+			m_width = header.magic;
+			m_height = header.version;
+			return m_width >= 0 && m_height >= 0 &&
+				(unsigned long long)m_width * m_height <= size - 2 * sizeof(int);
+		}
+		if (size < sizeof(header) || header.version != BLOCKDATA_VERSION ||
+			header.width < 0 || header.height < 0 || header.dataSize > size - sizeof(header))
+			return false;
+		m_format = header.format;
+		m_width = header.width;
+		m_height = header.height;
+		const unsigned int* words = (const unsigned int*)(data + sizeof(header));
+		if (m_format == BLOCK_FORMAT_BITS)
+		{
+			m_rowWords = (m_width + 31) / 32;
+			return (unsigned long long)m_rowWords * m_height * sizeof(unsigned int) <= header.dataSize;
+		}
+		if (m_format != BLOCK_FORMAT_TILES || header.tileSize <= 0 || header.tileSize % 32 != 0)
+			return false;
+		m_tileSize = header.tileSize;
+		m_tilesX = (m_width + m_tileSize - 1) / m_tileSize;
+		const int tilesY = (m_height + m_tileSize - 1) / m_tileSize;
+		if ((unsigned long long)m_tilesX * tilesY * sizeof(unsigned int) > header.dataSize)
+			return false;
+		const size_t tileBytes = (size_t)m_tileSize * m_tileSize / 8;
+		for (int i = 0; i < m_tilesX * tilesY; ++i)
+		{
+			const unsigned int entry = words[i];
+			if (entry == BLOCKDATA_TILE_BLOCKED || entry == BLOCKDATA_TILE_WALKABLE)
+				continue;
+			if (entry < sizeof(header) || (entry & 3) != 0 || entry > size || tileBytes > size - entry)
+				return false;
+		}
+		return true;
+	}
+
+	inline bool IsWalkable(int x, int y) const
+	{
+		if (x < 0 || y < 0 || x >= m_width || y >= m_height)
+			return false;
+		const unsigned int* words = (const unsigned int*)(m_data + sizeof(BlockDataHeader));
+		switch (m_format)
+		{
+		case BLOCK_FORMAT_BITS:
+			return (words[y * m_rowWords + (x >> 5)] >> (x & 31)) & 1;
+		case BLOCK_FORMAT_TILES:
+		{
+			const unsigned int entry = words[(y / m_tileSize) * m_tilesX + x / m_tileSize];
+			if (entry == BLOCKDATA_TILE_BLOCKED || entry == BLOCKDATA_TILE_WALKABLE)
+				return entry == BLOCKDATA_TILE_WALKABLE;
+			const unsigned int* tile = (const unsigned int*)(m_data + entry);
+			const int lx = x % m_tileSize;
+			const int ly = y % m_tileSize;
+			return (tile[ly * (m_tileSize / 32) + (lx >> 5)] >> (lx & 31)) & 1;
+		}
+		default:
+			return m_data[2 * sizeof(int) + (size_t)y * m_width + x] != 0;
+		}
+	}
+
+public:
+	int m_format;
+	int m_width;
+	int m_height;
+	int m_tileSize;
+	int m_rowWords;
+	int m_tilesX;
+	const unsigned char* m_data;
+	size_t m_size;
+	std::vector<unsigned int> m_copy;	// owned copy of LoadBlockData's buffer
+	MappedFile m_mappedFile;
+};
+
+BlockData* LoadBlockData(unsigned char* pucValue, unsigned int uiLength)
+{
+	if (pucValue == nullptr || uiLength == 0)
+	{
+		return nullptr;
+	}
+	BlockData* blockData = new BlockData();
+	blockData->m_copy.resize((uiLength + 3) / 4);
+	memcpy(&blockData->m_copy[0], pucValue, uiLength);
+	if (!blockData->Init((const unsigned char*)&blockData->m_copy[0], uiLength))
+	{
+		LOG("Invalid block data");
+		delete blockData;
+		return nullptr;
+	}
+	return blockData;
+}
+
+BlockData* LoadBlockDataFile(const char* path)
+{
+	BlockData* blockData = new BlockData();
+	if (path == nullptr || !blockData->m_mappedFile.Open(path) ||
+		!blockData->Init(blockData->m_mappedFile.m_data, blockData->m_mappedFile.m_size))
+	{
+		LOG("Could not load block data %s", path ? path : "");
+		delete blockData;
+		return nullptr;
+	}
+	return blockData;
+}
+
+void UnLoadBlockData(BlockData* blockData)
+{
+	delete blockData;
+}
+
+bool GetBlockDataSize(BlockData* blockData, int& width, int& height)
+{
+	if (blockData == nullptr)
+	{
+		return false;
+	}
+	width = blockData->m_width;
+	height = blockData->m_height;
 	return true;
 }
 
+bool IsBlocked(BlockData* blockData, int x, int y)
+{
+	return blockData == nullptr || !blockData->IsWalkable(x, y);
+}
+
+int IsBlockedBatch(BlockData* blockData, const int* cells, int count, unsigned char* blocked)
+{
+	if (blockData == nullptr || cells == nullptr || blocked == nullptr || count < 0)
+	{
+		return -1;
+	}
+	int nBlocked = 0;
+	for (int i = 0; i < count; ++i)
+	{
+		blocked[i] = blockData->IsWalkable(cells[i * 2], cells[i * 2 + 1]) ? 0 : 1;
+		nBlocked += blocked[i];
+	}
+	return nBlocked;
+}
 
 void ClearNavMesh()
 {
@@ -6,28 +6,155 @@
 #endif
 
 
+// Per query result of FindStraightPathBatch and the path requests
+enum NavMeshPathStatus
+{
+	NAVPATH_SUCCESS = 0,		// full path to the end point
+	NAVPATH_PARTIAL = 1,		// end not reachable, path leads to the closest point found
+	NAVPATH_NO_POLY = 2,		// start or end is not on the navmesh
+	NAVPATH_NO_PATH = 3,		// no path found
+	NAVPATH_BUFFER_FULL = 4,	// path found but the points buffer had no room left for it
+	NAVPATH_PENDING = 5,		// path request still searching
+};
+
+// Query profiles of an instance, see SetQueryProfile
+enum NavMeshQueryProfile
+{
+	NAVQUERY_PROFILE_PATH = 0,		// used by the path searches, pick extents (3, 4, 3)
+	NAVQUERY_PROFILE_POINT = 1,		// used by the raycasts and crowd targets, pick extents (2, 4, 2)
+	NAVQUERY_MAX_PROFILES = 16,
+};
+
+// How crowd agents avoid each other, see SetCrowdAvoidanceSolver
+enum NavCrowdAvoidanceSolver
+{
+	NAVCROWD_AVOIDANCE_SAMPLING = 0,	// scores candidate velocities, the default
+	NAVCROWD_AVOIDANCE_ORCA = 1,		// reciprocal half-planes, cheaper and smoother in dense crowds
+};
+
 extern "C"
 {
 	class NavMeshInstance;
 
+	// Takes a BuildSoloMesh tile or a BuildTiledMesh tile set, the LoadNavMesh variants
+	// and LoadSharedNavMesh tell them apart by the set header.
 	EXPORT_API NavMeshInstance* LoadNavMesh(unsigned char* pucValue, unsigned int uiLength);
+	// Zero copy loading. The InPlace variants keep using the caller's buffer, which
+	// must stay pinned until UnLoadNavMesh and start on a 4 byte boundary; Detour
+	// writes the tile links into it, so give every instance its own buffer.
+	// The File variants map the file copy-on-write instead: the pages Detour only
+	// reads stay shared between all instances and processes mapping the same file.
+	EXPORT_API NavMeshInstance* LoadNavMeshInPlace(unsigned char* pucValue, unsigned int uiLength);
+	EXPORT_API NavMeshInstance* LoadNavMeshFile(const char* path);
 	EXPORT_API int FindStraightPath(NavMeshInstance* inst, float startX, float startY, float endX, float endY);
 	EXPORT_API bool GetPathPoint(NavMeshInstance* inst, int index, float& x, float& y);
+	// Finds queryCount straight paths in one call. queries holds startX, startY, endX, endY
+	// per query. The points of all paths are packed into points as x, y pairs, at most
+	// maxPoints of them; path i starts at point offsets[i] and has counts[i] points, and
+	// status[i] is a NavMeshPathStatus. Returns the number of points written, -1 on bad arguments.
+	EXPORT_API int FindStraightPathBatch(NavMeshInstance* inst, const float* queries, int queryCount, float* points, int maxPoints, int* offsets, int* counts, int* status);
 	EXPORT_API bool PathRaycast(NavMeshInstance* inst, float startX, float startY, float endX, float endY, float& hitX, float& hitY);
+	// Query pool. Every instance keeps a pool of Detour queries with their own
+	// scratch, so several threads can search the same navmesh at once: each
+	// thread acquires a query, runs Query* calls on it and releases it again.
+	// PathRaycast and FindStraightPathBatch lease one internally and are safe
+	// to call from any thread; FindStraightPath/GetPathPoint keep their single
+	// per-instance result and are not. Obstacle updates must not overlap searches.
+	class NavMeshQuery;
+	EXPORT_API NavMeshQuery* AcquireNavMeshQuery(NavMeshInstance* inst);
+	EXPORT_API void ReleaseNavMeshQuery(NavMeshQuery* query);
+	EXPORT_API int QueryFindStraightPath(NavMeshQuery* query, float startX, float startY, float endX, float endY);
+	EXPORT_API bool QueryGetPathPoint(NavMeshQuery* query, int index, float& x, float& y);
+	EXPORT_API bool QueryPathRaycast(NavMeshQuery* query, float startX, float startY, float endX, float endY, float& hitX, float& hitY);
+	// Query profiles. Each instance holds NAVQUERY_MAX_PROFILES filters with their
+	// pick extents; all start out excluding disabled polys with every area cost 1.
+	// Give each unit type its own profile and pass its id to the Ex calls, the calls
+	// without a profile use the NavMeshQueryProfile defaults. Profiles are read
+	// without locking, so set them up before searching from other threads.
+	EXPORT_API bool SetQueryProfile(NavMeshInstance* inst, int profile, unsigned short includeFlags, unsigned short excludeFlags, float extentX, float extentY, float extentZ);
+	EXPORT_API bool SetQueryProfileAreaCost(NavMeshInstance* inst, int profile, int area, float cost);
+	EXPORT_API int FindStraightPathEx(NavMeshInstance* inst, int profile, float startX, float startY, float endX, float endY);
+	EXPORT_API int FindStraightPathBatchEx(NavMeshInstance* inst, int profile, const float* queries, int queryCount, float* points, int maxPoints, int* offsets, int* counts, int* status);
+	EXPORT_API bool PathRaycastEx(NavMeshInstance* inst, int profile, float startX, float startY, float endX, float endY, float& hitX, float& hitY);
+	EXPORT_API int QueryFindStraightPathEx(NavMeshQuery* query, int profile, float startX, float startY, float endX, float endY);
+	EXPORT_API bool QueryPathRaycastEx(NavMeshQuery* query, int profile, float startX, float startY, float endX, float endY, float& hitX, float& hitY);
+	// Time sliced path requests. RequestPath only picks the end polys and returns a
+	// ticket, 0 on failure. The searches run in UpdatePathRequests, which spends at
+	// most maxIters search iterations per call on all pending requests together and
+	// returns how many are still pending. Poll a ticket until its status is no longer
+	// NAVPATH_PENDING, read its points as x, y pairs and release it. Same threading
+	// rules as FindStraightPath.
+	EXPORT_API unsigned int RequestPath(NavMeshInstance* inst, int profile, float startX, float startY, float endX, float endY);
+	EXPORT_API int UpdatePathRequests(NavMeshInstance* inst, int maxIters);
+	// Returns a NavMeshPathStatus, -1 for an unknown ticket
+	EXPORT_API int GetPathRequestStatus(NavMeshInstance* inst, unsigned int ticket);
+	// Returns the number of points written, -1 for an unknown ticket
+	EXPORT_API int GetPathRequestPoints(NavMeshInstance* inst, unsigned int ticket, float* points, int maxPoints);
+	EXPORT_API void ReleasePathRequest(NavMeshInstance* inst, unsigned int ticket);
 	EXPORT_API void UnLoadNavMesh(NavMeshInstance* inst);
 	// ̬赲רú
 	EXPORT_API NavMeshInstance* LoadObstaclesMesh(unsigned char* pucValue, unsigned int uiLength);
+	// Compressed tiles stay in the buffer or mapping, see LoadNavMeshInPlace
+	EXPORT_API NavMeshInstance* LoadObstaclesMeshInPlace(unsigned char* pucValue, unsigned int uiLength);
+	EXPORT_API NavMeshInstance* LoadObstaclesMeshFile(const char* path);
+	// Shared maps. A map is loaded once and any number of instances attach to it;
+	// they get their own queries and crowd but search the shared navmesh. The
+	// first temp obstacle on an instance of a LoadSharedObstaclesMesh map gives
+	// that instance its own copy of the navmesh tiles, the compressed tiles stay
+	// shared; queries leased at that point keep the shared navmesh until they
+	// are released. The map is freed once it is released and every instance on
+	// it is unloaded.
+	class NavMeshShared;
+	EXPORT_API NavMeshShared* LoadSharedNavMesh(unsigned char* pucValue, unsigned int uiLength);
+	EXPORT_API NavMeshShared* LoadSharedObstaclesMesh(unsigned char* pucValue, unsigned int uiLength);
+	EXPORT_API void ReleaseSharedNavMesh(NavMeshShared* shared);
+	EXPORT_API NavMeshInstance* AttachNavMeshInstance(NavMeshShared* shared);
 	EXPORT_API bool AddObstacles(NavMeshInstance* inst, float x, float y, float z, float radius, float height, unsigned int &id, bool update);
 	EXPORT_API bool AddBoxObstacles(NavMeshInstance* inst, float minx, float miny, float minz, float maxx, float maxy, float maxz, unsigned int& id, bool update);
 	EXPORT_API bool RemoveObstacles(NavMeshInstance* inst, unsigned int id, bool update);
 	EXPORT_API bool UpdateObstaclesMesh(NavMeshInstance* inst);
 	// ȺѰ·
 	EXPORT_API bool InitCrowd(NavMeshInstance* inst, int max_agent = 128, float agent_radius = 0.7);
+	// InitCrowd with the per-agent limits: the neighbours and the wall segments an
+	// agent steers around. Every agent reserves memory for them, so lower them for
+	// sparse crowds and raise them for dense ones. InitCrowd uses 6 and 8.
+	EXPORT_API bool InitCrowdWithLimits(NavMeshInstance* inst, int max_agent, float agent_radius, int max_neighbours, int max_local_segments);
+	// Runs the per-agent phases of UpdateCrowdAgent on threadCount threads, the
+	// calling thread included; 1 updates serially and <= 0 uses every core. The
+	// agents move exactly as they would in a serial update.
+	EXPORT_API bool SetCrowdThreadCount(NavMeshInstance* inst, int threadCount);
+	// Path finding done per UpdateCrowdAgent: at most maxRequests agents enter the
+	// path queue and the queue runs at most maxIters search iterations. Defaults 8 and 100.
+	EXPORT_API bool SetCrowdPathBudget(NavMeshInstance* inst, int maxRequests, int maxIters);
+	// Selects a NavCrowdAvoidanceSolver for every agent, call after InitCrowd.
+	EXPORT_API bool SetCrowdAvoidanceSolver(NavMeshInstance* inst, int solver);
 	EXPORT_API bool AddCrowdAgent(NavMeshInstance* inst, float x, float y, float z, float radius, float height, float maxAcceleration, float maxSpeed, unsigned int& id, int update_flag = 0);
 	EXPORT_API bool RemoveCrowdAgent(NavMeshInstance* inst, unsigned int id);
 	EXPORT_API bool UpdateCrowdAgent(NavMeshInstance* inst, float dt);
 	EXPORT_API bool GetCrowdAgentPos(NavMeshInstance* inst, int index, float& x, float& y);
 	EXPORT_API bool ResetCrowdAgentTarget(NavMeshInstance* inst, int index);
 	EXPORT_API bool SetCrowdAgentTarget(NavMeshInstance* inst, int index, float x, float y);
+	// Copies the state of every active agent in one call, at most maxAgents of them.
+	// Each array gets one entry per agent and may be null to skip that field. indices
+	// are the agent ids, states are DT_CROWDAGENT_STATE_* and targetStates are
+	// DT_CROWDAGENT_TARGET_*. Returns the number of agents written, -1 on bad arguments.
+	EXPORT_API int GetCrowdAgentStates(NavMeshInstance* inst, int maxAgents, int* indices, float* posX, float* posY, float* velX, float* velY, int* states, int* targetStates);
+	// Requests a move target for count agents. Returns how many requests were accepted.
+	EXPORT_API int SetCrowdAgentTargets(NavMeshInstance* inst, const int* indices, const float* targetX, const float* targetY, int count);
+	// Changes the parameters of count agents. A null array keeps that parameter as it is.
+	// Returns the number of agents updated.
+	EXPORT_API int SetCrowdAgentParams(NavMeshInstance* inst, const int* indices, int count, const float* radius, const float* maxAcceleration, const float* maxSpeed, const int* updateFlags);
 	EXPORT_API void ClearNavMesh();
+	// Block grids from RecastWrapper's BuildBlockData, in any of its formats. The File
+	// variant maps the file and reads it in place. Cells are (x, y) = (column, row);
+	// cells outside the grid count as blocked.
+	class BlockData;
+	EXPORT_API BlockData* LoadBlockData(unsigned char* pucValue, unsigned int uiLength);
+	EXPORT_API BlockData* LoadBlockDataFile(const char* path);
+	EXPORT_API void UnLoadBlockData(BlockData* blockData);
+	EXPORT_API bool GetBlockDataSize(BlockData* blockData, int& width, int& height);
+	EXPORT_API bool IsBlocked(BlockData* blockData, int x, int y);
+	// Looks up count cells given as x, y pairs, blocked[i] is 1 for a blocked cell.
+	// Returns the number of blocked cells, -1 on bad arguments.
+	EXPORT_API int IsBlockedBatch(BlockData* blockData, const int* cells, int count, unsigned char* blocked);
 }
\ No newline at end of file
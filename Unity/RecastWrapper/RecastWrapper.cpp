@@ -12,6 +12,12 @@
 #include "DetourTileCache.h"
 #include "DetourTileCacheBuilder.h"
 #include <math.h>
+#include <string.h>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <algorithm>
+#include <float.h>
 #include "fastlz.h"
 
 #define ERROR_OUT_OF_MEMORY		1
@@ -246,35 +252,51 @@ FastLZCompressor *m_tcomp = new FastLZCompressor;
 MeshProcess *m_tmproc = new MeshProcess;
 dtNavMeshQuery *m_navQuery = nullptr;
 
-int rasterizeTileLayers(
-	const int tx, const int ty,
-	const rcConfig& cfg,
-	TileCacheData* tiles,
-	const int maxTiles)
+// Per thread state of the tile cache build. Workers share the input mesh
+// and the tile cache read only, everything they write goes through here.
+struct TileBuildWorker
 {
-	FastLZCompressor comp;
-	RasterizationContext rc;
+	TileBuildWorker() : talloc(32000) {}
 
-	const float* verts = m_mesh->getVerts();
-	const int nverts = m_mesh->getVertCount();
+	rcContext ctx;
+	FastLZCompressor comp;
+	LinearAllocator talloc;
+};
 
-	auto m_chunkyMesh = new rcChunkyTriMesh;
-	if (!m_chunkyMesh)
+// Calls job(worker, index) for every index in [0, count) on up to threadCount threads.
+// Indices are handed out in any order, so each job must only write its own slot.
+template<class Job>
+static void ParallelFor(int threadCount, const int count, Job job)
+{
+	if (threadCount > count)
+		threadCount = count;
+	if (threadCount <= 1)
 	{
-		printf("buildTiledNavigation: Out of memory 'm_chunkyMesh'.");
-		return false;
+		for (int i = 0; i < count; ++i)
+			job(0, i);
+		return;
 	}
-	if (!rcCreateChunkyTriMesh(m_mesh->getVerts(), m_mesh->getTris(), m_mesh->getTriCount(), 256, m_chunkyMesh))
+
+	std::atomic<int> next(0);
+	std::vector<std::thread> threads;
+	threads.reserve(threadCount);
+	for (int t = 0; t < threadCount; ++t)
 	{
-		printf("buildTiledNavigation: Failed to build chunky mesh.");
-		return false;
+		threads.push_back(std::thread([&next, &job, count, t]()
+		{
+			for (int i = next++; i < count; i = next++)
+				job(t, i);
+		}));
 	}
-	const rcChunkyTriMesh* chunkyMesh = m_chunkyMesh;
+	for (size_t t = 0; t < threads.size(); ++t)
+		threads[t].join();
+}
 
-	// Tile bounds.
+// Config of tile (tx, ty): cfg with the bounds of the tile plus its border.
+static void calcTileConfig(const rcConfig& cfg, const int tx, const int ty, rcConfig& tcfg)
+{
 	const float tcs = cfg.tileSize * cfg.cs;
 
-	rcConfig tcfg;
 	memcpy(&tcfg, &cfg, sizeof(tcfg));
 
 	tcfg.bmin[0] = cfg.bmin[0] + tx * tcs;
@@ -287,17 +309,36 @@ int rasterizeTileLayers(
 	tcfg.bmin[2] -= tcfg.borderSize * tcfg.cs;
 	tcfg.bmax[0] += tcfg.borderSize * tcfg.cs;
 	tcfg.bmax[2] += tcfg.borderSize * tcfg.cs;
+}
+
+int rasterizeTileLayers(
+	rcContext* ctx,
+	dtTileCacheCompressor* comp,
+	const rcChunkyTriMesh* chunkyMesh,
+	const int tx, const int ty,
+	const rcConfig& cfg,
+	TileCacheData* tiles,
+	const int maxTiles)
+{
+	RasterizationContext rc;
+
+	const float* verts = m_mesh->getVerts();
+	const int nverts = m_mesh->getVertCount();
+
+	// Tile bounds.
+	rcConfig tcfg;
+	calcTileConfig(cfg, tx, ty, tcfg);
 
 	// Allocate voxel heightfield where we rasterize our input data to.
 	rc.solid = rcAllocHeightfield();
 	if (!rc.solid)
 	{
-		m_ctx->log(RC_LOG_ERROR, "buildNavigation: Out of memory 'solid'.");
+		ctx->log(RC_LOG_ERROR, "buildNavigation: Out of memory 'solid'.");
 		return 0;
 	}
-	if (!rcCreateHeightfield(m_ctx, *rc.solid, tcfg.width, tcfg.height, tcfg.bmin, tcfg.bmax, tcfg.cs, tcfg.ch))
+	if (!rcCreateHeightfield(ctx, *rc.solid, tcfg.width, tcfg.height, tcfg.bmin, tcfg.bmax, tcfg.cs, tcfg.ch))
 	{
-		m_ctx->log(RC_LOG_ERROR, "buildNavigation: Could not create solid heightfield.");
+		ctx->log(RC_LOG_ERROR, "buildNavigation: Could not create solid heightfield.");
 		return 0;
 	}
 
@@ -307,7 +348,7 @@ int rasterizeTileLayers(
 	rc.triareas = new unsigned char[chunkyMesh->maxTrisPerChunk];
 	if (!rc.triareas)
 	{
-		m_ctx->log(RC_LOG_ERROR, "buildNavigation: Out of memory 'm_triareas' (%d).", chunkyMesh->maxTrisPerChunk);
+		ctx->log(RC_LOG_ERROR, "buildNavigation: Out of memory 'm_triareas' (%d).", chunkyMesh->maxTrisPerChunk);
 		return 0;
 	}
 
@@ -330,10 +371,10 @@ int rasterizeTileLayers(
 		const int ntris = node.n;
 
 		memset(rc.triareas, 0, ntris * sizeof(unsigned char));
-		rcMarkWalkableTriangles(m_ctx, tcfg.walkableSlopeAngle,
+		rcMarkWalkableTriangles(ctx, tcfg.walkableSlopeAngle,
 			verts, nverts, tris, ntris, rc.triareas);
 
-		if (!rcRasterizeTriangles(m_ctx, verts, nverts, tris, rc.triareas, ntris, *rc.solid, tcfg.walkableClimb))
+		if (!rcRasterizeTriangles(ctx, verts, nverts, tris, rc.triareas, ntris, *rc.solid, tcfg.walkableClimb))
 			return 0;
 	}
 
@@ -341,29 +382,29 @@ int rasterizeTileLayers(
 	// remove unwanted overhangs caused by the conservative rasterization
 	// as well as filter spans where the character cannot possibly stand.
 	if (m_filterLowHangingObstacles)
-		rcFilterLowHangingWalkableObstacles(m_ctx, tcfg.walkableClimb, *rc.solid);
+		rcFilterLowHangingWalkableObstacles(ctx, tcfg.walkableClimb, *rc.solid);
 	if (m_filterLedgeSpans)
-		rcFilterLedgeSpans(m_ctx, tcfg.walkableHeight, tcfg.walkableClimb, *rc.solid);
+		rcFilterLedgeSpans(ctx, tcfg.walkableHeight, tcfg.walkableClimb, *rc.solid);
 	if (m_filterWalkableLowHeightSpans)
-		rcFilterWalkableLowHeightSpans(m_ctx, tcfg.walkableHeight, *rc.solid);
+		rcFilterWalkableLowHeightSpans(ctx, tcfg.walkableHeight, *rc.solid);
 
 
 	rc.chf = rcAllocCompactHeightfield();
 	if (!rc.chf)
 	{
-		m_ctx->log(RC_LOG_ERROR, "buildNavigation: Out of memory 'chf'.");
+		ctx->log(RC_LOG_ERROR, "buildNavigation: Out of memory 'chf'.");
 		return 0;
 	}
-	if (!rcBuildCompactHeightfield(m_ctx, tcfg.walkableHeight, tcfg.walkableClimb, *rc.solid, *rc.chf))
+	if (!rcBuildCompactHeightfield(ctx, tcfg.walkableHeight, tcfg.walkableClimb, *rc.solid, *rc.chf))
 	{
-		m_ctx->log(RC_LOG_ERROR, "buildNavigation: Could not build compact data.");
+		ctx->log(RC_LOG_ERROR, "buildNavigation: Could not build compact data.");
 		return 0;
 	}
 
 	// Erode the walkable area by agent radius.
-	if (!rcErodeWalkableArea(m_ctx, tcfg.walkableRadius, *rc.chf))
+	if (!rcErodeWalkableArea(ctx, tcfg.walkableRadius, *rc.chf))
 	{
-		m_ctx->log(RC_LOG_ERROR, "buildNavigation: Could not erode.");
+		ctx->log(RC_LOG_ERROR, "buildNavigation: Could not erode.");
 		return 0;
 	}
 
@@ -371,7 +412,7 @@ int rasterizeTileLayers(
 	//const ConvexVolume* vols = m_geom->getConvexVolumes();
 	//for (int i = 0; i < m_geom->getConvexVolumeCount(); ++i)
 	//{
-	//	rcMarkConvexPolyArea(m_ctx, vols[i].verts, vols[i].nverts,
+	//	rcMarkConvexPolyArea(ctx, vols[i].verts, vols[i].nverts,
 	//		vols[i].hmin, vols[i].hmax,
 	//		(unsigned char)vols[i].area, *rc.chf);
 	//}
@@ -379,12 +420,12 @@ int rasterizeTileLayers(
 	rc.lset = rcAllocHeightfieldLayerSet();
 	if (!rc.lset)
 	{
-		m_ctx->log(RC_LOG_ERROR, "buildNavigation: Out of memory 'lset'.");
+		ctx->log(RC_LOG_ERROR, "buildNavigation: Out of memory 'lset'.");
 		return 0;
 	}
-	if (!rcBuildHeightfieldLayers(m_ctx, *rc.chf, tcfg.borderSize, tcfg.walkableHeight, *rc.lset))
+	if (!rcBuildHeightfieldLayers(ctx, *rc.chf, tcfg.borderSize, tcfg.walkableHeight, *rc.lset))
 	{
-		m_ctx->log(RC_LOG_ERROR, "buildNavigation: Could not build heighfield layers.");
+		ctx->log(RC_LOG_ERROR, "buildNavigation: Could not build heighfield layers.");
 		return 0;
 	}
 
@@ -416,7 +457,7 @@ int rasterizeTileLayers(
 		header.hmin = (unsigned short)layer->hmin;
 		header.hmax = (unsigned short)layer->hmax;
 
-		dtStatus status = dtBuildTileCacheLayer(&comp, &header, layer->heights, layer->areas, layer->cons,
+		dtStatus status = dtBuildTileCacheLayer(comp, &header, layer->heights, layer->areas, layer->cons,
 			&tile->data, &tile->dataSize);
 		if (dtStatusFailed(status))
 		{
@@ -453,6 +494,260 @@ float m_detailSampleDist = 6.0f;
 float m_detailSampleMaxError = 1.0f;
 int m_tileSize = 48;
 
+//------------------------- Incremental Begin-------------------------------
+
+// Tiled builds store a hash of every tile's input in binPath + ".hash".
+// With incremental builds on, tiles whose hash did not change are copied
+// from the previous output instead of being built again.
+static const int TILEHASH_MAGIC = 'T' << 24 | 'H' << 16 | 'S' << 8 | 'H'; //'THSH';
+static const int TILEHASH_VERSION = 1;
+
+struct TileHashHeader
+{
+	int magic;
+	int version;
+	int setMagic;		// magic of the output, TILECACHESET_MAGIC or NAVMESHSET_MAGIC
+	int tileWidth;
+	int tileHeight;
+	unsigned int outputSize;	// size of the output the hashes belong to
+	unsigned long long configHash;
+	// followed by tileWidth * tileHeight tile hashes
+};
+
+bool m_incrementalBuild = false;
+
+void SetIncrementalBuild(bool enable)
+{
+	m_incrementalBuild = enable;
+}
+
+// 64 bit FNV-1a.
+static unsigned long long hashBytes(const void* data, const size_t size, unsigned long long h = 14695981039346656037ULL)
+{
+	const unsigned char* bytes = (const unsigned char*)data;
+	for (size_t i = 0; i < size; ++i)
+	{
+		h ^= bytes[i];
+		h *= 1099511628211ULL;
+	}
+	return h;
+}
+
+// Hash of what every tile depends on. The config holds the mesh bounds, so
+// moving the bounds moves the tile grid and dirties everything.
+static unsigned long long hashBuildConfig(const rcConfig& cfg, const int setMagic)
+{
+	unsigned long long h = hashBytes(&setMagic, sizeof(setMagic));
+	h = hashBytes(&cfg, sizeof(cfg), h);
+	const float agent[3] = { m_agentHeight, m_agentRadius, m_agentMaxClimb };
+	h = hashBytes(agent, sizeof(agent), h);
+	const bool filters[3] = { m_filterLowHangingObstacles, m_filterLedgeSpans, m_filterWalkableLowHeightSpans };
+	return hashBytes(filters, sizeof(filters), h);
+}
+
+// Hash of the triangles overlapping tile (tx, ty) and its border. The triangle
+// hashes are summed, so reordering the mesh or regrouping the chunks does not
+// dirty a tile whose triangles stayed the same.
+static unsigned long long hashTileInput(const rcChunkyTriMesh* chunkyMesh, const int tx, const int ty, const rcConfig& cfg)
+{
+	rcConfig tcfg;
+	calcTileConfig(cfg, tx, ty, tcfg);
+
+	float tbmin[2], tbmax[2];
+	tbmin[0] = tcfg.bmin[0];
+	tbmin[1] = tcfg.bmin[2];
+	tbmax[0] = tcfg.bmax[0];
+	tbmax[1] = tcfg.bmax[2];
+	int cid[512];
+	const int ncid = rcGetChunksOverlappingRect(chunkyMesh, tbmin, tbmax, cid, 512);
+
+	const float* verts = m_mesh->getVerts();
+	unsigned long long sum = 0;
+	unsigned int count = 0;
+	for (int i = 0; i < ncid; ++i)
+	{
+		const rcChunkyTriMeshNode& node = chunkyMesh->nodes[cid[i]];
+		for (int j = 0; j < node.n; ++j)
+		{
+			const int* t = &chunkyMesh->tris[(node.i + j) * 3];
+			float tri[9];
+			rcVcopy(&tri[0], &verts[t[0] * 3]);
+			rcVcopy(&tri[3], &verts[t[1] * 3]);
+			rcVcopy(&tri[6], &verts[t[2] * 3]);
+			if (rcMax(tri[0], rcMax(tri[3], tri[6])) < tbmin[0] || rcMin(tri[0], rcMin(tri[3], tri[6])) > tbmax[0] ||
+				rcMax(tri[2], rcMax(tri[5], tri[8])) < tbmin[1] || rcMin(tri[2], rcMin(tri[5], tri[8])) > tbmax[1])
+				continue;
+			sum += hashBytes(tri, sizeof(tri));
+			count++;
+		}
+	}
+	unsigned long long h = hashBytes(&sum, sizeof(sum));
+	return hashBytes(&count, sizeof(count), h);
+}
+
+// Tile hashes and tiles of the previous output, indexed by tx + ty * tileWidth.
+struct PreviousBuild
+{
+	std::vector<unsigned char> file;
+	std::vector<unsigned long long> hashes;
+	std::vector<std::vector<TileCacheData> > tiles;	// point into file, in layer order
+};
+
+// Loads the previous output of binPath if it was built from the same config and grid.
+static bool loadPreviousBuild(const char* binPath, const int setMagic, const int tw, const int th,
+	const unsigned long long configHash, PreviousBuild& prev)
+{
+	FILE* fp = fopen((std::string(binPath) + ".hash").c_str(), "rb");
+	if (!fp)
+		return false;
+	TileHashHeader hashHeader;
+	prev.hashes.resize(tw * th);
+	bool ok = fread(&hashHeader, sizeof(hashHeader), 1, fp) == 1 &&
+		hashHeader.magic == TILEHASH_MAGIC &&
+		hashHeader.version == TILEHASH_VERSION &&
+		hashHeader.setMagic == setMagic &&
+		hashHeader.tileWidth == tw &&
+		hashHeader.tileHeight == th &&
+		hashHeader.configHash == configHash &&
+		fread(&prev.hashes[0], sizeof(unsigned long long), tw * th, fp) == (size_t)(tw * th);
+	fclose(fp);
+	if (!ok)
+		return false;
+
+	// The output must be the one the hashes were written for.
+	fp = fopen(binPath, "rb");
+	if (!fp)
+		return false;
+	prev.file.resize(hashHeader.outputSize);
+	ok = hashHeader.outputSize > 0 && fread(&prev.file[0], 1, prev.file.size(), fp) == prev.file.size() && fgetc(fp) == EOF;
+	fclose(fp);
+	if (!ok)
+		return false;
+
+	const unsigned char* data = &prev.file[0];
+	const size_t size = prev.file.size();
+	size_t pos = 0;
+	int numTiles = 0;
+	if (setMagic == TILECACHESET_MAGIC)
+	{
+		TileCacheSetHeader header;
+		if (size < sizeof(header))
+			return false;
+		memcpy(&header, data, sizeof(header));
+		if (header.magic != TILECACHESET_MAGIC || header.version != TILECACHESET_VERSION)
+			return false;
+		numTiles = header.numTiles;
+		pos = sizeof(header);
+	}
+	else
+	{
+		NavMeshSetHeader header;
+		if (size < sizeof(header))
+			return false;
+		memcpy(&header, data, sizeof(header));
+		if (header.magic != NAVMESHSET_MAGIC || header.version != NAVMESHSET_VERSION)
+			return false;
+		numTiles = header.numTiles;
+		pos = sizeof(header);
+	}
+
+	prev.tiles.resize(tw * th);
+	for (int i = 0; i < numTiles; ++i)
+	{
+		int dataSize = 0;
+		if (setMagic == TILECACHESET_MAGIC)
+		{
+			TileCacheTileHeader tileHeader;
+			if (pos + sizeof(tileHeader) > size)
+				return false;
+			memcpy(&tileHeader, data + pos, sizeof(tileHeader));
+			pos += sizeof(tileHeader);
+			dataSize = tileHeader.dataSize;
+		}
+		else
+		{
+			NavMeshTileHeader tileHeader;
+			if (pos + sizeof(tileHeader) > size)
+				return false;
+			memcpy(&tileHeader, data + pos, sizeof(tileHeader));
+			pos += sizeof(tileHeader);
+			dataSize = tileHeader.dataSize;
+		}
+		if (dataSize <= 0 || (size_t)dataSize > size - pos)
+			return false;
+
+		int x, y;
+		if (setMagic == TILECACHESET_MAGIC)
+		{
+			dtTileCacheLayerHeader layerHeader;
+			if ((size_t)dataSize < sizeof(layerHeader))
+				return false;
+			memcpy(&layerHeader, data + pos, sizeof(layerHeader));
+			x = layerHeader.tx;
+			y = layerHeader.ty;
+		}
+		else
+		{
+			dtMeshHeader meshHeader;
+			if ((size_t)dataSize < sizeof(meshHeader))
+				return false;
+			memcpy(&meshHeader, data + pos, sizeof(meshHeader));
+			x = meshHeader.x;
+			y = meshHeader.y;
+		}
+		if (x < 0 || x >= tw || y < 0 || y >= th)
+			return false;
+
+		TileCacheData tile;
+		tile.data = &prev.file[pos];
+		tile.dataSize = dataSize;
+		prev.tiles[x + y * tw].push_back(tile);
+		pos += dataSize;
+	}
+	return true;
+}
+
+// Copies the previous tiles of grid cell i, returns how many were copied.
+static int copyPreviousTiles(const PreviousBuild& prev, const int i, TileCacheData* tiles, const int maxTiles)
+{
+	int n = 0;
+	for (size_t j = 0; j < prev.tiles[i].size() && n < maxTiles; ++j)
+	{
+		const TileCacheData& src = prev.tiles[i][j];
+		tiles[n].data = (unsigned char*)dtAlloc(src.dataSize, DT_ALLOC_PERM);
+		if (!tiles[n].data)
+			break;
+		memcpy(tiles[n].data, src.data, src.dataSize);
+		tiles[n].dataSize = src.dataSize;
+		n++;
+	}
+	return n;
+}
+
+static void saveTileHashes(const char* binPath, const int setMagic, const int tw, const int th,
+	const unsigned long long configHash, const unsigned int outputSize, const std::vector<unsigned long long>& hashes)
+{
+	FILE* fp = fopen((std::string(binPath) + ".hash").c_str(), "wb");
+	if (!fp)
+	{
+		printf("Could create file:%s.hash to write tile hashes.", binPath);
+		return;
+	}
+	TileHashHeader header;
+	header.magic = TILEHASH_MAGIC;
+	header.version = TILEHASH_VERSION;
+	header.setMagic = setMagic;
+	header.tileWidth = tw;
+	header.tileHeight = th;
+	header.outputSize = outputSize;
+	header.configHash = configHash;
+	fwrite(&header, sizeof(header), 1, fp);
+	fwrite(&hashes[0], sizeof(unsigned long long), hashes.size(), fp);
+	fclose(fp);
+}
+
+//------------------------- Incremental End---------------------------------
+
 int BuildSoloMesh(const char* objPath, const char* binPath, const char* param)
 {
 	int m_partitionType = SAMPLE_PARTITION_WATERSHED;
@@ -865,9 +1160,19 @@ int BuildSoloMesh(const char* objPath, const char* binPath, const char* param)
 }
 
 int BuildTempObstacles(const char* objPath, const char* binPath, const char* param)
+{
+	return BuildTempObstaclesEx(objPath, binPath, param, 0);
+}
+
+int BuildTempObstaclesEx(const char* objPath, const char* binPath, const char* param, int threadCount)
 {
 	dtStatus status;
 
+	if (threadCount <= 0)
+		threadCount = (int)std::thread::hardware_concurrency();
+	if (threadCount <= 0)
+		threadCount = 1;
+
 	int m_partitionType = SAMPLE_PARTITION_WATERSHED;
 	m_ctx = new rcContext();
 	m_mesh = new rcMeshLoaderObj;
@@ -1007,6 +1312,19 @@ int BuildTempObstacles(const char* objPath, const char* binPath, const char* par
 		m_ctx->log(RC_LOG_ERROR, "buildTiledNavigation: Could not init Detour navmesh query");
 		return false;
 	}
+	delete m_chunkyMesh;
+	m_chunkyMesh = new rcChunkyTriMesh;
+	if (!m_chunkyMesh)
+	{
+		printf("buildTiledNavigation: Out of memory 'm_chunkyMesh'.");
+		return false;
+	}
+	if (!rcCreateChunkyTriMesh(m_mesh->getVerts(), m_mesh->getTris(), m_mesh->getTriCount(), 256, m_chunkyMesh))
+	{
+		printf("buildTiledNavigation: Failed to build chunky mesh.");
+		return false;
+	}
+
 	// Preprocess tiles.
 
 	m_ctx->resetTimers();
@@ -1015,38 +1333,87 @@ int BuildTempObstacles(const char* objPath, const char* binPath, const char* par
 	int m_cacheCompressedSize = 0;
 	//int m_cacheRawSize = 0;
 
-	for (int y = 0; y < th; ++y)
-	{
-		for (int x = 0; x < tw; ++x)
+	const unsigned long long configHash = hashBuildConfig(cfg, TILECACHESET_MAGIC);
+	std::vector<unsigned long long> hashes(tw * th);
+	PreviousBuild prev;
+	const bool incremental = m_incrementalBuild && loadPreviousBuild(binPath, TILECACHESET_MAGIC, tw, th, configHash, prev);
+
+	// The tiles are rasterized and compressed in parallel but added to the cache
+	// in grid order afterwards, so the tile refs and the written file do not
+	// depend on the thread count.
+	TileBuildWorker* workers = new TileBuildWorker[threadCount];
+	std::vector<TileCacheData> layers(tw * th * MAX_LAYERS);
+	std::vector<int> layerCounts(tw * th);
+	std::atomic<int> rebuilt(0);
+	ParallelFor(threadCount, tw * th, [&](int worker, int i)
+	{
+		hashes[i] = hashTileInput(m_chunkyMesh, i % tw, i / tw, cfg);
+		if (incremental && prev.hashes[i] == hashes[i])
 		{
-			TileCacheData tiles[MAX_LAYERS];
-			memset(tiles, 0, sizeof(tiles));
-			int ntiles = rasterizeTileLayers(x, y, cfg, tiles, MAX_LAYERS);
+			layerCounts[i] = copyPreviousTiles(prev, i, &layers[i * MAX_LAYERS], MAX_LAYERS);
+			return;
+		}
+		layerCounts[i] = rasterizeTileLayers(&workers[worker].ctx, &workers[worker].comp, m_chunkyMesh,
+			i % tw, i / tw, cfg, &layers[i * MAX_LAYERS], MAX_LAYERS);
+		rebuilt++;
+	});
+	if (m_incrementalBuild)
+		printf(">> Rebuilt %d of %d tiles", (int)rebuilt, tw * th);
 
-			for (int i = 0; i < ntiles; ++i)
+	for (int i = 0; i < tw * th; ++i)
+	{
+		for (int j = 0; j < layerCounts[i]; ++j)
+		{
+			TileCacheData* tile = &layers[i * MAX_LAYERS + j];
+			status = m_tileCache->addTile(tile->data, tile->dataSize, DT_COMPRESSEDTILE_FREE_DATA, 0);
+			if (dtStatusFailed(status))
 			{
-				TileCacheData* tile = &tiles[i];
-				status = m_tileCache->addTile(tile->data, tile->dataSize, DT_COMPRESSEDTILE_FREE_DATA, 0);
-				if (dtStatusFailed(status))
-				{
-					dtFree(tile->data);
-					tile->data = 0;
-					continue;
-				}
-
-				m_cacheLayerCount++;
-				m_cacheCompressedSize += tile->dataSize;
-				//m_cacheRawSize += calcLayerBufferSize(tcparams.width, tcparams.height);
+				dtFree(tile->data);
+				tile->data = 0;
+				continue;
 			}
+
+			m_cacheLayerCount++;
+			m_cacheCompressedSize += tile->dataSize;
+			//m_cacheRawSize += calcLayerBufferSize(tcparams.width, tcparams.height);
 		}
 	}
-	// Build initial meshes
+
+	delete m_chunkyMesh;
+	m_chunkyMesh = nullptr;
+
+	// Build initial meshes, same order as buildNavMeshTilesAt over the grid.
 	m_ctx->startTimer(RC_TIMER_TOTAL);
+	std::vector<dtCompressedTileRef> refs;
 	for (int y = 0; y < th; ++y)
+	{
 		for (int x = 0; x < tw; ++x)
-			m_tileCache->buildNavMeshTilesAt(x, y, m_navMesh);
+		{
+			dtCompressedTileRef tiles[MAX_LAYERS];
+			const int ntiles = m_tileCache->getTilesAt(x, y, tiles, MAX_LAYERS);
+			refs.insert(refs.end(), tiles, tiles + ntiles);
+		}
+	}
+
+	std::vector<TileCacheData> navTiles(refs.size());
+	ParallelFor(threadCount, (int)refs.size(), [&](int worker, int i)
+	{
+		m_tileCache->buildNavMeshTileData(refs[i], &workers[worker].talloc, &navTiles[i].data, &navTiles[i].dataSize);
+	});
+
+	// The navmesh is empty, so there is nothing to remove before adding.
+	for (size_t i = 0; i < navTiles.size(); ++i)
+	{
+		if (!navTiles[i].data)
+			continue;
+		status = m_navMesh->addTile(navTiles[i].data, navTiles[i].dataSize, DT_TILE_FREE_DATA, 0, 0);
+		if (dtStatusFailed(status))
+			dtFree(navTiles[i].data);
+	}
 	m_ctx->stopTimer(RC_TIMER_TOTAL);
 
+	delete[] workers;
+
 
 	if (!m_tileCache) return false;
 
@@ -1087,7 +1454,9 @@ int BuildTempObstacles(const char* objPath, const char* binPath, const char* par
 		fwrite(tile->data, tile->dataSize, 1, fp);
 	}
 
+	const unsigned int outputSize = (unsigned int)ftell(fp);
 	fclose(fp);
+	saveTileHashes(binPath, TILECACHESET_MAGIC, tw, th, configHash, outputSize, hashes);
 
 	dtFreeTileCache(m_tileCache);
 	m_tileCache = nullptr;
@@ -1097,129 +1466,1054 @@ int BuildTempObstacles(const char* objPath, const char* binPath, const char* par
 }
 
 
-int BuildBlockData(const char* binPath, const char* blockPath, int width, int height, bool bDebugFile /*= false*/)
+//------------------------- TiledMesh Begin---------------------------------
+
+// Intermediate results of one tile, freed when the tile is done.
+struct TileMeshContext
 {
-	unsigned char* navData = 0;
-	FILE* fp = fopen(binPath, "rb");
-	if (!fp)
-		return false;
-	if (fseek(fp, 0, SEEK_END) != 0)
+	TileMeshContext() :
+		solid(0),
+		triareas(0),
+		chf(0),
+		cset(0),
+		pmesh(0),
+		dmesh(0)
 	{
-		fclose(fp);
-		return false;
 	}
-	long navDataSize = ftell(fp);
-	if (navDataSize < 0)
+
+	~TileMeshContext()
 	{
-		fclose(fp);
-		return false;
+		rcFreeHeightField(solid);
+		delete[] triareas;
+		rcFreeCompactHeightfield(chf);
+		rcFreeContourSet(cset);
+		rcFreePolyMesh(pmesh);
+		rcFreePolyMeshDetail(dmesh);
 	}
-	if (fseek(fp, 0, SEEK_SET) != 0)
+
+	rcHeightfield* solid;
+	unsigned char* triareas;
+	rcCompactHeightfield* chf;
+	rcContourSet* cset;
+	rcPolyMesh* pmesh;
+	rcPolyMeshDetail* dmesh;
+};
+
+// Builds the Detour data of tile (tx, ty) from the chunky mesh triangles
+// overlapping it. Returns null if the tile has no walkable polygons.
+unsigned char* buildTileMesh(
+	rcContext* ctx,
+	const rcChunkyTriMesh* chunkyMesh,
+	const int tx, const int ty,
+	const rcConfig& cfg,
+	int& dataSize)
+{
+	TileMeshContext tc;
+	dataSize = 0;
+
+	const float* verts = m_mesh->getVerts();
+	const int nverts = m_mesh->getVertCount();
+
+	// Tile bounds, expanded by the border so that neighbouring tiles match.
+	rcConfig tcfg;
+	calcTileConfig(cfg, tx, ty, tcfg);
+
+	float tbmin[2], tbmax[2];
+	tbmin[0] = tcfg.bmin[0];
+	tbmin[1] = tcfg.bmin[2];
+	tbmax[0] = tcfg.bmax[0];
+	tbmax[1] = tcfg.bmax[2];
+	int cid[512];// TODO: Make grow when returning too many items.
+	const int ncid = rcGetChunksOverlappingRect(chunkyMesh, tbmin, tbmax, cid, 512);
+	if (!ncid)
+		return 0; // empty
+
+	tc.solid = rcAllocHeightfield();
+	if (!tc.solid)
 	{
-		fclose(fp);
-		return false;
+		ctx->log(RC_LOG_ERROR, "buildTileMesh: Out of memory 'solid'.");
+		return 0;
 	}
-	navData = (unsigned char*)dtAlloc(navDataSize, dtAllocHint::DT_ALLOC_PERM);
-	if (!navData)
+	if (!rcCreateHeightfield(ctx, *tc.solid, tcfg.width, tcfg.height, tcfg.bmin, tcfg.bmax, tcfg.cs, tcfg.ch))
 	{
-		fclose(fp);
-		return false;
+		ctx->log(RC_LOG_ERROR, "buildTileMesh: Could not create solid heightfield.");
+		return 0;
 	}
-	size_t readLen = fread(navData, navDataSize, 1, fp);
-	fclose(fp);
 
-	auto m_navMesh = dtAllocNavMesh();
-	if (!m_navMesh)
+	tc.triareas = new unsigned char[chunkyMesh->maxTrisPerChunk];
+	for (int i = 0; i < ncid; ++i)
 	{
-		dtFree(navData);
-		printf("Could not create Detour navmesh");
-		return false;
+		const rcChunkyTriMeshNode& node = chunkyMesh->nodes[cid[i]];
+		const int* tris = &chunkyMesh->tris[node.i * 3];
+		const int ntris = node.n;
+
+		memset(tc.triareas, 0, ntris * sizeof(unsigned char));
+		rcMarkWalkableTriangles(ctx, tcfg.walkableSlopeAngle,
+			verts, nverts, tris, ntris, tc.triareas);
+
+		if (!rcRasterizeTriangles(ctx, verts, nverts, tris, tc.triareas, ntris, *tc.solid, tcfg.walkableClimb))
+			return 0;
 	}
 
-	dtStatus status;
+	if (m_filterLowHangingObstacles)
+		rcFilterLowHangingWalkableObstacles(ctx, tcfg.walkableClimb, *tc.solid);
+	if (m_filterLedgeSpans)
+		rcFilterLedgeSpans(ctx, tcfg.walkableHeight, tcfg.walkableClimb, *tc.solid);
+	if (m_filterWalkableLowHeightSpans)
+		rcFilterWalkableLowHeightSpans(ctx, tcfg.walkableHeight, *tc.solid);
 
-	status = m_navMesh->init(navData, navDataSize, DT_TILE_FREE_DATA);
-	if (dtStatusFailed(status))
+	tc.chf = rcAllocCompactHeightfield();
+	if (!tc.chf)
 	{
-		dtFree(navData);
-		printf("Could not init Detour navmesh");
-		return false;
+		ctx->log(RC_LOG_ERROR, "buildTileMesh: Out of memory 'chf'.");
+		return 0;
+	}
+	if (!rcBuildCompactHeightfield(ctx, tcfg.walkableHeight, tcfg.walkableClimb, *tc.solid, *tc.chf))
+	{
+		ctx->log(RC_LOG_ERROR, "buildTileMesh: Could not build compact data.");
+		return 0;
 	}
+	rcFreeHeightField(tc.solid);
+	tc.solid = 0;
 
-	auto m_navQuery = dtAllocNavMeshQuery();
-	status = m_navQuery->init(m_navMesh, 2048);
-	if (dtStatusFailed(status))
+	if (!rcErodeWalkableArea(ctx, tcfg.walkableRadius, *tc.chf))
 	{
-		printf("Could not init Detour navmesh query");
-		return false;
+		ctx->log(RC_LOG_ERROR, "buildTileMesh: Could not erode.");
+		return 0;
 	}
 
-	float pos[3];
-	float m_polyPickExt[3] = { 50.6f, 50.0f, 50.6f };
-	dtQueryFilter m_filter;
-	m_filter.setIncludeFlags(SAMPLE_POLYFLAGS_ALL ^ SAMPLE_POLYFLAGS_DISABLED);
-	m_filter.setExcludeFlags(0);
+	// Watershed partitioning, same as BuildSoloMesh.
+	if (!rcBuildDistanceField(ctx, *tc.chf))
+	{
+		ctx->log(RC_LOG_ERROR, "buildTileMesh: Could not build distance field.");
+		return 0;
+	}
+	if (!rcBuildRegions(ctx, *tc.chf, tcfg.borderSize, tcfg.minRegionArea, tcfg.mergeRegionArea))
+	{
+		ctx->log(RC_LOG_ERROR, "buildTileMesh: Could not build watershed regions.");
+		return 0;
+	}
+
+	tc.cset = rcAllocContourSet();
+	if (!tc.cset)
+	{
+		ctx->log(RC_LOG_ERROR, "buildTileMesh: Out of memory 'cset'.");
+		return 0;
+	}
+	if (!rcBuildContours(ctx, *tc.chf, tcfg.maxSimplificationError, tcfg.maxEdgeLen, *tc.cset))
+	{
+		ctx->log(RC_LOG_ERROR, "buildTileMesh: Could not create contours.");
+		return 0;
+	}
+	if (tc.cset->nconts == 0)
+		return 0;
+
+	tc.pmesh = rcAllocPolyMesh();
+	if (!tc.pmesh)
+	{
+		ctx->log(RC_LOG_ERROR, "buildTileMesh: Out of memory 'pmesh'.");
+		return 0;
+	}
+	if (!rcBuildPolyMesh(ctx, *tc.cset, tcfg.maxVertsPerPoly, *tc.pmesh))
+	{
+		ctx->log(RC_LOG_ERROR, "buildTileMesh: Could not triangulate contours.");
+		return 0;
+	}
+
+	tc.dmesh = rcAllocPolyMeshDetail();
+	if (!tc.dmesh)
+	{
+		ctx->log(RC_LOG_ERROR, "buildTileMesh: Out of memory 'pmdtl'.");
+		return 0;
+	}
+	if (!rcBuildPolyMeshDetail(ctx, *tc.pmesh, *tc.chf, tcfg.detailSampleDist, tcfg.detailSampleMaxError, *tc.dmesh))
+	{
+		ctx->log(RC_LOG_ERROR, "buildTileMesh: Could not build detail mesh.");
+		return 0;
+	}
+
+	if (tcfg.maxVertsPerPoly > DT_VERTS_PER_POLYGON || tc.pmesh->npolys == 0)
+		return 0;
+	if (tc.pmesh->nverts >= 0xffff)
+	{
+		// The vertex indices are ushorts, and cannot point to more than 0xffff vertices.
+		ctx->log(RC_LOG_ERROR, "buildTileMesh: Too many vertices per tile %d (max: %d).", tc.pmesh->nverts, 0xffff);
+		return 0;
+	}
+
+	// Update poly flags from areas.
+	for (int i = 0; i < tc.pmesh->npolys; ++i)
+	{
+		if (tc.pmesh->areas[i] == RC_WALKABLE_AREA)
+			tc.pmesh->areas[i] = SAMPLE_POLYAREA_GROUND;
+
+		if (tc.pmesh->areas[i] == SAMPLE_POLYAREA_GROUND ||
+			tc.pmesh->areas[i] == SAMPLE_POLYAREA_GRASS ||
+			tc.pmesh->areas[i] == SAMPLE_POLYAREA_ROAD)
+		{
+			tc.pmesh->flags[i] = SAMPLE_POLYFLAGS_WALK;
+		}
+		else if (tc.pmesh->areas[i] == SAMPLE_POLYAREA_WATER)
+		{
+			tc.pmesh->flags[i] = SAMPLE_POLYFLAGS_SWIM;
+		}
+		else if (tc.pmesh->areas[i] == SAMPLE_POLYAREA_DOOR)
+		{
+			tc.pmesh->flags[i] = SAMPLE_POLYFLAGS_WALK | SAMPLE_POLYFLAGS_DOOR;
+		}
+	}
+
+	dtNavMeshCreateParams params;
+	memset(&params, 0, sizeof(params));
+	params.verts = tc.pmesh->verts;
+	params.vertCount = tc.pmesh->nverts;
+	params.polys = tc.pmesh->polys;
+	params.polyAreas = tc.pmesh->areas;
+	params.polyFlags = tc.pmesh->flags;
+	params.polyCount = tc.pmesh->npolys;
+	params.nvp = tc.pmesh->nvp;
+	params.detailMeshes = tc.dmesh->meshes;
+	params.detailVerts = tc.dmesh->verts;
+	params.detailVertsCount = tc.dmesh->nverts;
+	params.detailTris = tc.dmesh->tris;
+	params.detailTriCount = tc.dmesh->ntris;
+	params.walkableHeight = m_agentHeight;
+	params.walkableRadius = m_agentRadius;
+	params.walkableClimb = m_agentMaxClimb;
+	params.tileX = tx;
+	params.tileY = ty;
+	params.tileLayer = 0;
+	rcVcopy(params.bmin, tc.pmesh->bmin);
+	rcVcopy(params.bmax, tc.pmesh->bmax);
+	params.cs = tcfg.cs;
+	params.ch = tcfg.ch;
+	params.buildBvTree = true;
+
+	unsigned char* navData = 0;
+	if (!dtCreateNavMeshData(&params, &navData, &dataSize))
+	{
+		ctx->log(RC_LOG_ERROR, "buildTileMesh: Could not build Detour navmesh.");
+		return 0;
+	}
+	return navData;
+}
+
+int BuildTiledMesh(const char* objPath, const char* binPath, const char* param, int threadCount)
+{
+	dtStatus status;
+
+	if (threadCount <= 0)
+		threadCount = (int)std::thread::hardware_concurrency();
+	if (threadCount <= 0)
+		threadCount = 1;
+
+	m_ctx = new rcContext();
+	m_mesh = new rcMeshLoaderObj;
+	if (!m_mesh)
+	{
+		printf("loadMesh: Out of memory 'mesh'.");
+		return ERROR_OUT_OF_MEMORY;
+	}
+	if (!m_mesh->load(objPath))
+	{
+		printf("buildTiledNavigation: Could not load '%s'", objPath);
+		return ERROR_OBJ_FILE_ERROR;
+	}
+
+	if (param != nullptr && strlen(param) > 0)
+	{
+		int err = sscanf(param, "%f %f %f %f %f %f %f %f %f %f %f %f %f %d",
+			&m_cellSize,
+			&m_cellHeight,
+			&m_agentHeight,
+			&m_agentRadius,
+			&m_agentMaxClimb,
+			&m_agentMaxSlope,
+			&m_regionMinSize,
+			&m_regionMergeSize,
+			&m_edgeMaxLen,
+			&m_edgeMaxError,
+			&m_vertsPerPoly,
+			&m_detailSampleDist,
+			&m_detailSampleMaxError,
+			&m_tileSize);
+		if (err != 14)
+		{
+			printf("buildTiledNavigation: Malformed param '%s'", param);
+			return ERROR_BUILD_ERROR;
+		}
+	}
+
+	float meshBMin[3];
+	float meshBMax[3];
+	rcCalcBounds(m_mesh->getVerts(), m_mesh->getVertCount(), meshBMin, meshBMax);
+	const float* bmin = meshBMin;
+	const float* bmax = meshBMax;
+	int gw = 0, gh = 0;
+	rcCalcGridSize(bmin, bmax, m_cellSize, &gw, &gh);
+	const int ts = m_tileSize;
+	const int tw = (gw + ts - 1) / ts;
+	const int th = (gh + ts - 1) / ts;
+
+	// Max tiles and max polys affect how the tile IDs are caculated.
+	// There are 22 bits available for identifying a tile and a polygon.
+	int tileBits = rcMin((int)dtIlog2(dtNextPow2(tw * th)), 14);
+	int polyBits = 22 - tileBits;
+
+	rcConfig cfg;
+	memset(&cfg, 0, sizeof(cfg));
+	cfg.cs = m_cellSize;
+	cfg.ch = m_cellHeight;
+	cfg.walkableSlopeAngle = m_agentMaxSlope;
+	cfg.walkableHeight = (int)ceilf(m_agentHeight / cfg.ch);
+	cfg.walkableClimb = (int)floorf(m_agentMaxClimb / cfg.ch);
+	cfg.walkableRadius = (int)ceilf(m_agentRadius / cfg.cs);
+	cfg.maxEdgeLen = (int)(m_edgeMaxLen / m_cellSize);
+	cfg.maxSimplificationError = m_edgeMaxError;
+	cfg.minRegionArea = (int)rcSqr(m_regionMinSize);		// Note: area = size*size
+	cfg.mergeRegionArea = (int)rcSqr(m_regionMergeSize);	// Note: area = size*size
+	cfg.maxVertsPerPoly = (int)m_vertsPerPoly;
+	cfg.tileSize = ts;
+	cfg.borderSize = cfg.walkableRadius + 3; // Reserve enough padding.
+	cfg.width = cfg.tileSize + cfg.borderSize * 2;
+	cfg.height = cfg.tileSize + cfg.borderSize * 2;
+	cfg.detailSampleDist = m_detailSampleDist < 0.9f ? 0 : m_cellSize * m_detailSampleDist;
+	cfg.detailSampleMaxError = m_cellHeight * m_detailSampleMaxError;
+	rcVcopy(cfg.bmin, bmin);
+	rcVcopy(cfg.bmax, bmax);
+
+	dtNavMeshParams params;
+	memset(&params, 0, sizeof(params));
+	rcVcopy(params.orig, bmin);
+	params.tileWidth = ts * m_cellSize;
+	params.tileHeight = ts * m_cellSize;
+	params.maxTiles = 1 << tileBits;
+	params.maxPolys = 1 << polyBits;
+
+	dtNavMesh* navMesh = dtAllocNavMesh();
+	if (!navMesh)
+	{
+		printf("buildTiledNavigation: Could not allocate navmesh.");
+		return ERROR_OUT_OF_MEMORY;
+	}
+	status = navMesh->init(&params);
+	if (dtStatusFailed(status))
+	{
+		printf("buildTiledNavigation: Could not init navmesh.");
+		dtFreeNavMesh(navMesh);
+		return ERROR_BUILD_ERROR;
+	}
+
+	delete m_chunkyMesh;
+	m_chunkyMesh = new rcChunkyTriMesh;
+	if (!rcCreateChunkyTriMesh(m_mesh->getVerts(), m_mesh->getTris(), m_mesh->getTriCount(), 256, m_chunkyMesh))
+	{
+		printf("buildTiledNavigation: Failed to build chunky mesh.");
+		dtFreeNavMesh(navMesh);
+		return ERROR_BUILD_ERROR;
+	}
+
+	// Only the finished tiles are kept, the intermediate heightfields live
+	// as long as one tile build, so memory grows with the thread count and
+	// not with the map size. Tiles are added in grid order afterwards so the
+	// tile refs and the written file do not depend on the thread count.
+	const unsigned long long configHash = hashBuildConfig(cfg, NAVMESHSET_MAGIC);
+	std::vector<unsigned long long> hashes(tw * th);
+	PreviousBuild prev;
+	const bool incremental = m_incrementalBuild && loadPreviousBuild(binPath, NAVMESHSET_MAGIC, tw, th, configHash, prev);
+
+	rcContext* contexts = new rcContext[threadCount];
+	std::vector<TileCacheData> tiles(tw * th);
+	std::atomic<int> rebuilt(0);
+	ParallelFor(threadCount, tw * th, [&](int worker, int i)
+	{
+		hashes[i] = hashTileInput(m_chunkyMesh, i % tw, i / tw, cfg);
+		if (incremental && prev.hashes[i] == hashes[i])
+		{
+			copyPreviousTiles(prev, i, &tiles[i], 1);
+			return;
+		}
+		tiles[i].data = buildTileMesh(&contexts[worker], m_chunkyMesh, i % tw, i / tw, cfg, tiles[i].dataSize);
+		rebuilt++;
+	});
+	if (m_incrementalBuild)
+		printf(">> Rebuilt %d of %d tiles", (int)rebuilt, tw * th);
+	delete[] contexts;
+	delete m_chunkyMesh;
+	m_chunkyMesh = nullptr;
+
+	for (int i = 0; i < tw * th; ++i)
+	{
+		if (!tiles[i].data)
+			continue;
+		status = navMesh->addTile(tiles[i].data, tiles[i].dataSize, DT_TILE_FREE_DATA, 0, 0);
+		if (dtStatusFailed(status))
+			dtFree(tiles[i].data);
+	}
+
+	FILE* fp = fopen(binPath, "wb");
+	if (!fp)
+	{
+		printf("Could create file:%s to write bin.", binPath);
+		dtFreeNavMesh(navMesh);
+		return ERROR_BUILD_ERROR;
+	}
+
+	// Store header.
+	const dtNavMesh* mesh = navMesh;
+	NavMeshSetHeader header;
+	header.magic = NAVMESHSET_MAGIC;
+	header.version = NAVMESHSET_VERSION;
+	header.numTiles = 0;
+	for (int i = 0; i < mesh->getMaxTiles(); ++i)
+	{
+		const dtMeshTile* tile = mesh->getTile(i);
+		if (!tile || !tile->header || !tile->dataSize) continue;
+		header.numTiles++;
+	}
+	memcpy(&header.params, mesh->getParams(), sizeof(dtNavMeshParams));
+	fwrite(&header, sizeof(NavMeshSetHeader), 1, fp);
+
+	// Store tiles.
+	for (int i = 0; i < mesh->getMaxTiles(); ++i)
+	{
+		const dtMeshTile* tile = mesh->getTile(i);
+		if (!tile || !tile->header || !tile->dataSize) continue;
+
+		NavMeshTileHeader tileHeader;
+		tileHeader.tileRef = mesh->getTileRef(tile);
+		tileHeader.dataSize = tile->dataSize;
+		fwrite(&tileHeader, sizeof(tileHeader), 1, fp);
+
+		fwrite(tile->data, tile->dataSize, 1, fp);
+	}
+
+	const unsigned int outputSize = (unsigned int)ftell(fp);
+	fclose(fp);
+	saveTileHashes(binPath, NAVMESHSET_MAGIC, tw, th, configHash, outputSize, hashes);
+
+	printf(">> Tiled navmesh: %d tiles", header.numTiles);
+	dtFreeNavMesh(navMesh);
+
+	return 0;
+}
+
+//------------------------- TiledMesh End-----------------------------------
+
+//------------------------- BlockData Begin--------------------------------
+
+// A block cell (i, j) is walkable when the navmesh point (-i, 0, j) lies over
+// a polygon and is at least BLOCK_WALL_DISTANCE away from the nearest wall.
+static const float BLOCK_WALL_DISTANCE = 0.6f;
+static const float BLOCK_WALL_SEARCH_RADIUS = 20.0f;
+static const float BLOCK_PICK_EXTENTS[3] = { 50.6f, 50.0f, 50.6f };
+// Cells closer than this to a polygon edge are left to the exact queries.
+static const float BLOCK_EPSILON = 1e-3f;
+static const int BLOCK_STRIPE_ROWS = 16;
+static const int BLOCK_QUERY_NODES = 2048;
+
+// Versioned block files. The legacy format has no header and starts with the
+// width. Word and tile offsets are multiples of 4 so a mapped file can be read
+// in place.
+static const int BLOCKDATA_MAGIC = 'B' << 24 | 'L' << 16 | 'K' << 8 | 'D'; //'BLKD';
+static const int BLOCKDATA_VERSION = 1;
+static const int BLOCKDATA_TILE_SIZE = 64;
+// Tile table entries of BLOCK_FORMAT_TILES below the header size are uniform tiles.
+static const unsigned int BLOCKDATA_TILE_BLOCKED = 0;
+static const unsigned int BLOCKDATA_TILE_WALKABLE = 1;
+
+enum BlockDataFormat
+{
+	BLOCK_FORMAT_BYTES,	// width, height, then one char per cell
+	BLOCK_FORMAT_BITS,	// header, then rows of 32 bit words with one bit per cell
+	BLOCK_FORMAT_TILES,	// header, tile table, then the bits of the tiles that are not uniform
+};
+
+struct BlockDataHeader
+{
+	int magic;
+	int version;
+	int format;
+	int width;
+	int height;
+	int tileSize;		// cells per tile side, BLOCK_FORMAT_TILES only
+	unsigned int dataSize;	// bytes after the header
+	unsigned int reserved;
+};
+
+int m_blockDataFormat = BLOCK_FORMAT_BYTES;
+
+void SetBlockDataFormat(int format)
+{
+	if (format >= BLOCK_FORMAT_BYTES && format <= BLOCK_FORMAT_TILES)
+		m_blockDataFormat = format;
+}
+
+enum BlockCellFlags
+{
+	BLOCK_CELL_AMBIGUOUS = 0x01,	// too close to a polygon edge to trust the scanline
+	BLOCK_CELL_OVERLAP = 0x02,		// covered by more than one polygon
+};
+
+struct BlockPoly
+{
+	dtPolyRef ref;
+	float verts[DT_VERTS_PER_POLYGON * 3];
+	int nverts;
+	float walkableClimb;
+	float bmin[3], bmax[3];
+	int jmin, jmax;
+};
+
+struct BlockWall
+{
+	float a[3], b[3];
+	int jmin, jmax;
+};
+
+// The original per cell test, used where the scanline result is not certain.
+static bool sampleBlockCell(dtNavMeshQuery* navQuery, const dtQueryFilter& filter, const float* pos)
+{
 	dtPolyRef dtPy = 0;
 	float nearPos[3];
-	char *block = new char[width * height];
-	FILE* fp2 = 0;
-	if (bDebugFile)
+	bool bIsOverPoy = false;
+	dtStatus status = navQuery->findNearestPoly(pos, BLOCK_PICK_EXTENTS, &filter, &dtPy, nearPos, &bIsOverPoy);
+	if (bIsOverPoy)
+	{
+		if (status == DT_SUCCESS)
+		{
+			float hitDist, hitNormal[3], hitPos[3];
+			status = navQuery->findDistanceToWall(dtPy, pos, BLOCK_WALL_SEARCH_RADIUS, &filter, &hitDist, hitPos, hitNormal);
+			if (status == DT_SUCCESS)
+			{
+				bIsOverPoy = hitDist >= BLOCK_WALL_DISTANCE;
+			}
+			else
+			{
+				bIsOverPoy = false;
+			}
+		}
+	}
+	return bIsOverPoy;
+}
+
+// dtQueryFilter::passFilter is inline in Detour, this is its flag test.
+static inline bool passBlockFilter(const dtQueryFilter& filter, const dtPoly* poly)
+{
+	return (poly->flags & filter.getIncludeFlags()) != 0 && (poly->flags & filter.getExcludeFlags()) == 0;
+}
+
+// Same edge test as findDistanceToWall.
+static bool isSolidEdge(const dtNavMesh* navMesh, const dtMeshTile* tile, const dtPoly* poly, const int edge, const dtQueryFilter& filter)
+{
+	if (poly->neis[edge] & DT_EXT_LINK)
+	{
+		for (unsigned int k = poly->firstLink; k != DT_NULL_LINK; k = tile->links[k].next)
+		{
+			const dtLink* link = &tile->links[k];
+			if (link->edge == edge && link->ref != 0)
+			{
+				const dtMeshTile* neiTile = 0;
+				const dtPoly* neiPoly = 0;
+				navMesh->getTileAndPolyByRefUnsafe(link->ref, &neiTile, &neiPoly);
+				if (passBlockFilter(filter, neiPoly))
+					return false;
+			}
+		}
+		return true;
+	}
+	if (poly->neis[edge])
+	{
+		const unsigned int idx = (unsigned int)(poly->neis[edge] - 1);
+		return !passBlockFilter(filter, &tile->polys[idx]);
+	}
+	return true;
+}
+
+// Fills block with the walkable flag of every cell, row j at block[j * width].
+// Polygons are scanline rasterized into the grid and the walls are stamped
+// with their exact distance, both per stripe of rows in parallel. The cells
+// where that does not decide the answer for sure, those along polygon edges,
+// under overlapping polygons, near other floors, within BLOCK_WALL_DISTANCE of
+// a wall or where the wall search could run out of nodes, run the original
+// nearest poly and wall distance queries with a query per thread.
+static bool sampleBlockGrid(const dtNavMesh* navMesh, const dtQueryFilter& filter, char* block,
+	const int width, const int height, int threadCount)
+{
+	if (threadCount <= 0)
+		threadCount = (int)std::thread::hardware_concurrency();
+	if (threadCount <= 0)
+		threadCount = 1;
+
+	std::vector<BlockPoly> polys;
+	std::vector<BlockWall> walls;
+	const float wallBand = BLOCK_WALL_DISTANCE + BLOCK_EPSILON;
+	for (int t = 0; t < navMesh->getMaxTiles(); ++t)
+	{
+		const dtMeshTile* tile = navMesh->getTile(t);
+		if (!tile || !tile->header)
+			continue;
+		const dtPolyRef base = navMesh->getPolyRefBase(tile);
+		for (int p = 0; p < tile->header->polyCount; ++p)
+		{
+			const dtPoly* poly = &tile->polys[p];
+			const dtPolyRef ref = base | (dtPolyRef)p;
+			if (!passBlockFilter(filter, poly))
+				continue;
+
+			for (int e = 0; e < (int)poly->vertCount; ++e)
+			{
+				if (poly->getType() != DT_POLYTYPE_OFFMESH_CONNECTION && !isSolidEdge(navMesh, tile, poly, e, filter))
+					continue;
+				BlockWall wall;
+				dtVcopy(wall.a, &tile->verts[poly->verts[e] * 3]);
+				dtVcopy(wall.b, &tile->verts[poly->verts[(e + 1) % poly->vertCount] * 3]);
+				wall.jmin = (int)ceilf(dtMin(wall.a[2], wall.b[2]) - wallBand);
+				wall.jmax = (int)floorf(dtMax(wall.a[2], wall.b[2]) + wallBand);
+				walls.push_back(wall);
+			}
+
+			if (poly->getType() == DT_POLYTYPE_OFFMESH_CONNECTION)
+				continue;
+			BlockPoly bp;
+			bp.ref = ref;
+			bp.nverts = poly->vertCount;
+			bp.walkableClimb = tile->header->walkableClimb;
+			dtVset(bp.bmin, FLT_MAX, FLT_MAX, FLT_MAX);
+			dtVset(bp.bmax, -FLT_MAX, -FLT_MAX, -FLT_MAX);
+			for (int v = 0; v < bp.nverts; ++v)
+			{
+				dtVcopy(&bp.verts[v * 3], &tile->verts[poly->verts[v] * 3]);
+				dtVmin(bp.bmin, &bp.verts[v * 3]);
+				dtVmax(bp.bmax, &bp.verts[v * 3]);
+			}
+			bp.jmin = (int)ceilf(bp.bmin[2] - BLOCK_EPSILON);
+			bp.jmax = (int)floorf(bp.bmax[2] + BLOCK_EPSILON);
+			polys.push_back(bp);
+		}
+	}
+
+	// The polygons whose bounds overlap each polygon's bounds seen from above,
+	// the only ones that can be closer to a point over it than its own edges.
+	std::vector<std::vector<int> > overlapPolys(polys.size());
+	std::vector<int> byMinX(polys.size());
+	for (size_t i = 0; i < polys.size(); ++i)
+		byMinX[i] = (int)i;
+	std::sort(byMinX.begin(), byMinX.end(), [&](int a, int b) { return polys[a].bmin[0] < polys[b].bmin[0]; });
+	for (size_t a = 0; a < byMinX.size(); ++a)
+	{
+		const BlockPoly& pa = polys[byMinX[a]];
+		for (size_t b = a + 1; b < byMinX.size() && polys[byMinX[b]].bmin[0] <= pa.bmax[0] + BLOCK_EPSILON; ++b)
+		{
+			const BlockPoly& pb = polys[byMinX[b]];
+			if (pb.bmin[2] > pa.bmax[2] + BLOCK_EPSILON || pb.bmax[2] < pa.bmin[2] - BLOCK_EPSILON)
+				continue;
+			overlapPolys[byMinX[a]].push_back(byMinX[b]);
+			overlapPolys[byMinX[b]].push_back(byMinX[a]);
+		}
+	}
+
+	// findDistanceToWall takes a node for every polygon it reaches, which are
+	// the ones within BLOCK_WALL_SEARCH_RADIUS. Cells with more of them around
+	// than a query has nodes may run out and fail, so they take the exact path.
+	std::vector<int> cellSearchPolys;
+	if ((int)polys.size() > BLOCK_QUERY_NODES)
+	{
+		const float r = BLOCK_WALL_SEARCH_RADIUS + BLOCK_EPSILON;
+		cellSearchPolys.assign((width + 1) * (height + 1), 0);
+		for (size_t k = 0; k < polys.size(); ++k)
+		{
+			const BlockPoly& bp = polys[k];
+			const int i0 = dtMax(0, (int)ceilf(-bp.bmax[0] - r));
+			const int i1 = dtMin(width - 1, (int)floorf(-bp.bmin[0] + r));
+			const int j0 = dtMax(0, (int)ceilf(bp.bmin[2] - r));
+			const int j1 = dtMin(height - 1, (int)floorf(bp.bmax[2] + r));
+			if (i0 > i1 || j0 > j1)
+				continue;
+			cellSearchPolys[j0 * (width + 1) + i0]++;
+			cellSearchPolys[j0 * (width + 1) + i1 + 1]--;
+			cellSearchPolys[(j1 + 1) * (width + 1) + i0]--;
+			cellSearchPolys[(j1 + 1) * (width + 1) + i1 + 1]++;
+		}
+		for (int j = 0; j < height; ++j)
+		{
+			for (int i = 0; i < width; ++i)
+			{
+				int& c = cellSearchPolys[j * (width + 1) + i];
+				if (i > 0)
+					c += cellSearchPolys[j * (width + 1) + i - 1];
+				if (j > 0)
+					c += cellSearchPolys[(j - 1) * (width + 1) + i];
+				if (i > 0 && j > 0)
+					c -= cellSearchPolys[(j - 1) * (width + 1) + i - 1];
+			}
+		}
+	}
+
+	// Bucket the polygons and walls by the stripes of rows they touch.
+	const int stripeCount = (height + BLOCK_STRIPE_ROWS - 1) / BLOCK_STRIPE_ROWS;
+	std::vector<std::vector<int> > stripePolys(stripeCount);
+	std::vector<std::vector<int> > stripeWalls(stripeCount);
+	for (size_t i = 0; i < polys.size(); ++i)
+	{
+		const int s0 = dtMax(polys[i].jmin, 0) / BLOCK_STRIPE_ROWS;
+		const int s1 = dtMin(polys[i].jmax, height - 1) / BLOCK_STRIPE_ROWS;
+		for (int s = s0; polys[i].jmax >= 0 && s <= s1; ++s)
+			stripePolys[s].push_back((int)i);
+	}
+	for (size_t i = 0; i < walls.size(); ++i)
 	{
-		fp2 = fopen((std::string(blockPath)+".txt").c_str(), "wt");
+		const int s0 = dtMax(walls[i].jmin, 0) / BLOCK_STRIPE_ROWS;
+		const int s1 = dtMin(walls[i].jmax, height - 1) / BLOCK_STRIPE_ROWS;
+		for (int s = s0; walls[i].jmax >= 0 && s <= s1; ++s)
+			stripeWalls[s].push_back((int)i);
 	}
-	for (int j = height-1; j >= 0; j--)
+
+	dtNavMeshQuery** queries = new dtNavMeshQuery*[threadCount];
+	for (int t = 0; t < threadCount; ++t)
 	{
-		for (int i = 0; i < width; i++)
+		queries[t] = dtAllocNavMeshQuery();
+		if (!queries[t] || dtStatusFailed(queries[t]->init(navMesh, BLOCK_QUERY_NODES)))
 		{
-			pos[0] = -i;
-			pos[1] = 0;
-			pos[2] = j;
-			bool bIsOverPoy = false;
-			dtStatus status = m_navQuery->findNearestPoly(pos, m_polyPickExt, &m_filter, &dtPy, nearPos, &bIsOverPoy);
-			if (bIsOverPoy)
+			printf("Could not init Detour navmesh query");
+			for (int k = 0; k <= t; ++k)
+				dtFreeNavMeshQuery(queries[k]);
+			delete[] queries;
+			return false;
+		}
+	}
+
+	std::vector<int> cellPoly(width * height, -1);
+	std::vector<unsigned char> cellFlags(width * height, 0);
+	std::vector<float> cellWallSqr(width * height, FLT_MAX);
+	ParallelFor(threadCount, stripeCount, [&](int worker, int stripe)
+	{
+		const int j0 = stripe * BLOCK_STRIPE_ROWS;
+		const int j1 = dtMin(j0 + BLOCK_STRIPE_ROWS, height);
+
+		// Scanline pass, with the crossing test of dtPointInPolygon.
+		for (size_t k = 0; k < stripePolys[stripe].size(); ++k)
+		{
+			const int pi = stripePolys[stripe][k];
+			const BlockPoly& bp = polys[pi];
+			for (int j = dtMax(j0, bp.jmin); j < dtMin(j1, bp.jmax + 1); ++j)
 			{
-				if (status == DT_SUCCESS)
+				const float z = (float)j;
+				int* polyRow = &cellPoly[j * width];
+				unsigned char* flagRow = &cellFlags[j * width];
+
+				float xc[DT_VERTS_PER_POLYGON];
+				int nxc = 0;
+				bool nearVertex = false;
+				float xmin = FLT_MAX, xmax = -FLT_MAX;
+				for (int a = 0, b = bp.nverts - 1; a < bp.nverts; b = a++)
 				{
-					float hitDist, hitNormal[3], hitPos[3];
-					status = m_navQuery->findDistanceToWall(dtPy, pos, 20, &m_filter, &hitDist, hitPos, hitNormal);
-					if (status == DT_SUCCESS)
-					{
-						bIsOverPoy = hitDist >= 0.6;
-					}
-					else
+					const float* vi = &bp.verts[a * 3];
+					const float* vj = &bp.verts[b * 3];
+					xmin = dtMin(xmin, vi[0]);
+					xmax = dtMax(xmax, vi[0]);
+					if (dtAbs(vi[2] - z) < BLOCK_EPSILON)
+						nearVertex = true;
+					if ((vi[2] > z) != (vj[2] > z) && nxc < DT_VERTS_PER_POLYGON)
+						xc[nxc++] = (vj[0] - vi[0]) * (z - vi[2]) / (vj[2] - vi[2]) + vi[0];
+				}
+				if (nearVertex)
+				{
+					for (int i = dtMax(0, (int)ceilf(-xmax - BLOCK_EPSILON)); i <= dtMin(width - 1, (int)floorf(-xmin + BLOCK_EPSILON)); ++i)
+						flagRow[i] |= BLOCK_CELL_AMBIGUOUS;
+					continue;
+				}
+				// At most a crossing per edge, sort them in place.
+				for (int c = 1; c < nxc; ++c)
+				{
+					const float x = xc[c];
+					int d = c;
+					for (; d > 0 && xc[d - 1] > x; --d)
+						xc[d] = xc[d - 1];
+					xc[d] = x;
+				}
+				for (int c = 0; c + 1 < nxc; c += 2)
+				{
+					const float c0 = xc[c], c1 = xc[c + 1];
+					for (int i = dtMax(0, (int)ceilf(-c1 - BLOCK_EPSILON)); i <= dtMin(width - 1, (int)floorf(-c0 + BLOCK_EPSILON)); ++i)
 					{
-						bIsOverPoy = false;
+						const float x = -(float)i;
+						if (dtAbs(x - c0) < BLOCK_EPSILON || dtAbs(x - c1) < BLOCK_EPSILON)
+							flagRow[i] |= BLOCK_CELL_AMBIGUOUS;
+						else if (x > c0 && x < c1)
+						{
+							if (polyRow[i] >= 0)
+								flagRow[i] |= BLOCK_CELL_OVERLAP;
+							polyRow[i] = pi;
+						}
 					}
 				}
 			}
-			int nIndex = j * width + i;
-			block[nIndex] = bIsOverPoy;
-			if (fp2)
+		}
+
+		// Wall band, the exact 2D distance to every wall near the stripe.
+		for (size_t k = 0; k < stripeWalls[stripe].size(); ++k)
+		{
+			const BlockWall& wall = walls[stripeWalls[stripe][k]];
+			const int imin = dtMax(0, (int)ceilf(-dtMax(wall.a[0], wall.b[0]) - wallBand));
+			const int imax = dtMin(width - 1, (int)floorf(-dtMin(wall.a[0], wall.b[0]) + wallBand));
+			for (int j = dtMax(j0, wall.jmin); j < dtMin(j1, wall.jmax + 1); ++j)
+			{
+				for (int i = imin; i <= imax; ++i)
+				{
+					const float pos[3] = { -(float)i, 0, (float)j };
+					float t;
+					const float d = dtDistancePtSegSqr2D(pos, wall.a, wall.b, t);
+					float& cell = cellWallSqr[j * width + i];
+					if (d < cell)
+						cell = d;
+				}
+			}
+		}
+
+		// Decide every cell of the stripe.
+		dtNavMeshQuery* navQuery = queries[worker];
+		for (int j = j0; j < j1; ++j)
+		{
+			for (int i = 0; i < width; ++i)
 			{
-				fprintf(fp2, "%d", bIsOverPoy ? 1 : 0);
+				const int idx = j * width + i;
+				const float pos[3] = { -(float)i, 0, (float)j };
+				bool exact = (cellFlags[idx] & (BLOCK_CELL_AMBIGUOUS | BLOCK_CELL_OVERLAP)) != 0;
+				if (!exact && cellPoly[idx] < 0)
+				{
+					block[idx] = 0;
+					continue;
+				}
+				if (!exact && !cellSearchPolys.empty() && cellSearchPolys[j * (width + 1) + i] > BLOCK_QUERY_NODES)
+					exact = true;
+				if (!exact && cellWallSqr[idx] >= dtSqr(wallBand))
+				{
+					// The covering polygon is the nearest one when its height
+					// difference beyond the climb is less than the distance to
+					// every other polygon. Its own edges bound that distance for
+					// the polygons outside its bounds, the ones overlapping them,
+					// such as the floors above and below, are measured.
+					const int pi = cellPoly[idx];
+					const BlockPoly& bp = polys[pi];
+					float h = 0;
+					if (dtStatusSucceed(navQuery->getPolyHeight(bp.ref, pos, &h)) &&
+						dtAbs(h) + 1.0f < BLOCK_PICK_EXTENTS[1])
+					{
+						const float over = dtMax(dtAbs(h) - bp.walkableClimb, 0.0f);
+						const float nearSqr = dtSqr(over + BLOCK_EPSILON);
+						bool nearest = true;
+						for (int a = 0, b = bp.nverts - 1; nearest && a < bp.nverts; b = a++)
+						{
+							float t;
+							nearest = dtDistancePtSegSqr2D(pos, &bp.verts[b * 3], &bp.verts[a * 3], t) > nearSqr;
+						}
+						for (size_t k = 0; nearest && k < overlapPolys[pi].size(); ++k)
+						{
+							const BlockPoly& other = polys[overlapPolys[pi][k]];
+							if (dtPointInPolygon(pos, other.verts, other.nverts))
+								nearest = false;
+							for (int a = 0, b = other.nverts - 1; nearest && a < other.nverts; b = a++)
+							{
+								float t;
+								nearest = dtDistancePtSegSqr2D(pos, &other.verts[b * 3], &other.verts[a * 3], t) > nearSqr;
+							}
+						}
+						if (nearest)
+						{
+							block[idx] = 1;
+							continue;
+						}
+					}
+				}
+				block[idx] = sampleBlockCell(navQuery, filter, pos);
 			}
 		}
+	});
+
+	for (int t = 0; t < threadCount; ++t)
+		dtFreeNavMeshQuery(queries[t]);
+	delete[] queries;
+	return true;
+}
+
+// Writes the block file, and the rows from the top down as text with bDebugFile.
+static void writeBlockData(const char* blockPath, const char* block, int width, int height, bool bDebugFile)
+{
+	if (bDebugFile)
+	{
+		FILE* fp2 = fopen((std::string(blockPath) + ".txt").c_str(), "wt");
 		if (fp2)
 		{
-			fprintf(fp2, "\n");
+			for (int j = height - 1; j >= 0; j--)
+			{
+				for (int i = 0; i < width; i++)
+				{
+					fprintf(fp2, "%d", block[j * width + i] ? 1 : 0);
+				}
+				fprintf(fp2, "\n");
+			}
+			fclose(fp2);
 		}
 	}
-	if (fp2)
+
+	FILE* fp = fopen(blockPath, "wb");
+	if (!fp)
 	{
-		fclose(fp2);
+		printf("Could create file:%s to write block data.", blockPath);
+		return;
 	}
+	if (m_blockDataFormat == BLOCK_FORMAT_BYTES)
+	{
+		fwrite(&width, sizeof(width), 1, fp);
+		fwrite(&height, sizeof(height), 1, fp);
+		fwrite(block, width * height, 1, fp);
+		fclose(fp);
+		return;
+	}
+
+	BlockDataHeader header;
+	memset(&header, 0, sizeof(header));
+	header.magic = BLOCKDATA_MAGIC;
+	header.version = BLOCKDATA_VERSION;
+	header.format = m_blockDataFormat;
+	header.width = width;
+	header.height = height;
+
+	std::vector<unsigned int> words;
+	if (m_blockDataFormat == BLOCK_FORMAT_BITS)
+	{
+		const int rowWords = (width + 31) / 32;
+		words.resize(rowWords * height, 0);
+		for (int j = 0; j < height; ++j)
+			for (int i = 0; i < width; ++i)
+				if (block[j * width + i])
+					words[j * rowWords + i / 32] |= 1u << (i & 31);
+	}
+	else
+	{
+		// Uniform tiles are only an entry in the table, the others follow it
+		// as rows of tileSize bits. Cells past the grid edge count as blocked.
+		const int ts = BLOCKDATA_TILE_SIZE;
+		const int tileWords = ts * ts / 32;
+		const int tilesX = (width + ts - 1) / ts;
+		const int tilesY = (height + ts - 1) / ts;
+		header.tileSize = ts;
+		words.resize(tilesX * tilesY, BLOCKDATA_TILE_BLOCKED);
+		std::vector<unsigned int> bits(tileWords);
+		for (int ty = 0; ty < tilesY; ++ty)
+		{
+			for (int tx = 0; tx < tilesX; ++tx)
+			{
+				int walkable = 0, cells = 0;
+				std::fill(bits.begin(), bits.end(), 0u);
+				for (int y = 0; y < ts && ty * ts + y < height; ++y)
+				{
+					for (int x = 0; x < ts && tx * ts + x < width; ++x)
+					{
+						cells++;
+						if (block[(ty * ts + y) * width + tx * ts + x])
+						{
+							walkable++;
+							bits[y * (ts / 32) + x / 32] |= 1u << (x & 31);
+						}
+					}
+				}
+				unsigned int& entry = words[ty * tilesX + tx];
+				if (walkable == 0)
+					entry = BLOCKDATA_TILE_BLOCKED;
+				else if (walkable == cells)
+					entry = BLOCKDATA_TILE_WALKABLE;
+				else
+				{
+					entry = (unsigned int)(sizeof(BlockDataHeader) + words.size() * sizeof(unsigned int));
+					words.insert(words.end(), bits.begin(), bits.end());
+				}
+			}
+		}
+	}
+	header.dataSize = (unsigned int)(words.size() * sizeof(unsigned int));
+	fwrite(&header, sizeof(header), 1, fp);
+	if (!words.empty())
+		fwrite(&words[0], sizeof(unsigned int), words.size(), fp);
+	fclose(fp);
+}
+
+int BuildBlockData(const char* binPath, const char* blockPath, int width, int height, bool bDebugFile /*= false*/)
+{
+	return BuildBlockDataEx(binPath, blockPath, width, height, bDebugFile, 0);
+}
 
-	fp = fopen(blockPath, "wb");
-	fwrite(&width, sizeof(width), 1, fp);
-	fwrite(&height, sizeof(height), 1, fp);
-	fwrite(block, width*height, 1, fp);
+int BuildBlockDataEx(const char* binPath, const char* blockPath, int width, int height, bool bDebugFile, int threadCount)
+{
+	unsigned char* navData = 0;
+	FILE* fp = fopen(binPath, "rb");
+	if (!fp)
+		return false;
+	if (fseek(fp, 0, SEEK_END) != 0)
+	{
+		fclose(fp);
+		return false;
+	}
+	long navDataSize = ftell(fp);
+	if (navDataSize < 0)
+	{
+		fclose(fp);
+		return false;
+	}
+	if (fseek(fp, 0, SEEK_SET) != 0)
+	{
+		fclose(fp);
+		return false;
+	}
+	navData = (unsigned char*)dtAlloc(navDataSize, dtAllocHint::DT_ALLOC_PERM);
+	if (!navData)
+	{
+		fclose(fp);
+		return false;
+	}
+	size_t readLen = fread(navData, navDataSize, 1, fp);
 	fclose(fp);
+
+	auto m_navMesh = dtAllocNavMesh();
+	if (!m_navMesh)
+	{
+		dtFree(navData);
+		printf("Could not create Detour navmesh");
+		return false;
+	}
+
+	dtStatus status;
+
+	status = m_navMesh->init(navData, navDataSize, DT_TILE_FREE_DATA);
+	if (dtStatusFailed(status))
+	{
+		dtFree(navData);
+		printf("Could not init Detour navmesh");
+		return false;
+	}
+
+	dtQueryFilter m_filter;
+	m_filter.setIncludeFlags(SAMPLE_POLYFLAGS_ALL ^ SAMPLE_POLYFLAGS_DISABLED);
+	m_filter.setExcludeFlags(0);
+	char *block = new char[width * height];
+	if (!sampleBlockGrid(m_navMesh, m_filter, block, width, height, threadCount))
+	{
+		delete[] block;
+		return false;
+	}
+	writeBlockData(blockPath, block, width, height, bDebugFile);
 	delete[] block;
 
 	return 0;
 }
 
 int BuildBlockDataObstacles(const char* binPath, const char* blockPath, int width, int height, bool bDebugFile /*= false*/)
+{
+	return BuildBlockDataObstaclesEx(binPath, blockPath, width, height, bDebugFile, 0);
+}
+
+int BuildBlockDataObstaclesEx(const char* binPath, const char* blockPath, int width, int height, bool bDebugFile, int threadCount)
 {
 	unsigned char* pucValue = 0;
 	FILE* fp = fopen(binPath, "rb");
@@ -1249,6 +2543,11 @@ int BuildBlockDataObstacles(const char* binPath, const char* blockPath, int widt
 	}
 	size_t readLen = fread(pucValue, uiLength, 1, fp);
 	fclose(fp);
+	if (readLen != 1 || uiLength < (long)sizeof(TileCacheSetHeader))
+	{
+		dtFree(pucValue);
+		return false;
+	}
 	// Read header.
 	TileCacheSetHeader header;
 	int pos = 0;
@@ -1256,21 +2555,25 @@ int BuildBlockDataObstacles(const char* binPath, const char* blockPath, int widt
 	pos += sizeof(TileCacheSetHeader);
 	if (header.magic != TILECACHESET_MAGIC)
 	{
+		dtFree(pucValue);
 		return false;
 	}
 	if (header.version != TILECACHESET_VERSION)
 	{
+		dtFree(pucValue);
 		return false;
 	}
 
 	m_navMesh = dtAllocNavMesh();
 	if (!m_navMesh)
 	{
+		dtFree(pucValue);
 		return false;
 	}
 	dtStatus status = m_navMesh->init(&header.meshParams);
 	if (dtStatusFailed(status))
 	{
+		dtFree(pucValue);
 		return false;
 	}
 
@@ -1280,12 +2583,13 @@ int BuildBlockDataObstacles(const char* binPath, const char* blockPath, int widt
 	m_tileCache = dtAllocTileCache();
 	if (!m_tileCache)
 	{
-		fclose(fp);
+		dtFree(pucValue);
 		return false;
 	}
 	status = m_tileCache->init(&header.cacheParams, m_talloc, m_tcomp, m_tmproc);
 	if (dtStatusFailed(status))
 	{
+		dtFree(pucValue);
 		return false;
 	}
 
@@ -1314,73 +2618,28 @@ int BuildBlockDataObstacles(const char* binPath, const char* blockPath, int widt
 		if (tile)
 			m_tileCache->buildNavMeshTile(tile, m_navMesh);
 	}
+	dtFree(pucValue);
 
+	// Rebuild the tiles under the obstacle in the navmesh just loaded, one tile per update.
 	float test_pos[3] = { -32, 0, 32 };
 	unsigned int id;
 	m_tileCache->addObstacle(test_pos, 10, 10, &id);
 	bool upToDate = false;
-	dtNavMesh* navMeshQuery = (dtNavMesh*)(((dtNavMeshQuery*)m_navQuery)->getAttachedNavMesh());
-	m_tileCache->update(0, navMeshQuery, &upToDate);
-	//float pos[3];
-	float m_polyPickExt[3] = { 50.6f, 50.0f, 50.6f };
+	while (!upToDate)
+	{
+		if (dtStatusFailed(m_tileCache->update(0, m_navMesh, &upToDate)))
+			break;
+	}
 	dtQueryFilter m_filter;
 	m_filter.setIncludeFlags(SAMPLE_POLYFLAGS_ALL ^ SAMPLE_POLYFLAGS_DISABLED);
 	m_filter.setExcludeFlags(0);
-	dtPolyRef dtPy = 0;
-	float nearPos[3];
 	char* block = new char[width * height];
-	FILE* fp2 = 0;
-	if (bDebugFile)
+	if (!sampleBlockGrid(m_navMesh, m_filter, block, width, height, threadCount))
 	{
-		fp2 = fopen((std::string(blockPath) + ".txt").c_str(), "wt");
-	}
-	for (int j = height - 1; j >= 0; j--)
-	{
-		for (int i = 0; i < width; i++)
-		{
-			test_pos[0] = -i;
-			test_pos[1] = 0;
-			test_pos[2] = j;
-			bool bIsOverPoy = false;
-			dtStatus status = m_navQuery->findNearestPoly(test_pos, m_polyPickExt, &m_filter, &dtPy, nearPos, &bIsOverPoy);
-			if (bIsOverPoy)
-			{
-				if (status == DT_SUCCESS)
-				{
-					float hitDist, hitNormal[3], hitPos[3];
-					status = m_navQuery->findDistanceToWall(dtPy, test_pos, 20, &m_filter, &hitDist, hitPos, hitNormal);
-					if (status == DT_SUCCESS)
-					{
-						bIsOverPoy = hitDist >= 0.6;
-					}
-					else
-					{
-						bIsOverPoy = false;
-					}
-				}
-			}
-			int nIndex = j * width + i;
-			block[nIndex] = bIsOverPoy;
-			if (fp2)
-			{
-				fprintf(fp2, "%d", bIsOverPoy ? 1 : 0);
-			}
-		}
-		if (fp2)
-		{
-			fprintf(fp2, "\n");
-		}
-	}
-	if (fp2)
-	{
-		fclose(fp2);
+		delete[] block;
+		return false;
 	}
-
-	fp = fopen(blockPath, "wb");
-	fwrite(&width, sizeof(width), 1, fp);
-	fwrite(&height, sizeof(height), 1, fp);
-	fwrite(block, width * height, 1, fp);
-	fclose(fp);
+	writeBlockData(blockPath, block, width, height, bDebugFile);
 	delete[] block;
 
 	return 0;
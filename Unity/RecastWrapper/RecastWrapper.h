@@ -9,7 +9,26 @@
 extern "C"
 {
 	EXPORT_API int BuildSoloMesh(const char* objPath, const char* binPath, const char* param);
+	// The tiled builds write a hash of every tile's input to binPath + ".hash". When enabled,
+	// a later build into the same binPath only rebuilds the tiles whose hash changed and
+	// copies the others from the previous output. Off by default.
+	EXPORT_API void SetIncrementalBuild(bool enable);
 	EXPORT_API int BuildTempObstacles(const char* objPath, const char* binPath, const char* param);
+	// Same as BuildTempObstacles, building tiles on threadCount threads, <= 0 uses one per core.
+	// The written file is the same for any thread count.
+	EXPORT_API int BuildTempObstaclesEx(const char* objPath, const char* binPath, const char* param, int threadCount);
+	// Builds a static tiled navmesh written as a NavMeshSetHeader tile set instead of
+	// BuildSoloMesh's single tile. param is the BuildTempObstacles one, tile size last.
+	// Tiles are built on threadCount threads, <= 0 uses one per core. Returns 0 on success.
+	EXPORT_API int BuildTiledMesh(const char* objPath, const char* binPath, const char* param, int threadCount);
 	EXPORT_API int BuildBlockData(const char* binPath, const char* blockPath, int width, int height, bool bDebugFile = false);
 	EXPORT_API int BuildBlockDataObstacles(const char* binPath, const char* blockPath, int width, int height, bool bDebugFile = false);
+	// Format of the block files written from now on: 0 one char per cell (default),
+	// 1 one bit per cell, 2 one bit per cell with uniform 64x64 tiles stored as a
+	// table entry only. NavMeshWrapper's LoadBlockData reads all three.
+	EXPORT_API void SetBlockDataFormat(int format);
+	// Same as BuildBlockData and BuildBlockDataObstacles, sampling the grid on threadCount
+	// threads, <= 0 uses one per core. The block file is the same for any thread count.
+	EXPORT_API int BuildBlockDataEx(const char* binPath, const char* blockPath, int width, int height, bool bDebugFile, int threadCount);
+	EXPORT_API int BuildBlockDataObstaclesEx(const char* binPath, const char* blockPath, int width, int height, bool bDebugFile, int threadCount);
 }
\ No newline at end of file